@@ -0,0 +1,252 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - zip アーカイブからのコンテンツの取り出し。
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "archive.h"
+
+#define ARCHIVE_EOCD_SIG      0x06054b50u
+#define ARCHIVE_CENTRAL_SIG   0x02014b50u
+#define ARCHIVE_LOCAL_SIG     0x04034b50u
+#define ARCHIVE_EOCD_SIZE     22
+#define ARCHIVE_CENTRAL_SIZE  46
+#define ARCHIVE_LOCAL_SIZE    30
+
+/* zlib の 1 回の呼び出しに渡す量。avail_in / avail_out は 32 ビットです。 */
+#define ARCHIVE_CHUNK         (1u << 30)
+
+static uint16_t archive_u16(const uint8_t *p)
+{
+   return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t archive_u32(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* name の拡張子が list ("sfc|smc") に含まれるか、大文字小文字を区別せずに調べます。 */
+static bool archive_has_ext(const char *name, const char *list)
+{
+   const char *ext = strrchr(name, '.');
+   size_t      len;
+
+   if (!ext || strchr(ext, '/'))
+      return false;
+   ext++;
+   len = strlen(ext);
+
+   while (*list)
+   {
+      size_t n = strcspn(list, "|");
+      if (n == len && strncasecmp(list, ext, len) == 0)
+         return true;
+      list += n;
+      if (*list == '|')
+         list++;
+   }
+   return false;
+}
+
+bool archive_is_zip(const char *path)
+{
+   size_t len = strlen(path);
+   return len > 4 && strcasecmp(path + len - 4, ".zip") == 0;
+}
+
+bool archive_open(struct archive *ar, const char *path)
+{
+   struct stat st;
+   const uint8_t *eocd = NULL;
+   const uint8_t *p;
+   uint64_t cdir_offset;
+   size_t   i;
+   int      fd;
+
+   memset(ar, 0, sizeof(*ar));
+
+   fd = open(path, O_RDONLY);
+   if (fd < 0)
+      return false;
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < ARCHIVE_EOCD_SIZE)
+   {
+      close(fd);
+      return false;
+   }
+
+   ar->map_size = (size_t)st.st_size;
+   ar->map      = (const uint8_t*)mmap(NULL, ar->map_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (ar->map == MAP_FAILED)
+   {
+      ar->map = NULL;
+      return false;
+   }
+
+   /* 終端レコードは末尾のコメント (最大 64K) の手前にあります。 */
+   for (i = ar->map_size - ARCHIVE_EOCD_SIZE; ; i--)
+   {
+      if (archive_u32(ar->map + i) == ARCHIVE_EOCD_SIG)
+      {
+         eocd = ar->map + i;
+         break;
+      }
+      if (i == 0 || ar->map_size - i > 0xFFFF + ARCHIVE_EOCD_SIZE)
+         break;
+   }
+   if (!eocd)
+      goto error;
+
+   ar->entries   = archive_u16(eocd + 10);
+   ar->cdir_size = archive_u32(eocd + 12);
+   cdir_offset   = archive_u32(eocd + 16);
+   if (cdir_offset + ar->cdir_size > (uint64_t)(eocd - ar->map))
+      goto error;
+   ar->cdir = ar->map + cdir_offset;
+
+   ar->hash = 0xcbf29ce484222325ull;
+   for (p = ar->cdir; p < ar->cdir + ar->cdir_size; p++)
+      ar->hash = (ar->hash ^ *p) * 0x100000001b3ull;
+
+   /* 中央ディレクトリはすぐに読み終わり、以降はメンバーのデータを 1 度ずつ読むだけです。 */
+   madvise((void*)ar->map, ar->map_size, MADV_SEQUENTIAL);
+   return true;
+
+error:
+   archive_close(ar);
+   return false;
+}
+
+void archive_close(struct archive *ar)
+{
+   if (ar->map)
+      munmap((void*)ar->map, ar->map_size);
+   memset(ar, 0, sizeof(*ar));
+}
+
+bool archive_find(const struct archive *ar, const char *name, const char *extensions,
+      struct archive_member *member)
+{
+   const uint8_t *p   = ar->cdir;
+   const uint8_t *end = ar->cdir + ar->cdir_size;
+   unsigned i;
+
+   for (i = 0; i < ar->entries; i++)
+   {
+      size_t name_len, extra_len, comment_len;
+
+      if (p + ARCHIVE_CENTRAL_SIZE > end || archive_u32(p) != ARCHIVE_CENTRAL_SIG)
+         return false;
+
+      name_len    = archive_u16(p + 28);
+      extra_len   = archive_u16(p + 30);
+      comment_len = archive_u16(p + 32);
+      if (p + ARCHIVE_CENTRAL_SIZE + name_len > end)
+         return false;
+
+      member->method      = archive_u16(p + 10);
+      member->crc32       = archive_u32(p + 16);
+      member->packed_size = archive_u32(p + 20);
+      member->size        = archive_u32(p + 24);
+      member->offset      = archive_u32(p + 42);
+      if (name_len >= sizeof(member->name))
+         name_len = sizeof(member->name) - 1;
+      memcpy(member->name, p + ARCHIVE_CENTRAL_SIZE, name_len);
+      member->name[name_len] = '\0';
+
+      /* ディレクトリ (末尾が '/') と暗号化されたメンバーは候補にしません。 */
+      if (name_len && member->name[name_len - 1] != '/' && !(archive_u16(p + 8) & 1))
+      {
+         if (name ? strcmp(member->name, name) == 0
+               : (!extensions || archive_has_ext(member->name, extensions)))
+            return true;
+      }
+
+      p += ARCHIVE_CENTRAL_SIZE + archive_u16(p + 28) + extra_len + comment_len;
+   }
+
+   return false;
+}
+
+static bool archive_inflate(const uint8_t *src, uint64_t src_size, uint8_t *dst, uint64_t dst_size)
+{
+   z_stream z;
+   int      ret = Z_OK;
+
+   memset(&z, 0, sizeof(z));
+   if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+      return false;
+
+   z.next_in  = (Bytef*)src;
+   z.next_out = dst;
+
+   while (ret == Z_OK)
+   {
+      if (!z.avail_in && src_size)
+      {
+         z.avail_in = src_size < ARCHIVE_CHUNK ? (uInt)src_size : ARCHIVE_CHUNK;
+         src_size  -= z.avail_in;
+      }
+      if (!z.avail_out && dst_size)
+      {
+         z.avail_out = dst_size < ARCHIVE_CHUNK ? (uInt)dst_size : ARCHIVE_CHUNK;
+         dst_size   -= z.avail_out;
+      }
+      ret = inflate(&z, Z_NO_FLUSH);
+   }
+
+   inflateEnd(&z);
+   return ret == Z_STREAM_END && !z.avail_out && !dst_size;
+}
+
+bool archive_extract(const struct archive *ar, const struct archive_member *member, void *dst)
+{
+   const uint8_t *local = ar->map + member->offset;
+   const uint8_t *data;
+   uLong crc = crc32(0, Z_NULL, 0);
+
+   if (member->offset + ARCHIVE_LOCAL_SIZE > ar->map_size || archive_u32(local) != ARCHIVE_LOCAL_SIG)
+      return false;
+
+   /* ローカルヘッダーの extra は中央ディレクトリのものと長さが違うことがあります。 */
+   data = local + ARCHIVE_LOCAL_SIZE + archive_u16(local + 26) + archive_u16(local + 28);
+   if ((uint64_t)(data - ar->map) + member->packed_size > ar->map_size)
+      return false;
+
+   switch (member->method)
+   {
+      case 0:
+         if (member->packed_size != member->size)
+            return false;
+         memcpy(dst, data, member->size);
+         break;
+      case 8:
+         if (!archive_inflate(data, member->packed_size, (uint8_t*)dst, member->size))
+            return false;
+         break;
+      default:
+         fprintf(stderr, "[archive] 対応していない圧縮方式です (%u): %s\n",
+               member->method, member->name);
+         return false;
+   }
+
+   crc = crc32_z(crc, (const Bytef*)dst, member->size);
+   if (crc != member->crc32)
+   {
+      fprintf(stderr, "[archive] CRC32 が一致しません: %s\n", member->name);
+      return false;
+   }
+
+   return true;
+}
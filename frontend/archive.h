@@ -0,0 +1,51 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - zip アーカイブからのコンテンツの取り出し。
+ *
+ * アーカイブ全体を読み取り専用で mmap() し、末尾の中央ディレクトリからメンバーを探します。
+ * 無圧縮 (stored) と deflate のメンバーを zlib で展開し、CRC32 を確かめます。
+ * ZIP64 と暗号化されたメンバーには対応しません。
+ */
+
+#ifndef RETROBENCH_ARCHIVE_H__
+#define RETROBENCH_ARCHIVE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+struct archive_member
+{
+   char     name[1024];
+   uint64_t offset;        /* ローカルヘッダーの位置 */
+   uint64_t packed_size;
+   uint64_t size;          /* 展開後のサイズ */
+   uint32_t crc32;
+   unsigned method;        /* 0: stored, 8: deflate */
+};
+
+struct archive
+{
+   const uint8_t *map;
+   size_t         map_size;
+   const uint8_t *cdir;    /* 中央ディレクトリ */
+   size_t         cdir_size;
+   unsigned       entries;
+   uint64_t       hash;    /* 中央ディレクトリの FNV-1a。メンバーの名前・サイズ・CRC32 を含みます */
+};
+
+/* path が zip なら true を返します。中身は読まず、拡張子だけを見ます。 */
+bool archive_is_zip(const char *path);
+
+bool archive_open(struct archive *ar, const char *path);
+void archive_close(struct archive *ar);
+
+/* name のメンバーを探します。name が NULL の場合は、拡張子が extensions ("sfc|smc" の形式) に
+ * 含まれる最初のメンバーを、extensions も NULL なら最初のファイルを選びます。 */
+bool archive_find(const struct archive *ar, const char *name, const char *extensions,
+      struct archive_member *member);
+
+/* member を dst (member->size バイト) に展開します。CRC32 が合わなければ false を返します。 */
+bool archive_extract(const struct archive *ar, const struct archive_member *member, void *dst);
+
+#endif
@@ -0,0 +1,392 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 音声パイプライン。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "audio.h"
+#include "timer.h"
+
+/* 占有率がこれを下回ったら underrun_likely を通知します。 */
+#define AUDIO_UNDERRUN_LIKELY_FILL 0.25
+
+struct audio_state
+{
+   struct audio_config config;
+   struct audio_ring   ring;
+   struct audio_stats  stats;
+
+   size_t   buffer_frames;     /* latency_ms に相当するフレーム数。リングはこれ以上溜めません。 */
+   double   in_rate;
+   double   base_ratio;        /* out_rate / in_rate */
+   double   phase;             /* 入力ブロック内の読み出し位置 */
+   int16_t  prev[2];           /* 直前のブロックの最後のフレーム */
+   int16_t *resampled;
+   size_t   resampled_frames;
+
+   retro_audio_buffer_status_callback_t status_cb;
+   unsigned min_latency_ms;    /* SET_MINIMUM_AUDIO_LATENCY で要求された遅延 */
+
+   pthread_t thread;
+   bool      thread_running;
+   atomic_bool quit;
+   atomic_bool started;        /* リングが半分まで溜まってから再生を始めます */
+
+   /* 出力スレッドだけが書き込むカウンタ */
+   _Atomic uint64_t underruns;
+   _Atomic uint64_t underrun_frames;
+   _Atomic uint64_t periods;
+
+   bool initialized;
+};
+
+static struct audio_state audio;
+
+__thread struct audio_block audio_block;
+
+/* ---- SPSC リング ---- */
+
+bool audio_ring_init(struct audio_ring *ring, size_t frames)
+{
+   size_t capacity = 1;
+
+   while (capacity < frames)
+      capacity <<= 1;
+
+   ring->data = (int16_t*)calloc(capacity, 2 * sizeof(int16_t));
+   if (!ring->data)
+      return false;
+
+   ring->capacity = capacity;
+   atomic_init(&ring->write_pos, 0);
+   atomic_init(&ring->read_pos, 0);
+   return true;
+}
+
+void audio_ring_free(struct audio_ring *ring)
+{
+   free(ring->data);
+   ring->data     = NULL;
+   ring->capacity = 0;
+}
+
+size_t audio_ring_used(struct audio_ring *ring)
+{
+   size_t w = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+   size_t r = atomic_load_explicit(&ring->read_pos,  memory_order_acquire);
+   return w - r;
+}
+
+size_t audio_ring_write(struct audio_ring *ring, const int16_t *data, size_t frames)
+{
+   size_t w     = atomic_load_explicit(&ring->write_pos, memory_order_relaxed);
+   size_t r     = atomic_load_explicit(&ring->read_pos,  memory_order_acquire);
+   size_t space = ring->capacity - (w - r);
+   size_t start, first;
+
+   if (frames > space)
+      frames = space;
+
+   start = w & (ring->capacity - 1);
+   first = ring->capacity - start;
+   if (first > frames)
+      first = frames;
+
+   memcpy(ring->data + start * 2, data, first * 2 * sizeof(int16_t));
+   memcpy(ring->data, data + first * 2, (frames - first) * 2 * sizeof(int16_t));
+
+   atomic_store_explicit(&ring->write_pos, w + frames, memory_order_release);
+   return frames;
+}
+
+size_t audio_ring_read(struct audio_ring *ring, int16_t *data, size_t frames)
+{
+   size_t r     = atomic_load_explicit(&ring->read_pos,  memory_order_relaxed);
+   size_t w     = atomic_load_explicit(&ring->write_pos, memory_order_acquire);
+   size_t avail = w - r;
+   size_t start, first;
+
+   if (frames > avail)
+      frames = avail;
+
+   start = r & (ring->capacity - 1);
+   first = ring->capacity - start;
+   if (first > frames)
+      first = frames;
+
+   memcpy(data, ring->data + start * 2, first * 2 * sizeof(int16_t));
+   memcpy(data + first * 2, ring->data, (frames - first) * 2 * sizeof(int16_t));
+
+   atomic_store_explicit(&ring->read_pos, r + frames, memory_order_release);
+   return frames;
+}
+
+/* ---- 出力スレッド ---- */
+
+static void audio_timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+   ts->tv_nsec += (long)(ns % 1000000000ull);
+   ts->tv_sec  += (time_t)(ns / 1000000000ull);
+   if (ts->tv_nsec >= 1000000000L)
+   {
+      ts->tv_nsec -= 1000000000L;
+      ts->tv_sec++;
+   }
+}
+
+/* オーディオデバイスの代わりに、out_rate * (1 + clock_skew) の速さで読み出します。 */
+static void *audio_thread(void *arg)
+{
+   struct timespec next;
+   size_t   period    = audio.config.period_frames;
+   uint64_t period_ns = (uint64_t)(period * 1e9
+         / (audio.config.out_rate * (1.0 + audio.config.clock_skew)));
+   int16_t *buf       = (int16_t*)malloc(period * 2 * sizeof(int16_t));
+
+   (void)arg;
+
+   if (!buf)
+      return NULL;
+
+   clock_gettime(CLOCK_MONOTONIC, &next);
+
+   while (!atomic_load(&audio.quit))
+   {
+      size_t got;
+
+      audio_timespec_add_ns(&next, period_ns);
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+      if (!atomic_load(&audio.started))
+         continue;
+
+      got = audio_ring_read(&audio.ring, buf, period);
+      atomic_fetch_add(&audio.periods, 1);
+      if (got < period)
+      {
+         atomic_fetch_add(&audio.underruns, 1);
+         atomic_fetch_add(&audio.underrun_frames, period - got);
+      }
+   }
+
+   free(buf);
+   return NULL;
+}
+
+static bool audio_start(void)
+{
+   size_t frames = (size_t)audio.config.out_rate * audio.config.latency_ms / 1000;
+
+   if (frames < audio.config.period_frames * 2)
+      frames = audio.config.period_frames * 2;
+   if (!audio_ring_init(&audio.ring, frames))
+      return false;
+   audio.buffer_frames = frames;
+
+   atomic_store(&audio.quit, false);
+   atomic_store(&audio.started, false);
+   if (pthread_create(&audio.thread, NULL, audio_thread, NULL) != 0)
+   {
+      audio_ring_free(&audio.ring);
+      return false;
+   }
+
+   audio.thread_running = true;
+   return true;
+}
+
+static void audio_stop(void)
+{
+   if (audio.thread_running)
+   {
+      atomic_store(&audio.quit, true);
+      pthread_join(audio.thread, NULL);
+      audio.thread_running = false;
+   }
+   audio_ring_free(&audio.ring);
+}
+
+bool audio_init(const struct audio_config *config, double in_rate)
+{
+   audio_free();
+
+   audio.config      = *config;
+   if (audio.config.latency_ms < audio.min_latency_ms)
+      audio.config.latency_ms = audio.min_latency_ms;
+   audio.in_rate     = in_rate > 0.0 ? in_rate : config->out_rate;
+   audio.base_ratio  = config->out_rate / audio.in_rate;
+   audio.stats.fill_min  = SIZE_MAX;
+   audio.stats.ratio_min = audio.base_ratio * 2.0;
+   audio.stats.ratio_max = 0.0;
+
+   if (!audio_start())
+      return false;
+
+   audio.initialized = true;
+   return true;
+}
+
+void audio_free(void)
+{
+   retro_audio_buffer_status_callback_t cb = audio.status_cb;
+   unsigned min_latency_ms                 = audio.min_latency_ms;
+
+   audio_stop();
+   free(audio.resampled);
+   memset(&audio, 0, sizeof(audio));
+   /* コアからの登録と要求はフロントエンドの音声の再初期化をまたいで有効です。 */
+   audio.status_cb      = cb;
+   audio.min_latency_ms = min_latency_ms;
+}
+
+bool audio_active(void)
+{
+   return audio.initialized;
+}
+
+const struct audio_config *audio_config(void)
+{
+   return &audio.config;
+}
+
+const struct audio_stats *audio_stats(void)
+{
+   audio.stats.underruns       = atomic_load(&audio.underruns);
+   audio.stats.underrun_frames = atomic_load(&audio.underrun_frames);
+   audio.stats.periods         = atomic_load(&audio.periods);
+   return &audio.stats;
+}
+
+/* ---- 生産者側 ---- */
+
+/* 線形補間で ratio 倍にリサンプリングし、出力フレーム数を返します。 */
+static size_t audio_resample(const int16_t *in, size_t frames, double ratio)
+{
+   double step = 1.0 / ratio;
+   size_t max  = (size_t)(frames * ratio) + 2;
+   size_t out  = 0;
+
+   if (max > audio.resampled_frames)
+   {
+      int16_t *buf = (int16_t*)realloc(audio.resampled, max * 2 * sizeof(int16_t));
+      if (!buf)
+         return 0;
+      audio.resampled        = buf;
+      audio.resampled_frames = max;
+   }
+
+   /* 位置 p は in[p - 1] と in[p] の間を指し、in[-1] は直前のブロックの最後のフレームです。 */
+   while (audio.phase < (double)frames && out < max)
+   {
+      size_t i          = (size_t)audio.phase;
+      double frac       = audio.phase - (double)i;
+      const int16_t *a  = i ? in + (i - 1) * 2 : audio.prev;
+      const int16_t *b  = in + i * 2;
+
+      audio.resampled[out * 2 + 0] = (int16_t)(a[0] + (b[0] - a[0]) * frac);
+      audio.resampled[out * 2 + 1] = (int16_t)(a[1] + (b[1] - a[1]) * frac);
+      out++;
+      audio.phase += step;
+   }
+
+   audio.phase  -= (double)frames;
+   audio.prev[0] = in[(frames - 1) * 2 + 0];
+   audio.prev[1] = in[(frames - 1) * 2 + 1];
+   return out;
+}
+
+size_t audio_push(const int16_t *data, size_t frames)
+{
+   size_t used, out, written;
+   double fill, ratio;
+
+   if (!audio.initialized || !frames)
+      return frames;
+
+   used  = audio_ring_used(&audio.ring);
+   fill  = (double)used / (double)audio.buffer_frames;
+   ratio = audio.base_ratio * (1.0 + audio.config.max_rate_delta * (1.0 - 2.0 * fill));
+
+   /* リングの実容量は 2 の累乗に切り上げているので、要求された遅延の分までしか書きません。 */
+   out     = audio_resample(data, frames, ratio);
+   written = used < audio.buffer_frames ? audio.buffer_frames - used : 0;
+   if (written > out)
+      written = out;
+   written = audio_ring_write(&audio.ring, audio.resampled, written);
+
+   if (!atomic_load_explicit(&audio.started, memory_order_relaxed)
+         && used + written >= audio.buffer_frames / 2)
+      atomic_store(&audio.started, true);
+
+   audio.stats.pushed_frames  += frames;
+   audio.stats.written_frames += written;
+   audio.stats.dropped_frames += out - written;
+   audio.stats.fill_sum       += (double)used;
+   audio.stats.fill_samples++;
+   if (used < audio.stats.fill_min)
+      audio.stats.fill_min = used;
+   if (ratio < audio.stats.ratio_min)
+      audio.stats.ratio_min = ratio;
+   if (ratio > audio.stats.ratio_max)
+      audio.stats.ratio_max = ratio;
+
+   return frames;
+}
+
+void audio_set_buffer_status_callback(retro_audio_buffer_status_callback_t cb)
+{
+   audio.status_cb = cb;
+}
+
+bool audio_set_minimum_latency(unsigned latency_ms)
+{
+   if (latency_ms > 512)
+      latency_ms = 512;
+   audio.min_latency_ms = latency_ms;
+   if (!audio.initialized)
+      return true;
+
+   /* 現在より短い要求は何もしません。0 は既定値に戻す要求ですが、既定値はそのままです。 */
+   if (latency_ms <= audio.config.latency_ms)
+      return true;
+
+   audio_stop();
+   audio.config.latency_ms = latency_ms;
+   if (!audio_start())
+   {
+      audio.initialized = false;
+      return false;
+   }
+   return true;
+}
+
+void audio_report_buffer_status(void)
+{
+   size_t   used;
+   unsigned occupancy;
+   bool     underrun_likely;
+
+   if (!audio.status_cb)
+      return;
+
+   if (!audio.initialized)
+   {
+      audio.status_cb(false, 0, false);
+      return;
+   }
+
+   used            = audio_ring_used(&audio.ring);
+   occupancy       = (unsigned)(used * 100 / audio.buffer_frames);
+   underrun_likely = atomic_load(&audio.started)
+      && used < (size_t)(audio.buffer_frames * AUDIO_UNDERRUN_LIKELY_FILL);
+
+   audio.status_cb(true, occupancy > 100 ? 100 : occupancy, underrun_likely);
+   audio.stats.status_calls++;
+   if (underrun_likely)
+      audio.stats.underrun_likely++;
+}
@@ -0,0 +1,140 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 音声パイプライン。
+ *
+ * エミュレーションスレッドが retro_audio_sample_batch_t で受け取ったサンプルを
+ * 線形補間でリサンプリングし、ロックフリーの SPSC リングに書き込みます。
+ * 出力スレッドはオーディオデバイスの代わりに一定周期でリングから読み出します。
+ *
+ * リサンプリング比はリングの占有率から動的に調整します (dynamic rate control)。
+ *   ratio = out_rate / in_rate * (1 + max_delta * (1 - 2 * fill))
+ * 占有率が半分を下回ると少し多めに、上回ると少し少なめに出力するので、
+ * 映像とオーディオのクロック差があってもリングは半分付近に保たれます。
+ *
+ * コアが RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK を登録した場合は、
+ * retro_run() の直前に占有率とアンダーランの予兆を通知します。
+ */
+
+#ifndef RETROBENCH_AUDIO_H__
+#define RETROBENCH_AUDIO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "libretro.h"
+
+/* ロックフリーの単一生産者・単一消費者リング。単位はステレオフレームです。 */
+struct audio_ring
+{
+   int16_t *data;
+   size_t   capacity;          /* 2 の累乗 */
+
+   /* 書き込み位置と読み出し位置は別のキャッシュラインに置きます。 */
+   _Atomic size_t write_pos __attribute__((aligned(64)));
+   _Atomic size_t read_pos  __attribute__((aligned(64)));
+};
+
+bool   audio_ring_init(struct audio_ring *ring, size_t frames);
+void   audio_ring_free(struct audio_ring *ring);
+/* 書き込めたフレーム数を返します。生産者スレッドからのみ呼べます。 */
+size_t audio_ring_write(struct audio_ring *ring, const int16_t *data, size_t frames);
+/* 読み出せたフレーム数を返します。消費者スレッドからのみ呼べます。 */
+size_t audio_ring_read(struct audio_ring *ring, int16_t *data, size_t frames);
+/* リングに入っているフレーム数を返します。どちらのスレッドからも呼べます。 */
+size_t audio_ring_used(struct audio_ring *ring);
+
+struct audio_config
+{
+   unsigned out_rate;          /* 出力サンプルレート (Hz) */
+   unsigned latency_ms;        /* リングの長さ */
+   unsigned period_frames;     /* 出力スレッドが 1 回に読むフレーム数 */
+   double   max_rate_delta;    /* 動的レート制御の最大補正量 */
+   double   clock_skew;        /* 出力クロックのずれ (例: 0.003 で 0.3% 速い) */
+};
+
+struct audio_stats
+{
+   uint64_t pushed_frames;     /* コアから受け取ったフレーム数 */
+   uint64_t written_frames;    /* リサンプリング後にリングへ書いたフレーム数 */
+   uint64_t dropped_frames;    /* リングが満杯で捨てたフレーム数 */
+   uint64_t underruns;         /* 出力スレッドが 1 周期分を読めなかった回数 */
+   uint64_t underrun_frames;   /* アンダーランで無音を補ったフレーム数 */
+   uint64_t periods;
+   uint64_t status_calls;      /* バッファ状態コールバックを呼んだ回数 */
+   uint64_t underrun_likely;   /* underrun_likely = true で通知した回数 */
+   uint64_t fill_samples;
+   double   fill_sum;          /* push 時の占有フレーム数の合計 (遅延の平均用) */
+   size_t   fill_min;
+   double   ratio_min;
+   double   ratio_max;
+};
+
+bool audio_init(const struct audio_config *config, double in_rate);
+void audio_free(void);
+
+/* 統計を返します。出力スレッド側のカウンタもこの時点の値に更新します。 */
+const struct audio_stats *audio_stats(void);
+const struct audio_config *audio_config(void);
+bool audio_active(void);
+
+/* エミュレーションスレッドから、コアのサンプルを渡します。 */
+size_t audio_push(const int16_t *data, size_t frames);
+
+/* SET_AUDIO_BUFFER_STATUS_CALLBACK / SET_MINIMUM_AUDIO_LATENCY の実装です。 */
+void audio_set_buffer_status_callback(retro_audio_buffer_status_callback_t cb);
+bool audio_set_minimum_latency(unsigned latency_ms);
+
+/* retro_run() の直前に呼び、コアに占有率を通知します。 */
+void audio_report_buffer_status(void);
+
+/* ---- retro_audio_sample_t の合成 ----
+ *
+ * 1 フレームずつ届くサンプルをスレッドローカルのブロックに溜め、
+ * AUDIO_BLOCK_FRAMES に達するか audio_block_flush() が呼ばれたときに
+ * まとめて sink (retro_audio_sample_batch_t と同じ経路) に渡します。
+ * ブロックはキャッシュライン境界に置き、書き込みが他の変数と干渉しないようにします。 */
+
+#define AUDIO_BLOCK_FRAMES 512
+
+typedef size_t (*audio_sink_t)(const int16_t *data, size_t frames);
+
+struct audio_block
+{
+   int16_t data[AUDIO_BLOCK_FRAMES * 2];
+   size_t  frames;
+   uint64_t flushes;
+} __attribute__((aligned(64)));
+
+extern __thread struct audio_block audio_block;
+
+static inline void audio_block_sample(int16_t left, int16_t right, audio_sink_t sink)
+{
+   struct audio_block *block = &audio_block;
+   size_t frames             = block->frames;
+
+   block->data[frames * 2 + 0] = left;
+   block->data[frames * 2 + 1] = right;
+   if (++frames == AUDIO_BLOCK_FRAMES)
+   {
+      sink(block->data, frames);
+      block->flushes++;
+      frames = 0;
+   }
+   block->frames = frames;
+}
+
+/* 溜まっている分を sink に渡します。フレームの終わりに呼びます。 */
+static inline void audio_block_flush(audio_sink_t sink)
+{
+   struct audio_block *block = &audio_block;
+
+   if (!block->frames)
+      return;
+   sink(block->data, block->frames);
+   block->flushes++;
+   block->frames = 0;
+}
+
+#endif
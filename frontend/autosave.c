@@ -0,0 +1,541 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - RETRO_MEMORY_SAVE_RAM / RETRO_MEMORY_RTC の自動保存。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AUTOSAVE_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUTOSAVE_NEON
+#endif
+
+#include "autosave.h"
+#include "cpu_features.h"
+#include "dispatch.h"
+#include "timer.h"
+
+#define AUTOSAVE_BLOCK 64
+
+/* 書き込みに失敗したら、この間隔から倍々に延ばして最大 AUTOSAVE_RETRY_MAX までやり直します。 */
+#define AUTOSAVE_RETRY_MIN 250000000ull
+#define AUTOSAVE_RETRY_MAX 30000000000ull
+
+/* ---- 比較カーネル ---- */
+
+/* size が AUTOSAVE_BLOCK の倍数でない場合の残り。 */
+static bool autosave_update_tail(uint8_t *shadow, const uint8_t *live, size_t size)
+{
+   if (!size || !memcmp(shadow, live, size))
+      return false;
+   memcpy(shadow, live, size);
+   return true;
+}
+
+static bool autosave_update_scalar(uint8_t *shadow, const uint8_t *live, size_t size)
+{
+   bool changed = false;
+   size_t i;
+
+   for (i = 0; i + AUTOSAVE_BLOCK <= size; i += AUTOSAVE_BLOCK)
+   {
+      uint64_t a[AUTOSAVE_BLOCK / 8], b[AUTOSAVE_BLOCK / 8], diff = 0;
+      unsigned j;
+
+      memcpy(a, shadow + i, AUTOSAVE_BLOCK);
+      memcpy(b, live + i, AUTOSAVE_BLOCK);
+      for (j = 0; j < AUTOSAVE_BLOCK / 8; j++)
+         diff |= a[j] ^ b[j];
+      if (diff)
+      {
+         memcpy(shadow + i, live + i, AUTOSAVE_BLOCK);
+         changed = true;
+      }
+   }
+
+   return autosave_update_tail(shadow + i, live + i, size - i) || changed;
+}
+
+#if defined(AUTOSAVE_X86)
+__attribute__((target("sse2")))
+static bool autosave_update_sse2(uint8_t *shadow, const uint8_t *live, size_t size)
+{
+   bool changed = false;
+   size_t i;
+
+   for (i = 0; i + AUTOSAVE_BLOCK <= size; i += AUTOSAVE_BLOCK)
+   {
+      __m128i l0 = _mm_loadu_si128((const __m128i*)(live + i));
+      __m128i l1 = _mm_loadu_si128((const __m128i*)(live + i + 16));
+      __m128i l2 = _mm_loadu_si128((const __m128i*)(live + i + 32));
+      __m128i l3 = _mm_loadu_si128((const __m128i*)(live + i + 48));
+      __m128i eq = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(l0, _mm_loadu_si128((const __m128i*)(shadow + i))),
+                          _mm_cmpeq_epi8(l1, _mm_loadu_si128((const __m128i*)(shadow + i + 16)))),
+            _mm_and_si128(_mm_cmpeq_epi8(l2, _mm_loadu_si128((const __m128i*)(shadow + i + 32))),
+                          _mm_cmpeq_epi8(l3, _mm_loadu_si128((const __m128i*)(shadow + i + 48)))));
+
+      if (_mm_movemask_epi8(eq) != 0xFFFF)
+      {
+         _mm_storeu_si128((__m128i*)(shadow + i),      l0);
+         _mm_storeu_si128((__m128i*)(shadow + i + 16), l1);
+         _mm_storeu_si128((__m128i*)(shadow + i + 32), l2);
+         _mm_storeu_si128((__m128i*)(shadow + i + 48), l3);
+         changed = true;
+      }
+   }
+
+   return autosave_update_tail(shadow + i, live + i, size - i) || changed;
+}
+
+__attribute__((target("avx2")))
+static bool autosave_update_avx2(uint8_t *shadow, const uint8_t *live, size_t size)
+{
+   bool changed = false;
+   size_t i;
+
+   for (i = 0; i + AUTOSAVE_BLOCK <= size; i += AUTOSAVE_BLOCK)
+   {
+      __m256i l0 = _mm256_loadu_si256((const __m256i*)(live + i));
+      __m256i l1 = _mm256_loadu_si256((const __m256i*)(live + i + 32));
+      __m256i eq = _mm256_and_si256(
+            _mm256_cmpeq_epi8(l0, _mm256_loadu_si256((const __m256i*)(shadow + i))),
+            _mm256_cmpeq_epi8(l1, _mm256_loadu_si256((const __m256i*)(shadow + i + 32))));
+
+      if (_mm256_movemask_epi8(eq) != -1)
+      {
+         _mm256_storeu_si256((__m256i*)(shadow + i),      l0);
+         _mm256_storeu_si256((__m256i*)(shadow + i + 32), l1);
+         changed = true;
+      }
+   }
+
+   return autosave_update_tail(shadow + i, live + i, size - i) || changed;
+}
+
+/* 64 ビット単位の比較なら AVX-512F だけで済みます。 */
+__attribute__((target("avx512f")))
+static bool autosave_update_avx512(uint8_t *shadow, const uint8_t *live, size_t size)
+{
+   bool changed = false;
+   size_t i;
+
+   for (i = 0; i + AUTOSAVE_BLOCK <= size; i += AUTOSAVE_BLOCK)
+   {
+      __m512i l = _mm512_loadu_si512((const void*)(live + i));
+
+      if (_mm512_cmpneq_epi64_mask(l, _mm512_loadu_si512((const void*)(shadow + i))))
+      {
+         _mm512_storeu_si512((void*)(shadow + i), l);
+         changed = true;
+      }
+   }
+
+   return autosave_update_tail(shadow + i, live + i, size - i) || changed;
+}
+#endif
+
+#if defined(AUTOSAVE_NEON)
+static bool autosave_update_neon(uint8_t *shadow, const uint8_t *live, size_t size)
+{
+   bool changed = false;
+   size_t i;
+
+   for (i = 0; i + AUTOSAVE_BLOCK <= size; i += AUTOSAVE_BLOCK)
+   {
+      uint8x16_t l0 = vld1q_u8(live + i);
+      uint8x16_t l1 = vld1q_u8(live + i + 16);
+      uint8x16_t l2 = vld1q_u8(live + i + 32);
+      uint8x16_t l3 = vld1q_u8(live + i + 48);
+      uint64x2_t d  = vreinterpretq_u64_u8(vorrq_u8(
+            vorrq_u8(veorq_u8(l0, vld1q_u8(shadow + i)),      veorq_u8(l1, vld1q_u8(shadow + i + 16))),
+            vorrq_u8(veorq_u8(l2, vld1q_u8(shadow + i + 32)), veorq_u8(l3, vld1q_u8(shadow + i + 48)))));
+
+      if (vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1))
+      {
+         vst1q_u8(shadow + i,      l0);
+         vst1q_u8(shadow + i + 16, l1);
+         vst1q_u8(shadow + i + 32, l2);
+         vst1q_u8(shadow + i + 48, l3);
+         changed = true;
+      }
+   }
+
+   return autosave_update_tail(shadow + i, live + i, size - i) || changed;
+}
+#endif
+
+static const struct autosave_kernel autosave_kernel_list[] = {
+#if defined(AUTOSAVE_X86)
+   { "avx512", CPU_FEATURE_AVX512F, autosave_update_avx512 },
+   { "avx2",   RETRO_SIMD_AVX2, autosave_update_avx2 },
+   { "sse2",   RETRO_SIMD_SSE2, autosave_update_sse2 },
+#endif
+#if defined(AUTOSAVE_NEON)
+   { "neon",   RETRO_SIMD_NEON, autosave_update_neon },
+#endif
+   { "scalar", 0,               autosave_update_scalar },
+};
+
+#define AUTOSAVE_KERNELS (sizeof(autosave_kernel_list) / sizeof(autosave_kernel_list[0]))
+
+static struct dispatch_variant autosave_variants[AUTOSAVE_KERNELS];
+
+/* dispatch_bind() までは、どの CPU でも動くスカラー版を使います。 */
+static const void *autosave_current = &autosave_kernel_list[AUTOSAVE_KERNELS - 1];
+
+const struct autosave_kernel *autosave_kernels(unsigned *count)
+{
+   *count = AUTOSAVE_KERNELS;
+   return autosave_kernel_list;
+}
+
+void autosave_register(void)
+{
+   unsigned i;
+
+   for (i = 0; i < AUTOSAVE_KERNELS; i++)
+   {
+      autosave_variants[i].name     = autosave_kernel_list[i].name;
+      autosave_variants[i].features = autosave_kernel_list[i].simd;
+      autosave_variants[i].impl     = &autosave_kernel_list[i];
+   }
+
+   dispatch_register("autosave", autosave_variants, AUTOSAVE_KERNELS, &autosave_current);
+}
+
+const struct autosave_kernel *autosave_kernel(void)
+{
+   return (const struct autosave_kernel*)autosave_current;
+}
+
+/* ---- 保存 ---- */
+
+struct autosave_region
+{
+   unsigned    id;             /* RETRO_MEMORY_* */
+   char        path[4096];
+   uint8_t    *shadow;         /* 最後に比べたときのコアのメモリ */
+   size_t      size;
+
+   /* ここから下は lock で守ります。書き込みスレッドは pending と writing を入れ替えて使います。 */
+   uint8_t    *pending;
+   uint8_t    *writing;
+   bool        queued;
+   uint64_t    retry_ns;       /* 失敗した書き込みを、この時刻 (timer_ns) まで待ってからやり直します */
+   uint64_t    backoff;
+};
+
+static struct
+{
+   struct core *core;
+   unsigned interval;
+   unsigned frame;
+   struct autosave_region regions[2];
+
+   pthread_t       thread;
+   pthread_mutex_t lock;
+   pthread_cond_t  cond;
+   bool            running;
+   bool            quit;
+
+   struct autosave_stats stats;    /* 書き込みの分は lock で守ります */
+} autosave = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* 一時ファイルに書いて fsync() し、rename() で置き換えます。 */
+static bool autosave_write_file(const char *path, const uint8_t *data, size_t size)
+{
+   char tmp[4096 + 8];
+   size_t done = 0;
+   int fd;
+
+   snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+   fd = mkstemp(tmp);
+   if (fd < 0)
+      return false;
+
+   while (done < size)
+   {
+      ssize_t n = write(fd, data + done, size - done);
+      if (n <= 0)
+         goto error;
+      done += (size_t)n;
+   }
+   if (fsync(fd) != 0 || fchmod(fd, 0644) != 0)
+      goto error;
+   close(fd);
+   if (rename(tmp, path) != 0)
+   {
+      unlink(tmp);
+      return false;
+   }
+   return true;
+
+error:
+   close(fd);
+   unlink(tmp);
+   return false;
+}
+
+/* lock を持ったまま、timer_ns() で表した時刻 until まで cond を待ちます。 */
+static void autosave_wait_until(uint64_t until)
+{
+   struct timespec ts;
+   uint64_t now = timer_ns();
+   uint64_t ns;
+
+   if (until <= now)
+      return;
+   clock_gettime(CLOCK_REALTIME, &ts);
+   ns         = (uint64_t)ts.tv_nsec + (until - now);
+   ts.tv_sec += (time_t)(ns / 1000000000ull);
+   ts.tv_nsec = (long)(ns % 1000000000ull);
+   pthread_cond_timedwait(&autosave.cond, &autosave.lock, &ts);
+}
+
+static void *autosave_thread(void *arg)
+{
+   unsigned i;
+   (void)arg;
+
+   pthread_mutex_lock(&autosave.lock);
+   for (;;)
+   {
+      struct autosave_region *region = NULL;
+      uint64_t now  = timer_ns();
+      uint64_t wake = 0;
+      uint64_t start;
+      bool ok;
+
+      /* 終了するときは待たずに最後の 1 回を試します。 */
+      for (i = 0; i < 2 && !region; i++)
+      {
+         struct autosave_region *r = &autosave.regions[i];
+
+         if (!r->queued)
+            continue;
+         if (autosave.quit || r->retry_ns <= now)
+            region = r;
+         else if (!wake || r->retry_ns < wake)
+            wake = r->retry_ns;
+      }
+
+      if (!region)
+      {
+         if (autosave.quit)
+            break;
+         if (wake)
+            autosave_wait_until(wake);
+         else
+            pthread_cond_wait(&autosave.cond, &autosave.lock);
+         continue;
+      }
+
+      /* 書いている間に届いたスナップショットは pending に入ります。 */
+      {
+         uint8_t *p       = region->writing;
+         region->writing  = region->pending;
+         region->pending  = p;
+         region->queued   = false;
+      }
+      pthread_mutex_unlock(&autosave.lock);
+
+      start = timer_ns();
+      ok    = autosave_write_file(region->path, region->writing, region->size);
+
+      pthread_mutex_lock(&autosave.lock);
+      if (ok)
+      {
+         autosave.stats.writes++;
+         autosave.stats.write_bytes += region->size;
+         region->retry_ns = 0;
+         region->backoff  = 0;
+      }
+      else
+      {
+         autosave.stats.failures++;
+         if (autosave.quit)
+            fprintf(stderr, "[autosave] %s を書き込めませんでした\n", region->path);
+         else
+         {
+            /* 写しはもう新しい内容になっているので、失敗したスナップショットは捨てずに
+             * 書き込み待ちに戻します。待っている間に届いた新しいものがあれば、そちらを書きます。 */
+            if (!region->queued)
+            {
+               uint8_t *p       = region->pending;
+               region->pending  = region->writing;
+               region->writing  = p;
+               region->queued   = true;
+            }
+            region->backoff  = region->backoff ? region->backoff * 2 : AUTOSAVE_RETRY_MIN;
+            if (region->backoff > AUTOSAVE_RETRY_MAX)
+               region->backoff = AUTOSAVE_RETRY_MAX;
+            region->retry_ns = timer_ns() + region->backoff;
+         }
+      }
+      autosave.stats.write_ns += timer_ns() - start;
+   }
+   pthread_mutex_unlock(&autosave.lock);
+   return NULL;
+}
+
+/* 保存してあったファイルをコアのメモリに読み込みます。 */
+static void autosave_load(const char *path, uint8_t *data, size_t size)
+{
+   FILE *fp = fopen(path, "rb");
+   size_t n;
+
+   if (!fp)
+      return;
+   n = fread(data, 1, size, fp);
+   if (fgetc(fp) != EOF || n != size)
+      fprintf(stderr, "[autosave] %s の大きさがコアのメモリ (%zu バイト) と違います\n", path, size);
+   fclose(fp);
+}
+
+static void autosave_check(struct autosave_region *region)
+{
+   const uint8_t *live = (const uint8_t*)autosave.core->retro_get_memory_data(region->id);
+   uint64_t start;
+   bool changed;
+
+   /* retro_load_game() の後で大きさが変わるコアは扱いません。 */
+   if (!live || autosave.core->retro_get_memory_size(region->id) != region->size)
+      return;
+
+   start   = timer_ns();
+   changed = autosave_kernel()->update(region->shadow, live, region->size);
+   autosave.stats.checks++;
+   autosave.stats.check_bytes += region->size;
+   autosave.stats.check_ns    += timer_ns() - start;
+   if (!changed)
+      return;
+
+   autosave.stats.changes++;
+   pthread_mutex_lock(&autosave.lock);
+   if (region->queued)
+      autosave.stats.coalesced++;
+   memcpy(region->pending, region->shadow, region->size);
+   region->queued = true;
+   pthread_cond_signal(&autosave.cond);
+   pthread_mutex_unlock(&autosave.lock);
+}
+
+static void autosave_free_regions(void)
+{
+   unsigned i;
+
+   for (i = 0; i < 2; i++)
+   {
+      free(autosave.regions[i].shadow);
+      free(autosave.regions[i].pending);
+      free(autosave.regions[i].writing);
+      memset(&autosave.regions[i], 0, sizeof(autosave.regions[i]));
+   }
+}
+
+bool autosave_init(struct core *core, const char *dir, const char *name, unsigned interval)
+{
+   static const unsigned ids[2]   = { RETRO_MEMORY_SAVE_RAM, RETRO_MEMORY_RTC };
+   static const char    *exts[2]  = { "srm", "rtc" };
+   unsigned i;
+
+   autosave.core     = core;
+   autosave.interval = interval ? interval : 1;
+   autosave.frame    = 0;
+   autosave.quit     = false;
+   memset(&autosave.stats, 0, sizeof(autosave.stats));
+
+   for (i = 0; i < 2; i++)
+   {
+      struct autosave_region *region = &autosave.regions[i];
+      uint8_t *live = (uint8_t*)core->retro_get_memory_data(ids[i]);
+      size_t   size = core->retro_get_memory_size(ids[i]);
+      int      n;
+
+      memset(region, 0, sizeof(*region));
+      region->id = ids[i];
+      if (!live || !size)
+         continue;
+
+      n = snprintf(region->path, sizeof(region->path), "%s/%s.%s", dir, name, exts[i]);
+      if (n < 0 || (size_t)n >= sizeof(region->path))
+         goto error;
+
+      region->shadow  = (uint8_t*)malloc(size);
+      region->pending = (uint8_t*)malloc(size);
+      region->writing = (uint8_t*)malloc(size);
+      if (!region->shadow || !region->pending || !region->writing)
+         goto error;
+      region->size = size;
+
+      autosave_load(region->path, live, size);
+      memcpy(region->shadow, live, size);
+   }
+
+   if (pthread_create(&autosave.thread, NULL, autosave_thread, NULL) != 0)
+      goto error;
+   autosave.running = true;
+   return true;
+
+error:
+   autosave_free_regions();
+   return false;
+}
+
+void autosave_frame(void)
+{
+   unsigned i;
+
+   if (!autosave.running || ++autosave.frame < autosave.interval)
+      return;
+   autosave.frame = 0;
+
+   for (i = 0; i < 2; i++)
+      if (autosave.regions[i].size)
+         autosave_check(&autosave.regions[i]);
+}
+
+void autosave_free(void)
+{
+   unsigned i;
+
+   if (autosave.running)
+   {
+      for (i = 0; i < 2; i++)
+         if (autosave.regions[i].size)
+            autosave_check(&autosave.regions[i]);
+
+      pthread_mutex_lock(&autosave.lock);
+      autosave.quit = true;
+      pthread_cond_signal(&autosave.cond);
+      pthread_mutex_unlock(&autosave.lock);
+      pthread_join(autosave.thread, NULL);
+      autosave.running = false;
+   }
+
+   autosave_free_regions();
+}
+
+void autosave_get_stats(struct autosave_stats *stats)
+{
+   pthread_mutex_lock(&autosave.lock);
+   *stats = autosave.stats;
+   pthread_mutex_unlock(&autosave.lock);
+}
+
+void autosave_reset_stats(void)
+{
+   pthread_mutex_lock(&autosave.lock);
+   memset(&autosave.stats, 0, sizeof(autosave.stats));
+   pthread_mutex_unlock(&autosave.lock);
+}
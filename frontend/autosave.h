@@ -0,0 +1,69 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - RETRO_MEMORY_SAVE_RAM / RETRO_MEMORY_RTC の自動保存。
+ *
+ * 各メモリの写し (shadow) を持ち、一定フレームごとにコアのメモリと 64 バイトのブロック単位で比べます。
+ * 違うブロックだけを写しに取り込み、変わっていれば写しのスナップショットを書き込みスレッドに渡します。
+ * 書き込みスレッドは同じディレクトリの一時ファイルに書いて fsync() してから rename() するので、
+ * 途中で落ちても前回のファイルか新しいファイルのどちらかが残ります。
+ * 書き込みに失敗したスナップショットは、間隔を倍々に延ばしながら書けるまでやり直します。
+ * セーブに触れないゲームプレイの間は比較だけで、ディスクには何も書きません。
+ *
+ * 比較のカーネルは dispatch_bind() が CPU の機能から AVX-512 / AVX2 / SSE2 / NEON / スカラーの順に選びます。
+ */
+
+#ifndef RETROBENCH_AUTOSAVE_H__
+#define RETROBENCH_AUTOSAVE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "core.h"
+
+/* shadow と live を比べ、違うブロックを shadow に写します。1 つでも違えば true を返します。 */
+typedef bool (*autosave_update_t)(uint8_t *shadow, const uint8_t *live, size_t size);
+
+struct autosave_kernel
+{
+   const char       *name;
+   uint64_t          simd;     /* 必要な RETRO_SIMD_* / CPU_FEATURE_* ビット */
+   autosave_update_t update;
+};
+
+struct autosave_stats
+{
+   uint64_t checks;            /* 比較した回数 (メモリごと) */
+   uint64_t check_ns;
+   uint64_t check_bytes;
+   uint64_t changes;           /* 変わっていた回数 */
+   uint64_t coalesced;         /* 書き込み待ちのスナップショットを新しいもので置き換えた回数 */
+   uint64_t writes;            /* rename() まで終えた回数 */
+   uint64_t write_bytes;
+   uint64_t write_ns;
+   uint64_t failures;
+};
+
+/* 利用可能かどうかにかかわらず、すべてのカーネルを優先度順に返します。 */
+const struct autosave_kernel *autosave_kernels(unsigned *count);
+
+/* カーネルを dispatch_register() に "autosave" として登録します。 */
+void autosave_register(void);
+
+/* 選ばれているカーネルを返します。 */
+const struct autosave_kernel *autosave_kernel(void);
+
+/* dir/name.srm と dir/name.rtc があればコアのメモリに読み込み、書き込みスレッドを開始します。
+ * retro_load_game() の後に呼びます。interval フレームごとに比べます。 */
+bool autosave_init(struct core *core, const char *dir, const char *name, unsigned interval);
+
+/* フレームの終わりに呼びます。 */
+void autosave_frame(void);
+
+/* 最後に比べて書き込み、スレッドを止めます。retro_unload_game() の前に呼びます。 */
+void autosave_free(void);
+
+void autosave_get_stats(struct autosave_stats *stats);
+void autosave_reset_stats(void);
+
+#endif
@@ -0,0 +1,666 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 多数のコンテンツをワーカープロセスで並列に実行するバッチランナー。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "batch.h"
+#include "core.h"
+#include "content.h"
+#include "callbacks.h"
+#include "memmap.h"
+#include "logger.h"
+#include "perf.h"
+#include "savestate.h"
+#include "timer.h"
+
+#define BATCH_LINE_MAX 4096
+
+/* dlclose() してもコアが外れず、新しいプロセスに入れ替わるワーカーの終了コード。 */
+#define BATCH_EXIT_RECYCLE 3
+
+enum batch_status
+{
+   BATCH_PENDING = 0,
+   BATCH_RUNNING,
+   BATCH_OK,
+   BATCH_FAILED,               /* dlopen() や retro_load_game() が失敗した */
+   BATCH_CRASHED               /* 実行中にワーカーが落ちた */
+};
+
+struct batch_result
+{
+   int      status;            /* enum batch_status */
+   int      worker;
+   int      signal;            /* BATCH_CRASHED のとき、ワーカーを止めたシグナル (exit なら 0) */
+   unsigned frames;
+   uint64_t load_ns;           /* dlopen() から retro_load_game() まで。fork_server なら fork() からステートの適用まで */
+   uint64_t run_ns;
+   uint64_t unload_ns;         /* retro_unload_game() から dlclose() まで。fork_server では 0 */
+};
+
+/* head と tail を 1 つの 64 ビットにまとめ、持ち主は前から、盗む側は後ろから CAS で 1 つずつ取ります。
+ * ジョブは数百ミリ秒以上かかるので、この程度の競合は問題になりません。 */
+struct batch_deque
+{
+   _Atomic uint64_t range __attribute__((aligned(64)));   /* 下位 32 ビットが head、上位が tail */
+};
+
+struct batch_worker
+{
+   pid_t    pid;
+   int      job;               /* 実行中のジョブ。無ければ -1 */
+   unsigned spawns;            /* このスロットで起動したプロセスの数 */
+   uint64_t jobs;
+   uint64_t steals;
+   uint64_t busy_ns;
+   uint64_t cpu_ns;            /* ジョブに使った CPU 時間 (コアのスレッドを含む) */
+} __attribute__((aligned(64)));
+
+static struct
+{
+   struct batch_config  config;
+   char               **paths;       /* NULL はコンテンツなし */
+   unsigned             jobs;
+   unsigned             workers;
+   void                *map;         /* 以下の 3 つを置いた共有メモリ */
+   size_t               map_size;
+   struct batch_deque  *deques;
+   struct batch_worker *slots;
+   struct batch_result *results;
+   struct savestate_meta state_meta;   /* fork サーバーのコアとコンテンツ。ステートと比べます */
+} batch;
+
+static bool batch_read_list(const char *path)
+{
+   char     line[BATCH_LINE_MAX];
+   unsigned capacity = 0;
+   FILE    *f = fopen(path, "r");
+
+   if (!f)
+   {
+      fprintf(stderr, "[batch] ジョブの一覧を開けません: %s\n", path);
+      return false;
+   }
+
+   while (fgets(line, sizeof(line), f))
+   {
+      size_t n = strcspn(line, "\r\n");
+
+      line[n] = '\0';
+      if (!n || line[0] == '#')
+         continue;
+
+      if (batch.jobs == capacity)
+      {
+         char **paths;
+
+         capacity = capacity ? capacity * 2 : 64;
+         paths    = (char**)realloc(batch.paths, capacity * sizeof(*paths));
+         if (!paths)
+            break;
+         batch.paths = paths;
+      }
+      batch.paths[batch.jobs++] = strcmp(line, "-") ? strdup(line) : NULL;
+   }
+
+   fclose(f);
+   if (!batch.jobs)
+      fprintf(stderr, "[batch] ジョブがありません: %s\n", path);
+   return batch.jobs != 0;
+}
+
+static void batch_free(void)
+{
+   unsigned i;
+
+   for (i = 0; i < batch.jobs; i++)
+      free(batch.paths[i]);
+   free(batch.paths);
+   if (batch.map)
+      munmap(batch.map, batch.map_size);
+   memset(&batch, 0, sizeof(batch));
+}
+
+/* キューと結果を MAP_SHARED で確保し、ジョブを連続した範囲でワーカーに振り分けます。 */
+static bool batch_map(void)
+{
+   size_t deques  = (size_t)batch.workers * sizeof(*batch.deques);
+   size_t slots   = (size_t)batch.workers * sizeof(*batch.slots);
+   size_t results = (size_t)batch.jobs * sizeof(*batch.results);
+   unsigned w;
+
+   batch.map_size = deques + slots + results;
+   batch.map      = mmap(NULL, batch.map_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (batch.map == MAP_FAILED)
+   {
+      batch.map = NULL;
+      return false;
+   }
+
+   batch.deques  = (struct batch_deque*)batch.map;
+   batch.slots   = (struct batch_worker*)((uint8_t*)batch.map + deques);
+   batch.results = (struct batch_result*)((uint8_t*)batch.map + deques + slots);
+
+   for (w = 0; w < batch.workers; w++)
+   {
+      uint64_t head = (uint64_t)batch.jobs * w / batch.workers;
+      uint64_t tail = (uint64_t)batch.jobs * (w + 1) / batch.workers;
+
+      atomic_init(&batch.deques[w].range, head | tail << 32);
+      batch.slots[w].job = -1;
+   }
+   return true;
+}
+
+/* キューから 1 つ取ります。steal なら後ろから取ります。空なら -1 を返します。 */
+static int batch_take(struct batch_deque *deque, bool steal)
+{
+   uint64_t range = atomic_load(&deque->range);
+
+   for (;;)
+   {
+      uint32_t head = (uint32_t)range;
+      uint32_t tail = (uint32_t)(range >> 32);
+      uint64_t next = steal ? range - ((uint64_t)1 << 32) : range + 1;
+
+      if (head >= tail)
+         return -1;
+      if (atomic_compare_exchange_weak(&deque->range, &range, next))
+         return (int)(steal ? tail - 1 : head);
+   }
+}
+
+static unsigned batch_left(unsigned w)
+{
+   uint64_t range = atomic_load(&batch.deques[w].range);
+   uint32_t head  = (uint32_t)range;
+   uint32_t tail  = (uint32_t)(range >> 32);
+
+   return tail > head ? tail - head : 0;
+}
+
+static unsigned batch_remaining(void)
+{
+   unsigned w, left = 0;
+
+   for (w = 0; w < batch.workers; w++)
+      left += batch_left(w);
+   return left;
+}
+
+/* 自分のキューが空なら、残りの一番多いキューから盗みます。 */
+static int batch_next(unsigned slot)
+{
+   int job = batch_take(&batch.deques[slot], false);
+
+   while (job < 0)
+   {
+      unsigned w, victim = 0, most = 0;
+
+      for (w = 0; w < batch.workers; w++)
+      {
+         unsigned left = batch_left(w);
+
+         if (left > most)
+         {
+            most   = left;
+            victim = w;
+         }
+      }
+      if (!most)
+         return -1;
+
+      job = batch_take(&batch.deques[victim], true);
+      if (job >= 0)
+         batch.slots[slot].steals++;
+   }
+   return job;
+}
+
+/* 前のジョブでコアから通知された状態を、起動直後の値に戻します。 */
+static void batch_reset_frontend(void)
+{
+   if (frontend_state.has_memmap)
+      memmap_free(&frontend_state.memmap);
+   frontend_state.has_memmap           = false;
+   frontend_state.pixel_format         = RETRO_PIXEL_FORMAT_0RGB1555;
+   frontend_state.serialization_quirks = 0;
+   frontend_state.shutdown             = false;
+}
+
+/* ジョブを 1 つ実行します。dlclose() の後もコアが読み込まれたままなら true を返します。 */
+static bool batch_run_job(int job)
+{
+   struct batch_result *result = &batch.results[job];
+   struct core core;
+   uint64_t start = timer_ns();
+   unsigned i;
+   bool     ok;
+   void    *resident;
+
+   batch_reset_frontend();
+   ok = core_load(&core, batch.config.core_path, false);
+   if (ok)
+   {
+      callbacks_set_environment(&core);
+      core.retro_init();
+      core.initialized = true;
+      callbacks_install(&core);
+      ok = core_load_game(&core, batch.paths[job]);
+   }
+   result->load_ns = timer_ns() - start;
+
+   if (ok)
+   {
+      start = timer_ns();
+      for (i = 0; i < batch.config.frames && !frontend_state.shutdown; i++)
+      {
+         callbacks_run(&core);
+         callbacks_frame_end();
+      }
+      result->run_ns = timer_ns() - start;
+      result->frames = i;
+   }
+
+   start = timer_ns();
+   core_unload(&core);
+   result->unload_ns = timer_ns() - start;
+   result->status    = ok ? BATCH_OK : BATCH_FAILED;
+
+   resident = dlopen(batch.config.core_path, RTLD_NOW | RTLD_NOLOAD);
+   if (resident)
+      dlclose(resident);
+   return resident != NULL;
+}
+
+static void batch_worker_main(unsigned slot)
+{
+   struct batch_worker *worker = &batch.slots[slot];
+   int code = EXIT_SUCCESS;
+   int job;
+
+   /* 親の出力スレッドは fork() で引き継がれないので、ワーカーごとに開始します。 */
+   logger_start();
+
+   while ((job = batch_next(slot)) >= 0)
+   {
+      uint64_t start = timer_ns();
+      uint64_t cpu   = timer_cpu_ns();
+      bool     resident;
+
+      worker->job                = job;
+      batch.results[job].worker  = (int)slot;
+      batch.results[job].status  = BATCH_RUNNING;
+      resident                   = batch_run_job(job);
+      worker->jobs++;
+      worker->busy_ns           += timer_ns() - start;
+      worker->cpu_ns            += timer_cpu_ns() - cpu;
+      worker->job                = -1;
+
+      if (resident)
+      {
+         code = BATCH_EXIT_RECYCLE;
+         break;
+      }
+   }
+
+   logger_stop();
+   fflush(stdout);
+   fflush(stderr);
+   _exit(code);
+}
+
+static bool batch_spawn(unsigned slot)
+{
+   pid_t pid;
+
+   /* 親のバッファに残った出力を子が重ねて書き出さないようにします。 */
+   fflush(stdout);
+   fflush(stderr);
+   batch.slots[slot].job = -1;
+
+   pid = fork();
+   if (pid < 0)
+   {
+      fprintf(stderr, "[batch] ワーカーを起動できません: %s\n", strerror(errno));
+      return false;
+   }
+   if (pid == 0)
+      batch_worker_main(slot);
+
+   batch.slots[slot].pid = pid;
+   batch.slots[slot].spawns++;
+   return true;
+}
+
+/* 終了した子のスロットを返します。ジョブの途中で落ちていれば、そのジョブを crashed として記録します。 */
+static struct batch_worker *batch_reap(pid_t pid, int status, bool *crashed)
+{
+   unsigned w;
+
+   for (w = 0; w < batch.workers; w++)
+   {
+      struct batch_worker *worker = &batch.slots[w];
+
+      if (worker->pid != pid)
+         continue;
+
+      *crashed = worker->job >= 0;
+      if (*crashed)
+      {
+         struct batch_result *result = &batch.results[worker->job];
+
+         result->status = BATCH_CRASHED;
+         result->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+         worker->jobs++;
+         worker->job    = -1;
+      }
+      worker->pid = 0;
+      return worker;
+   }
+   return NULL;
+}
+
+/* ワーカーがすべて終わるまで待ちます。ジョブの途中で落ちたワーカーや、
+ * コアが外れずに入れ替わるワーカーは、ジョブが残っていれば同じスロットで起動し直します。 */
+static void batch_wait(unsigned alive)
+{
+   while (alive)
+   {
+      struct batch_worker *worker;
+      bool  crashed;
+      int   status;
+      pid_t pid = waitpid(-1, &status, 0);
+
+      if (pid < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+
+      if (!(worker = batch_reap(pid, status, &crashed)))
+         continue;
+      alive--;
+
+      if ((crashed || (WIFEXITED(status) && WEXITSTATUS(status) == BATCH_EXIT_RECYCLE))
+            && batch_remaining() && batch_spawn((unsigned)(worker - batch.slots)))
+         alive++;
+   }
+}
+
+/* ---- fork サーバー ---- */
+
+/* 温まったコアを引き継いだ子の本体です。forked は親が fork() する直前の時刻です。 */
+static void batch_serve_job(struct core *core, unsigned slot, int job, uint64_t forked)
+{
+   struct batch_worker *worker = &batch.slots[slot];
+   struct batch_result *result = &batch.results[job];
+   unsigned i;
+   bool     ok = true;
+
+   logger_start();
+   if (batch.paths[job])
+      ok = savestate_load(core, batch.paths[job], &batch.state_meta, NULL);
+   result->load_ns = timer_ns() - forked;
+
+   if (ok)
+   {
+      uint64_t start = timer_ns();
+
+      for (i = 0; i < batch.config.frames && !frontend_state.shutdown; i++)
+      {
+         callbacks_run(core);
+         callbacks_frame_end();
+      }
+      result->run_ns = timer_ns() - start;
+      result->frames = i;
+   }
+   result->status = ok ? BATCH_OK : BATCH_FAILED;
+
+   /* fork() した子の CPU 時間は 0 から数えます。 */
+   worker->jobs++;
+   worker->busy_ns += timer_ns() - forked;
+   worker->cpu_ns  += timer_cpu_ns();
+   worker->job      = -1;
+
+   /* retro_unload_game() や retro_deinit() は親の状態の写しを片付けるだけなので呼びません。 */
+   logger_stop();
+   fflush(stdout);
+   fflush(stderr);
+   _exit(EXIT_SUCCESS);
+}
+
+static bool batch_fork_job(struct core *core, unsigned slot, int job)
+{
+   struct batch_worker *worker = &batch.slots[slot];
+   uint64_t start;
+   pid_t    pid;
+
+   fflush(stdout);
+   fflush(stderr);
+   worker->job                = job;
+   batch.results[job].worker  = (int)slot;
+   batch.results[job].status  = BATCH_RUNNING;
+
+   start = timer_ns();
+   pid   = fork();
+   if (pid < 0)
+   {
+      fprintf(stderr, "[batch] ジョブを fork() できません: %s\n", strerror(errno));
+      worker->job               = -1;
+      batch.results[job].status = BATCH_PENDING;
+      return false;
+   }
+   if (pid == 0)
+      batch_serve_job(core, slot, job, start);
+
+   worker->pid = pid;
+   worker->spawns++;
+   return true;
+}
+
+/* コアを 1 度だけ起動し、ジョブごとに fork() します。同時に動かす子はワーカー数までです。
+ * 起動にかかった時間を *cold_ns に返します。 */
+static bool batch_serve(uint64_t *cold_ns)
+{
+   struct core core;
+   uint64_t start = timer_ns();
+   unsigned w, running = 0;
+   int      next = 0;
+   bool     ok;
+
+   ok = core_load(&core, batch.config.core_path, false);
+   if (ok)
+   {
+      callbacks_set_environment(&core);
+      core.retro_init();
+      core.initialized = true;
+      callbacks_install(&core);
+      ok = core_load_game(&core, batch.config.content_path);
+   }
+   *cold_ns = timer_ns() - start;
+   if (!ok)
+   {
+      core_unload(&core);
+      return false;
+   }
+
+   savestate_describe(&batch.state_meta, &core, frontend_state.serialization_quirks, 0);
+   if (batch.config.content_path)
+      content_hash(&core.content, &batch.state_meta.content_hash);
+
+   for (;;)
+   {
+      struct batch_worker *worker;
+      bool  crashed;
+      int   status;
+      pid_t pid;
+
+      for (w = 0; w < batch.workers && next < (int)batch.jobs; w++)
+      {
+         if (batch.slots[w].pid)
+            continue;
+         if (!batch_fork_job(&core, w, next))
+            break;
+         next++;
+         running++;
+      }
+      if (!running)
+         break;
+
+      pid = waitpid(-1, &status, 0);
+      if (pid < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+      if ((worker = batch_reap(pid, status, &crashed)))
+         running--;
+   }
+
+   core_unload(&core);
+   return true;
+}
+
+/* 集計を表示し、成功したジョブの数を返します。cold_ns は fork サーバーがコアを起動した時間です。 */
+static unsigned batch_report(uint64_t wall_ns, uint64_t cold_ns)
+{
+   unsigned counts[BATCH_CRASHED + 1] = { 0 };
+   uint64_t load_ns = 0, run_ns = 0, unload_ns = 0, frames = 0;
+   uint64_t cpu_ns  = 0, steals = 0;
+   unsigned spawns  = 0;
+   unsigned i, ran;
+   double   wall    = (double)wall_ns;
+
+   for (i = 0; i < batch.jobs; i++)
+   {
+      const struct batch_result *result = &batch.results[i];
+
+      counts[result->status]++;
+      if (result->status != BATCH_OK)
+         continue;
+      load_ns   += result->load_ns;
+      run_ns    += result->run_ns;
+      unload_ns += result->unload_ns;
+      frames    += result->frames;
+   }
+   for (i = 0; i < batch.workers; i++)
+   {
+      cpu_ns  += batch.slots[i].cpu_ns;
+      steals  += batch.slots[i].steals;
+      spawns  += batch.slots[i].spawns;
+   }
+   ran = counts[BATCH_OK] ? counts[BATCH_OK] : 1;
+
+   printf("core:            %s\n", batch.config.core_path);
+   printf("batch:           %u jobs × %u frames on %u workers%s  %.3f s  %.0f jobs/hour\n",
+         batch.jobs, batch.config.frames, batch.workers,
+         batch.config.fork_server ? " (fork server)" : "", wall / 1e9,
+         wall > 0.0 ? (counts[BATCH_OK] + counts[BATCH_FAILED]) * 3600e9 / wall : 0.0);
+   printf("                 ok %u  failed %u  crashed %u  not run %u  processes %u  steals %llu\n",
+         counts[BATCH_OK], counts[BATCH_FAILED], counts[BATCH_CRASHED],
+         counts[BATCH_PENDING] + counts[BATCH_RUNNING], spawns, (unsigned long long)steals);
+   if (batch.config.fork_server)
+   {
+      printf("startup:         cold %.2f ms once (dlopen → retro_load_game)  "
+            "per job %.3f ms (fork → ステートの適用)\n", cold_ns / 1e6, load_ns / 1e6 / ran);
+      printf("per job:         run %.2f ms (%.1f us/frame)\n",
+            run_ns / 1e6 / ran, frames ? run_ns / 1e3 / frames : 0.0);
+   }
+   else
+      printf("per job:         load %.2f ms  run %.2f ms (%.1f us/frame)  unload %.2f ms\n",
+            load_ns / 1e6 / ran, run_ns / 1e6 / ran,
+            frames ? run_ns / 1e3 / frames : 0.0, unload_ns / 1e6 / ran);
+   /* ジョブの CPU 時間の合計を経過時間で割ったもので、1 つのワーカーで順に実行した場合に比べた速さです。
+    * ワーカー数に近いほど線形に伸びています。CPU の数より多いワーカーは伸びに寄与しません。 */
+   printf("scaling:         %.2fx of one worker  (%.0f%% of %u workers)\n",
+         wall > 0.0 ? cpu_ns / wall : 0.0,
+         wall > 0.0 ? 100.0 * cpu_ns / (wall * batch.workers) : 0.0, batch.workers);
+
+   for (i = 0; i < batch.workers; i++)
+   {
+      const struct batch_worker *worker = &batch.slots[i];
+
+      printf("  worker %-3u     %llu jobs  %llu steals  busy %.0f%%  cpu %.0f%%  processes %u\n", i,
+            (unsigned long long)worker->jobs, (unsigned long long)worker->steals,
+            wall > 0.0 ? 100.0 * worker->busy_ns / wall : 0.0,
+            wall > 0.0 ? 100.0 * worker->cpu_ns / wall : 0.0, worker->spawns);
+   }
+
+   for (i = 0; i < batch.jobs; i++)
+   {
+      const struct batch_result *result = &batch.results[i];
+      const char *path = batch.paths[i] ? batch.paths[i] : "-";
+
+      if (result->status == BATCH_FAILED)
+         printf("failed:          %s\n", path);
+      else if (result->status == BATCH_CRASHED && result->signal)
+         printf("crashed:         %s (%s)\n", path, strsignal(result->signal));
+      else if (result->status == BATCH_CRASHED)
+         printf("crashed:         %s (exit)\n", path);
+   }
+   return counts[BATCH_OK];
+}
+
+bool batch_run(const struct batch_config *config)
+{
+   unsigned w, alive = 0;
+   uint64_t start, cold_ns = 0;
+   bool     ok = false;
+
+   memset(&batch, 0, sizeof(batch));
+   batch.config = *config;
+   if (!batch_read_list(config->list_path))
+   {
+      batch_free();
+      return false;
+   }
+
+   batch.workers = config->workers;
+   if (!batch.workers)
+   {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      batch.workers = cpus > 0 ? (unsigned)cpus : 1;
+   }
+   if (batch.workers > batch.jobs)
+      batch.workers = batch.jobs;
+
+   if (!batch_map())
+   {
+      fprintf(stderr, "[batch] 共有メモリを確保できません\n");
+      batch_free();
+      return false;
+   }
+
+   /* コアが GET_PERF_INTERFACE を使う場合に備えて、fork() の前に 1 度だけ較正しておきます。 */
+   perf_init(false);
+
+   start = timer_ns();
+   if (config->fork_server)
+      alive = batch_serve(&cold_ns);
+   else
+   {
+      for (w = 0; w < batch.workers; w++)
+         if (batch_spawn(w))
+            alive++;
+      batch_wait(alive);
+   }
+
+   if (alive)
+      ok = batch_report(timer_ns() - start, cold_ns) != 0;
+   batch_free();
+   return ok;
+}
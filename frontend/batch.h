@@ -0,0 +1,44 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 多数のコンテンツをワーカープロセスで並列に実行するバッチランナー。
+ *
+ * libretro コアはグローバル状態を持つので、1 つのプロセスで動かせるインスタンスは 1 つだけです。
+ * そこで CPU の数だけワーカープロセスを fork() し、各ワーカーがジョブごとにコアを dlopen() して
+ * retro_load_game() → N 回の retro_run() → retro_unload_game() を繰り返します。
+ *
+ * ジョブは最初にワーカーごとの両端キューへ連続した範囲で振り分けます。ワーカーは自分のキューを
+ * 前から取り、空になったら残りの一番多いキューの後ろから盗むので、重いコンテンツが偏っても
+ * 最後まで全員が働けます。キューと結果は fork() の前に確保した共有メモリに置きます。
+ *
+ * ワーカーが落ちても、親は実行中だったジョブを crashed として記録し、代わりのワーカーを起動します。
+ * dlclose() してもコアが読み込まれたまま残る (NODELETE) 場合は、グローバル状態を次のジョブに
+ * 持ち越さないように、ワーカーはそのジョブで終了して新しいプロセスに入れ替わります。
+ *
+ * fork_server を指定すると、親が 1 度だけコアを dlopen() して retro_init() と retro_load_game() を済ませ、
+ * ジョブごとにその状態から fork() します。子はコピーオンライトで温まったコアをそのまま使うので、
+ * ジョブの起動は fork() と、一覧の行が指すステート (savestate.h) の retro_unserialize() だけで済みます。
+ * 子は後始末をせずに終了します。retro_load_game() までにスレッドを起動するコアは、
+ * 子にそのスレッドが引き継がれないので使えません。
+ */
+
+#ifndef RETROBENCH_BATCH_H__
+#define RETROBENCH_BATCH_H__
+
+#include <stdbool.h>
+
+struct batch_config
+{
+   const char *core_path;
+   const char *list_path;      /* コンテンツのパスを 1 行に 1 つ並べたファイル。"-" はコンテンツなし */
+   unsigned    workers;        /* 0 ならオンラインの CPU の数 */
+   unsigned    frames;         /* ジョブごとに retro_run() を呼ぶ回数 */
+   bool        fork_server;    /* 一覧の各行を content_path から始めるステートとして扱う */
+   const char *content_path;   /* fork_server で読み込むコンテンツ。NULL ならコンテンツなし */
+};
+
+/* list_path のジョブをすべて実行して集計を表示します。fork_server なら一覧の各行はステートのファイルです。
+ * ジョブが 1 つも成功しなかった場合や、ワーカーを起動できなかった場合は false を返します。
+ * fork() するので、スレッドを開始する前 (logger_start() より前) に呼びます。 */
+bool batch_run(const struct batch_config *config);
+
+#endif
@@ -0,0 +1,1756 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアを必要としない部品単体のベンチマーク。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <zlib.h>
+
+#include "bench.h"
+#include "memmap.h"
+#include "pixconv.h"
+#include "framehash.h"
+#include "tilediff.h"
+#include "video.h"
+#include "cpu_features.h"
+#include "audio.h"
+#include "input.h"
+#include "vfs.h"
+#include "content.h"
+#include "options.h"
+#include "logger.h"
+#include "autosave.h"
+#include "savestate.h"
+#include "timer.h"
+
+/* 再現性のために固定シードの xorshift を使います。 */
+static uint32_t bench_rand_state = 2463534242u;
+
+static uint32_t bench_rand(void)
+{
+   bench_rand_state ^= bench_rand_state << 13;
+   bench_rand_state ^= bench_rand_state >> 17;
+   bench_rand_state ^= bench_rand_state << 5;
+   return bench_rand_state;
+}
+
+/* ---- memmap ---- */
+
+/* TODO が提案する「addr と len の両方で立っている最下位ビットを消す」方式。 */
+static size_t bench_len_lowest_common(size_t addr, size_t len)
+{
+   while (addr >= len)
+   {
+      size_t common = addr & len;
+      if (!common)
+         return SIZE_MAX;
+      addr &= ~(common & (~common + 1));
+   }
+   return addr;
+}
+
+/* TODO に書かれた「上位から足していき、len を超えたら直前のビットを外す」方式。 */
+static size_t bench_len_todo(size_t addr, size_t len)
+{
+   size_t result = 0;
+   size_t bit;
+
+   for (bit = (size_t)1 << (sizeof(size_t) * 8 - 1); bit; bit >>= 1)
+      if ((addr & bit) && (result | bit) < len)
+         result |= bit;
+   return result;
+}
+
+static bool bench_memmap(void)
+{
+   static uint8_t wram[0x20000], rom[512 * 1024], spc[0x10000];
+   /* ヘッダーのサンプル記述子（SNES LoROM）をそのまま使います。 */
+   struct retro_memory_descriptor descs[] = {
+      { RETRO_MEMDESC_SYSTEM_RAM, wram, 0, 0x7E0000, 0, 0, 0x20000, NULL },
+      { RETRO_MEMDESC_SYSTEM_RAM, wram, 0, 0x000000, 0xC0E000, 0, 0x2000, NULL },
+      { RETRO_MEMDESC_SYSTEM_RAM, wram, 0, 0x800000, 0xC0E000, 0, 0x2000, NULL },
+      { RETRO_MEMDESC_CONST, rom, 0, 0x008000, 0x408000, 0x8000, sizeof(rom), NULL },
+      { RETRO_MEMDESC_CONST, rom, 0, 0x400000, 0x400000, 0x8000, sizeof(rom), NULL },
+      { 0, spc, 0, 0, 0, 0, sizeof(spc), "S" },
+      { 0, NULL, 0, 0, 0xFFFFFF, 0, 0, NULL },
+   };
+   struct retro_memory_map map = { descs, sizeof(descs) / sizeof(descs[0]) };
+   const struct memmap_space *space;
+   struct memmap mm;
+   enum { LOOKUPS = 1 << 22 };
+   uint32_t *addrs;
+   uint64_t  start, walk_ns, table_ns, sum_walk = 0, sum_table = 0;
+   size_t    i, len, mismatch = 0, checked = 0, example_addr = 0, example_len = 0;
+   volatile size_t sink = 0;
+
+   for (i = 0; i < sizeof(rom); i++)
+      rom[i] = (uint8_t)bench_rand();
+   for (i = 0; i < sizeof(wram); i++)
+      wram[i] = (uint8_t)bench_rand();
+
+   start = timer_ns();
+   if (!memmap_compile(&mm, &map))
+   {
+      fprintf(stderr, "memmap: コンパイルに失敗しました\n");
+      return false;
+   }
+   printf("memmap compile:  %.1f us\n", (timer_ns() - start) / 1e3);
+
+   for (i = 0; i < mm.num_spaces; i++)
+      printf("  space \"%s\":   max 0x%zX  page %u B  %zu pages (%zu KB, lookup %zu)\n",
+            mm.spaces[i].name, mm.spaces[i].max_addr,
+            1u << mm.spaces[i].page_bits, mm.spaces[i].pages,
+            mm.spaces[i].pages * sizeof(struct memmap_page) / 1024,
+            mm.spaces[i].lookup_pages);
+
+   /* 24 ビット空間の全アドレスで、記述子を辿った結果と一致することを確かめます。 */
+   space = memmap_find_space(&mm, NULL);
+   for (i = 0; i <= 0xFFFFFF; i++)
+      if (memmap_translate(space, i, NULL) != memmap_translate_descriptors(&mm, NULL, i))
+      {
+         fprintf(stderr, "memmap: 0x%06zX の変換結果が一致しません\n", i);
+         memmap_free(&mm);
+         return false;
+      }
+   printf("memmap verify:   24 ビット空間の全アドレスが記述子の走査と一致\n");
+
+   addrs = (uint32_t*)malloc(LOOKUPS * sizeof(*addrs));
+   if (!addrs)
+   {
+      memmap_free(&mm);
+      return false;
+   }
+   for (i = 0; i < LOOKUPS; i++)
+      addrs[i] = bench_rand() & 0xFFFFFF;
+
+   start = timer_ns();
+   for (i = 0; i < LOOKUPS; i++)
+   {
+      const uint8_t *p = memmap_translate_descriptors(&mm, NULL, addrs[i]);
+      sum_walk += p ? *p : 0;
+   }
+   walk_ns = timer_ns() - start;
+
+   start = timer_ns();
+   for (i = 0; i < LOOKUPS; i++)
+   {
+      const uint8_t *p = memmap_translate(space, addrs[i], NULL);
+      sum_table += p ? *p : 0;
+   }
+   table_ns = timer_ns() - start;
+
+   printf("memmap lookup:   descriptors %.2f ns  table %.2f ns  (%.1fx)%s\n",
+         (double)walk_ns / LOOKUPS, (double)table_ns / LOOKUPS,
+         (double)walk_ns / (double)table_ns,
+         sum_walk == sum_table ? "" : "  ※結果不一致");
+
+   /* ヘッダーの TODO: 2 つの len 除去方式は等価か。 */
+   for (len = 1; len < 4096; len++)
+   {
+      size_t addr, limit = 1;
+      while (limit < len)
+         limit <<= 1;
+      for (addr = 0; addr < limit; addr++, checked++)
+         if (bench_len_todo(addr, len) != bench_len_lowest_common(addr, len))
+         {
+            if (!mismatch)
+            {
+               example_addr = addr;
+               example_len  = len;
+            }
+            mismatch++;
+         }
+   }
+   printf("len TODO:        最下位共通ビット方式は %zu / %zu 件で不一致 (例: len=%zu addr=%zu)\n",
+         mismatch, checked, example_len, example_addr);
+
+   start = timer_ns();
+   for (i = 0; i < LOOKUPS; i++)
+      sink += memmap_len_reduce(addrs[i] & 0x1FFF, 0x1800);
+   walk_ns = timer_ns() - start;
+   start = timer_ns();
+   for (i = 0; i < LOOKUPS; i++)
+      sink += bench_len_todo(addrs[i] & 0x1FFF, 0x1800);
+   table_ns = timer_ns() - start;
+   printf("len reduce:      header %.2f ns  TODO %.2f ns  (ページテーブルでは実行時 0 ns)\n",
+         (double)walk_ns / LOOKUPS, (double)table_ns / LOOKUPS);
+
+   free(addrs);
+   memmap_free(&mm);
+   return true;
+}
+
+/* ---- pixconv ---- */
+
+static bool bench_pixconv_size(unsigned width, unsigned height, unsigned iterations)
+{
+   static const enum retro_pixel_format formats[] = {
+      RETRO_PIXEL_FORMAT_RGB565, RETRO_PIXEL_FORMAT_0RGB1555
+   };
+   static const char *format_names[] = { "RGB565", "0RGB1555" };
+   /* pitch がちょうど幅と一致しない場合も扱えることを確かめるため、行末に余白を入れます。 */
+   size_t    src_pitch = width * 2 + 48;
+   size_t    dst_pitch = width * 4 + 64;
+   uint16_t *src = (uint16_t*)malloc(src_pitch * height);
+   uint32_t *dst = (uint32_t*)malloc(dst_pitch * height);
+   uint32_t *ref = (uint32_t*)malloc(dst_pitch * height);
+   uint64_t  simd = cpu_features_ext();
+   unsigned  count, k, f, it;
+   size_t    i, y;
+   const struct pixconv_kernel *kernels = pixconv_kernels(&count);
+   bool ok = src && dst && ref;
+
+   if (!ok)
+      goto end;
+
+   for (i = 0; i < src_pitch * height / 2; i++)
+      src[i] = (uint16_t)bench_rand();
+
+   for (f = 0; f < 2; f++)
+   {
+      pixconv_frame_with(&kernels[count - 1], formats[f],
+            ref, dst_pitch, src, src_pitch, width, height);
+
+      for (k = 0; k < count; k++)
+      {
+         uint64_t start, ns;
+         double   bytes;
+
+         if ((kernels[k].simd & simd) != kernels[k].simd)
+         {
+            printf("pixconv %4ux%-4u %-8s %-6s 非対応\n",
+                  width, height, format_names[f], kernels[k].name);
+            continue;
+         }
+
+         memset(dst, 0, dst_pitch * height);
+         pixconv_frame_with(&kernels[k], formats[f],
+               dst, dst_pitch, src, src_pitch, width, height);
+         for (y = 0; y < height; y++)
+            if (memcmp((uint8_t*)dst + y * dst_pitch, (uint8_t*)ref + y * dst_pitch,
+                     width * sizeof(uint32_t)) != 0)
+            {
+               fprintf(stderr, "pixconv: %s の出力がスカラー版と一致しません\n",
+                     kernels[k].name);
+               ok = false;
+               goto end;
+            }
+
+         start = timer_ns();
+         for (it = 0; it < iterations; it++)
+            pixconv_frame_with(&kernels[k], formats[f],
+                  dst, dst_pitch, src, src_pitch, width, height);
+         ns    = timer_ns() - start;
+         bytes = (double)width * height * (2 + 4) * iterations;
+
+         printf("pixconv %4ux%-4u %-8s %-6s %7.2f GB/s  %8.1f us/frame\n",
+               width, height, format_names[f], kernels[k].name,
+               bytes / (double)ns, ns / 1e3 / iterations);
+      }
+   }
+
+end:
+   free(src);
+   free(dst);
+   free(ref);
+   return ok;
+}
+
+static bool bench_pixconv(void)
+{
+   return bench_pixconv_size(320, 240, 4000)
+       && bench_pixconv_size(1920, 1080, 200);
+}
+
+/* ---- video ---- */
+
+#define BENCH_VIDEO_FRAMES 3000
+
+static bool bench_framehash_size(unsigned width, unsigned height, unsigned iterations)
+{
+   size_t   pitch = (size_t)width * 4 + 64;
+   size_t   bytes = (size_t)width * 4;
+   uint8_t *src   = (uint8_t*)malloc(pitch * height);
+   uint64_t simd  = cpu_features_ext();
+   uint64_t ref, ref_tail;
+   unsigned count, k, it;
+   size_t   i;
+   const struct framehash_kernel *kernels = framehash_kernels(&count);
+   bool ok = src != NULL;
+
+   if (!ok)
+      return false;
+
+   for (i = 0; i < pitch * height; i++)
+      src[i] = (uint8_t)bench_rand();
+   /* 行末の端数も、スカラー版と同じ値になることを確かめます。 */
+   ref      = framehash_frame_with(&kernels[count - 1], src, pitch, bytes, height);
+   ref_tail = framehash_frame_with(&kernels[count - 1], src, pitch, bytes + 20, height);
+
+   for (k = 0; k < count; k++)
+   {
+      uint64_t start, ns;
+
+      if ((kernels[k].simd & simd) != kernels[k].simd)
+      {
+         printf("framehash %4ux%-4u %-6s 非対応\n", width, height, kernels[k].name);
+         continue;
+      }
+
+      if (framehash_frame_with(&kernels[k], src, pitch, bytes + 20, height) != ref_tail)
+         ok = false;
+
+      start = timer_ns();
+      for (it = 0; it < iterations; it++)
+         if (framehash_frame_with(&kernels[k], src, pitch, bytes, height) != ref)
+            ok = false;
+      ns = timer_ns() - start;
+
+      if (!ok)
+      {
+         fprintf(stderr, "framehash: %s の結果がスカラー版と一致しません\n", kernels[k].name);
+         break;
+      }
+
+      printf("framehash %4ux%-4u %-6s %7.2f GB/s  %8.1f us/frame\n",
+            width, height, kernels[k].name,
+            (double)bytes * height * iterations / (double)ns, ns / 1e3 / iterations);
+   }
+
+   /* 1 ピクセルの違いや、ブロックを入れ替えた場合も見分けられることを確かめます。 */
+   if (ok)
+   {
+      uint8_t block[64];
+
+      src[pitch * (height / 2) + 5] ^= 1;
+      if (framehash_frame(src, pitch, bytes, height) == ref)
+         ok = false;
+      src[pitch * (height / 2) + 5] ^= 1;
+
+      memcpy(block, src, 64);
+      memcpy(src, src + 64, 64);
+      memcpy(src + 64, block, 64);
+      if (framehash_frame(src, pitch, bytes, height) == ref)
+         ok = false;
+      if (!ok)
+         fprintf(stderr, "framehash: 違うフレームに同じ値を返しました\n");
+   }
+
+   free(src);
+   return ok;
+}
+
+/* 静止した場面と毎フレーム動く場面で、映像パイプラインにかかる時間を比べます。
+ * convert はすべて変換する場合、hash は NULL を渡さないコアのフレームをハッシュで比べる場合、
+ * NULL は GET_CAN_DUPE に応じたコアが重複フレームに NULL を渡す場合です。 */
+static bool bench_video_scene(enum retro_pixel_format format, bool moving, unsigned mode)
+{
+   static const char *mode_names[] = { "convert", "hash", "NULL" };
+   const unsigned width = 320, height = 240;
+   unsigned bpp   = format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+   size_t   pitch = (size_t)width * bpp;
+   uint8_t *src   = (uint8_t*)malloc(pitch * height);
+   uint64_t start, ns;
+   unsigned f;
+   size_t   i;
+
+   if (!src || !video_init(width, height))
+   {
+      free(src);
+      return false;
+   }
+   for (i = 0; i < pitch * height; i++)
+      src[i] = (uint8_t)bench_rand();
+   video_state.detect_dupes = mode == 1;
+
+   start = timer_ns();
+   for (f = 0; f < BENCH_VIDEO_FRAMES; f++)
+   {
+      /* コアが描き換える分は測りません。 */
+      if (moving)
+         src[(f * 4099) % (pitch * height)]++;
+      video_frame(mode == 2 && !moving && f ? NULL : src, width, height, pitch, format);
+   }
+   ns = timer_ns() - start;
+
+   printf("video %-8s %-6s %-7s %7.1f us/frame  dupe %.2f/frame\n",
+         format == RETRO_PIXEL_FORMAT_XRGB8888 ? "XRGB8888" : "RGB565",
+         moving ? "moving" : "static", mode_names[mode], ns / 1e3 / BENCH_VIDEO_FRAMES,
+         (double)(video_state.stats.dupes + video_state.stats.identical) / BENCH_VIDEO_FRAMES);
+
+   video_free();
+   free(src);
+   return true;
+}
+
+static bool bench_video(void)
+{
+   static const enum retro_pixel_format formats[] = {
+      RETRO_PIXEL_FORMAT_XRGB8888, RETRO_PIXEL_FORMAT_RGB565
+   };
+   unsigned f, mode;
+   bool ok = bench_framehash_size(320, 240, 4000)
+          && bench_framehash_size(1920, 1080, 100);
+
+   for (f = 0; ok && f < 2; f++)
+   {
+      for (mode = 0; ok && mode < 3; mode++)
+         ok = bench_video_scene(formats[f], false, mode);
+      for (mode = 0; ok && mode < 2; mode++)
+         ok = bench_video_scene(formats[f], true, mode);
+   }
+   return ok;
+}
+
+/* ---- tiles ---- */
+
+#define BENCH_TILES_FRAMES  3000
+#define BENCH_TILES_SPRITES 8
+
+/* 各カーネルの印がスカラー版と一致するか、ランダムな位置の 1 バイトの違いで確かめます。
+ * タイルの幅がチャンク (64 バイト) より狭い場合と、割り切れない場合も含めます。 */
+static bool bench_tilediff_check(void)
+{
+   static const size_t tile_widths[] = { 24, 64, 96 };
+   const size_t row_bytes = 1000;
+   uint8_t  ref[1000], src[1000], start[48], want[48];
+   uint64_t simd = cpu_features_ext();
+   unsigned count, k, it;
+   const struct tilediff_kernel *kernels = tilediff_kernels(&count);
+
+   for (it = 0; it < 3000; it++)
+   {
+      size_t   tile_bytes = tile_widths[it % 3];
+      size_t   i;
+      unsigned marked;
+
+      for (i = 0; i < row_bytes; i++)
+         ref[i] = src[i] = (uint8_t)bench_rand();
+      if (it & 1)
+         src[bench_rand() % row_bytes] ^= 0x10;
+      memset(start, 0, sizeof(start));
+      start[bench_rand() % (row_bytes / tile_bytes)] = 1;
+      memcpy(want, start, sizeof(want));
+      marked = kernels[count - 1].row(ref, src, row_bytes, tile_bytes, want);
+
+      for (k = 0; k < count; k++)
+      {
+         uint8_t flags[48];
+
+         if ((kernels[k].simd & simd) != kernels[k].simd)
+            continue;
+         memcpy(flags, start, sizeof(flags));
+         if (kernels[k].row(ref, src, row_bytes, tile_bytes, flags) != marked
+               || memcmp(flags, want, sizeof(flags)) != 0)
+         {
+            fprintf(stderr, "tilediff: %s の印がスカラー版と一致しません\n", kernels[k].name);
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+/* 2D のゲームを真似たフレームを描きます。背景は動かさず、スプライトが動き、
+ * 左上のスコアが 8 フレームに 1 回変わります。scroll なら背景が毎フレーム 1 ピクセル流れます。 */
+static void bench_tiles_draw(uint8_t *frame, const uint8_t *background, unsigned width, unsigned height,
+      unsigned bpp, unsigned f, bool scroll)
+{
+   size_t   pitch = (size_t)width * bpp;
+   unsigned y, i;
+
+   for (y = 0; y < height; y++)
+   {
+      size_t shift = scroll ? (size_t)(f % width) * bpp : 0;
+      memcpy(frame + y * pitch, background + y * pitch + shift, pitch - shift);
+      memcpy(frame + y * pitch + pitch - shift, background + y * pitch, shift);
+   }
+
+   for (i = 0; i < BENCH_TILES_SPRITES; i++)
+   {
+      unsigned sx = (i * 37 + f * (i + 1)) % (width - 16);
+      unsigned sy = (i * 53 + f * (i % 3 + 1)) % (height - 16);
+
+      for (y = 0; y < 16; y++)
+         memset(frame + (sy + y) * pitch + (size_t)sx * bpp, (int)(0x40 + i), 16 * bpp);
+   }
+
+   for (y = 0; y < 8; y++)
+      memset(frame + y * pitch, (int)(f / 8), 48 * bpp);
+}
+
+static bool bench_tiles_scene(enum retro_pixel_format format, unsigned tile, bool scroll)
+{
+   const unsigned width = 320, height = 240;
+   unsigned bpp   = format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+   size_t   pitch = (size_t)width * bpp;
+   uint8_t *background = (uint8_t*)malloc(pitch * height);
+   uint8_t *frame      = (uint8_t*)malloc(pitch * height);
+   uint64_t ns = 0, start;
+   unsigned f;
+   size_t   i;
+   bool ok = background && frame && video_init(width, height);
+
+   if (ok && tile)
+      ok = video_enable_tiles(tile);
+   if (!ok)
+      goto end;
+
+   for (i = 0; i < pitch * height; i++)
+      background[i] = (uint8_t)bench_rand();
+   video_state.detect_dupes = false;
+
+   for (f = 0; f < BENCH_TILES_FRAMES; f++)
+   {
+      /* コアが描く分は測りません。 */
+      bench_tiles_draw(frame, background, width, height, bpp, f, scroll);
+      start = timer_ns();
+      video_frame(frame, width, height, pitch, format);
+      ns   += timer_ns() - start;
+
+      /* 変わったタイルだけを変換した出力が、フレーム全体を変換したものと一致することを確かめます。 */
+      if (tile && f % 500 == 499)
+      {
+         uint32_t *ref = (uint32_t*)malloc((size_t)width * height * 4);
+         if (!ref)
+         {
+            ok = false;
+            break;
+         }
+         pixconv_frame(format, ref, (size_t)width * 4, frame, pitch, width, height);
+         for (i = 0; i < height; i++)
+            if (memcmp(ref + i * width, (uint8_t*)video_state.output + i * video_state.output_pitch,
+                     (size_t)width * 4) != 0)
+               ok = false;
+         free(ref);
+         if (!ok)
+         {
+            fprintf(stderr, "tiles: フレーム %u の出力がフレーム全体の変換と一致しません\n", f);
+            break;
+         }
+      }
+   }
+
+   if (ok)
+   {
+      const struct video_stats *vs = &video_state.stats;
+      printf("tiles %-8s %-6s %-5s %6.1f us/frame  processed %6.1f KB/frame of %5.1f KB",
+            format == RETRO_PIXEL_FORMAT_XRGB8888 ? "XRGB8888" : "RGB565",
+            scroll ? "scroll" : "sprite", tile ? (tile == 16 ? "16px" : "32px") : "full",
+            ns / 1e3 / BENCH_TILES_FRAMES, vs->bytes_in / 1024.0 / BENCH_TILES_FRAMES,
+            pitch * height / 1024.0);
+      if (tile)
+         printf("  dirty %5.1f/%.0f tiles  %.1f rects",
+               (double)vs->dirty_tiles / BENCH_TILES_FRAMES, (double)vs->tiles / BENCH_TILES_FRAMES,
+               (double)vs->rects / BENCH_TILES_FRAMES);
+      printf("\n");
+   }
+
+end:
+   video_free();
+   free(background);
+   free(frame);
+   return ok;
+}
+
+static bool bench_tiles(void)
+{
+   static const enum retro_pixel_format formats[] = {
+      RETRO_PIXEL_FORMAT_XRGB8888, RETRO_PIXEL_FORMAT_RGB565
+   };
+   static const unsigned tiles[] = { 0, 16, 32 };
+   unsigned f, t, scroll;
+   bool ok = bench_tilediff_check();
+
+   for (f = 0; ok && f < 2; f++)
+      for (scroll = 0; ok && scroll < 2; scroll++)
+         for (t = 0; ok && t < 3; t++)
+            ok = bench_tiles_scene(formats[f], tiles[t], scroll);
+   return ok;
+}
+
+/* ---- audiosample ---- */
+
+#define BENCH_AUDIO_FRAMES_PER_RUN 800     /* 48 kHz / 60 fps */
+#define BENCH_AUDIO_RUNS           20000
+
+static struct audio_ring bench_audio_ring;
+
+static size_t bench_audio_sink(const int16_t *data, size_t frames)
+{
+   return audio_ring_write(&bench_audio_ring, data, frames);
+}
+
+/* 合成しない場合: 1 フレームごとにリングへ書きます。 */
+static void RETRO_CALLCONV bench_audio_sample_direct(int16_t left, int16_t right)
+{
+   int16_t frame[2];
+   frame[0] = left;
+   frame[1] = right;
+   audio_ring_write(&bench_audio_ring, frame, 1);
+}
+
+static void RETRO_CALLCONV bench_audio_sample_block(int16_t left, int16_t right)
+{
+   audio_block_sample(left, right, bench_audio_sink);
+}
+
+static size_t RETRO_CALLCONV bench_audio_sample_batch(const int16_t *data, size_t frames)
+{
+   audio_block_flush(bench_audio_sink);
+   return bench_audio_sink(data, frames);
+}
+
+/* コアの 1 フレーム分を mode で生成し、リングから読み出して中身を確かめます。
+ * mode: 0 = 1 フレームずつ直接, 1 = ブロックに合成, 2 = コアがバッチで渡す */
+static bool bench_audio_run(unsigned mode, unsigned runs, uint64_t *ns)
+{
+   retro_audio_sample_t volatile       sample = mode == 0
+      ? bench_audio_sample_direct : bench_audio_sample_block;
+   retro_audio_sample_batch_t volatile batch  = bench_audio_sample_batch;
+   static int16_t in[BENCH_AUDIO_FRAMES_PER_RUN * 2];
+   static int16_t out[BENCH_AUDIO_FRAMES_PER_RUN * 2];
+   unsigned run, i;
+
+   *ns = 0;
+   for (run = 0; run < runs; run++)
+   {
+      uint64_t start;
+
+      for (i = 0; i < BENCH_AUDIO_FRAMES_PER_RUN * 2; i++)
+         in[i] = (int16_t)(run * 31 + i);
+
+      start = timer_ns();
+      if (mode == 2)
+         batch(in, BENCH_AUDIO_FRAMES_PER_RUN);
+      else
+      {
+         for (i = 0; i < BENCH_AUDIO_FRAMES_PER_RUN; i++)
+            sample(in[i * 2 + 0], in[i * 2 + 1]);
+         audio_block_flush(bench_audio_sink);
+      }
+      *ns += timer_ns() - start;
+
+      if (audio_ring_read(&bench_audio_ring, out, BENCH_AUDIO_FRAMES_PER_RUN)
+               != BENCH_AUDIO_FRAMES_PER_RUN
+            || memcmp(in, out, sizeof(in)) != 0)
+      {
+         fprintf(stderr, "audiosample: モード %u の出力が入力と一致しません\n", mode);
+         return false;
+      }
+   }
+   return true;
+}
+
+static bool bench_audiosample(void)
+{
+   static const char *names[] = { "per-sample", "coalesced", "batch" };
+   uint64_t ns[3];
+   unsigned mode;
+   bool ok = true;
+
+   if (!audio_ring_init(&bench_audio_ring, BENCH_AUDIO_FRAMES_PER_RUN * 2))
+      return false;
+
+   for (mode = 0; mode < 3 && ok; mode++)
+   {
+      uint64_t flushes = audio_block.flushes;
+      double   frames  = (double)BENCH_AUDIO_FRAMES_PER_RUN * BENCH_AUDIO_RUNS;
+
+      ok = bench_audio_run(mode, BENCH_AUDIO_RUNS / 10, &ns[mode])
+        && bench_audio_run(mode, BENCH_AUDIO_RUNS, &ns[mode]);
+      if (!ok)
+         break;
+
+      printf("audiosample %-10s %8.1f Mframes/s  %6.2f ns/frame  %7.1f us/run  "
+            "%.2f blocks/run  %.2fx\n",
+            names[mode], frames / (double)ns[mode] * 1e3,
+            (double)ns[mode] / frames, ns[mode] / 1e3 / BENCH_AUDIO_RUNS,
+            (double)(audio_block.flushes - flushes) / (BENCH_AUDIO_RUNS + BENCH_AUDIO_RUNS / 10),
+            (double)ns[0] / (double)ns[mode]);
+   }
+
+   audio_ring_free(&bench_audio_ring);
+   return ok;
+}
+
+/* ---- input ---- */
+
+#define BENCH_INPUT_QUERIES 4096
+#define BENCH_INPUT_ROUNDS  2000
+
+struct bench_input_query
+{
+   unsigned port, device, index, id;
+};
+
+static bool bench_input(void)
+{
+   static struct bench_input_query queries[BENCH_INPUT_QUERIES];
+   static const unsigned devices[] = {
+      RETRO_DEVICE_JOYPAD, RETRO_DEVICE_JOYPAD, RETRO_DEVICE_JOYPAD, RETRO_DEVICE_ANALOG,
+      RETRO_DEVICE_MOUSE, RETRO_DEVICE_KEYBOARD, RETRO_DEVICE_LIGHTGUN, RETRO_DEVICE_POINTER
+   };
+   retro_input_state_t volatile fns[2] = { input_query, input_state };
+   static const char *names[2] = { "query", "snapshot" };
+   unsigned port, device, index, id, i, round, f;
+   uint64_t ns[2];
+
+   input_set_synthetic(true);
+
+   /* 範囲外も含めて、スナップショットが入力層と同じ答えを返すことを確かめます。 */
+   for (i = 0; i < 64; i++)
+   {
+      input_poll();
+      for (port = 0; port < INPUT_MAX_PORTS + 2; port++)
+         for (device = 0; device < 10; device++)
+            for (index = 0; index < 5; index++)
+               for (id = 0; id < RETROK_LAST + 2; id++)
+               {
+                  unsigned qid = id == RETROK_LAST + 1 ? RETRO_DEVICE_ID_JOYPAD_MASK : id;
+                  if (input_state(port, device, index, qid)
+                        != input_query(port, device, index, qid))
+                  {
+                     fprintf(stderr, "input: (%u, %u, %u, %u) の答えが入力層と一致しません\n",
+                           port, device, index, qid);
+                     input_set_synthetic(false);
+                     return false;
+                  }
+               }
+   }
+
+   /* コアらしい問い合わせの混ざり方: パッドのボタンが多く、ときどき他のデバイス。 */
+   for (i = 0; i < BENCH_INPUT_QUERIES; i++)
+   {
+      queries[i].port   = bench_rand() % 2;
+      queries[i].device = devices[bench_rand() % 8];
+      queries[i].index  = queries[i].device == RETRO_DEVICE_ANALOG ? bench_rand() % 3 : 0;
+      queries[i].id     = queries[i].device == RETRO_DEVICE_KEYBOARD
+         ? bench_rand() % RETROK_LAST : bench_rand() % 16;
+   }
+
+   for (f = 0; f < 2; f++)
+   {
+      retro_input_state_t fn = fns[f];
+      volatile int16_t sink  = 0;
+      uint64_t start         = timer_ns();
+
+      for (round = 0; round < BENCH_INPUT_ROUNDS; round++)
+      {
+         if (f == 1)
+            input_poll();
+         for (i = 0; i < BENCH_INPUT_QUERIES; i++)
+            sink += fn(queries[i].port, queries[i].device, queries[i].index, queries[i].id);
+      }
+      ns[f] = timer_ns() - start;
+      (void)sink;
+
+      printf("input %-8s %6.2f ns/call  %.2fx\n", names[f],
+            (double)ns[f] / ((double)BENCH_INPUT_QUERIES * BENCH_INPUT_ROUNDS),
+            (double)ns[0] / (double)ns[f]);
+   }
+
+   input_set_synthetic(false);
+   return true;
+}
+
+/* ---- vfs ---- */
+
+#define BENCH_VFS_SECTOR        2352          /* CD-ROM の生セクタ */
+#define BENCH_VFS_CHUNK         (64 * 1024)
+#define BENCH_VFS_RANDOM_READS  200000
+#define BENCH_VFS_DEFAULT_MB    2048
+
+enum bench_vfs_pattern
+{
+   BENCH_VFS_SEQ_CHUNK = 0,
+   BENCH_VFS_SEQ_SECTOR,
+   BENCH_VFS_RANDOM_SECTOR,
+   BENCH_VFS_PATTERNS
+};
+
+/* ディスクイメージの代わりに、1 MB ごとに先頭を書き換えた乱数のファイルを作ります。 */
+static bool bench_vfs_create(const char *path, uint64_t size)
+{
+   uint8_t *buf = (uint8_t*)malloc(1 << 20);
+   FILE    *fp  = fopen(path, "wb");
+   uint64_t mb;
+   size_t   i;
+   bool     ok  = buf && fp;
+
+   for (i = 0; ok && i < (1 << 20); i += 4)
+   {
+      uint32_t r = bench_rand();
+      memcpy(buf + i, &r, 4);
+   }
+
+   for (mb = 0; ok && mb < size >> 20; mb++)
+   {
+      memcpy(buf, &mb, sizeof(mb));
+      ok = fwrite(buf, 1, 1 << 20, fp) == 1 << 20;
+   }
+
+   if (fp && fclose(fp) != 0)
+      ok = false;
+   free(buf);
+   return ok;
+}
+
+/* 読み込みの合間にコアのエミュレーションを模して回す時間と、その読み込みの量。
+ * 実際の CD (2 倍速で 1 秒に 150 セクタ) よりずっと詰めてあり、
+ * それでもディスクの帯域 (約 1 GB/s) を下回る消費速度にしてあります。 */
+#define BENCH_VFS_WORK_NS   4000
+#define BENCH_VFS_PACED_MB  512
+
+static void bench_vfs_work(void)
+{
+   uint64_t until = timer_ns() + BENCH_VFS_WORK_NS;
+   while (timer_ns() < until)
+      ;
+}
+
+/* 読んだデータの検算として、各読み込みの先頭 8 バイトを足し合わせます。
+ * paced なら読み込みの合間に bench_vfs_work() を挟み、read の中にいた時間を stall_ns に返します。 */
+static bool bench_vfs_pass(const char *path, unsigned pattern, bool paced, const uint64_t *offsets,
+      uint64_t *ns, uint64_t *stall_ns, uint64_t *reads, uint64_t *bytes, uint64_t *checksum)
+{
+   static uint8_t buf[BENCH_VFS_CHUNK];
+   unsigned hints = pattern == BENCH_VFS_RANDOM_SECTOR
+      ? RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS : RETRO_VFS_FILE_ACCESS_HINT_NONE;
+   size_t   len   = pattern == BENCH_VFS_SEQ_CHUNK ? BENCH_VFS_CHUNK : BENCH_VFS_SECTOR;
+   uint64_t start = timer_ns();
+   uint64_t sum   = 0;
+   unsigned i     = 0;
+   struct retro_vfs_file_handle *stream = vfs_open(path, RETRO_VFS_FILE_ACCESS_READ, hints);
+
+   *reads    = 0;
+   *bytes    = 0;
+   *stall_ns = 0;
+   if (!stream)
+      return false;
+
+   for (;;)
+   {
+      uint64_t word, t0;
+      int64_t  n;
+
+      if (paced && *bytes >= ((uint64_t)BENCH_VFS_PACED_MB << 20))
+         break;
+      if (pattern == BENCH_VFS_RANDOM_SECTOR)
+      {
+         if (i == BENCH_VFS_RANDOM_READS)
+            break;
+         vfs_seek(stream, (int64_t)offsets[i++], RETRO_VFS_SEEK_POSITION_START);
+      }
+
+      t0 = paced ? timer_ns() : 0;
+      if ((n = vfs_read(stream, buf, len)) <= 0)
+         break;
+      if (paced)
+      {
+         *stall_ns += timer_ns() - t0;
+         bench_vfs_work();
+      }
+
+      memcpy(&word, buf, sizeof(word));
+      sum    += word;
+      *bytes += (uint64_t)n;
+      (*reads)++;
+   }
+
+   vfs_close(stream);
+   *ns       = timer_ns() - start;
+   *checksum = sum;
+   return true;
+}
+
+/* ページキャッシュから追い出し、次のパスをディスクから読ませます。 */
+static void bench_vfs_drop_cache(const char *path)
+{
+   int fd = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return;
+   fdatasync(fd);
+   posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+   close(fd);
+}
+
+#define BENCH_VFS_BACKENDS 4
+
+static bool bench_vfs(void)
+{
+   static const char *pattern_names[BENCH_VFS_PATTERNS] = { "seq-64K", "seq-2352", "rand-2352" };
+   static const char *backend_names[BENCH_VFS_BACKENDS] = { "mmap", "pread", "uring", "threads" };
+   const char *env_mb  = getenv("RETROBENCH_VFS_MB");
+   const char *tmpdir  = getenv("TMPDIR");
+   uint64_t    size    = (uint64_t)(env_mb ? strtoull(env_mb, NULL, 0) : BENCH_VFS_DEFAULT_MB) << 20;
+   uint64_t   *offsets = (uint64_t*)malloc(BENCH_VFS_RANDOM_READS * sizeof(*offsets));
+   uint64_t    ns, stall_ns, reads, bytes, sums[BENCH_VFS_BACKENDS];
+   unsigned    pattern, backend, i;
+   char        path[1024];
+   bool        ok = offsets != NULL;
+
+   snprintf(path, sizeof(path), "%s/retrobench-vfs-%ld.bin", tmpdir ? tmpdir : "/tmp", (long)getpid());
+
+   if (ok && (size < (1 << 20) || !bench_vfs_create(path, size)))
+   {
+      fprintf(stderr, "vfs: %s に %llu MB のファイルを作れません\n",
+            path, (unsigned long long)(size >> 20));
+      ok = false;
+   }
+
+   for (i = 0; ok && i < BENCH_VFS_RANDOM_READS; i++)
+      offsets[i] = (((uint64_t)bench_rand() << 32) | bench_rand())
+         % (size / BENCH_VFS_SECTOR) * BENCH_VFS_SECTOR;
+
+   printf("vfs image %llu MB (RETROBENCH_VFS_MB で変更できます)\n",
+         (unsigned long long)(size >> 20));
+
+   /* CD のコアのように、ディスクから小さな順次読み込みを繰り返しながら合間に計算する場合。
+    * stall は read の中で待っていた時間で、先読みが計算と重なるほど小さくなります。 */
+   for (backend = 0; ok && backend < BENCH_VFS_BACKENDS; backend++)
+   {
+      struct vfs_stats before, after;
+
+      bench_vfs_drop_cache(path);
+      vfs_set_backend((enum vfs_backend)backend);
+      vfs_get_stats(&before);
+      ok = bench_vfs_pass(path, BENCH_VFS_SEQ_SECTOR, true, offsets,
+            &ns, &stall_ns, &reads, &bytes, &sums[backend]);
+      vfs_get_stats(&after);
+      printf("vfs %-9s %-7s cold %7.2f GB/s  stall %8.1f ns/read  %5.1f%% of run",
+            pattern_names[BENCH_VFS_SEQ_SECTOR], backend_names[backend],
+            (double)bytes / (double)ns, (double)stall_ns / (double)reads,
+            100.0 * (double)stall_ns / (double)ns);
+      if (after.cached > before.cached)
+         printf("  (%s, miss %llu wait %llu)",
+               after.cached_uring > before.cached_uring ? "io_uring" : "thread pool",
+               (unsigned long long)(after.cache_misses - before.cache_misses),
+               (unsigned long long)(after.cache_waits - before.cache_waits));
+      printf("\n");
+   }
+
+   /* 以降はページキャッシュに載った状態での比較です。全体を 1 度読んで載せておきます。 */
+   vfs_set_backend(VFS_BACKEND_PREAD);
+   if (ok)
+      ok = bench_vfs_pass(path, BENCH_VFS_SEQ_CHUNK, false, offsets,
+            &ns, &stall_ns, &reads, &bytes, &sums[0]);
+
+   for (pattern = 0; ok && pattern < BENCH_VFS_PATTERNS; pattern++)
+   {
+      for (backend = 0; ok && backend < BENCH_VFS_BACKENDS; backend++)
+      {
+         vfs_set_backend((enum vfs_backend)backend);
+         ok = bench_vfs_pass(path, pattern, false, offsets,
+               &ns, &stall_ns, &reads, &bytes, &sums[backend]);
+         printf("vfs %-9s %-7s warm %7.2f GB/s  %8.1f ns/read\n", pattern_names[pattern],
+               backend_names[backend], (double)bytes / (double)ns, (double)ns / (double)reads);
+
+         if (ok && sums[backend] != sums[0])
+         {
+            fprintf(stderr, "vfs: %s で %s と %s の読んだ内容が一致しません\n",
+                  pattern_names[pattern], backend_names[backend], backend_names[0]);
+            ok = false;
+         }
+      }
+   }
+
+   vfs_set_backend(VFS_BACKEND_MMAP);
+   remove(path);
+   free(offsets);
+   return ok;
+}
+
+/* ---- content ---- */
+
+#define BENCH_CONTENT_DEFAULT_MB  64
+#define BENCH_CONTENT_MEMBER      "game.bin"
+
+static void bench_put16(uint8_t *p, uint32_t v)
+{
+   p[0] = (uint8_t)v;
+   p[1] = (uint8_t)(v >> 8);
+}
+
+static void bench_put32(uint8_t *p, uint32_t v)
+{
+   bench_put16(p, v);
+   bench_put16(p + 2, v >> 16);
+}
+
+/* data を deflate で圧縮し、メンバーが 1 つだけの zip として書き出します。 */
+static bool bench_content_zip(const char *path, const uint8_t *data, size_t size)
+{
+   uint8_t  local[30], central[46], eocd[22];
+   size_t   name_len = strlen(BENCH_CONTENT_MEMBER);
+   uLong    bound    = compressBound((uLong)size);
+   uint8_t *packed   = (uint8_t*)malloc(bound);
+   uint32_t crc      = (uint32_t)crc32(0, data, (uInt)size);
+   z_stream z;
+   FILE    *fp;
+   bool     ok;
+
+   if (!packed)
+      return false;
+
+   memset(&z, 0, sizeof(z));
+   ok = deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+   if (ok)
+   {
+      z.next_in   = (Bytef*)data;
+      z.avail_in  = (uInt)size;
+      z.next_out  = packed;
+      z.avail_out = (uInt)bound;
+      ok = deflate(&z, Z_FINISH) == Z_STREAM_END;
+      deflateEnd(&z);
+   }
+
+   memset(local, 0, sizeof(local));
+   bench_put32(local, 0x04034b50);
+   bench_put16(local + 4, 20);
+   bench_put16(local + 8, 8);
+   bench_put32(local + 14, crc);
+   bench_put32(local + 18, (uint32_t)z.total_out);
+   bench_put32(local + 22, (uint32_t)size);
+   bench_put16(local + 26, (uint32_t)name_len);
+
+   memset(central, 0, sizeof(central));
+   bench_put32(central, 0x02014b50);
+   bench_put16(central + 4, 20);
+   memcpy(central + 6, local + 4, 26);
+   bench_put32(central + 42, 0);
+
+   memset(eocd, 0, sizeof(eocd));
+   bench_put32(eocd, 0x06054b50);
+   bench_put16(eocd + 8, 1);
+   bench_put16(eocd + 10, 1);
+   bench_put32(eocd + 12, (uint32_t)(sizeof(central) + name_len));
+   bench_put32(eocd + 16, (uint32_t)(sizeof(local) + name_len + z.total_out));
+
+   fp = ok ? fopen(path, "wb") : NULL;
+   ok = fp
+      && fwrite(local, 1, sizeof(local), fp) == sizeof(local)
+      && fwrite(BENCH_CONTENT_MEMBER, 1, name_len, fp) == name_len
+      && fwrite(packed, 1, z.total_out, fp) == z.total_out
+      && fwrite(central, 1, sizeof(central), fp) == sizeof(central)
+      && fwrite(BENCH_CONTENT_MEMBER, 1, name_len, fp) == name_len
+      && fwrite(eocd, 1, sizeof(eocd), fp) == sizeof(eocd);
+   if (fp && fclose(fp) != 0)
+      ok = false;
+
+   free(packed);
+   return ok;
+}
+
+/* プロセスの匿名メモリ (ヒープなど) の常駐量。ファイルのマッピングは含みません。 */
+static long bench_rss_anon_kb(void)
+{
+   char  line[256];
+   long  kb = -1;
+   FILE *fp = fopen("/proc/self/status", "r");
+
+   if (!fp)
+      return -1;
+   while (fgets(line, sizeof(line), fp))
+      if (sscanf(line, "RssAnon: %ld kB", &kb) == 1)
+         break;
+   fclose(fp);
+   return kb;
+}
+
+/* コンテンツを開き、コアが retro_load_game() でするように全体を 1 度読んでから閉じます。
+ * 読み終えた時点で増えていた匿名メモリを anon_kb に返します。 */
+static bool bench_content_load(const char *path, const struct retro_system_info *system,
+      uint64_t *ns, uint64_t *sum, long *anon_kb, struct content_stats *stats,
+      char *cached, size_t cached_size)
+{
+   struct content content;
+   const uint64_t *p;
+   long     anon  = bench_rss_anon_kb();
+   uint64_t start = timer_ns();
+   size_t   i;
+
+   if (!content_open(&content, path, system))
+      return false;
+
+   *sum = 0;
+   p    = (const uint64_t*)content.info.data;
+   for (i = 0; i < content.info.size / 8; i++)
+      *sum += p[i];
+   *ns      = timer_ns() - start;
+   *anon_kb = bench_rss_anon_kb() - anon;
+   *stats   = content.stats;
+   if (cached)
+      snprintf(cached, cached_size, "%s", content.ext.full_path ? content.ext.full_path : "");
+
+   content_close(&content);
+   return true;
+}
+
+enum bench_content_source
+{
+   BENCH_CONTENT_PLAIN = 0,
+   BENCH_CONTENT_ZIP,
+   BENCH_CONTENT_CACHED
+};
+
+struct bench_content_pass
+{
+   const char *kind;
+   const char *state;
+   enum bench_content_source source;
+   bool drop;          /* 読む前にページキャッシュから落とす */
+   bool persistent;    /* SET_CONTENT_INFO_OVERRIDE で persistent_data を指定したコア */
+};
+
+static bool bench_content(void)
+{
+   /* cold はページキャッシュから落としてからの読み込みです。extract は初回の起動に当たります。
+    * キャッシュディレクトリはこのプロセス専用なので、最初の archive は必ず展開になります。 */
+   static const struct bench_content_pass passes[] = {
+      { "file",    "cold",        BENCH_CONTENT_PLAIN,  true,  false },
+      { "file",    "warm",        BENCH_CONTENT_PLAIN,  false, false },
+      { "file",    "persist cold", BENCH_CONTENT_PLAIN, true,  true  },
+      { "file",    "persist warm", BENCH_CONTENT_PLAIN, false, true  },
+      { "archive", "extract",     BENCH_CONTENT_ZIP,    true,  false },
+      { "archive", "cached cold", BENCH_CONTENT_CACHED, true,  false },
+      { "archive", "cached warm", BENCH_CONTENT_CACHED, false, false },
+   };
+   static const struct retro_system_content_info_override persistent[] = {
+      { "bin", false, true },
+      { NULL, false, false }
+   };
+   static const struct retro_system_content_info_override none[] = {
+      { NULL, false, false }
+   };
+   struct retro_system_info system;
+   struct content_stats stats;
+   const char *env_mb = getenv("RETROBENCH_CONTENT_MB");
+   const char *tmpdir = getenv("TMPDIR");
+   size_t   size = (size_t)(env_mb ? strtoull(env_mb, NULL, 0) : BENCH_CONTENT_DEFAULT_MB) << 20;
+   uint8_t *data = (uint8_t*)malloc(size);
+   uint64_t ns, sum, file_sum = 0, file_ns = 0;
+   long     anon_kb;
+   char     plain[1024], zip[1024], dir[1024], cached[4096];
+   unsigned pass;
+   size_t   i;
+   FILE    *fp;
+   bool     ok = data != NULL && size > 0;
+
+   memset(&system, 0, sizeof(system));
+   system.valid_extensions = "bin";
+   cached[0] = '\0';
+
+   snprintf(plain, sizeof(plain), "%s/retrobench-content-%ld.bin", tmpdir ? tmpdir : "/tmp", (long)getpid());
+   snprintf(zip, sizeof(zip), "%s/retrobench-content-%ld.zip", tmpdir ? tmpdir : "/tmp", (long)getpid());
+   snprintf(dir, sizeof(dir), "%s/retrobench-content-%ld", tmpdir ? tmpdir : "/tmp", (long)getpid());
+   content_set_cache_dir(dir);
+
+   /* ROM のようにほどほどに縮むデータとして、1 バイトあたり 4 ビットの乱数にします。 */
+   for (i = 0; ok && i < size; i++)
+      data[i] = (uint8_t)(bench_rand() >> 28);
+
+   fp = ok ? fopen(plain, "wb") : NULL;
+   ok = fp && fwrite(data, 1, size, fp) == size;
+   if (fp && fclose(fp) != 0)
+      ok = false;
+   if (ok)
+      ok = bench_content_zip(zip, data, size);
+   free(data);
+   if (!ok)
+   {
+      fprintf(stderr, "content: %s に %zu MB のコンテンツを作れません\n", plain, size >> 20);
+      remove(plain);
+      remove(zip);
+      return false;
+   }
+
+   printf("content %zu MB (RETROBENCH_CONTENT_MB で変更できます)  zip %s\n", size >> 20, zip);
+
+   for (pass = 0; ok && pass < sizeof(passes) / sizeof(passes[0]); pass++)
+   {
+      const struct bench_content_pass *p = &passes[pass];
+      const char *path = p->source == BENCH_CONTENT_PLAIN ? plain : zip;
+
+      if (p->drop)
+         bench_vfs_drop_cache(p->source == BENCH_CONTENT_PLAIN ? plain
+               : p->source == BENCH_CONTENT_ZIP ? zip : cached);
+      content_set_override(p->persistent ? persistent : none);
+
+      ok = bench_content_load(path, &system, &ns, &sum, &anon_kb, &stats,
+            p->source == BENCH_CONTENT_PLAIN ? NULL : cached, sizeof(cached));
+      if (!ok)
+         break;
+      if (pass == 0)
+      {
+         file_ns  = ns;
+         file_sum = sum;
+      }
+
+      printf("content %-7s %-12s %8.2f ms  %6.2f GB/s  x%.2f of file cold  anon %+6.1f MB%s\n",
+            p->kind, p->state, ns / 1e6, (double)size / (double)ns,
+            (double)ns / (double)file_ns, anon_kb / 1024.0, stats.mapped ? "  (mmap)" : "");
+
+      if (sum != file_sum)
+      {
+         fprintf(stderr, "content: %s %s の内容が file と一致しません\n", p->kind, p->state);
+         ok = false;
+      }
+      if (p->source != BENCH_CONTENT_PLAIN && stats.cache_hit != (p->source == BENCH_CONTENT_CACHED))
+      {
+         fprintf(stderr, "content: %s でキャッシュの状態が想定と違います\n", p->state);
+         ok = false;
+      }
+   }
+
+   if (cached[0])
+      remove(cached);
+   rmdir(dir);
+   remove(plain);
+   remove(zip);
+   content_set_override(none);
+   content_set_cache_dir(NULL);
+   return ok;
+}
+
+/* ---- options ---- */
+
+#define BENCH_OPTIONS_MAX     256
+#define BENCH_OPTIONS_ROUNDS  20000
+
+/* 以前のフロントエンドと同じ、定義の配列を先頭から strcmp() で探す方式です。 */
+static const char *bench_options_linear(const struct retro_core_option_definition *defs,
+      const char *key)
+{
+   for (; defs->key; defs++)
+      if (strcmp(defs->key, key) == 0)
+         return defs->default_value;
+   return NULL;
+}
+
+static bool bench_options(void)
+{
+   static const unsigned counts[] = { 8, 32, 128, 256 };
+   struct retro_core_option_definition *defs =
+      (struct retro_core_option_definition*)calloc(BENCH_OPTIONS_MAX + 1, sizeof(*defs));
+   char    (*keys)[64] = (char(*)[64])malloc(BENCH_OPTIONS_MAX * 64);
+   const char *volatile sink;
+   struct retro_variable var;
+   uint64_t start, linear_ns, hash_ns, update_ns;
+   unsigned c, i, r;
+   bool     ok = defs && keys;
+
+   /* 実際のコアのように、長い共通の接頭辞を持つキーにします。 */
+   for (i = 0; ok && i < BENCH_OPTIONS_MAX; i++)
+      snprintf(keys[i], sizeof(keys[i]), "retrobench_core_video_option_%03u", i);
+
+   for (c = 0; ok && c < sizeof(counts) / sizeof(counts[0]); c++)
+   {
+      unsigned n = counts[c];
+
+      memset(defs, 0, (BENCH_OPTIONS_MAX + 1) * sizeof(*defs));
+      for (i = 0; i < n; i++)
+      {
+         defs[i].key             = keys[i];
+         defs[i].desc            = keys[i];
+         defs[i].values[0].value = "disabled";
+         defs[i].values[1].value = "enabled";
+         defs[i].default_value   = "enabled";
+      }
+      ok = options_set_definitions(defs);
+
+      /* コアが retro_run() ごとに check_variables() で全オプションを読む場合を真似ます。 */
+      start = timer_ns();
+      for (r = 0; ok && r < BENCH_OPTIONS_ROUNDS; r++)
+         for (i = 0; i < n; i++)
+            sink = bench_options_linear(defs, keys[i]);
+      linear_ns = timer_ns() - start;
+
+      start = timer_ns();
+      for (r = 0; ok && r < BENCH_OPTIONS_ROUNDS; r++)
+         for (i = 0; i < n; i++)
+         {
+            var.key = keys[i];
+            options_get(&var);
+            sink = var.value;
+            if (!sink)
+               ok = false;
+         }
+      hash_ns = timer_ns() - start;
+
+      start = timer_ns();
+      for (r = 0; ok && r < BENCH_OPTIONS_ROUNDS * 16; r++)
+         if (options_poll_update())
+            sink = NULL;
+      update_ns = timer_ns() - start;
+
+      printf("options %3u keys  linear %7.1f ns/get  perfect hash %6.1f ns/get  (x%.1f)  "
+            "%8.1f ns/frame  variable_update %.1f ns\n", n,
+            (double)linear_ns / ((double)BENCH_OPTIONS_ROUNDS * n),
+            (double)hash_ns / ((double)BENCH_OPTIONS_ROUNDS * n),
+            (double)linear_ns / (double)hash_ns,
+            (double)hash_ns / BENCH_OPTIONS_ROUNDS,
+            (double)update_ns / (BENCH_OPTIONS_ROUNDS * 16.0));
+   }
+
+   /* 登録されていないキーは strcmp() 1 回で落ちることを確かめます。 */
+   var.key = "retrobench_core_video_option_missing";
+   if (ok && options_get(&var))
+      ok = false;
+
+   memset(&options_stats, 0, sizeof(options_stats));
+   free(defs);
+   free(keys);
+   return ok;
+}
+
+/* ---- log ---- */
+
+#define BENCH_LOG_FRAMES   2000
+#define BENCH_LOG_BURST    32      /* retro_run() 1 回の中で出すメッセージ数 */
+#define BENCH_LOG_THREADS  4
+
+/* コアがフレームの中で出しそうな DEBUG メッセージ。 */
+static void bench_log_message(unsigned i)
+{
+   logger_printf(RETRO_LOG_DEBUG, "[core] frame %u pc=%08x line %3d %s %.3f ms\n",
+         i / BENCH_LOG_BURST, i * 4, (int)(i % 262), (i & 1) ? "vblank" : "hblank", i * 0.016);
+}
+
+/* フレームごとに BENCH_LOG_BURST 件を出した時間の合計を返します。
+ * wait なら、次のフレームまでに出力スレッドが書き終える (別のコアで動く) 場合を真似ます。 */
+static uint64_t bench_log_frames(bool wait)
+{
+   uint64_t total = 0;
+   unsigned f, i;
+
+   for (f = 0; f < BENCH_LOG_FRAMES; f++)
+   {
+      uint64_t start = timer_ns();
+      for (i = 0; i < BENCH_LOG_BURST; i++)
+         bench_log_message(f * BENCH_LOG_BURST + i);
+      total += timer_ns() - start;
+
+      if (wait)
+         logger_flush();
+   }
+   return total;
+}
+
+static void *bench_log_thread(void *arg)
+{
+   unsigned i;
+   (void)arg;
+
+   for (i = 0; i < BENCH_LOG_FRAMES * BENCH_LOG_BURST / BENCH_LOG_THREADS; i++)
+      bench_log_message(i);
+   return NULL;
+}
+
+static bool bench_log(void)
+{
+   const double count = (double)BENCH_LOG_FRAMES * BENCH_LOG_BURST;
+   pthread_t threads[BENCH_LOG_THREADS];
+   struct logger_stats stats;
+   uint64_t sync_ns, async_ns, limited_ns;
+   unsigned i;
+   bool ok = true;
+   /* stderr と同じくバッファなしにして、1 件ごとに write() させます。 */
+   FILE *out = fopen("/dev/null", "w");
+
+   if (!out)
+      return false;
+   setvbuf(out, NULL, _IONBF, 0);
+
+   logger_configure(out, RETRO_LOG_DEBUG, 0);
+   sync_ns = bench_log_frames(false);
+
+   if (!logger_start())
+   {
+      fclose(out);
+      return false;
+   }
+   logger_reset_stats();
+   async_ns = bench_log_frames(true);
+   logger_flush();
+   logger_get_stats(&stats);
+   if (stats.messages[RETRO_LOG_DEBUG] != (uint64_t)count || stats.written != (uint64_t)count)
+      ok = false;
+
+   printf("log sync     %7.1f ns/msg  (整形と write() を呼び出したスレッドで行う)\n",
+         (double)sync_ns / count);
+   printf("log async    %7.1f ns/msg  出力スレッド %.1f ns/msg  (x%.1f)  written %llu\n",
+         (double)async_ns / count, (double)stats.write_ns / count,
+         (double)sync_ns / (double)async_ns, (unsigned long long)stats.written);
+
+   /* 上限を超えたメッセージは時刻を読んで数えるだけで捨てます。 */
+   logger_stop();
+   logger_configure(out, RETRO_LOG_DEBUG, 1000);
+   logger_start();
+   logger_reset_stats();
+   limited_ns = bench_log_frames(false);
+   logger_flush();
+   logger_get_stats(&stats);
+   printf("log limited  %7.1f ns/msg  (1000 件/秒)  written %llu  rate-limited %llu\n",
+         (double)limited_ns / count, (unsigned long long)stats.written,
+         (unsigned long long)stats.limited[RETRO_LOG_DEBUG]);
+
+   /* 複数のスレッドが待たずに出し続けると、リングが溢れた分を数えて捨てます。 */
+   logger_stop();
+   logger_configure(out, RETRO_LOG_DEBUG, 0);
+   logger_start();
+   logger_reset_stats();
+   for (i = 0; i < BENCH_LOG_THREADS; i++)
+      if (pthread_create(&threads[i], NULL, bench_log_thread, NULL) != 0)
+         break;
+   while (i--)
+      pthread_join(threads[i], NULL);
+   logger_flush();
+   logger_get_stats(&stats);
+   printf("log threads  %u threads  messages %llu  overflowed %llu  written %llu\n",
+         BENCH_LOG_THREADS, (unsigned long long)stats.messages[RETRO_LOG_DEBUG],
+         (unsigned long long)stats.overflowed, (unsigned long long)stats.written);
+   if (stats.messages[RETRO_LOG_DEBUG] + stats.overflowed != (uint64_t)count
+         || stats.written != stats.messages[RETRO_LOG_DEBUG])
+      ok = false;
+
+   logger_stop();
+   logger_configure(stderr, RETRO_LOG_WARN, 0);
+   fclose(out);
+   return ok;
+}
+
+/* ---- autosave ---- */
+
+#define BENCH_AUTOSAVE_FRAMES   3600    /* 60 fps で 1 分 */
+#define BENCH_AUTOSAVE_PERIOD   60      /* 比べずに毎秒書く場合 */
+
+static bool bench_autosave_size(size_t size, unsigned iterations)
+{
+   uint8_t *live   = (uint8_t*)malloc(size);
+   uint8_t *shadow = (uint8_t*)malloc(size);
+   uint64_t simd   = cpu_features_ext();
+   unsigned count, k, it;
+   size_t   i;
+   const struct autosave_kernel *kernels = autosave_kernels(&count);
+   bool ok = live && shadow;
+
+   if (!ok)
+      goto end;
+
+   for (i = 0; i < size; i++)
+      live[i] = (uint8_t)bench_rand();
+
+   for (k = 0; k < count; k++)
+   {
+      uint64_t start, ns;
+
+      if ((kernels[k].simd & simd) != kernels[k].simd)
+      {
+         printf("autosave %7zu KB %-6s 非対応\n", size / 1024, kernels[k].name);
+         continue;
+      }
+
+      /* 1 バイトだけ違う写しを、ブロックの境目と末尾も含めて取り込めることを確かめます。 */
+      for (it = 0; it < 64; it++)
+      {
+         size_t at = it < 2 ? (it ? size - 1 : 0) : bench_rand() % size;
+
+         memcpy(shadow, live, size);
+         shadow[at] ^= 0x5A;
+         if (!kernels[k].update(shadow, live, size) || memcmp(shadow, live, size) != 0
+               || kernels[k].update(shadow, live, size))
+         {
+            fprintf(stderr, "autosave: %s がオフセット %zu の違いを正しく扱えません\n",
+                  kernels[k].name, at);
+            ok = false;
+            goto end;
+         }
+      }
+
+      /* ゲームプレイ中のほとんどの比較は、何も変わっていない場合です。 */
+      start = timer_ns();
+      for (it = 0; it < iterations; it++)
+         if (kernels[k].update(shadow, live, size))
+            ok = false;
+      ns = timer_ns() - start;
+
+      printf("autosave %7zu KB %-6s %7.2f GB/s  %9.2f us/check\n",
+            size / 1024, kernels[k].name,
+            (double)size * 2 * iterations / (double)ns, ns / 1e3 / iterations);
+   }
+
+end:
+   free(live);
+   free(shadow);
+   return ok;
+}
+
+/* 1 分のゲームプレイで、セーブポイントで 2 回だけ SRAM に書くコアを真似ます。 */
+static bool bench_autosave_play(void)
+{
+   static const unsigned saves[] = { 1000, 2500 };
+   const size_t size = 8192;
+   uint8_t *live   = (uint8_t*)calloc(1, size);
+   uint8_t *shadow = (uint8_t*)calloc(1, size);
+   uint64_t periodic = 0, dirty = 0, start, ns;
+   unsigned f, s = 0, checks = 0;
+
+   if (!live || !shadow)
+   {
+      free(live);
+      free(shadow);
+      return false;
+   }
+
+   start = timer_ns();
+   for (f = 0; f < BENCH_AUTOSAVE_FRAMES; f++)
+   {
+      if (s < sizeof(saves) / sizeof(saves[0]) && f == saves[s])
+      {
+         memset(live + 256 * s, (int)(s + 1), 256);
+         s++;
+      }
+      if (f % BENCH_AUTOSAVE_PERIOD == BENCH_AUTOSAVE_PERIOD - 1)
+         periodic += size;
+      checks++;
+      if (autosave_kernel()->update(shadow, live, size))
+         dirty += size;
+   }
+   ns = timer_ns() - start;
+
+   printf("autosave play %u frames  periodic (%u フレームごと) %llu KB  dirty-only %llu KB  "
+         "(%s, %.2f us/frame)\n",
+         BENCH_AUTOSAVE_FRAMES, BENCH_AUTOSAVE_PERIOD,
+         (unsigned long long)(periodic / 1024), (unsigned long long)(dirty / 1024),
+         autosave_kernel()->name, ns / 1e3 / checks);
+
+   free(live);
+   free(shadow);
+   return dirty == size * (sizeof(saves) / sizeof(saves[0]));
+}
+
+static bool bench_autosave(void)
+{
+   return bench_autosave_size(8 * 1024, 200000)
+       && bench_autosave_size(128 * 1024, 10000)
+       && bench_autosave_size(2 * 1024 * 1024, 500)
+       && bench_autosave_play();
+}
+
+/* ---- savestate ---- */
+
+#define BENCH_STATE_DEFAULT_MB 32
+#define BENCH_STATE_ROUNDS     3
+
+/* エミュレーターのステートに似せて、4 KB ごとにゼロ / 繰り返し / 4 ビットの乱数 / 乱数を 4:3:2:1 で並べます。 */
+static void bench_savestate_fill(uint8_t *data, size_t size)
+{
+   size_t block, i;
+
+   for (block = 0; block < size; block += 4096)
+   {
+      size_t   n    = size - block < 4096 ? size - block : 4096;
+      unsigned kind = bench_rand() % 10;
+      uint32_t tile = bench_rand();
+
+      for (i = 0; i < n; i++)
+         data[block + i] = kind < 4 ? 0
+            : kind < 7 ? (uint8_t)(tile >> (8 * (i & 3)))
+            : kind < 9 ? (uint8_t)(bench_rand() >> 28) : (uint8_t)bench_rand();
+   }
+}
+
+/* これまでの retro_serialize() をそのまま書く方法です。比べやすいように、同じく fsync() と rename() をします。 */
+static bool bench_savestate_write_raw(const char *path, const uint8_t *data, size_t size)
+{
+   char tmp[4096 + 8];
+   FILE *fp;
+   bool ok;
+   int  fd;
+
+   snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+   if ((fd = mkstemp(tmp)) < 0)
+      return false;
+   if (!(fp = fdopen(fd, "wb")))
+   {
+      close(fd);
+      unlink(tmp);
+      return false;
+   }
+   ok = fwrite(data, 1, size, fp) == size && fflush(fp) == 0 && fsync(fd) == 0;
+   ok = fclose(fp) == 0 && ok && rename(tmp, path) == 0;
+   if (!ok)
+      unlink(tmp);
+   return ok;
+}
+
+static bool bench_savestate_read_raw(const char *path, uint8_t *data, size_t size)
+{
+   FILE *fp = fopen(path, "rb");
+   bool  ok = fp && fread(data, 1, size, fp) == size;
+
+   if (fp)
+      fclose(fp);
+   return ok;
+}
+
+static bool bench_savestate(void)
+{
+   struct savestate_meta   meta;
+   struct savestate_stats  stats;
+   struct savestate_reader reader;
+   const char *env_mb = getenv("RETROBENCH_STATE_MB");
+   const char *tmpdir = getenv("TMPDIR");
+   size_t   size  = (size_t)(env_mb ? strtoull(env_mb, NULL, 0) : BENCH_STATE_DEFAULT_MB) << 20;
+   uint8_t *state = (uint8_t*)malloc(size);
+   uint8_t *back  = (uint8_t*)malloc(size);
+   long     cpus  = sysconf(_SC_NPROCESSORS_ONLN);
+   uint64_t raw_save = UINT64_MAX, raw_load = UINT64_MAX;
+   char     raw[1024], packed[1024];
+   unsigned threads, r;
+   bool     ok = state && back && size;
+
+   snprintf(raw, sizeof(raw), "%s/retrobench-state-%ld.raw", tmpdir ? tmpdir : "/tmp", (long)getpid());
+   snprintf(packed, sizeof(packed), "%s/retrobench-state-%ld.rbss", tmpdir ? tmpdir : "/tmp", (long)getpid());
+   memset(&meta, 0, sizeof(meta));
+   snprintf(meta.library_name, sizeof(meta.library_name), "retrobench");
+   snprintf(meta.library_version, sizeof(meta.library_version), "bench");
+   meta.content_hash = 1;
+
+   if (ok)
+      bench_savestate_fill(state, size);
+   printf("savestate %zu MB (RETROBENCH_STATE_MB で変更できます)  %s\n", size >> 20, packed);
+
+   /* 読み込みはページキャッシュに載った状態を測るので、ディスクの速さではなく展開のコストです。 */
+   for (r = 0; ok && r < BENCH_STATE_ROUNDS; r++)
+   {
+      uint64_t start = timer_ns(), ns;
+
+      ok    = bench_savestate_write_raw(raw, state, size);
+      ns    = timer_ns() - start;
+      raw_save = ns < raw_save ? ns : raw_save;
+      start = timer_ns();
+      ok    = ok && bench_savestate_read_raw(raw, back, size) && memcmp(back, state, size) == 0;
+      ns    = timer_ns() - start;
+      raw_load = ns < raw_load ? ns : raw_load;
+   }
+   if (ok)
+      printf("savestate raw          save %8.2f ms  %7.1f MB/s  load %8.2f ms  %7.1f MB/s  file %7.2f MB\n",
+            raw_save / 1e6, size / 1048576.0 / (raw_save / 1e9),
+            raw_load / 1e6, size / 1048576.0 / (raw_load / 1e9), size / 1048576.0);
+
+   for (threads = 1; ok && threads <= (cpus > 1 ? (unsigned)cpus : 1) && threads <= SAVESTATE_MAX_THREADS;
+         threads *= 2)
+   {
+      uint64_t save = UINT64_MAX, load = UINT64_MAX, file_bytes = 0;
+
+      for (r = 0; ok && r < BENCH_STATE_ROUNDS; r++)
+      {
+         uint64_t start, ns;
+
+         ok = savestate_write(packed, &meta, state, size, threads, &stats);
+         save       = stats.ns < save ? stats.ns : save;
+         file_bytes = stats.file_bytes;
+
+         memset(back, 0, size);
+         start = timer_ns();
+         ok    = ok && savestate_open(&reader, packed);
+         if (ok)
+         {
+            ok = reader.meta.size == size && savestate_read(&reader, back);
+            savestate_close(&reader);
+         }
+         ns   = timer_ns() - start;
+         load = ns < load ? ns : load;
+         if (ok && memcmp(back, state, size) != 0)
+         {
+            fprintf(stderr, "savestate: 読み戻した内容が一致しません\n");
+            ok = false;
+         }
+      }
+      if (ok)
+         printf("savestate rbss %2u thr  save %8.2f ms  %7.1f MB/s  load %8.2f ms  %7.1f MB/s  file %7.2f MB (%.0f%%)  save x%.2f load x%.2f of raw\n",
+               stats.threads, save / 1e6, size / 1048576.0 / (save / 1e9),
+               load / 1e6, size / 1048576.0 / (load / 1e9), file_bytes / 1048576.0,
+               100.0 * file_bytes / size, (double)save / raw_save, (double)load / raw_load);
+   }
+
+   /* 壊れたチャンクを読み込まないことを確かめます。 */
+   if (ok)
+   {
+      FILE *fp = fopen(packed, "r+b");
+
+      ok = fp && fseek(fp, -16, SEEK_END) == 0 && fputc(0x5A, fp) != EOF;
+      if (fp)
+         fclose(fp);
+      ok = ok && savestate_open(&reader, packed);
+      if (ok)
+      {
+         fprintf(stderr, "savestate: 以下は壊したチャンクを検出したことを示すメッセージです\n");
+         ok = !savestate_read(&reader, back);
+         savestate_close(&reader);
+      }
+      if (!ok)
+         fprintf(stderr, "savestate: 壊れたチャンクを検出できませんでした\n");
+   }
+
+   remove(raw);
+   remove(packed);
+   free(state);
+   free(back);
+   return ok;
+}
+
+/* ---- 登録 ---- */
+
+struct bench_entry
+{
+   const char *name;
+   const char *desc;
+   bool (*run)(void);
+};
+
+static const struct bench_entry bench_entries[] = {
+   { "memmap", "retro_memory_map の変換: 記述子の走査とページテーブル", bench_memmap },
+   { "pixconv", "0RGB1555/RGB565 → XRGB8888 変換カーネル (GB/s)", bench_pixconv },
+   { "video", "重複フレーム: framehash (GB/s) と、静止 / 動く場面で映像パイプラインにかかる時間", bench_video },
+   { "tiles", "変わったタイルだけを変換: 2D の場面でフレームあたりに処理するバイト数と時間", bench_tiles },
+   { "input", "retro_input_state_t: 入力層への問い合わせ / スナップショットの表引き", bench_input },
+   { "audiosample", "retro_audio_sample_t: 1 フレームずつ / ブロックに合成 / バッチ", bench_audiosample },
+   { "vfs", "retro_vfs_read_t: mmap / pread / 先読み (io_uring, スレッド) でディスクイメージを読む", bench_vfs },
+   { "options", "RETRO_ENVIRONMENT_GET_VARIABLE: 定義の線形探索 / 完全ハッシュ", bench_options },
+   { "content", "retro_load_game() のデータ: ファイル (コピー / persistent_data の mmap) / zip の展開 / 展開済みキャッシュ", bench_content },
+   { "log", "retro_log_printf_t: 呼び出したスレッドで整形 / リングに写して出力スレッドで整形 / 上限で間引き", bench_log },
+   { "autosave", "RETRO_MEMORY_SAVE_RAM の変更検出 (GB/s) と、1 分のプレイで書き込むバイト数", bench_autosave },
+   { "savestate", "ステートファイル: retro_serialize() のダンプと、チャンクを並列に圧縮したコンテナの保存 / 読み込み時間", bench_savestate },
+};
+
+bool bench_run(const char *name)
+{
+   size_t i;
+
+   for (i = 0; i < sizeof(bench_entries) / sizeof(bench_entries[0]); i++)
+      if (strcmp(bench_entries[i].name, name) == 0)
+         return bench_entries[i].run();
+
+   fprintf(stderr, "不明なベンチマーク: %s\n", name);
+   bench_list();
+   return false;
+}
+
+void bench_list(void)
+{
+   size_t i;
+
+   fprintf(stderr, "ベンチマーク:\n");
+   for (i = 0; i < sizeof(bench_entries) / sizeof(bench_entries[0]); i++)
+      fprintf(stderr, "  %-10s %s\n", bench_entries[i].name, bench_entries[i].desc);
+}
@@ -0,0 +1,17 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアを必要としない部品単体のベンチマーク。
+ */
+
+#ifndef RETROBENCH_BENCH_H__
+#define RETROBENCH_BENCH_H__
+
+#include <stdbool.h>
+
+/* name のベンチマークを実行します。該当するものが無ければ false を返します。 */
+bool bench_run(const char *name);
+
+/* 利用できるベンチマーク名を stderr に列挙します。 */
+void bench_list(void);
+
+#endif
@@ -0,0 +1,553 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアに渡すコールバック群。
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "callbacks.h"
+#include "video.h"
+#include "fbpool.h"
+#include "audio.h"
+#include "movie.h"
+#include "input.h"
+#include "perf.h"
+#include "vfs.h"
+#include "content.h"
+#include "options.h"
+#include "logger.h"
+#include "timer.h"
+
+struct callback_stats callback_stats;
+struct frontend_state frontend_state = {
+   ".", ".", NULL, NULL, RETRO_PIXEL_FORMAT_0RGB1555, 0, { 0 }, false,
+   FRONTEND_AV_ENABLE_VIDEO | FRONTEND_AV_ENABLE_AUDIO, false, false
+};
+
+static bool env_get_can_dupe(void *data)
+{
+   *(bool*)data = true;
+   return true;
+}
+
+static bool env_shutdown(void *data)
+{
+   (void)data;
+   frontend_state.shutdown = true;
+   return true;
+}
+
+static bool env_get_system_directory(void *data)
+{
+   *(const char**)data = frontend_state.system_dir;
+   return true;
+}
+
+static bool env_get_save_directory(void *data)
+{
+   *(const char**)data = frontend_state.save_dir;
+   return true;
+}
+
+static bool env_get_libretro_path(void *data)
+{
+   *(const char**)data = frontend_state.core_path;
+   return true;
+}
+
+static bool env_set_pixel_format(void *data)
+{
+   enum retro_pixel_format fmt = *(const enum retro_pixel_format*)data;
+   if (fmt > RETRO_PIXEL_FORMAT_RGB565)
+      return false;
+   frontend_state.pixel_format = fmt;
+   return true;
+}
+
+static bool env_get_log_interface(void *data)
+{
+   ((struct retro_log_callback*)data)->log = logger_printf;
+   return true;
+}
+
+/* 受け付けるだけで何もしません。 */
+static bool env_accept(void *data)
+{
+   (void)data;
+   return true;
+}
+
+static bool env_set_serialization_quirks(void *data)
+{
+   /* 巻き戻しはステートサイズの変化に対応しているので、
+    * CORE_VARIABLE_SIZE には FRONT_VARIABLE_SIZE で応えます。 */
+   uint64_t *quirks = (uint64_t*)data;
+   *quirks &= RETRO_SERIALIZATION_QUIRK_INCOMPLETE
+            | RETRO_SERIALIZATION_QUIRK_MUST_INITIALIZE
+            | RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE
+            | RETRO_SERIALIZATION_QUIRK_SINGLE_SESSION
+            | RETRO_SERIALIZATION_QUIRK_ENDIAN_DEPENDENT
+            | RETRO_SERIALIZATION_QUIRK_PLATFORM_DEPENDENT;
+   if (*quirks & RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE)
+      *quirks |= RETRO_SERIALIZATION_QUIRK_FRONT_VARIABLE_SIZE;
+   frontend_state.serialization_quirks = *quirks;
+   return true;
+}
+
+static bool env_get_variable(void *data)
+{
+   return options_get((struct retro_variable*)data);
+}
+
+static bool env_get_variable_update(void *data)
+{
+   *(bool*)data = options_poll_update();
+   return true;
+}
+
+static bool env_set_variables(void *data)
+{
+   return options_set_variables((const struct retro_variable*)data);
+}
+
+static bool env_get_core_options_version(void *data)
+{
+   *(unsigned*)data = 1;
+   return true;
+}
+
+static bool env_set_core_options(void *data)
+{
+   return options_set_definitions((const struct retro_core_option_definition*)data);
+}
+
+static bool env_set_core_options_intl(void *data)
+{
+   return options_set_intl((const struct retro_core_options_intl*)data);
+}
+
+static bool env_set_core_options_display(void *data)
+{
+   return options_set_display((const struct retro_core_option_display*)data);
+}
+
+static bool env_set_memory_maps(void *data)
+{
+   if (frontend_state.has_memmap)
+      memmap_free(&frontend_state.memmap);
+   frontend_state.has_memmap = memmap_compile(&frontend_state.memmap,
+         (const struct retro_memory_map*)data);
+   return frontend_state.has_memmap;
+}
+
+static bool env_get_current_software_framebuffer(void *data)
+{
+   return fbpool_get_framebuffer((struct retro_framebuffer*)data);
+}
+
+static bool env_set_audio_buffer_status_callback(void *data)
+{
+   const struct retro_audio_buffer_status_callback *cb =
+      (const struct retro_audio_buffer_status_callback*)data;
+   audio_set_buffer_status_callback(cb ? cb->callback : NULL);
+   return true;
+}
+
+static bool env_set_minimum_audio_latency(void *data)
+{
+   return audio_set_minimum_latency(*(const unsigned*)data);
+}
+
+static bool env_get_perf_interface(void *data)
+{
+   perf_get_interface((struct retro_perf_callback*)data);
+   return true;
+}
+
+static bool env_get_vfs_interface(void *data)
+{
+   return vfs_get_interface((struct retro_vfs_interface_info*)data);
+}
+
+static bool env_set_content_info_override(void *data)
+{
+   return content_set_override((const struct retro_system_content_info_override*)data);
+}
+
+static bool env_get_game_info_ext(void *data)
+{
+   return content_get_info_ext(frontend_state.content,
+         (const struct retro_game_info_ext**)data);
+}
+
+static bool env_get_input_bitmasks(void *data)
+{
+   /* RETRO_DEVICE_ID_JOYPAD_MASK に対応します。data を使わず戻り値だけを見るコアもあります。 */
+   if (data)
+      *(bool*)data = true;
+   return true;
+}
+
+static bool env_get_audio_video_enable(void *data)
+{
+   *(int*)data = frontend_state.av_enable;
+   return true;
+}
+
+static bool env_get_fastforwarding(void *data)
+{
+   /* 計測は常にペーシングなしで行うので、早送り中として扱います。 */
+   *(bool*)data = true;
+   return true;
+}
+
+/* retro_run() の中で呼ばれていたら報告する理由。 */
+#define ENV_CACHE_ONCE    "セッション中は変わらないので、最初に一度取得すれば足ります"
+#define ENV_CACHE_INIT    "retro_load_game() までに一度通知すれば足ります"
+
+struct env_command
+{
+   unsigned    cmd;        /* EXPERIMENTAL ビットを含めたコマンド */
+   const char *name;
+   bool      (*handler)(void *data);   /* NULL なら対応していません */
+   const char *cache;      /* retro_run() で毎回呼ぶ必要がないコマンドなら、その理由 */
+};
+
+/* 表は EXPERIMENTAL / PRIVATE ビットを除いた番号で引きます。
+ * ビットだけが違う同じ番号 (SET_SERIALIZATION_QUIRKS と SET_HW_SHARED_CONTEXT) を取り違えないよう、
+ * 引いた後で cmd と完全に一致するかを確かめます。 */
+#define ENV_INDEX(cmd) ((cmd) & ~(unsigned)(RETRO_ENVIRONMENT_EXPERIMENTAL | RETRO_ENVIRONMENT_PRIVATE))
+#define ENV(cmd, handler, cache) \
+   [ENV_INDEX(RETRO_ENVIRONMENT_ ## cmd)] = { RETRO_ENVIRONMENT_ ## cmd, #cmd, handler, cache }
+
+static const struct env_command env_commands[CALLBACKS_ENV_COMMANDS] = {
+   ENV(SET_ROTATION,                  NULL,                       ENV_CACHE_INIT),
+   ENV(GET_OVERSCAN,                  NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_CAN_DUPE,                  env_get_can_dupe,           ENV_CACHE_ONCE),
+   ENV(SET_MESSAGE,                   NULL,                       NULL),
+   ENV(SHUTDOWN,                      env_shutdown,               NULL),
+   ENV(SET_PERFORMANCE_LEVEL,         env_accept,                 ENV_CACHE_INIT),
+   ENV(GET_SYSTEM_DIRECTORY,          env_get_system_directory,   ENV_CACHE_ONCE),
+   ENV(SET_PIXEL_FORMAT,              env_set_pixel_format,       ENV_CACHE_INIT),
+   ENV(SET_INPUT_DESCRIPTORS,         env_accept,                 ENV_CACHE_INIT),
+   ENV(SET_KEYBOARD_CALLBACK,         NULL,                       ENV_CACHE_INIT),
+   ENV(SET_DISK_CONTROL_INTERFACE,    NULL,                       ENV_CACHE_INIT),
+   ENV(SET_HW_RENDER,                 NULL,                       ENV_CACHE_INIT),
+   ENV(GET_VARIABLE,                  env_get_variable,
+         "GET_VARIABLE_UPDATE が true を返したときだけ読み直せば足ります"),
+   ENV(SET_VARIABLES,                 env_set_variables,          ENV_CACHE_INIT),
+   ENV(GET_VARIABLE_UPDATE,           env_get_variable_update,    NULL),
+   ENV(SET_SUPPORT_NO_GAME,           env_accept,                 ENV_CACHE_INIT),
+   ENV(GET_LIBRETRO_PATH,             env_get_libretro_path,      ENV_CACHE_ONCE),
+   ENV(SET_FRAME_TIME_CALLBACK,       NULL,                       ENV_CACHE_INIT),
+   ENV(SET_AUDIO_CALLBACK,            NULL,                       ENV_CACHE_INIT),
+   ENV(GET_RUMBLE_INTERFACE,          NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_INPUT_DEVICE_CAPABILITIES, NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_SENSOR_INTERFACE,          NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_CAMERA_INTERFACE,          NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_LOG_INTERFACE,             env_get_log_interface,      ENV_CACHE_ONCE),
+   ENV(GET_PERF_INTERFACE,            env_get_perf_interface,     ENV_CACHE_ONCE),
+   ENV(GET_LOCATION_INTERFACE,        NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_CORE_ASSETS_DIRECTORY,     NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_SAVE_DIRECTORY,            env_get_save_directory,     ENV_CACHE_ONCE),
+   ENV(SET_SYSTEM_AV_INFO,            NULL,                       NULL),
+   ENV(SET_PROC_ADDRESS_CALLBACK,     NULL,                       ENV_CACHE_INIT),
+   ENV(SET_SUBSYSTEM_INFO,            env_accept,                 ENV_CACHE_INIT),
+   ENV(SET_CONTROLLER_INFO,           env_accept,                 ENV_CACHE_INIT),
+   ENV(SET_MEMORY_MAPS,               env_set_memory_maps,        ENV_CACHE_INIT),
+   ENV(SET_GEOMETRY,                  env_accept,                 NULL),
+   ENV(GET_USERNAME,                  NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_LANGUAGE,                  NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_CURRENT_SOFTWARE_FRAMEBUFFER, env_get_current_software_framebuffer, NULL),
+   ENV(GET_HW_RENDER_INTERFACE,       NULL,                       ENV_CACHE_ONCE),
+   ENV(SET_SUPPORT_ACHIEVEMENTS,      NULL,                       ENV_CACHE_INIT),
+   ENV(SET_HW_RENDER_CONTEXT_NEGOTIATION_INTERFACE, NULL,         ENV_CACHE_INIT),
+   ENV(SET_SERIALIZATION_QUIRKS,      env_set_serialization_quirks, ENV_CACHE_INIT),
+   ENV(GET_VFS_INTERFACE,             env_get_vfs_interface,      ENV_CACHE_ONCE),
+   ENV(GET_LED_INTERFACE,             NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_AUDIO_VIDEO_ENABLE,        env_get_audio_video_enable, NULL),
+   ENV(GET_MIDI_INTERFACE,            NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_FASTFORWARDING,            env_get_fastforwarding,
+         "計測中は常に true なので、GET_VARIABLE_UPDATE と同じ頻度で読めば足ります"),
+   ENV(GET_TARGET_REFRESH_RATE,       NULL,                       NULL),
+   ENV(GET_INPUT_BITMASKS,            env_get_input_bitmasks,     ENV_CACHE_ONCE),
+   ENV(GET_CORE_OPTIONS_VERSION,      env_get_core_options_version, ENV_CACHE_ONCE),
+   ENV(SET_CORE_OPTIONS,              env_set_core_options,       ENV_CACHE_INIT),
+   ENV(SET_CORE_OPTIONS_INTL,         env_set_core_options_intl,  ENV_CACHE_INIT),
+   ENV(SET_CORE_OPTIONS_DISPLAY,      env_set_core_options_display, NULL),
+   ENV(GET_PREFERRED_HW_RENDER,       NULL,                       ENV_CACHE_ONCE),
+   ENV(GET_DISK_CONTROL_INTERFACE_VERSION, NULL,                  ENV_CACHE_ONCE),
+   ENV(SET_DISK_CONTROL_EXT_INTERFACE, NULL,                      ENV_CACHE_INIT),
+   ENV(GET_MESSAGE_INTERFACE_VERSION, NULL,                       ENV_CACHE_ONCE),
+   ENV(SET_MESSAGE_EXT,               NULL,                       NULL),
+   ENV(GET_INPUT_MAX_USERS,           NULL,                       ENV_CACHE_ONCE),
+   ENV(SET_AUDIO_BUFFER_STATUS_CALLBACK, env_set_audio_buffer_status_callback, ENV_CACHE_INIT),
+   ENV(SET_MINIMUM_AUDIO_LATENCY,     env_set_minimum_audio_latency, ENV_CACHE_INIT),
+   ENV(SET_FASTFORWARDING_OVERRIDE,   NULL,                       NULL),
+   ENV(SET_CONTENT_INFO_OVERRIDE,     env_set_content_info_override, ENV_CACHE_INIT),
+   ENV(GET_GAME_INFO_EXT,             env_get_game_info_ext,      ENV_CACHE_ONCE),
+};
+
+#define ENV_SAMPLE 16
+
+/* callbacks_run() の中、つまりコアの retro_run() から呼ばれている間だけ true です。 */
+static bool in_run;
+
+static bool RETRO_CALLCONV environment_cb(unsigned cmd, void *data)
+{
+   unsigned index = ENV_INDEX(cmd);
+   const struct env_command *command = NULL;
+   struct env_stats *stats;
+   uint64_t start;
+   bool ret;
+
+   callback_stats.environment++;
+
+   if (index < CALLBACKS_ENV_COMMANDS && env_commands[index].name
+         && env_commands[index].cmd == cmd)
+      command = &env_commands[index];
+   else
+      index = CALLBACKS_ENV_COMMANDS;
+
+   stats = &callback_stats.env[index];
+   stats->calls++;
+   if (in_run)
+      stats->run_calls++;
+   if (!command || !command->handler)
+      return false;
+
+   /* 時刻の取得はハンドラより重いことが多いので、ENV_SAMPLE 回に 1 回だけ測ります。 */
+   if ((stats->calls - 1) % ENV_SAMPLE)
+      return command->handler(data);
+
+   start = timer_ns();
+   ret   = command->handler(data);
+   stats->ns += timer_ns() - start;
+   stats->timed++;
+   return ret;
+}
+
+static void RETRO_CALLCONV video_refresh_cb(const void *data,
+      unsigned width, unsigned height, size_t pitch)
+{
+   callback_stats.video_refresh++;
+   if (!data)
+      callback_stats.video_dupe++;
+   if (frontend_state.av_enable & FRONTEND_AV_ENABLE_VIDEO)
+      video_frame(data, width, height, pitch, frontend_state.pixel_format);
+}
+
+/* audio_sample_cb と audio_sample_batch_cb が共有するバッチ経路。 */
+static size_t audio_submit(const int16_t *data, size_t frames)
+{
+   if (audio_active() && (frontend_state.av_enable & FRONTEND_AV_ENABLE_AUDIO))
+      audio_push(data, frames);
+   return frames;
+}
+
+static void RETRO_CALLCONV audio_sample_cb(int16_t left, int16_t right)
+{
+   callback_stats.audio_sample++;
+   callback_stats.audio_frames++;
+
+   /* 先行実行のセカンダリなど、音声が無効なフレームのサンプルは溜めません。 */
+   if (frontend_state.av_enable & FRONTEND_AV_ENABLE_AUDIO)
+      audio_block_sample(left, right, audio_submit);
+}
+
+static size_t RETRO_CALLCONV audio_sample_batch_cb(const int16_t *data, size_t frames)
+{
+   callback_stats.audio_sample_batch++;
+   callback_stats.audio_frames += frames;
+
+   /* 1 フレーム単位とバッチが混ざっても順序が崩れないよう、溜めた分を先に流します。 */
+   audio_block_flush(audio_submit);
+   return audio_submit(data, frames);
+}
+
+static void RETRO_CALLCONV input_poll_cb(void)
+{
+   callback_stats.input_poll++;
+   /* 先行実行のセカンダリは、プライマリが最後に読んだ入力が続くものとして進めます。
+    * 入力層を読むと合成入力やムービーの位置まで進んでしまいます。 */
+   if (frontend_state.predict_input)
+      return;
+   input_poll();
+   movie_poll();
+}
+
+static int16_t RETRO_CALLCONV input_state_cb(unsigned port, unsigned device,
+      unsigned index, unsigned id)
+{
+   callback_stats.input_state++;
+   input_count(device);
+   return movie_input_state(port, device, index, id, input_state);
+}
+
+void callbacks_context_init(struct frontend_context *ctx)
+{
+   memset(ctx, 0, sizeof(*ctx));
+   ctx->state.system_dir   = frontend_state.system_dir;
+   ctx->state.save_dir     = frontend_state.save_dir;
+   ctx->state.pixel_format = RETRO_PIXEL_FORMAT_0RGB1555;
+   ctx->state.av_enable    = FRONTEND_AV_ENABLE_VIDEO | FRONTEND_AV_ENABLE_AUDIO;
+}
+
+void callbacks_swap_context(struct frontend_context *ctx)
+{
+   struct frontend_state state = frontend_state;
+
+   frontend_state = ctx->state;
+   ctx->state     = state;
+   options_swap_seen(&ctx->options_seen);
+}
+
+void callbacks_context_free(struct frontend_context *ctx)
+{
+   if (ctx->state.has_memmap)
+      memmap_free(&ctx->state.memmap);
+   ctx->state.has_memmap = false;
+}
+
+void callbacks_set_environment(struct core *core)
+{
+   frontend_state.core_path = core->path;
+   frontend_state.content   = &core->content;
+   core->retro_set_environment(environment_cb);
+}
+
+void callbacks_install(struct core *core)
+{
+   core->retro_set_video_refresh(video_refresh_cb);
+   core->retro_set_audio_sample(audio_sample_cb);
+   core->retro_set_audio_sample_batch(audio_sample_batch_cb);
+   core->retro_set_input_poll(input_poll_cb);
+   core->retro_set_input_state(input_state_cb);
+}
+
+void callbacks_run(struct core *core)
+{
+   in_run = true;
+   core->retro_run();
+   in_run = false;
+}
+
+void callbacks_frame_end(void)
+{
+   audio_block_flush(audio_submit);
+   callback_stats.audio_blocks += audio_block.flushes;
+   audio_block.flushes          = 0;
+   input_frame_end();
+}
+
+/* 連続して呼んだ timer_ns() の差。ハンドラの時間から引きます。 */
+static double env_timer_overhead(void)
+{
+   uint64_t start = timer_ns();
+   uint64_t last  = start;
+   unsigned i;
+
+   for (i = 0; i < 1000; i++)
+      last = timer_ns();
+   return (double)(last - start) / 1000.0;
+}
+
+void callbacks_report_environment(double frames)
+{
+   double overhead = env_timer_overhead();
+   unsigned i;
+
+   printf("environment:     %-36s %11s %10s %10s\n", "command", "calls/frame", "in run", "ns/call");
+   for (i = 0; i <= CALLBACKS_ENV_COMMANDS; i++)
+   {
+      const struct env_stats *s = &callback_stats.env[i];
+      bool handled = i < CALLBACKS_ENV_COMMANDS && env_commands[i].handler;
+
+      if (!s->calls)
+         continue;
+      printf("                 %-36s %11.2f %10.2f %10.1f%s\n",
+            i < CALLBACKS_ENV_COMMANDS ? env_commands[i].name : "(other)",
+            s->calls / frames, s->run_calls / frames,
+            s->timed && (double)s->ns / (double)s->timed > overhead
+               ? (double)s->ns / (double)s->timed - overhead : 0.0,
+            handled ? "" : "  未対応");
+   }
+
+   for (i = 0; i < CALLBACKS_ENV_COMMANDS; i++)
+   {
+      const struct env_stats *s = &callback_stats.env[i];
+
+      if (s->run_calls && env_commands[i].cache)
+         printf("                 ! %s を retro_run() の中で %.2f 回/フレーム呼んでいます。%s\n",
+               env_commands[i].name, s->run_calls / frames, env_commands[i].cache);
+   }
+}
+
+#define CALLBACK_COST_ITERATIONS 1000000
+
+void callbacks_measure_cost(struct callback_cost *cost)
+{
+   /* volatile な関数ポインタを経由させ、コアからの間接呼び出しを再現します。 */
+   retro_video_refresh_t volatile      video  = video_refresh_cb;
+   retro_audio_sample_t volatile       sample = audio_sample_cb;
+   retro_audio_sample_batch_t volatile batch  = audio_sample_batch_cb;
+   retro_input_poll_t volatile         poll   = input_poll_cb;
+   retro_input_state_t volatile        state  = input_state_cb;
+   retro_environment_t volatile        env    = environment_cb;
+   struct callback_stats saved = callback_stats;
+   struct input_stats saved_input = input_stats;
+   struct options_stats saved_options = options_stats;
+   struct video_state saved_video = video_state;
+   struct retro_variable var   = { options_first_key(), NULL };
+   bool     update;
+   uint64_t flushes            = audio_block.flushes;
+   int16_t  samples[2]         = { 0, 0 };
+   uint64_t start;
+   unsigned i;
+
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      video(NULL, 0, 0, 0);
+   cost->video_refresh = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      sample(0, 0);
+   cost->audio_sample = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+   audio_block.frames  = 0;
+   audio_block.flushes = flushes;
+
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      batch(samples, 1);
+   cost->audio_sample_batch = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      poll();
+   cost->input_poll = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      state(0, RETRO_DEVICE_JOYPAD, 0, i & 15);
+   cost->input_state = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+
+   /* オプションが無いコアでは、登録されていないキーを引く場合のコストになります。 */
+   if (!var.key)
+      var.key = "retrobench_missing";
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      env(RETRO_ENVIRONMENT_GET_VARIABLE, &var);
+   cost->get_variable = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+
+   start = timer_ns();
+   for (i = 0; i < CALLBACK_COST_ITERATIONS; i++)
+      env(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &update);
+   cost->get_variable_update = (double)(timer_ns() - start) / CALLBACK_COST_ITERATIONS;
+
+   callback_stats = saved;
+   input_stats    = saved_input;
+   options_stats  = saved_options;
+   video_state    = saved_video;
+}
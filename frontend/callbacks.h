@@ -0,0 +1,116 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアに渡すコールバック群。
+ */
+
+#ifndef RETROBENCH_CALLBACKS_H__
+#define RETROBENCH_CALLBACKS_H__
+
+#include <stdint.h>
+
+#include "libretro.h"
+#include "core.h"
+#include "memmap.h"
+
+/* environment のコマンドごとの統計を取る表の大きさ。
+ * 番号は EXPERIMENTAL / PRIVATE ビットを除いたもので、表に無いコマンドは最後の要素にまとめます。 */
+#define CALLBACKS_ENV_COMMANDS 80
+
+struct env_stats
+{
+   uint64_t calls;
+   uint64_t run_calls;           /* そのうち retro_run() の中から呼ばれた回数 */
+   uint64_t timed;               /* そのうち時間を測った回数 */
+   uint64_t ns;                  /* 測ったハンドラの時間の合計 */
+};
+
+/* コールバックの呼び出し回数。
+ * シンクはカウンタのインクリメント以外何もしないため、
+ * retro_run() の計測にほとんど影響を与えません。 */
+struct callback_stats
+{
+   uint64_t environment;
+   uint64_t video_refresh;
+   uint64_t video_dupe;          /* data == NULL で呼ばれた回数 */
+   uint64_t audio_sample;
+   uint64_t audio_sample_batch;
+   uint64_t audio_frames;        /* 受け取ったオーディオフレーム(L/R の組)の総数 */
+   uint64_t audio_blocks;        /* audio_sample をまとめてバッチ経路に渡した回数 */
+   uint64_t input_poll;
+   uint64_t input_state;
+   struct env_stats env[CALLBACKS_ENV_COMMANDS + 1];
+};
+
+/* RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE で返すビット。 */
+#define FRONTEND_AV_ENABLE_VIDEO             (1 << 0)
+#define FRONTEND_AV_ENABLE_AUDIO             (1 << 1)
+#define FRONTEND_AV_ENABLE_FAST_SAVESTATES   (1 << 2)
+#define FRONTEND_AV_ENABLE_HARD_DISABLE_AUDIO (1 << 3)
+
+/* フロントエンドの設定と、コアから通知された状態。 */
+struct frontend_state
+{
+   const char *system_dir;
+   const char *save_dir;
+   const char *core_path;
+   const struct content *content;   /* GET_GAME_INFO_EXT で返す、このインスタンスのコンテンツ */
+   enum retro_pixel_format pixel_format;
+   uint64_t serialization_quirks;   /* SET_SERIALIZATION_QUIRKS で受け付けたフラグ */
+   struct memmap memmap;            /* SET_MEMORY_MAPS をコンパイルしたもの */
+   bool has_memmap;
+   int av_enable;                   /* FRONTEND_AV_ENABLE_* 。先行実行中はインスタンスごとに切り替えます。 */
+   bool predict_input;              /* retro_input_poll_t で入力層を読まず、今のスナップショットを使い続ける */
+   bool shutdown;
+};
+
+/* コアインスタンスごとの状態。先行実行のセカンダリのように同じプロセスで 2 つ目のインスタンスを
+ * 動かすときは、そのインスタンスを呼ぶ間だけ callbacks_swap_context() で入れ替えます。 */
+struct frontend_context
+{
+   struct frontend_state state;
+   uint64_t options_seen;           /* options_swap_seen() で入れ替える世代 */
+};
+
+extern struct callback_stats callback_stats;
+extern struct frontend_state frontend_state;
+
+/* ディレクトリの設定は今のものを引き継ぎ、コアから通知される値は既定にした状態を作ります。 */
+void callbacks_context_init(struct frontend_context *ctx);
+
+/* 使用中の状態と ctx を入れ替えます。もう 1 度呼ぶと元に戻ります。 */
+void callbacks_swap_context(struct frontend_context *ctx);
+
+/* ctx が持つメモリマップを解放します。入れ替えていないときに呼びます。 */
+void callbacks_context_free(struct frontend_context *ctx);
+
+/* コアに retro_set_environment() を呼びます。retro_init() の前に呼ぶ必要があります。 */
+void callbacks_set_environment(struct core *core);
+
+/* 残りの retro_set_*() を呼びます。 */
+void callbacks_install(struct core *core);
+
+/* core->retro_run() を呼びます。この間の environment 呼び出しを retro_run() の中として数えます。 */
+void callbacks_run(struct core *core);
+
+/* フレームの終わりに呼び、retro_audio_sample_t で溜めたサンプルを流します。 */
+void callbacks_frame_end(void);
+
+/* environment のコマンドごとの呼び出し回数と時間を表示し、
+ * retro_run() の中で毎回呼ぶ必要のないコマンドを指摘します。 */
+void callbacks_report_environment(double frames);
+
+struct callback_cost
+{
+   double video_refresh;
+   double audio_sample;
+   double audio_sample_batch;
+   double input_poll;
+   double input_state;
+   double get_variable;          /* environment 経由の GET_VARIABLE */
+   double get_variable_update;
+};
+
+/* 1 回あたりのコールバック呼び出しコスト(ns)を、関数ポインタ経由で計測します。 */
+void callbacks_measure_cost(struct callback_cost *cost);
+
+#endif
@@ -0,0 +1,555 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コンテンツの読み込みと RETRO_ENVIRONMENT_*_CONTENT_INFO_OVERRIDE /
+ * GET_GAME_INFO_EXT。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "content.h"
+#include "archive.h"
+#include "timer.h"
+
+#define CONTENT_MAX_OVERRIDES 32
+
+#define CONTENT_FNV_BASIS 0xcbf29ce484222325ull
+#define CONTENT_FNV_PRIME 0x100000001b3ull
+
+/* SET_CONTENT_INFO_OVERRIDE の写し。コアの配列が retro_set_environment() の後も
+ * 残っているとは限らないので、拡張子の文字列ごとコピーしておきます。 */
+struct content_override
+{
+   char extensions[256];
+   bool need_fullpath;
+   bool persistent_data;
+};
+
+static struct content_override content_overrides[CONTENT_MAX_OVERRIDES];
+static unsigned content_override_count;
+static char content_cache_dir[4096];
+
+/* ext が list ("md|sms|gg") に含まれるか調べます。ext は小文字です。 */
+static bool content_ext_in(const char *ext, const char *list)
+{
+   size_t len = strlen(ext);
+
+   while (list && *list)
+   {
+      size_t n = strcspn(list, "|");
+      if (n == len && strncasecmp(list, ext, len) == 0)
+         return true;
+      list += n;
+      if (*list == '|')
+         list++;
+   }
+   return false;
+}
+
+/* 拡張子に一致する最初の上書きを返します。 */
+static const struct content_override *content_find_override(const char *ext)
+{
+   unsigned i;
+
+   for (i = 0; i < content_override_count; i++)
+      if (content_ext_in(ext, content_overrides[i].extensions))
+         return &content_overrides[i];
+   return NULL;
+}
+
+bool content_set_override(const struct retro_system_content_info_override *overrides)
+{
+   if (!overrides)
+      return true;
+
+   content_override_count = 0;
+   for (; overrides->extensions; overrides++)
+   {
+      struct content_override *o;
+
+      if (content_override_count == CONTENT_MAX_OVERRIDES)
+         return false;
+      o = &content_overrides[content_override_count++];
+      snprintf(o->extensions, sizeof(o->extensions), "%s", overrides->extensions);
+      o->need_fullpath   = overrides->need_fullpath;
+      o->persistent_data = overrides->persistent_data;
+   }
+   return true;
+}
+
+bool content_get_info_ext(const struct content *content, const struct retro_game_info_ext **ext)
+{
+   if (!content || !content->opened)
+      return false;
+   *ext = &content->ext;
+   return true;
+}
+
+void content_set_cache_dir(const char *dir)
+{
+   snprintf(content_cache_dir, sizeof(content_cache_dir), "%s", dir ? dir : "");
+}
+
+/* キャッシュディレクトリを途中の階層も含めて作ります。 */
+static bool content_cache_prepare(void)
+{
+   char *p;
+
+   if (!content_cache_dir[0])
+   {
+      const char *xdg  = getenv("XDG_CACHE_HOME");
+      const char *home = getenv("HOME");
+
+      if (xdg && *xdg)
+         snprintf(content_cache_dir, sizeof(content_cache_dir), "%s/retrobench/content", xdg);
+      else if (home && *home)
+         snprintf(content_cache_dir, sizeof(content_cache_dir), "%s/.cache/retrobench/content", home);
+      else
+         return false;
+   }
+
+   for (p = content_cache_dir + 1; ; p++)
+   {
+      if (*p != '/' && *p != '\0')
+         continue;
+      if (*p == '\0')
+         return mkdir(content_cache_dir, 0755) == 0 || errno == EEXIST;
+      *p = '\0';
+      if (mkdir(content_cache_dir, 0755) != 0 && errno != EEXIST)
+      {
+         *p = '/';
+         return false;
+      }
+      *p = '/';
+   }
+}
+
+/* path をディレクトリ・拡張子なしのベース名・小文字の拡張子に分けます。 */
+static void content_split_path(const char *path, char *dir, size_t dir_size,
+      char *name, size_t name_size, char *ext, size_t ext_size)
+{
+   const char *base = strrchr(path, '/');
+   const char *dot;
+   size_t      len;
+
+   if (dir)
+   {
+      if (!base)
+         snprintf(dir, dir_size, ".");
+      else if (base == path)
+         snprintf(dir, dir_size, "/");
+      else
+         snprintf(dir, dir_size, "%.*s", (int)(base - path), path);
+   }
+
+   base = base ? base + 1 : path;
+   dot  = strrchr(base, '.');
+   len  = dot ? (size_t)(dot - base) : strlen(base);
+
+   if (name)
+      snprintf(name, name_size, "%.*s", (int)len, base);
+   if (ext)
+   {
+      char *p;
+      snprintf(ext, ext_size, "%s", dot ? dot + 1 : "");
+      for (p = ext; *p; p++)
+         *p = (char)tolower((unsigned char)*p);
+   }
+}
+
+static uint64_t content_fnv(uint64_t hash, const uint8_t *data, size_t size)
+{
+   size_t i;
+
+   for (i = 0; i < size; i++)
+      hash = (hash ^ data[i]) * CONTENT_FNV_PRIME;
+   return hash;
+}
+
+/* エンディアンによらないように、下位のバイトから混ぜます。 */
+static uint64_t content_fnv_u64(uint64_t hash, uint64_t value)
+{
+   unsigned i;
+
+   for (i = 0; i < 8; i++)
+      hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * CONTENT_FNV_PRIME;
+   return hash;
+}
+
+/* ファイル全体をヒープに読み込みます。 */
+static void *content_read_file(const char *path, size_t *size)
+{
+   struct stat st;
+   uint8_t *data = NULL;
+   size_t   done = 0;
+   int      fd   = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return NULL;
+
+   if (fstat(fd, &st) < 0)
+      goto error;
+
+   /* 空ファイルでも NULL と区別できるように 1 バイト多く確保します。 */
+   data = (uint8_t*)malloc((size_t)st.st_size + 1);
+   if (!data)
+      goto error;
+
+   while (done < (size_t)st.st_size)
+   {
+      ssize_t n = read(fd, data + done, (size_t)st.st_size - done);
+      if (n <= 0)
+         goto error;
+      done += (size_t)n;
+   }
+
+   close(fd);
+   *size = done;
+   return data;
+
+error:
+   free(data);
+   close(fd);
+   return NULL;
+}
+
+/* 通常ファイルを読み取り専用でマップします。空のファイルなどマップできないものは false を返します。 */
+static bool content_map_file(struct content *content, const char *path)
+{
+   struct stat st;
+   void *p  = MAP_FAILED;
+   int   fd = open(path, O_RDONLY);
+
+   if (fd < 0)
+      return false;
+   if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+      p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (p == MAP_FAILED)
+      return false;
+
+   content->map        = p;
+   content->map_size   = (size_t)st.st_size;
+   content->stats.size = (uint64_t)st.st_size;
+   return true;
+}
+
+/* member の展開済みファイルを content->full_path に用意します。
+ * map が true なら、そのファイルを読み取り専用でマップして content->map に置きます。 */
+static bool content_cache_fetch(struct content *content, const struct archive *ar,
+      const struct archive_member *member, bool map)
+{
+   char   name[256];
+   char   tmp[sizeof(content->full_path) + 8];
+   size_t size = (size_t)member->size;
+   void  *p    = NULL;
+   struct stat st;
+   unsigned i;
+   int    fd, n;
+
+   if (!content_cache_prepare())
+      return false;
+
+   /* メンバー名に含まれるディレクトリの区切りは平らにします。 */
+   for (i = 0; member->name[i] && i < sizeof(name) - 1; i++)
+      name[i] = member->name[i] == '/' ? '_' : member->name[i];
+   name[i] = '\0';
+   n = snprintf(content->full_path, sizeof(content->full_path), "%s/%016llx-%s",
+         content_cache_dir, (unsigned long long)ar->hash, name);
+   if (n < 0 || (size_t)n >= sizeof(content->full_path))
+      return false;
+
+   fd = open(content->full_path, O_RDONLY);
+   if (fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size == member->size)
+   {
+      content->stats.cache_hit = true;
+      if (map && size)
+      {
+         p = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+         if (p == MAP_FAILED)
+         {
+            close(fd);
+            return false;
+         }
+         /* コアは retro_load_game() の中でほぼ全体を読むので、まとめて読み込ませます。 */
+         madvise(p, size, MADV_WILLNEED);
+      }
+      close(fd);
+      content->map      = p;
+      content->map_size = p ? size : 0;
+      return true;
+   }
+   if (fd >= 0)
+      close(fd);
+
+   /* 展開先をマップして直接書き込み、終わってから名前を付けます。 */
+   snprintf(tmp, sizeof(tmp), "%s.XXXXXX", content->full_path);
+   fd = mkstemp(tmp);
+   if (fd < 0)
+      return false;
+
+   if (ftruncate(fd, (off_t)size) != 0)
+      goto error;
+   if (size)
+   {
+      p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED)
+      {
+         p = NULL;
+         goto error;
+      }
+      if (!archive_extract(ar, member, p))
+         goto error;
+   }
+   if (fchmod(fd, 0644) != 0 || rename(tmp, content->full_path) != 0)
+      goto error;
+   close(fd);
+
+   if (p && !map)
+   {
+      munmap(p, size);
+      p = NULL;
+   }
+   if (p)
+      mprotect(p, size, PROT_READ);
+   content->map      = p;
+   content->map_size = p ? size : 0;
+   return true;
+
+error:
+   if (p)
+      munmap(p, size);
+   close(fd);
+   unlink(tmp);
+   content->full_path[0] = '\0';
+   return false;
+}
+
+/* アーカイブの中のファイルを開きます。need_fullpath のコアには展開済みファイルのパスを渡します。 */
+static bool content_open_archive(struct content *content, const char *inner,
+      const struct retro_system_info *system, bool *need_fullpath)
+{
+   const struct content_override *o;
+   struct archive        ar;
+   struct archive_member member;
+
+   if (!archive_open(&ar, content->archive_path))
+   {
+      fprintf(stderr, "[content] アーカイブを開けません: %s\n", content->archive_path);
+      return false;
+   }
+
+   if (!archive_find(&ar, inner, inner ? NULL : system->valid_extensions, &member))
+   {
+      fprintf(stderr, "[content] アーカイブに %s がありません: %s\n",
+            inner ? inner : system->valid_extensions, content->archive_path);
+      archive_close(&ar);
+      return false;
+   }
+
+   snprintf(content->archive_file, sizeof(content->archive_file), "%s", member.name);
+   content->member_hash = content_fnv(CONTENT_FNV_BASIS, (const uint8_t*)member.name, strlen(member.name));
+   content->member_hash = content_fnv_u64(content->member_hash, member.size);
+   content->member_hash = content_fnv_u64(content->member_hash, member.crc32);
+   content_split_path(content->archive_path, content->dir, sizeof(content->dir),
+         content->name, sizeof(content->name), NULL, 0);
+   content_split_path(member.name, NULL, 0, NULL, 0,
+         content->ext_name, sizeof(content->ext_name));
+
+   o = content_find_override(content->ext_name);
+   if (o)
+   {
+      *need_fullpath      = o->need_fullpath;
+      content->persistent = o->persistent_data;
+   }
+
+   if (!content_cache_fetch(content, &ar, &member, !*need_fullpath))
+   {
+      /* キャッシュを置けない場合は、毎回ヒープへ展開します。 */
+      if (*need_fullpath)
+      {
+         fprintf(stderr, "[content] 展開先を用意できません: %s\n", content_cache_dir);
+         archive_close(&ar);
+         return false;
+      }
+      content->heap = malloc((size_t)member.size + 1);
+      if (!content->heap || !archive_extract(&ar, &member, content->heap))
+      {
+         archive_close(&ar);
+         return false;
+      }
+   }
+   else if (!*need_fullpath && !content->map)
+      content->heap = malloc(1);   /* 空のメンバー */
+
+   content->stats.archived = true;
+   content->stats.size     = member.size;
+   archive_close(&ar);
+   return *need_fullpath || content->map || content->heap;
+}
+
+bool content_open(struct content *content, const char *path, const struct retro_system_info *system)
+{
+   const struct content_override *o;
+   const char *inner         = NULL;
+   bool        need_fullpath = system->need_fullpath;
+   uint64_t    start         = timer_ns();
+   char       *hash;
+
+   memset(content, 0, sizeof(*content));
+   content->persistent = true;
+   snprintf(content->path, sizeof(content->path), "%s", path);
+   snprintf(content->archive_path, sizeof(content->archive_path), "%s", path);
+
+   /* "foo.zip#bar.sfc" はアーカイブの中の bar.sfc を指します。 */
+   hash = strrchr(content->archive_path, '#');
+   if (hash)
+   {
+      *hash = '\0';
+      if (archive_is_zip(content->archive_path))
+         inner = hash + 1;
+      else
+         *hash = '#';
+   }
+
+   /* zip を自分で扱うコアと、展開を禁じたコアにはそのまま渡します。 */
+   if ((inner || archive_is_zip(content->archive_path)) && !system->block_extract
+         && !content_ext_in("zip", system->valid_extensions))
+   {
+      if (!content_open_archive(content, inner, system, &need_fullpath))
+         return false;
+   }
+   else
+   {
+      content->archive_path[0] = '\0';
+      snprintf(content->full_path, sizeof(content->full_path), "%s", path);
+      content_split_path(path, content->dir, sizeof(content->dir),
+            content->name, sizeof(content->name), content->ext_name, sizeof(content->ext_name));
+
+      o = content_find_override(content->ext_name);
+      if (o)
+      {
+         need_fullpath       = o->need_fullpath;
+         content->persistent = o->persistent_data;
+      }
+
+      /* persistent_data を約束したコアにはファイルをそのままマップして渡します。
+       * ページは触られたときに読み込まれ、同じファイルを開いた他のインスタンスとも共有されます。 */
+      if (!need_fullpath && o && o->persistent_data)
+         content_map_file(content, path);
+
+      if (!need_fullpath && !content->map)
+      {
+         size_t size = 0;
+
+         content->heap = content_read_file(path, &size);
+         if (!content->heap)
+         {
+            fprintf(stderr, "[content] コンテンツを読み込めません: %s\n", path);
+            return false;
+         }
+         content->stats.size = size;
+      }
+   }
+
+   content->info.path = need_fullpath && content->stats.archived ? content->full_path : content->path;
+   if (!need_fullpath)
+   {
+      content->info.data = content->map ? content->map : content->heap;
+      content->info.size = (size_t)content->stats.size;
+   }
+
+   content->ext.full_path       = content->full_path[0] ? content->full_path : NULL;
+   content->ext.archive_path    = content->stats.archived ? content->archive_path : NULL;
+   content->ext.archive_file    = content->stats.archived ? content->archive_file : NULL;
+   content->ext.dir             = content->dir;
+   content->ext.name            = content->name;
+   content->ext.ext             = content->ext_name;
+   content->ext.data            = content->info.data;
+   content->ext.size            = content->info.size;
+   content->ext.file_in_archive = content->stats.archived;
+   content->ext.persistent_data = content->persistent;
+
+   content->stats.mapped  = content->map != NULL;
+   content->stats.load_ns = timer_ns() - start;
+   content->opened        = true;
+   return true;
+}
+
+bool content_hash(const struct content *content, uint64_t *hash)
+{
+   static uint8_t block[CONTENT_HASH_BLOCK];
+   struct stat st;
+   uint64_t h;
+   size_t   head, tail;
+   int      fd;
+
+   if (content->stats.archived)
+   {
+      *hash = content->member_hash;
+      return true;
+   }
+
+   fd = open(content->full_path, O_RDONLY);
+   if (fd < 0)
+      return false;
+   if (fstat(fd, &st) != 0)
+      goto error;
+
+   /* 先頭と末尾のブロックが重なる小さなファイルは全体を 1 度だけ混ぜます。 */
+   head = (uint64_t)st.st_size < CONTENT_HASH_BLOCK ? (size_t)st.st_size : CONTENT_HASH_BLOCK;
+   tail = (uint64_t)st.st_size - head < CONTENT_HASH_BLOCK
+      ? (size_t)((uint64_t)st.st_size - head) : CONTENT_HASH_BLOCK;
+
+   h = content_fnv_u64(CONTENT_FNV_BASIS, (uint64_t)st.st_size);
+   if (pread(fd, block, head, 0) != (ssize_t)head)
+      goto error;
+   h = content_fnv(h, block, head);
+   if (pread(fd, block, tail, (off_t)((uint64_t)st.st_size - tail)) != (ssize_t)tail)
+      goto error;
+   h = content_fnv(h, block, tail);
+
+   close(fd);
+   *hash = h;
+   return true;
+
+error:
+   close(fd);
+   return false;
+}
+
+static void content_release(struct content *content)
+{
+   if (content->map)
+      munmap(content->map, content->map_size);
+   free(content->heap);
+   content->map      = NULL;
+   content->map_size = 0;
+   content->heap     = NULL;
+}
+
+void content_loaded(struct content *content)
+{
+   if (content->persistent)
+      return;
+
+   content_release(content);
+   content->info.data = NULL;
+   content->info.size = 0;
+   content->ext.data  = NULL;
+   content->ext.size  = 0;
+}
+
+void content_close(struct content *content)
+{
+   content_release(content);
+   content->opened = false;
+}
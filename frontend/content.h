@@ -0,0 +1,85 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コンテンツの読み込みと RETRO_ENVIRONMENT_*_CONTENT_INFO_OVERRIDE /
+ * GET_GAME_INFO_EXT。
+ *
+ * "foo.zip#bar.sfc" (または "foo.zip") のようにアーカイブの中のファイルを指定された場合は、
+ * 展開したものをキャッシュディレクトリに "<アーカイブのハッシュ>-<メンバー名>" として置き、
+ * 次回からはそれを mmap() するだけで渡します。ハッシュは中央ディレクトリから求めるので、
+ * アーカイブ全体を読み直さずに中身の変化を見分けられます。
+ * 展開は一時ファイルに書いてから rename() するので、途中で止まっても壊れたキャッシュは残りません。
+ *
+ * 通常のファイルも、コアが SET_CONTENT_INFO_OVERRIDE でその拡張子に persistent_data を指定していれば
+ * ヒープにコピーせずに mmap() して渡します。
+ *
+ * マッピングは retro_game_info::data / retro_game_info_ext::data として渡し、retro_deinit() まで
+ * 保持します。ただし SET_CONTENT_INFO_OVERRIDE で persistent_data = false と指定された拡張子は、
+ * retro_load_game() が戻った時点で解放します。
+ */
+
+#ifndef RETROBENCH_CONTENT_H__
+#define RETROBENCH_CONTENT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define CONTENT_HASH_BLOCK (64 * 1024)
+
+struct content_stats
+{
+   bool     archived;      /* アーカイブの中のファイル */
+   bool     cache_hit;     /* 展開済みのキャッシュがあった */
+   bool     mapped;        /* data を mmap() で渡した */
+   uint64_t size;
+   uint64_t load_ns;       /* retro_load_game() を呼ぶまでにかかった時間 */
+};
+
+struct content
+{
+   struct retro_game_info     info;
+   struct retro_game_info_ext ext;
+   void    *heap;          /* ヒープに読んだ場合のバッファ */
+   void    *map;           /* mmap() した場合のマッピング */
+   size_t   map_size;
+   bool     persistent;    /* data を retro_deinit() まで保持する */
+   char     path[4096];    /* 指定されたパス。retro_game_info::path に渡します */
+   char     full_path[4096];
+   char     archive_path[4096];
+   char     archive_file[1024];
+   char     dir[4096];
+   char     name[256];
+   char     ext_name[32];
+   uint64_t member_hash;   /* アーカイブのメンバーの名前・サイズ・CRC32 の FNV-1a */
+   bool     opened;        /* content_open() が成功し、まだ content_close() していない */
+   struct content_stats stats;
+};
+
+/* 展開したコンテンツを置くディレクトリ。NULL なら $XDG_CACHE_HOME/retrobench/content
+ * ($XDG_CACHE_HOME がなければ ~/.cache) を使います。 */
+void content_set_cache_dir(const char *dir);
+
+/* RETRO_ENVIRONMENT_SET_CONTENT_INFO_OVERRIDE に応えます。NULL は対応の確認です。 */
+bool content_set_override(const struct retro_system_content_info_override *overrides);
+
+/* RETRO_ENVIRONMENT_GET_GAME_INFO_EXT に応えます。content は問い合わせてきたコアインスタンスのもので、
+ * 開いていなければ false を返します。 */
+bool content_get_info_ext(const struct content *content, const struct retro_game_info_ext **ext);
+
+/* path を読み込み、content->info に retro_load_game() へ渡す内容を用意します。 */
+bool content_open(struct content *content, const char *path, const struct retro_system_info *system);
+
+/* コンテンツを見分ける値を hash に入れます。アーカイブのメンバーは中央ディレクトリの名前・サイズ・CRC32 から、
+ * 通常のファイルはサイズと先頭・末尾の CONTENT_HASH_BLOCK バイトから求めるので、大きなディスクイメージでも
+ * 全体は読みません。ステートがどのコンテンツのものかを確かめるためのもので、完全な一致は保証しません。 */
+bool content_hash(const struct content *content, uint64_t *hash);
+
+/* retro_load_game() が戻った後に呼びます。persistent_data = false のバッファを解放します。 */
+void content_loaded(struct content *content);
+
+/* retro_deinit() の後に呼びます。 */
+void content_close(struct content *content);
+
+#endif
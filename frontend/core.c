@@ -0,0 +1,178 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアの動的読み込み。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include "core.h"
+#include "perf.h"
+#include "logger.h"
+
+#define CORE_SYMBOL(sym) \
+   do { \
+      *(void**)&core->sym = dlsym(core->handle, #sym); \
+      if (!core->sym) \
+      { \
+         fprintf(stderr, "[core] シンボル %s が見つかりません: %s\n", #sym, core->path); \
+         goto error; \
+      } \
+   } while (0)
+
+/* src を dst_template (mkstemp 形式) にコピーします。 */
+static bool core_copy_file(const char *src, char *dst_template)
+{
+   char buf[1 << 16];
+   ssize_t n;
+   int in  = open(src, O_RDONLY);
+   int out = -1;
+
+   if (in < 0)
+      return false;
+
+   out = mkstemp(dst_template);
+   if (out < 0)
+   {
+      close(in);
+      return false;
+   }
+
+   while ((n = read(in, buf, sizeof(buf))) > 0)
+   {
+      if (write(out, buf, (size_t)n) != n)
+      {
+         n = -1;
+         break;
+      }
+   }
+
+   close(in);
+   close(out);
+
+   if (n < 0)
+   {
+      unlink(dst_template);
+      return false;
+   }
+
+   return true;
+}
+
+bool core_load(struct core *core, const char *path, bool copy)
+{
+   const char *open_path = path;
+
+   memset(core, 0, sizeof(*core));
+   snprintf(core->path, sizeof(core->path), "%s", path);
+
+   if (copy)
+   {
+      snprintf(core->tmp_path, sizeof(core->tmp_path),
+            "/tmp/retrobench_core_XXXXXX");
+      if (!core_copy_file(path, core->tmp_path))
+      {
+         fprintf(stderr, "[core] コアのコピーに失敗しました: %s\n", path);
+         core->tmp_path[0] = '\0';
+         return false;
+      }
+      open_path = core->tmp_path;
+   }
+
+   core->handle = dlopen(open_path, RTLD_NOW | RTLD_LOCAL);
+   if (!core->handle)
+   {
+      fprintf(stderr, "[core] dlopen に失敗しました: %s\n", dlerror());
+      goto error;
+   }
+
+   CORE_SYMBOL(retro_set_environment);
+   CORE_SYMBOL(retro_set_video_refresh);
+   CORE_SYMBOL(retro_set_audio_sample);
+   CORE_SYMBOL(retro_set_audio_sample_batch);
+   CORE_SYMBOL(retro_set_input_poll);
+   CORE_SYMBOL(retro_set_input_state);
+   CORE_SYMBOL(retro_init);
+   CORE_SYMBOL(retro_deinit);
+   CORE_SYMBOL(retro_api_version);
+   CORE_SYMBOL(retro_get_system_info);
+   CORE_SYMBOL(retro_get_system_av_info);
+   CORE_SYMBOL(retro_set_controller_port_device);
+   CORE_SYMBOL(retro_reset);
+   CORE_SYMBOL(retro_run);
+   CORE_SYMBOL(retro_serialize_size);
+   CORE_SYMBOL(retro_serialize);
+   CORE_SYMBOL(retro_unserialize);
+   CORE_SYMBOL(retro_cheat_reset);
+   CORE_SYMBOL(retro_cheat_set);
+   CORE_SYMBOL(retro_load_game);
+   CORE_SYMBOL(retro_load_game_special);
+   CORE_SYMBOL(retro_unload_game);
+   CORE_SYMBOL(retro_get_region);
+   CORE_SYMBOL(retro_get_memory_data);
+   CORE_SYMBOL(retro_get_memory_size);
+
+   if (core->retro_api_version() != RETRO_API_VERSION)
+   {
+      fprintf(stderr, "[core] API バージョンが一致しません: %u != %u\n",
+            core->retro_api_version(), RETRO_API_VERSION);
+      goto error;
+   }
+
+   core->retro_get_system_info(&core->system_info);
+   return true;
+
+error:
+   core_unload(core);
+   return false;
+}
+
+void core_unload(struct core *core)
+{
+   if (core->game_loaded)
+      core->retro_unload_game();
+   if (core->initialized)
+      core->retro_deinit();
+   if (core->handle)
+   {
+      if (core->retro_run)
+         perf_forget_module(*(void**)&core->retro_run);
+      /* 出力スレッドがまだコアの書式文字列を読むかもしれません。 */
+      logger_flush();
+      dlclose(core->handle);
+   }
+   if (core->tmp_path[0])
+      unlink(core->tmp_path);
+
+   content_close(&core->content);
+
+   core->handle        = NULL;
+   core->tmp_path[0]   = '\0';
+   core->initialized   = false;
+   core->game_loaded   = false;
+}
+
+bool core_load_game(struct core *core, const char *path)
+{
+   bool loaded;
+
+   if (path && !content_open(&core->content, path, &core->system_info))
+      return false;
+
+   loaded = core->retro_load_game(path ? &core->content.info : NULL);
+   if (path)
+      content_loaded(&core->content);
+   if (!loaded)
+   {
+      fprintf(stderr, "[core] retro_load_game() が失敗しました\n");
+      return false;
+   }
+
+   core->game_loaded = true;
+   core->retro_get_system_av_info(&core->av_info);
+   return true;
+}
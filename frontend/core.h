@@ -0,0 +1,77 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - libretro.h を使ったヘッドレスのリファレンスフロントエンド。
+ * 本ディレクトリのソースは libretro.h と同じライセンスで提供されます。
+ */
+
+#ifndef RETROBENCH_CORE_H__
+#define RETROBENCH_CORE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libretro.h"
+#include "content.h"
+
+/* dlopen() したコアの関数テーブル。
+ * libretro コアはグローバル状態を持つため、同じ .so を複数回 dlopen() しても
+ * 同じインスタンスが返ってきます。別インスタンスが必要な場合は
+ * core_load() に copy = true を渡して一時ファイルにコピーしてから読み込みます。 */
+struct core
+{
+   void *handle;
+   char path[4096];
+   char tmp_path[4096];   /* copy = true で作成した一時ファイル。無ければ空文字列。 */
+
+   void (*retro_set_environment)(retro_environment_t);
+   void (*retro_set_video_refresh)(retro_video_refresh_t);
+   void (*retro_set_audio_sample)(retro_audio_sample_t);
+   void (*retro_set_audio_sample_batch)(retro_audio_sample_batch_t);
+   void (*retro_set_input_poll)(retro_input_poll_t);
+   void (*retro_set_input_state)(retro_input_state_t);
+
+   void (*retro_init)(void);
+   void (*retro_deinit)(void);
+   unsigned (*retro_api_version)(void);
+   void (*retro_get_system_info)(struct retro_system_info *info);
+   void (*retro_get_system_av_info)(struct retro_system_av_info *info);
+   void (*retro_set_controller_port_device)(unsigned port, unsigned device);
+   void (*retro_reset)(void);
+   void (*retro_run)(void);
+   size_t (*retro_serialize_size)(void);
+   bool (*retro_serialize)(void *data, size_t size);
+   bool (*retro_unserialize)(const void *data, size_t size);
+   void (*retro_cheat_reset)(void);
+   void (*retro_cheat_set)(unsigned index, bool enabled, const char *code);
+   bool (*retro_load_game)(const struct retro_game_info *game);
+   bool (*retro_load_game_special)(unsigned game_type,
+         const struct retro_game_info *info, size_t num_info);
+   void (*retro_unload_game)(void);
+   unsigned (*retro_get_region)(void);
+   void *(*retro_get_memory_data)(unsigned id);
+   size_t (*retro_get_memory_size)(unsigned id);
+
+   struct retro_system_info system_info;
+   struct retro_system_av_info av_info;
+
+   /* retro_load_game() に渡したコンテンツ。data は retro_deinit() まで保持します。 */
+   struct content content;
+
+   bool initialized;
+   bool game_loaded;
+};
+
+/* コアを読み込み、すべてのシンボルを解決します。
+ * 失敗した場合は false を返し、理由を stderr に出力します。 */
+bool core_load(struct core *core, const char *path, bool copy);
+
+/* ゲームをアンロードし、retro_deinit() を呼んでから dlclose() します。 */
+void core_unload(struct core *core);
+
+/* コンテンツを読み込み、retro_load_game() を呼びます。
+ * path が NULL の場合はコンテンツなしで起動します。
+ * need_fullpath でないコアにはファイル全体をメモリに読み込んで渡します。
+ * zip の中のファイルは content.h のキャッシュを通して渡します。 */
+bool core_load_game(struct core *core, const char *path);
+
+#endif
@@ -0,0 +1,256 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_get_cpu_features_t の実装。
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cpu_features.h"
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
+
+struct cpu_feature_name
+{
+   const char *name;
+   uint64_t    bit;
+};
+
+static const struct cpu_feature_name cpu_feature_names[] = {
+   { "mmx",        RETRO_SIMD_MMX },
+   { "mmxext",     RETRO_SIMD_MMXEXT },
+   { "cmov",       RETRO_SIMD_CMOV },
+   { "sse",        RETRO_SIMD_SSE },
+   { "sse2",       RETRO_SIMD_SSE2 },
+   { "sse3",       RETRO_SIMD_SSE3 },
+   { "ssse3",      RETRO_SIMD_SSSE3 },
+   { "sse4",       RETRO_SIMD_SSE4 },
+   { "sse42",      RETRO_SIMD_SSE42 },
+   { "popcnt",     RETRO_SIMD_POPCNT },
+   { "movbe",      RETRO_SIMD_MOVBE },
+   { "aes",        RETRO_SIMD_AES },
+   { "avx",        RETRO_SIMD_AVX },
+   { "avx2",       RETRO_SIMD_AVX2 },
+   { "fma3",       CPU_FEATURE_FMA3 },
+   { "f16c",       CPU_FEATURE_F16C },
+   { "bmi1",       CPU_FEATURE_BMI1 },
+   { "bmi2",       CPU_FEATURE_BMI2 },
+   { "avx512f",    CPU_FEATURE_AVX512F },
+   { "avx512dq",   CPU_FEATURE_AVX512DQ },
+   { "avx512bw",   CPU_FEATURE_AVX512BW },
+   { "avx512vl",   CPU_FEATURE_AVX512VL },
+   { "avx512vbmi", CPU_FEATURE_AVX512VBMI },
+   { "neon",       RETRO_SIMD_NEON },
+   { "asimd",      RETRO_SIMD_ASIMD },
+   { "sve",        CPU_FEATURE_SVE },
+   { "sve2",       CPU_FEATURE_SVE2 },
+   { "vmx",        RETRO_SIMD_VMX },
+   { "vmx128",     RETRO_SIMD_VMX128 },
+   { "vfpu",       RETRO_SIMD_VFPU },
+   { "ps",         RETRO_SIMD_PS },
+   { "vfpv3",      RETRO_SIMD_VFPV3 },
+   { "vfpv4",      RETRO_SIMD_VFPV4 },
+};
+
+/* 機能と、それを使うのに必要な機能。前提になるものが先に来るように並べます。 */
+struct cpu_feature_dep
+{
+   uint64_t bit;
+   uint64_t requires;
+};
+
+static const struct cpu_feature_dep cpu_feature_deps[] = {
+   { RETRO_SIMD_SSE2,        RETRO_SIMD_SSE },
+   { RETRO_SIMD_SSE3,        RETRO_SIMD_SSE2 },
+   { RETRO_SIMD_SSSE3,       RETRO_SIMD_SSE3 },
+   { RETRO_SIMD_SSE4,        RETRO_SIMD_SSSE3 },
+   { RETRO_SIMD_SSE42,       RETRO_SIMD_SSE4 },
+   { RETRO_SIMD_AVX,         RETRO_SIMD_SSE42 },
+   { RETRO_SIMD_AVX2,        RETRO_SIMD_AVX },
+   { CPU_FEATURE_FMA3,       RETRO_SIMD_AVX },
+   { CPU_FEATURE_F16C,       RETRO_SIMD_AVX },
+   { CPU_FEATURE_AVX512F,    RETRO_SIMD_AVX2 | CPU_FEATURE_FMA3 | CPU_FEATURE_F16C },
+   { CPU_FEATURE_AVX512DQ,   CPU_FEATURE_AVX512F },
+   { CPU_FEATURE_AVX512BW,   CPU_FEATURE_AVX512F },
+   { CPU_FEATURE_AVX512VL,   CPU_FEATURE_AVX512F },
+   { CPU_FEATURE_AVX512VBMI, CPU_FEATURE_AVX512BW },
+   { RETRO_SIMD_ASIMD,       RETRO_SIMD_NEON },
+   { CPU_FEATURE_SVE,        RETRO_SIMD_ASIMD },
+   { CPU_FEATURE_SVE2,       CPU_FEATURE_SVE },
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+
+/* OS が YMM / ZMM レジスタの保存に対応しているかを XCR0 で確認します。 */
+static uint64_t cpu_features_xgetbv(void)
+{
+   uint32_t eax, edx;
+   __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+   return ((uint64_t)edx << 32) | eax;
+}
+
+static uint64_t cpu_features_detect(void)
+{
+   unsigned eax, ebx, ecx, edx;
+   uint64_t cpu     = 0;
+   uint64_t xcr0    = 0;
+   unsigned max_std = __get_cpuid_max(0, NULL);
+   bool     ymm     = false;
+   bool     zmm     = false;
+
+   if (max_std < 1)
+      return 0;
+
+   __cpuid(1, eax, ebx, ecx, edx);
+
+   if (edx & (1 << 15)) cpu |= RETRO_SIMD_CMOV;
+   if (edx & (1 << 23)) cpu |= RETRO_SIMD_MMX;
+   if (edx & (1 << 25)) cpu |= RETRO_SIMD_SSE | RETRO_SIMD_MMXEXT;
+   if (edx & (1 << 26)) cpu |= RETRO_SIMD_SSE2;
+   if (ecx & (1 <<  0)) cpu |= RETRO_SIMD_SSE3;
+   if (ecx & (1 <<  9)) cpu |= RETRO_SIMD_SSSE3;
+   if (ecx & (1 << 19)) cpu |= RETRO_SIMD_SSE4;
+   if (ecx & (1 << 20)) cpu |= RETRO_SIMD_SSE42;
+   if (ecx & (1 << 22)) cpu |= RETRO_SIMD_MOVBE;
+   if (ecx & (1 << 23)) cpu |= RETRO_SIMD_POPCNT;
+   if (ecx & (1 << 25)) cpu |= RETRO_SIMD_AES;
+
+   /* XCR0 の bit 1-2 は XMM/YMM、bit 5-7 は opmask と ZMM の上下半分です。 */
+   if (ecx & (1 << 27))
+      xcr0 = cpu_features_xgetbv();
+   ymm = (xcr0 & 0x06) == 0x06;
+   zmm = (xcr0 & 0xE6) == 0xE6;
+
+   if (ymm && (ecx & (1 << 28))) cpu |= RETRO_SIMD_AVX;
+   if (ymm && (ecx & (1 << 12))) cpu |= CPU_FEATURE_FMA3;
+   if (ymm && (ecx & (1 << 29))) cpu |= CPU_FEATURE_F16C;
+
+   if (max_std >= 7)
+   {
+      __cpuid_count(7, 0, eax, ebx, ecx, edx);
+      if (ymm && (ebx & (1 << 5)))
+         cpu |= RETRO_SIMD_AVX2;
+      if (ebx & (1 << 3)) cpu |= CPU_FEATURE_BMI1;
+      if (ebx & (1 << 8)) cpu |= CPU_FEATURE_BMI2;
+
+      if (zmm && (ebx & (1 << 16)))
+      {
+         cpu |= CPU_FEATURE_AVX512F;
+         if (ebx & (1u << 17)) cpu |= CPU_FEATURE_AVX512DQ;
+         if (ebx & (1u << 30)) cpu |= CPU_FEATURE_AVX512BW;
+         if (ebx & (1u << 31)) cpu |= CPU_FEATURE_AVX512VL;
+         if (ecx & (1u <<  1)) cpu |= CPU_FEATURE_AVX512VBMI;
+      }
+   }
+
+   return cpu;
+}
+#else
+static uint64_t cpu_features_detect(void)
+{
+   uint64_t cpu = 0;
+#if defined(__aarch64__)
+   cpu |= RETRO_SIMD_NEON | RETRO_SIMD_ASIMD;
+#if defined(__linux__)
+   {
+      unsigned long hwcap  = getauxval(AT_HWCAP);
+      unsigned long hwcap2 = getauxval(AT_HWCAP2);
+      /* HWCAP_SVE / HWCAP2_SVE2。古いヘッダーにはないので値で書きます。 */
+      if (hwcap & (1ul << 22))
+         cpu |= CPU_FEATURE_SVE;
+      if (hwcap2 & (1ul << 1))
+         cpu |= CPU_FEATURE_SVE2;
+   }
+#endif
+#elif defined(__ARM_NEON)
+   cpu |= RETRO_SIMD_NEON;
+#endif
+   return cpu;
+}
+#endif
+
+static uint64_t cpu_features;
+static uint64_t cpu_features_disabled;
+static bool     cpu_features_detected;
+
+uint64_t cpu_features_ext(void)
+{
+   uint64_t cpu;
+   unsigned i;
+
+   if (!cpu_features_detected)
+   {
+      cpu_features          = cpu_features_detect();
+      cpu_features_detected = true;
+   }
+
+   /* 土台の機能を外したら、それを前提にする拡張もまとめて外します。
+    * 表は前提が先に来る順なので、1 度なめるだけで連鎖がすべて伝わります。 */
+   cpu = cpu_features & ~cpu_features_disabled;
+   for (i = 0; i < sizeof(cpu_feature_deps) / sizeof(cpu_feature_deps[0]); i++)
+      if ((cpu & cpu_feature_deps[i].requires) != cpu_feature_deps[i].requires)
+         cpu &= ~cpu_feature_deps[i].bit;
+   return cpu;
+}
+
+uint64_t RETRO_CALLCONV cpu_features_get(void)
+{
+   return cpu_features_ext() & CPU_FEATURE_RETRO_MASK;
+}
+
+void cpu_features_disable(uint64_t mask)
+{
+   cpu_features_disabled |= mask;
+}
+
+bool cpu_features_parse(const char *names, uint64_t *mask)
+{
+   const char *p = names;
+
+   *mask = 0;
+   while (*p)
+   {
+      size_t   len = strcspn(p, ",");
+      unsigned i;
+
+      for (i = 0; i < sizeof(cpu_feature_names) / sizeof(cpu_feature_names[0]); i++)
+         if (strlen(cpu_feature_names[i].name) == len
+               && strncmp(cpu_feature_names[i].name, p, len) == 0)
+            break;
+      if (i == sizeof(cpu_feature_names) / sizeof(cpu_feature_names[0]))
+         return false;
+
+      *mask |= cpu_feature_names[i].bit;
+      p     += len;
+      if (*p == ',')
+         p++;
+   }
+
+   return true;
+}
+
+size_t cpu_features_string(uint64_t mask, char *buf, size_t size)
+{
+   size_t   len = 0;
+   unsigned i;
+
+   if (size)
+      buf[0] = '\0';
+
+   for (i = 0; i < sizeof(cpu_feature_names) / sizeof(cpu_feature_names[0]); i++)
+   {
+      int n;
+
+      if (!(mask & cpu_feature_names[i].bit))
+         continue;
+      n = snprintf(buf + len, size - len, "%s%s", len ? " " : "", cpu_feature_names[i].name);
+      if (n < 0 || (size_t)n >= size - len)
+         break;
+      len += (size_t)n;
+   }
+
+   return len;
+}
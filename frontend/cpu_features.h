@@ -0,0 +1,52 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_get_cpu_features_t の実装。
+ *
+ * RETRO_SIMD_* は ASIMD までしか定義がないので、それ以降の拡張命令
+ * (AVX-512, BMI2, F16C, SVE など) は CPU_FEATURE_* として上位 32 ビットに置きます。
+ * コアに返す cpu_features_get() は RETRO_SIMD_* のビットだけを返し、
+ * フロントエンドの部品は cpu_features_ext() で両方を見ます。
+ */
+
+#ifndef RETROBENCH_CPU_FEATURES_H__
+#define RETROBENCH_CPU_FEATURES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define CPU_FEATURE_FMA3       (UINT64_C(1) << 32)
+#define CPU_FEATURE_F16C       (UINT64_C(1) << 33)
+#define CPU_FEATURE_BMI1       (UINT64_C(1) << 34)
+#define CPU_FEATURE_BMI2       (UINT64_C(1) << 35)
+#define CPU_FEATURE_AVX512F    (UINT64_C(1) << 36)
+#define CPU_FEATURE_AVX512DQ   (UINT64_C(1) << 37)
+#define CPU_FEATURE_AVX512BW   (UINT64_C(1) << 38)
+#define CPU_FEATURE_AVX512VL   (UINT64_C(1) << 39)
+#define CPU_FEATURE_AVX512VBMI (UINT64_C(1) << 40)
+#define CPU_FEATURE_SVE        (UINT64_C(1) << 41)
+#define CPU_FEATURE_SVE2       (UINT64_C(1) << 42)
+
+/* RETRO_SIMD_* が使う範囲。 */
+#define CPU_FEATURE_RETRO_MASK UINT64_C(0xFFFFFFFF)
+
+/* 実行中の CPU が対応する RETRO_SIMD_* のビットマスクを返します。
+ * 初回の呼び出しで検出し、以降はキャッシュした値を返します。 */
+uint64_t RETRO_CALLCONV cpu_features_get(void);
+
+/* RETRO_SIMD_* と CPU_FEATURE_* を合わせたビットマスクを返します。 */
+uint64_t cpu_features_ext(void);
+
+/* 指定したビットを検出しなかったことにします。遅い側の実装を試すときに使います。 */
+void cpu_features_disable(uint64_t mask);
+
+/* "avx512f,bmi2" のようなカンマ区切りの名前をビットマスクにします。
+ * 知らない名前があれば false を返します。 */
+bool cpu_features_parse(const char *names, uint64_t *mask);
+
+/* mask のビットを名前の空白区切りで buf に書きます。書いた長さを返します。 */
+size_t cpu_features_string(uint64_t mask, char *buf, size_t size);
+
+#endif
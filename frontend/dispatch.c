@@ -0,0 +1,96 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - ホットなカーネルの実装を CPU の機能で選ぶ登録表。
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "cpu_features.h"
+
+struct dispatch_kernel
+{
+   const char *name;
+   const struct dispatch_variant *variants;
+   unsigned count;
+   const void **slot;
+   const struct dispatch_variant *bound;
+};
+
+static struct dispatch_kernel dispatch_kernels[DISPATCH_MAX_KERNELS];
+static unsigned dispatch_count;
+static uint64_t dispatch_features;
+static bool     dispatch_bound_once;
+
+static void dispatch_select(struct dispatch_kernel *k, uint64_t features)
+{
+   unsigned i;
+
+   for (i = 0; i + 1 < k->count; i++)
+      if ((k->variants[i].features & features) == k->variants[i].features)
+         break;
+
+   k->bound = &k->variants[i];
+   *k->slot = k->bound->impl;
+}
+
+static void dispatch_log(const struct dispatch_kernel *k)
+{
+   char buf[128];
+
+   cpu_features_string(k->bound->features, buf, sizeof(buf));
+   fprintf(stderr, "dispatch: %-16s %-8s (%u 個の実装から選択%s%s)\n",
+         k->name, k->bound->name, k->count, buf[0] ? "、必要な機能: " : "", buf);
+}
+
+bool dispatch_register(const char *kernel, const struct dispatch_variant *variants,
+      unsigned count, const void **slot)
+{
+   struct dispatch_kernel *k;
+
+   if (dispatch_count == DISPATCH_MAX_KERNELS)
+   {
+      *slot = variants[count - 1].impl;
+      return false;
+   }
+
+   k           = &dispatch_kernels[dispatch_count++];
+   k->name     = kernel;
+   k->variants = variants;
+   k->count    = count;
+   k->slot     = slot;
+   dispatch_select(k, dispatch_bound_once ? dispatch_features : 0);
+   if (dispatch_bound_once)
+      dispatch_log(k);
+   return true;
+}
+
+void dispatch_bind(uint64_t features)
+{
+   unsigned i;
+   char buf[512];
+
+   dispatch_features   = features;
+   dispatch_bound_once = true;
+
+   cpu_features_string(features, buf, sizeof(buf));
+   fprintf(stderr, "dispatch: cpu %s\n", buf);
+
+   for (i = 0; i < dispatch_count; i++)
+   {
+      dispatch_select(&dispatch_kernels[i], features);
+      dispatch_log(&dispatch_kernels[i]);
+   }
+}
+
+const struct dispatch_variant *dispatch_bound(const char *kernel)
+{
+   unsigned i;
+
+   for (i = 0; i < dispatch_count; i++)
+      if (strcmp(dispatch_kernels[i].name, kernel) == 0)
+         return dispatch_kernels[i].bound;
+
+   return NULL;
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - ホットなカーネルの実装を CPU の機能で選ぶ登録表。
+ *
+ * 部品は同じカーネルの実装 (AVX-512 / AVX2 / SSE2 / スカラーなど) を優先度順に
+ * dispatch_register() で登録します。dispatch_bind() は retro_init() の直前に 1 度だけ呼び、
+ * 各カーネルで必要な機能がすべてそろう最初の実装を slot に書き込みます。
+ * 以降の呼び出し側は slot を読むだけで、CPU の機能を調べ直すことはありません。
+ *
+ * 実装 (impl) は関数の表を持つ構造体などを指す任意のポインタです。
+ * 最後の実装は features = 0 の、どの CPU でも動くものにしてください。
+ */
+
+#ifndef RETROBENCH_DISPATCH_H__
+#define RETROBENCH_DISPATCH_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DISPATCH_MAX_KERNELS 32
+
+struct dispatch_variant
+{
+   const char *name;
+   uint64_t    features;      /* 必要な RETRO_SIMD_* / CPU_FEATURE_* のビット */
+   const void *impl;
+};
+
+/* カーネルを登録します。dispatch_bind() より後に登録した場合はその場で選びます。
+ * 表が一杯なら false を返し、slot には最後の実装を書きます。 */
+bool dispatch_register(const char *kernel, const struct dispatch_variant *variants,
+      unsigned count, const void **slot);
+
+/* features (cpu_features_ext() の戻り値) で登録済みの全カーネルを選び直し、
+ * 選んだ実装を標準エラーに 1 行ずつ書きます。 */
+void dispatch_bind(uint64_t features);
+
+/* kernel に選ばれている実装を返します。登録されていなければ NULL です。 */
+const struct dispatch_variant *dispatch_bound(const char *kernel);
+
+#endif
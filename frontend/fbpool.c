@@ -0,0 +1,117 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER 用のバッファプール。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fbpool.h"
+
+#define FBPOOL_ALIGN 64
+
+struct fbpool fbpool = { { NULL }, 0, 0, 0, 0, RETRO_PIXEL_FORMAT_0RGB1555, -1, -1, 0, 0, 0 };
+
+static unsigned fbpool_bpp(enum retro_pixel_format format)
+{
+   return format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+}
+
+bool fbpool_init(unsigned max_width, unsigned max_height,
+      enum retro_pixel_format format)
+{
+   unsigned i;
+
+   fbpool_free();
+
+   fbpool.pitch       = ((size_t)max_width * fbpool_bpp(format) + FBPOOL_ALIGN - 1)
+                      & ~(size_t)(FBPOOL_ALIGN - 1);
+   fbpool.buffer_size = fbpool.pitch * max_height;
+   fbpool.max_width   = max_width;
+   fbpool.max_height  = max_height;
+   fbpool.format      = format;
+
+   for (i = 0; i < FBPOOL_BUFFERS; i++)
+   {
+      void *ptr = NULL;
+      if (posix_memalign(&ptr, FBPOOL_ALIGN, fbpool.buffer_size) != 0)
+      {
+         fbpool_free();
+         return false;
+      }
+      fbpool.buffers[i] = (uint8_t*)ptr;
+   }
+
+   return true;
+}
+
+void fbpool_free(void)
+{
+   unsigned i;
+
+   for (i = 0; i < FBPOOL_BUFFERS; i++)
+      free(fbpool.buffers[i]);
+
+   memset(&fbpool, 0, sizeof(fbpool));
+   fbpool.writing   = -1;
+   fbpool.presented = -1;
+}
+
+bool fbpool_get_framebuffer(struct retro_framebuffer *fb)
+{
+   unsigned i;
+
+   if (!fbpool.buffers[0])
+      return false;
+   if (fb->width > fbpool.max_width || fb->height > fbpool.max_height)
+      return false;
+   if (fb->access_flags & ~(unsigned)(RETRO_MEMORY_ACCESS_READ | RETRO_MEMORY_ACCESS_WRITE))
+      return false;
+
+   /* 同じ retro_run() の中で何度呼ばれても同じバッファを返します。
+    * それ以外は表示中でないバッファを順に選ぶので、コアが表示中のフレームを壊すことはありません。 */
+   if (fbpool.writing < 0)
+   {
+      for (i = 0; i < FBPOOL_BUFFERS; i++)
+      {
+         unsigned index = (fbpool.next + i) % FBPOOL_BUFFERS;
+         if ((int)index != fbpool.presented)
+         {
+            fbpool.writing = (int)index;
+            fbpool.next    = (index + 1) % FBPOOL_BUFFERS;
+            break;
+         }
+      }
+   }
+
+   /* ヒープ上の通常のメモリなので、読み出しを要求されても常にキャッシュ有効です。 */
+   fb->data         = fbpool.buffers[fbpool.writing];
+   fb->pitch        = fbpool.pitch;
+   fb->format       = fbpool.format;
+   fb->memory_flags = RETRO_MEMORY_TYPE_CACHED;
+   fbpool.acquires++;
+   return true;
+}
+
+int fbpool_find(const void *ptr)
+{
+   int i;
+
+   if (!ptr)
+      return -1;
+
+   for (i = 0; i < FBPOOL_BUFFERS; i++)
+      if (ptr == fbpool.buffers[i])
+         return i;
+
+   return -1;
+}
+
+void fbpool_submit(int index)
+{
+   /* retro_run() が戻った後はコアに渡したバッファは使われないので、描画中の印も外します。 */
+   fbpool.presented = index;
+   fbpool.writing   = -1;
+   if (index >= 0)
+      fbpool.submits++;
+}
@@ -0,0 +1,57 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER 用のバッファプール。
+ *
+ * キャッシュライン境界に揃えたフレームバッファを 3 枚持ち、
+ * コアが描画中の 1 枚、表示側が読んでいる 1 枚、予備の 1 枚を回します。
+ * コアがプールのバッファをそのまま retro_video_refresh_t に渡した場合、
+ * 映像パイプラインはコピーせずにそのバッファを表示側に渡せます。
+ */
+
+#ifndef RETROBENCH_FBPOOL_H__
+#define RETROBENCH_FBPOOL_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define FBPOOL_BUFFERS 3
+
+struct fbpool
+{
+   uint8_t  *buffers[FBPOOL_BUFFERS];
+   size_t    buffer_size;
+   unsigned  max_width;
+   unsigned  max_height;
+   size_t    pitch;            /* 64 バイト境界に揃えた行のバイト数 */
+   enum retro_pixel_format format;
+
+   int       writing;          /* コアに渡しているバッファ。無ければ -1 */
+   int       presented;        /* 表示側が保持しているバッファ。無ければ -1 */
+   unsigned  next;             /* 次に試すバッファ */
+
+   uint64_t  acquires;         /* GET_CURRENT_SOFTWARE_FRAMEBUFFER に応えた回数 */
+   uint64_t  submits;          /* プールのバッファが video_refresh に渡された回数 */
+};
+
+extern struct fbpool fbpool;
+
+/* format のピクセルで max_width × max_height を描けるバッファを 3 枚確保します。 */
+bool fbpool_init(unsigned max_width, unsigned max_height,
+      enum retro_pixel_format format);
+void fbpool_free(void);
+
+/* GET_CURRENT_SOFTWARE_FRAMEBUFFER の実装です。
+ * 幅・高さ・アクセスフラグを確認し、data/pitch/format/memory_flags を埋めます。 */
+bool fbpool_get_framebuffer(struct retro_framebuffer *fb);
+
+/* ptr がプールのバッファの先頭であれば、そのインデックスを返します。無ければ -1 。 */
+int fbpool_find(const void *ptr);
+
+/* video_refresh に渡されたプールのバッファを表示中にし、以前表示していたものを返却します。
+ * index が -1 (プール外のフレーム) の場合は、表示中・描画中のバッファをすべて返却します。 */
+void fbpool_submit(int index);
+
+#endif
@@ -0,0 +1,396 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 同じ内容のフレームを見分けるための 64 ビットのハッシュ。
+ *
+ * ブロック s のレーン j の鍵は framehash_keys[j] + s * FRAMEHASH_STEP です。
+ * SIMD のカーネルは鍵のベクトルに FRAMEHASH_STEP を足しながら進め、
+ * 行の末尾の端数だけスカラーの framehash_tail() で処理します。
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRAMEHASH_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FRAMEHASH_NEON
+#endif
+
+#include "framehash.h"
+#include "cpu_features.h"
+#include "dispatch.h"
+
+#define FRAMEHASH_BLOCK 64
+#define FRAMEHASH_STEP  0x9E3779B97F4A7C15ull
+
+static const uint64_t framehash_keys[FRAMEHASH_LANES] = {
+   0xBE4BA423396CFEB8ull, 0x1CAD21F72C81017Cull, 0xDB979083E96DD4DEull, 0x1F67B3B7A4A44072ull,
+   0x78E5C0CC4EE679CBull, 0x2172FFCC7DD05A82ull, 0x8E2443F7744608B8ull, 0x4C263A81E69035E0ull,
+};
+
+static inline void framehash_block(uint64_t *acc, const uint8_t *p, uint64_t s)
+{
+   unsigned j;
+
+   for (j = 0; j < FRAMEHASH_LANES; j++)
+   {
+      uint64_t d, dk;
+
+      memcpy(&d, p + j * 8, 8);
+      dk      = d ^ (framehash_keys[j] + s * FRAMEHASH_STEP);
+      acc[j] += (dk & 0xFFFFFFFFu) * (dk >> 32) + d;
+   }
+}
+
+/* 64 バイトに満たない行末を 0 で埋めて 1 ブロックとして積み上げます。 */
+static void framehash_tail(uint64_t *acc, const uint8_t *p, size_t bytes, uint64_t s)
+{
+   uint8_t block[FRAMEHASH_BLOCK] = { 0 };
+
+   memcpy(block, p, bytes);
+   framehash_block(acc, block, s);
+}
+
+static void framehash_rows_scalar(uint64_t *acc, const uint8_t *data, size_t pitch,
+      size_t row_bytes, unsigned height)
+{
+   uint64_t s = 0;
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      const uint8_t *row = data + y * pitch;
+      size_t x;
+
+      for (x = 0; x + FRAMEHASH_BLOCK <= row_bytes; x += FRAMEHASH_BLOCK)
+         framehash_block(acc, row + x, s++);
+      if (x < row_bytes)
+         framehash_tail(acc, row + x, row_bytes - x, s++);
+   }
+}
+
+#if defined(FRAMEHASH_X86)
+/* a += lo32(d ^ k) * hi32(d ^ k) + d */
+#define FRAMEHASH_SSE2_LANE(a, k, p) do { \
+   __m128i d_  = _mm_loadu_si128((const __m128i*)(p)); \
+   __m128i dk_ = _mm_xor_si128(d_, k); \
+   a = _mm_add_epi64(a, _mm_add_epi64(_mm_mul_epu32(dk_, _mm_srli_epi64(dk_, 32)), d_)); \
+} while (0)
+
+__attribute__((target("sse2")))
+static void framehash_rows_sse2(uint64_t *acc, const uint8_t *data, size_t pitch,
+      size_t row_bytes, unsigned height)
+{
+   const __m128i step = _mm_set1_epi64x((long long)FRAMEHASH_STEP);
+   __m128i a0 = _mm_loadu_si128((const __m128i*)acc);
+   __m128i a1 = _mm_loadu_si128((const __m128i*)(acc + 2));
+   __m128i a2 = _mm_loadu_si128((const __m128i*)(acc + 4));
+   __m128i a3 = _mm_loadu_si128((const __m128i*)(acc + 6));
+   __m128i k0 = _mm_loadu_si128((const __m128i*)framehash_keys);
+   __m128i k1 = _mm_loadu_si128((const __m128i*)(framehash_keys + 2));
+   __m128i k2 = _mm_loadu_si128((const __m128i*)(framehash_keys + 4));
+   __m128i k3 = _mm_loadu_si128((const __m128i*)(framehash_keys + 6));
+   uint64_t s = 0;
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      const uint8_t *row = data + y * pitch;
+      size_t x;
+
+      for (x = 0; x + FRAMEHASH_BLOCK <= row_bytes; x += FRAMEHASH_BLOCK, s++)
+      {
+         FRAMEHASH_SSE2_LANE(a0, k0, row + x);
+         FRAMEHASH_SSE2_LANE(a1, k1, row + x + 16);
+         FRAMEHASH_SSE2_LANE(a2, k2, row + x + 32);
+         FRAMEHASH_SSE2_LANE(a3, k3, row + x + 48);
+         k0 = _mm_add_epi64(k0, step);
+         k1 = _mm_add_epi64(k1, step);
+         k2 = _mm_add_epi64(k2, step);
+         k3 = _mm_add_epi64(k3, step);
+      }
+
+      if (x < row_bytes)
+      {
+         _mm_storeu_si128((__m128i*)acc,       a0);
+         _mm_storeu_si128((__m128i*)(acc + 2), a1);
+         _mm_storeu_si128((__m128i*)(acc + 4), a2);
+         _mm_storeu_si128((__m128i*)(acc + 6), a3);
+         framehash_tail(acc, row + x, row_bytes - x, s++);
+         a0 = _mm_loadu_si128((const __m128i*)acc);
+         a1 = _mm_loadu_si128((const __m128i*)(acc + 2));
+         a2 = _mm_loadu_si128((const __m128i*)(acc + 4));
+         a3 = _mm_loadu_si128((const __m128i*)(acc + 6));
+         k0 = _mm_add_epi64(k0, step);
+         k1 = _mm_add_epi64(k1, step);
+         k2 = _mm_add_epi64(k2, step);
+         k3 = _mm_add_epi64(k3, step);
+      }
+   }
+
+   _mm_storeu_si128((__m128i*)acc,       a0);
+   _mm_storeu_si128((__m128i*)(acc + 2), a1);
+   _mm_storeu_si128((__m128i*)(acc + 4), a2);
+   _mm_storeu_si128((__m128i*)(acc + 6), a3);
+}
+
+#define FRAMEHASH_AVX2_LANE(a, k, p) do { \
+   __m256i d_  = _mm256_loadu_si256((const __m256i*)(p)); \
+   __m256i dk_ = _mm256_xor_si256(d_, k); \
+   a = _mm256_add_epi64(a, _mm256_add_epi64(_mm256_mul_epu32(dk_, _mm256_srli_epi64(dk_, 32)), d_)); \
+} while (0)
+
+/* 加算の連鎖が 1 本だと遅延で律速するので、偶数と奇数のブロックを別のアキュムレーターに積み、
+ * 最後に足し合わせます。足し算の順序が変わるだけなので値はスカラー版と同じです。 */
+__attribute__((target("avx2")))
+static void framehash_rows_avx2(uint64_t *acc, const uint8_t *data, size_t pitch,
+      size_t row_bytes, unsigned height)
+{
+   const __m256i step  = _mm256_set1_epi64x((long long)FRAMEHASH_STEP);
+   const __m256i step2 = _mm256_add_epi64(step, step);
+   __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+   __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+   __m256i b0 = _mm256_setzero_si256();
+   __m256i b1 = _mm256_setzero_si256();
+   __m256i k0 = _mm256_loadu_si256((const __m256i*)framehash_keys);
+   __m256i k1 = _mm256_loadu_si256((const __m256i*)(framehash_keys + 4));
+   uint64_t s = 0;
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      const uint8_t *row = data + y * pitch;
+      size_t x;
+
+      for (x = 0; x + 2 * FRAMEHASH_BLOCK <= row_bytes; x += 2 * FRAMEHASH_BLOCK, s += 2)
+      {
+         __m256i j0 = _mm256_add_epi64(k0, step);
+         __m256i j1 = _mm256_add_epi64(k1, step);
+
+         FRAMEHASH_AVX2_LANE(a0, k0, row + x);
+         FRAMEHASH_AVX2_LANE(a1, k1, row + x + 32);
+         FRAMEHASH_AVX2_LANE(b0, j0, row + x + 64);
+         FRAMEHASH_AVX2_LANE(b1, j1, row + x + 96);
+         k0 = _mm256_add_epi64(k0, step2);
+         k1 = _mm256_add_epi64(k1, step2);
+      }
+
+      if (x + FRAMEHASH_BLOCK <= row_bytes)
+      {
+         FRAMEHASH_AVX2_LANE(a0, k0, row + x);
+         FRAMEHASH_AVX2_LANE(a1, k1, row + x + 32);
+         k0 = _mm256_add_epi64(k0, step);
+         k1 = _mm256_add_epi64(k1, step);
+         x += FRAMEHASH_BLOCK;
+         s++;
+      }
+
+      if (x < row_bytes)
+      {
+         _mm256_storeu_si256((__m256i*)acc,       _mm256_add_epi64(a0, b0));
+         _mm256_storeu_si256((__m256i*)(acc + 4), _mm256_add_epi64(a1, b1));
+         framehash_tail(acc, row + x, row_bytes - x, s++);
+         a0 = _mm256_loadu_si256((const __m256i*)acc);
+         a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+         b0 = _mm256_setzero_si256();
+         b1 = _mm256_setzero_si256();
+         k0 = _mm256_add_epi64(k0, step);
+         k1 = _mm256_add_epi64(k1, step);
+      }
+   }
+
+   _mm256_storeu_si256((__m256i*)acc,       _mm256_add_epi64(a0, b0));
+   _mm256_storeu_si256((__m256i*)(acc + 4), _mm256_add_epi64(a1, b1));
+}
+
+#define FRAMEHASH_AVX512_LANE(a, k, p) do { \
+   __m512i d_  = _mm512_loadu_si512((const void*)(p)); \
+   __m512i dk_ = _mm512_xor_si512(d_, k); \
+   a = _mm512_add_epi64(a, _mm512_add_epi64(_mm512_mul_epu32(dk_, _mm512_srli_epi64(dk_, 32)), d_)); \
+} while (0)
+
+__attribute__((target("avx512f")))
+static void framehash_rows_avx512(uint64_t *acc, const uint8_t *data, size_t pitch,
+      size_t row_bytes, unsigned height)
+{
+   const __m512i step  = _mm512_set1_epi64((long long)FRAMEHASH_STEP);
+   const __m512i step2 = _mm512_add_epi64(step, step);
+   __m512i a = _mm512_loadu_si512((const void*)acc);
+   __m512i b = _mm512_setzero_si512();
+   __m512i k = _mm512_loadu_si512((const void*)framehash_keys);
+   uint64_t s = 0;
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      const uint8_t *row = data + y * pitch;
+      size_t x;
+
+      for (x = 0; x + 2 * FRAMEHASH_BLOCK <= row_bytes; x += 2 * FRAMEHASH_BLOCK, s += 2)
+      {
+         __m512i j = _mm512_add_epi64(k, step);
+
+         FRAMEHASH_AVX512_LANE(a, k, row + x);
+         FRAMEHASH_AVX512_LANE(b, j, row + x + 64);
+         k = _mm512_add_epi64(k, step2);
+      }
+
+      if (x + FRAMEHASH_BLOCK <= row_bytes)
+      {
+         FRAMEHASH_AVX512_LANE(a, k, row + x);
+         k = _mm512_add_epi64(k, step);
+         x += FRAMEHASH_BLOCK;
+         s++;
+      }
+
+      if (x < row_bytes)
+      {
+         _mm512_storeu_si512((void*)acc, _mm512_add_epi64(a, b));
+         framehash_tail(acc, row + x, row_bytes - x, s++);
+         a = _mm512_loadu_si512((const void*)acc);
+         b = _mm512_setzero_si512();
+         k = _mm512_add_epi64(k, step);
+      }
+   }
+
+   _mm512_storeu_si512((void*)acc, _mm512_add_epi64(a, b));
+}
+#endif
+
+#if defined(FRAMEHASH_NEON)
+#define FRAMEHASH_NEON_LANE(a, k, p) do { \
+   uint64x2_t d_  = vreinterpretq_u64_u8(vld1q_u8(p)); \
+   uint64x2_t dk_ = veorq_u64(d_, k); \
+   a = vaddq_u64(a, vaddq_u64(vmull_u32(vmovn_u64(dk_), vshrn_n_u64(dk_, 32)), d_)); \
+} while (0)
+
+static void framehash_rows_neon(uint64_t *acc, const uint8_t *data, size_t pitch,
+      size_t row_bytes, unsigned height)
+{
+   const uint64x2_t step = vdupq_n_u64(FRAMEHASH_STEP);
+   uint64x2_t a0 = vld1q_u64(acc),     a1 = vld1q_u64(acc + 2);
+   uint64x2_t a2 = vld1q_u64(acc + 4), a3 = vld1q_u64(acc + 6);
+   uint64x2_t k0 = vld1q_u64(framehash_keys),     k1 = vld1q_u64(framehash_keys + 2);
+   uint64x2_t k2 = vld1q_u64(framehash_keys + 4), k3 = vld1q_u64(framehash_keys + 6);
+   uint64_t s = 0;
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      const uint8_t *row = data + y * pitch;
+      size_t x;
+
+      for (x = 0; x + FRAMEHASH_BLOCK <= row_bytes; x += FRAMEHASH_BLOCK, s++)
+      {
+         FRAMEHASH_NEON_LANE(a0, k0, row + x);
+         FRAMEHASH_NEON_LANE(a1, k1, row + x + 16);
+         FRAMEHASH_NEON_LANE(a2, k2, row + x + 32);
+         FRAMEHASH_NEON_LANE(a3, k3, row + x + 48);
+         k0 = vaddq_u64(k0, step);
+         k1 = vaddq_u64(k1, step);
+         k2 = vaddq_u64(k2, step);
+         k3 = vaddq_u64(k3, step);
+      }
+
+      if (x < row_bytes)
+      {
+         vst1q_u64(acc, a0);
+         vst1q_u64(acc + 2, a1);
+         vst1q_u64(acc + 4, a2);
+         vst1q_u64(acc + 6, a3);
+         framehash_tail(acc, row + x, row_bytes - x, s++);
+         a0 = vld1q_u64(acc);
+         a1 = vld1q_u64(acc + 2);
+         a2 = vld1q_u64(acc + 4);
+         a3 = vld1q_u64(acc + 6);
+         k0 = vaddq_u64(k0, step);
+         k1 = vaddq_u64(k1, step);
+         k2 = vaddq_u64(k2, step);
+         k3 = vaddq_u64(k3, step);
+      }
+   }
+
+   vst1q_u64(acc, a0);
+   vst1q_u64(acc + 2, a1);
+   vst1q_u64(acc + 4, a2);
+   vst1q_u64(acc + 6, a3);
+}
+#endif
+
+static const struct framehash_kernel framehash_kernel_list[] = {
+#if defined(FRAMEHASH_X86)
+   { "avx512", CPU_FEATURE_AVX512F, framehash_rows_avx512 },
+   { "avx2",   RETRO_SIMD_AVX2, framehash_rows_avx2 },
+   { "sse2",   RETRO_SIMD_SSE2, framehash_rows_sse2 },
+#endif
+#if defined(FRAMEHASH_NEON)
+   { "neon",   RETRO_SIMD_NEON, framehash_rows_neon },
+#endif
+   { "scalar", 0,               framehash_rows_scalar },
+};
+
+#define FRAMEHASH_KERNELS (sizeof(framehash_kernel_list) / sizeof(framehash_kernel_list[0]))
+
+static struct dispatch_variant framehash_variants[FRAMEHASH_KERNELS];
+
+/* dispatch_bind() までは、どの CPU でも動くスカラー版を使います。 */
+static const void *framehash_current = &framehash_kernel_list[FRAMEHASH_KERNELS - 1];
+
+const struct framehash_kernel *framehash_kernels(unsigned *count)
+{
+   *count = FRAMEHASH_KERNELS;
+   return framehash_kernel_list;
+}
+
+void framehash_register(void)
+{
+   unsigned i;
+
+   for (i = 0; i < FRAMEHASH_KERNELS; i++)
+   {
+      framehash_variants[i].name     = framehash_kernel_list[i].name;
+      framehash_variants[i].features = framehash_kernel_list[i].simd;
+      framehash_variants[i].impl     = &framehash_kernel_list[i];
+   }
+
+   dispatch_register("framehash", framehash_variants, FRAMEHASH_KERNELS, &framehash_current);
+}
+
+const struct framehash_kernel *framehash_kernel(void)
+{
+   return (const struct framehash_kernel*)framehash_current;
+}
+
+/* murmur3 の fmix64。 */
+static inline uint64_t framehash_mix(uint64_t h)
+{
+   h ^= h >> 33;
+   h *= 0xFF51AFD7ED558CCDull;
+   h ^= h >> 33;
+   h *= 0xC4CEB9FE1A85EC53ull;
+   h ^= h >> 33;
+   return h;
+}
+
+uint64_t framehash_frame_with(const struct framehash_kernel *kernel,
+      const void *data, size_t pitch, size_t row_bytes, unsigned height)
+{
+   uint64_t acc[FRAMEHASH_LANES];
+   uint64_t h = (uint64_t)row_bytes * FRAMEHASH_STEP + height;
+   unsigned j;
+
+   for (j = 0; j < FRAMEHASH_LANES; j++)
+      acc[j] = framehash_keys[FRAMEHASH_LANES - 1 - j];
+
+   kernel->rows(acc, (const uint8_t*)data, pitch, row_bytes, height);
+
+   for (j = 0; j < FRAMEHASH_LANES; j++)
+      h = (h ^ framehash_mix(acc[j])) * 0x9FB21C651E98DF25ull;
+   return framehash_mix(h);
+}
+
+uint64_t framehash_frame(const void *data, size_t pitch, size_t row_bytes, unsigned height)
+{
+   return framehash_frame_with(framehash_kernel(), data, pitch, row_bytes, height);
+}
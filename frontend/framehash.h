@@ -0,0 +1,48 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 同じ内容のフレームを見分けるための 64 ビットのハッシュ。
+ *
+ * 各行を 64 バイトずつ 8 つの 64 ビットのレーンに分け、
+ * レーンごとに acc += lo32(d ^ k) * hi32(d ^ k) + d を積み上げます (XXH3 の蓄積と同じ形)。
+ * k はフレームの先頭からのブロックの位置で変えるので、ブロックを入れ替えた場合も別の値になります。
+ * 行の末尾の 64 バイトに満たない部分は 0 で埋めて 1 ブロックとして扱います。
+ * どのカーネルも同じ値を返し、dispatch_bind() が CPU の機能から
+ * AVX-512 / AVX2 / SSE2 / NEON / スカラーの順に選びます。
+ */
+
+#ifndef RETROBENCH_FRAMEHASH_H__
+#define RETROBENCH_FRAMEHASH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAMEHASH_LANES 8
+
+/* height 行 × row_bytes バイトを acc に積み上げます。 */
+typedef void (*framehash_rows_t)(uint64_t *acc, const uint8_t *data, size_t pitch,
+      size_t row_bytes, unsigned height);
+
+struct framehash_kernel
+{
+   const char      *name;
+   uint64_t         simd;      /* 必要な RETRO_SIMD_* / CPU_FEATURE_* ビット */
+   framehash_rows_t rows;
+};
+
+/* 利用可能かどうかにかかわらず、すべてのカーネルを優先度順に返します。 */
+const struct framehash_kernel *framehash_kernels(unsigned *count);
+
+/* カーネルを dispatch_register() に "framehash" として登録します。 */
+void framehash_register(void);
+
+/* 選ばれているカーネルを返します。 */
+const struct framehash_kernel *framehash_kernel(void);
+
+/* height 行 × row_bytes バイトのフレームのハッシュを返します。 */
+uint64_t framehash_frame(const void *data, size_t pitch, size_t row_bytes, unsigned height);
+
+/* 指定したカーネルでハッシュを求めます。ベンチマーク用です。 */
+uint64_t framehash_frame_with(const struct framehash_kernel *kernel,
+      const void *data, size_t pitch, size_t row_bytes, unsigned height);
+
+#endif
@@ -0,0 +1,176 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 入力のスナップショット。
+ */
+
+#include <string.h>
+
+#include "input.h"
+
+#define INPUT_KEYBOARD_BASE 1
+#define INPUT_PORT_BASE     (1 + RETROK_LAST)
+#define INPUT_JOYPAD_MASK_ID 16
+
+struct input_layout
+{
+   uint32_t base;
+   uint32_t port_mask;         /* ポートの位置 (port << INPUT_PORT_SHIFT) に掛けるマスク */
+   uint32_t indexes;
+   uint32_t index_shift;
+   uint32_t index_mask;        /* index を使わないデバイスは 0 */
+   uint32_t ids;
+};
+
+/* デバイスの種類ごとの表の位置。indexes = 0 のデバイスは常に 0 を返します。
+ * index を使わないデバイスは index_mask = 0 にして、どの index にも同じ値を返します。
+ * 掛け算を避けるため、ポートと index の間隔はすべて 2 の累乗にしてあります。 */
+#define INPUT_PORT_MASK ((INPUT_MAX_PORTS - 1) << INPUT_PORT_SHIFT)
+
+static const struct input_layout input_layouts[INPUT_DEVICES] = {
+   { 0, 0, 0, 0, 0, 0 },                                                         /* NONE */
+   { INPUT_PORT_BASE +  0, INPUT_PORT_MASK, UINT32_MAX, 0, 0, 17 },              /* JOYPAD */
+   { INPUT_PORT_BASE + 17, INPUT_PORT_MASK, UINT32_MAX, 0, 0, 11 },              /* MOUSE */
+   { INPUT_KEYBOARD_BASE,  0,               UINT32_MAX, 0, 0, RETROK_LAST },     /* KEYBOARD */
+   { INPUT_PORT_BASE + 28, INPUT_PORT_MASK, UINT32_MAX, 0, 0, 17 },              /* LIGHTGUN */
+   { INPUT_PORT_BASE + 45, INPUT_PORT_MASK, 3, 4, ~0u, 16 },                     /* ANALOG */
+   { INPUT_PORT_BASE + 93, INPUT_PORT_MASK, INPUT_MAX_POINTERS, 2, ~0u, 4 },     /* POINTER */
+   { 0, 0, 0, 0, 0, 0 },
+};
+
+struct input_snapshot input_snapshot;
+struct input_stats input_stats;
+
+/* ---- 入力層 ----
+ * OS の入力層を持たないので、合成入力を有効にしたときだけ、
+ * 固定シードの乱数で 8 回の poll ごとにパッドのボタンを押し替えます。 */
+
+#define INPUT_SYNTH_PORTS 2
+
+static bool     input_synthetic;
+static uint32_t input_synth_seed = 2463534242u;
+static unsigned input_synth_polls;
+static int16_t  input_synth_buttons[INPUT_SYNTH_PORTS];
+
+static void input_layer_poll(void)
+{
+   unsigned port;
+
+   if (!input_synthetic || (input_synth_polls++ & 7))
+      return;
+
+   for (port = 0; port < INPUT_SYNTH_PORTS; port++)
+   {
+      input_synth_seed ^= input_synth_seed << 13;
+      input_synth_seed ^= input_synth_seed >> 17;
+      input_synth_seed ^= input_synth_seed << 5;
+      /* 同時に押すボタンは 2 つ程度に抑えます。 */
+      input_synth_buttons[port] = (int16_t)(input_synth_seed
+            & (input_synth_seed >> 8) & 0x0FFF);
+   }
+}
+
+/* 十字キーの向きをそのままアナログスティックの振れにします。 */
+static int16_t input_synth_axis(int16_t buttons, unsigned plus, unsigned minus)
+{
+   return (int16_t)((((buttons >> plus) & 1) - ((buttons >> minus) & 1)) * 0x7FFF);
+}
+
+int16_t RETRO_CALLCONV input_query(unsigned port, unsigned device,
+      unsigned index, unsigned id)
+{
+   int16_t buttons;
+
+   if (!input_synthetic || port >= INPUT_SYNTH_PORTS)
+      return 0;
+
+   buttons = input_synth_buttons[port];
+   switch (device & RETRO_DEVICE_MASK)
+   {
+      case RETRO_DEVICE_JOYPAD:
+         if (id == RETRO_DEVICE_ID_JOYPAD_MASK)
+            return buttons;
+         return id < 16 ? (buttons >> id) & 1 : 0;
+
+      case RETRO_DEVICE_ANALOG:
+         if (index == RETRO_DEVICE_INDEX_ANALOG_LEFT && id == RETRO_DEVICE_ID_ANALOG_X)
+            return input_synth_axis(buttons,
+                  RETRO_DEVICE_ID_JOYPAD_RIGHT, RETRO_DEVICE_ID_JOYPAD_LEFT);
+         if (index == RETRO_DEVICE_INDEX_ANALOG_LEFT && id == RETRO_DEVICE_ID_ANALOG_Y)
+            return input_synth_axis(buttons,
+                  RETRO_DEVICE_ID_JOYPAD_DOWN, RETRO_DEVICE_ID_JOYPAD_UP);
+         if (index == RETRO_DEVICE_INDEX_ANALOG_BUTTON && id < 16)
+            return ((buttons >> id) & 1) ? 0x7FFF : 0;
+         return 0;
+
+      default:
+         return 0;
+   }
+}
+
+void input_set_synthetic(bool enable)
+{
+   input_synthetic = enable;
+}
+
+/* ---- スナップショット ---- */
+
+void input_poll(void)
+{
+   unsigned port, id;
+
+   input_stats.polls++;
+   input_layer_poll();
+
+   memset(&input_snapshot, 0, sizeof(input_snapshot));
+   if (!input_synthetic)
+      return;
+
+   for (port = 0; port < INPUT_SYNTH_PORTS; port++)
+   {
+      int16_t *slots  = input_snapshot.slots + INPUT_PORT_BASE + (port << INPUT_PORT_SHIFT);
+      int16_t *joypad = slots + input_layouts[RETRO_DEVICE_JOYPAD].base - INPUT_PORT_BASE;
+      int16_t *analog = slots + input_layouts[RETRO_DEVICE_ANALOG].base - INPUT_PORT_BASE;
+      int16_t buttons = input_synth_buttons[port];
+
+      for (id = 0; id < 16; id++)
+      {
+         joypad[id] = (buttons >> id) & 1;
+         analog[RETRO_DEVICE_INDEX_ANALOG_BUTTON * 16 + id] = joypad[id] ? 0x7FFF : 0;
+      }
+      joypad[INPUT_JOYPAD_MASK_ID] = buttons;
+
+      analog[RETRO_DEVICE_INDEX_ANALOG_LEFT * 16 + RETRO_DEVICE_ID_ANALOG_X] =
+         input_synth_axis(buttons, RETRO_DEVICE_ID_JOYPAD_RIGHT, RETRO_DEVICE_ID_JOYPAD_LEFT);
+      analog[RETRO_DEVICE_INDEX_ANALOG_LEFT * 16 + RETRO_DEVICE_ID_ANALOG_Y] =
+         input_synth_axis(buttons, RETRO_DEVICE_ID_JOYPAD_DOWN, RETRO_DEVICE_ID_JOYPAD_UP);
+   }
+}
+
+int16_t RETRO_CALLCONV input_state(unsigned port, unsigned device,
+      unsigned index, unsigned id)
+{
+   unsigned d       = device & RETRO_DEVICE_MASK;
+   unsigned type    = d & (INPUT_DEVICES - 1);
+   unsigned joypad  = d == RETRO_DEVICE_JOYPAD;
+   unsigned is_mask = joypad & (id == RETRO_DEVICE_ID_JOYPAD_MASK);
+   unsigned slot_id = id ^ ((id ^ INPUT_JOYPAD_MASK_ID) & -is_mask);
+   const struct input_layout *layout = &input_layouts[type];
+   size_t   valid, slot;
+
+   /* id 16 はビットマスクの位置なので、JOYPAD に直接 16 を問い合わせた場合は範囲外です。 */
+   valid = (d < INPUT_DEVICES) & (port < INPUT_MAX_PORTS)
+         & (index < layout->indexes) & (slot_id < layout->ids)
+         & ((id != INPUT_JOYPAD_MASK_ID) | !joypad);
+   slot  = layout->base + ((port << INPUT_PORT_SHIFT) & layout->port_mask)
+         + ((index << layout->index_shift) & layout->index_mask) + slot_id;
+
+   return input_snapshot.slots[slot & -valid];
+}
+
+void input_frame_end(void)
+{
+   if (input_stats.frame_calls > input_stats.max_frame_calls)
+      input_stats.max_frame_calls = input_stats.frame_calls;
+   input_stats.frame_calls = 0;
+   input_stats.frames++;
+}
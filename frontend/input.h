@@ -0,0 +1,82 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 入力のスナップショット。
+ *
+ * retro_input_poll_t の時点で、入力層から全デバイスの状態を 1 つの密な表に取り込み、
+ * 以降の retro_input_state_t は分岐なしの表引きだけで答えます。
+ * コアが 1 フレームに何百回問い合わせても、入力層に触れるのは poll の 1 回だけです。
+ *
+ * 表の並び (int16_t の配列):
+ *   [0]                       範囲外の問い合わせに答える 0
+ *   [1, 1 + RETROK_LAST)      キーボード (retro_key)。ポートによらず共通
+ *   以降 INPUT_MAX_PORTS 個のポートごとに INPUT_PORT_SLOTS 個ずつ
+ *     JOYPAD   17 (id 0-15 と RETRO_DEVICE_ID_JOYPAD_MASK)
+ *     MOUSE    11
+ *     LIGHTGUN 17
+ *     ANALOG   3 index x 16 id (ANALOG_BUTTON はボタンの id を使います)
+ *     POINTER  INPUT_MAX_POINTERS x 4
+ * 範囲外の port / device / index / id は有効ビットで添字を 0 に落とします。
+ */
+
+#ifndef RETROBENCH_INPUT_H__
+#define RETROBENCH_INPUT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define INPUT_MAX_PORTS     8      /* 2 の累乗 */
+#define INPUT_MAX_POINTERS  4
+#define INPUT_DEVICES       8      /* RETRO_DEVICE_NONE から POINTER まで + 予備 */
+
+/* 1 ポートあたり 17 + 11 + 17 + 48 + 16 = 109 を、2 の累乗の 128 に切り上げます。 */
+#define INPUT_PORT_SHIFT    7
+#define INPUT_PORT_SLOTS    (1 << INPUT_PORT_SHIFT)
+#define INPUT_SLOTS         (1 + RETROK_LAST + INPUT_MAX_PORTS * INPUT_PORT_SLOTS)
+
+struct input_snapshot
+{
+   int16_t slots[INPUT_SLOTS];
+} __attribute__((aligned(64)));
+
+/* 問い合わせの回数。calls はデバイスの種類 (device & RETRO_DEVICE_MASK) ごと。 */
+struct input_stats
+{
+   uint64_t calls[INPUT_DEVICES];
+   uint64_t polls;
+   uint64_t frames;
+   uint64_t frame_calls;       /* 現在のフレームの問い合わせ回数 */
+   uint64_t max_frame_calls;
+};
+
+extern struct input_snapshot input_snapshot;
+extern struct input_stats input_stats;
+
+/* 入力層の代わりに、固定シードの乱数でパッドを押す合成入力を使います。 */
+void input_set_synthetic(bool enable);
+
+/* 入力層から状態を読み、スナップショットを作り直します。retro_input_poll_t から呼びます。 */
+void input_poll(void);
+
+/* スナップショットから答えます。retro_input_state_t と同じ形です。 */
+int16_t RETRO_CALLCONV input_state(unsigned port, unsigned device,
+      unsigned index, unsigned id);
+
+/* 入力層に直接問い合わせます。スナップショットを使わない場合の比較用です。 */
+int16_t RETRO_CALLCONV input_query(unsigned port, unsigned device,
+      unsigned index, unsigned id);
+
+/* コアからの問い合わせを 1 回数えます。範囲外のデバイスは NONE として数えます。 */
+static inline void input_count(unsigned device)
+{
+   unsigned d = device & RETRO_DEVICE_MASK;
+
+   input_stats.calls[d < INPUT_DEVICES ? d : 0]++;
+   input_stats.frame_calls++;
+}
+
+/* retro_run() の後に呼び、フレームごとの問い合わせ回数を集計します。 */
+void input_frame_end(void);
+
+#endif
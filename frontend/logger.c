@@ -0,0 +1,1035 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_log_printf_t の非同期実装。
+ */
+
+/* dladdr1() のために必要です。 */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "logger.h"
+#include "timer.h"
+
+#define LOGGER_RING_SIZE     (1 << 16)   /* スレッドごとのリングの大きさ (2 の累乗) */
+#define LOGGER_RECORD_MAX    2048        /* 1 件の最大の大きさ (ヘッダを含む) */
+#define LOGGER_LINE_MAX      4096
+#define LOGGER_FMT_CACHE     16
+#define LOGGER_IDLE_NS       1000000     /* 空のときに出力スレッドが眠る時間 */
+#define LOGGER_NOTE_NS       1000000000ull
+
+#define LOGGER_ALIGN(n)      (((n) + 7) & ~(size_t)7)
+#define LOGGER_NULL_STRING   UINT32_MAX
+
+enum
+{
+   LOGGER_PAD      = 1 << 0,   /* リングの終わりまでの詰め物 */
+   LOGGER_FMT_COPY = 1 << 1,   /* 書式文字列を最初の引数としてコピーした */
+   LOGGER_TEXT     = 1 << 2    /* 整形済みの文字列だけを持つ */
+};
+
+/* リングの 1 件。この後に 8 バイト単位で引数が並びます。
+ * 整数は 64 ビットに広げ、文字列は 32 ビットの長さに続けて NUL 終端の中身を置きます。 */
+struct logger_record
+{
+   uint32_t size;              /* ヘッダを含む大きさ。8 の倍数 */
+   uint8_t  level;
+   uint8_t  flags;
+   uint16_t reserved;
+   const char *fmt;
+};
+
+/* 生産者 (コアのスレッド) 1 つにつき 1 つ。出力スレッドだけが読み出します。
+ * 生産者のスレッドが終わると closed を立て、出力スレッドが読み終えてから解放します。 */
+struct logger_ring
+{
+   struct logger_ring *next;
+   uint8_t *data;
+   atomic_bool closed;
+
+   /* 生産者だけが触ります。読み取り専用の領域にあると分かった書式文字列です。 */
+   const char *fmt_cache[LOGGER_FMT_CACHE];
+   unsigned fmt_generation;
+
+   _Atomic uint64_t messages[LOGGER_LEVELS];
+   _Atomic uint64_t overflowed;
+   _Atomic uint64_t preformatted;
+
+   _Atomic size_t head __attribute__((aligned(64)));   /* 生産者が書いた位置 */
+   _Atomic size_t tail __attribute__((aligned(64)));   /* 出力スレッドが読んだ位置 */
+};
+
+static struct
+{
+   FILE *out;
+   enum retro_log_level min_level;
+   unsigned rate;
+
+   pthread_t thread;
+   bool running;
+   atomic_bool active;         /* 生産者はこれを見てリングに積むか同期的に書くかを決めます */
+   atomic_bool quit;
+
+   /* rings の付け外しと走査は rings_lock の中で行います。生産者がリングに積むときは触りません。 */
+   pthread_mutex_t rings_lock;
+   struct logger_ring *rings;
+   atomic_uint ring_count;     /* ログを書いたスレッドの数。解放したリングも数えます */
+   pthread_once_t key_once;
+   pthread_key_t  key;         /* スレッドの終了時に logger_ring_close() を呼ぶためのキー */
+
+   /* 解放したリングのカウンタ。rings_lock の中で読み書きします。 */
+   uint64_t retired_messages[LOGGER_LEVELS];
+   uint64_t retired_overflowed;
+   uint64_t retired_preformatted;
+
+   atomic_uint generation;     /* 変わったら書式文字列のキャッシュを捨てます */
+
+   _Atomic uint64_t window[LOGGER_LEVELS];
+   atomic_uint      window_count[LOGGER_LEVELS];
+   _Atomic uint64_t limited[LOGGER_LEVELS];
+   _Atomic uint64_t written;
+   _Atomic uint64_t write_ns;
+
+   /* 出力スレッドだけが触ります。 */
+   uint64_t noted_limited[LOGGER_LEVELS];
+   uint64_t noted_overflowed;
+   uint64_t noted_at;
+   char     batch[LOGGER_RING_SIZE];
+   size_t   batch_used;
+   _Atomic uint64_t passes;    /* logger_drain() を終えた回数 */
+} logger = {
+   .min_level  = RETRO_LOG_WARN,
+   .rings_lock = PTHREAD_MUTEX_INITIALIZER,
+   .key_once   = PTHREAD_ONCE_INIT
+};
+
+static __thread struct logger_ring *logger_self;
+
+/* logger_reset_stats() の時点の値。カウンタ自体は戻さずに差を返します。 */
+static struct logger_stats logger_base;
+
+static const char *logger_names[LOGGER_LEVELS] = { "DEBUG", "INFO", "WARN", "ERROR" };
+
+/* ---- 書式の解釈 ---- */
+
+enum logger_length
+{
+   LOGGER_LEN_NONE,
+   LOGGER_LEN_HH,
+   LOGGER_LEN_H,
+   LOGGER_LEN_L,
+   LOGGER_LEN_LL,
+   LOGGER_LEN_J,
+   LOGGER_LEN_Z,
+   LOGGER_LEN_T,
+   LOGGER_LEN_LD
+};
+
+enum logger_arg
+{
+   LOGGER_ARG_NONE,            /* %% */
+   LOGGER_ARG_INT,
+   LOGGER_ARG_UINT,
+   LOGGER_ARG_DOUBLE,
+   LOGGER_ARG_LDOUBLE,
+   LOGGER_ARG_STRING,
+   LOGGER_ARG_POINTER,
+   LOGGER_ARG_INVALID          /* 後から整形できない変換 */
+};
+
+struct logger_spec
+{
+   const char *start;          /* '%' の位置 */
+   const char *end;            /* 変換文字の次 */
+   enum logger_length length;
+   enum logger_arg arg;
+   bool star_width;
+   bool star_prec;
+   bool has_prec;
+   int  prec;                  /* has_prec で * でないときの精度 */
+};
+
+static bool logger_is_digit(char c)
+{
+   return c >= '0' && c <= '9';
+}
+
+/* *p から次の変換指定を探して spec に入れます。無ければ false を返します。 */
+static bool logger_next_spec(const char **p, struct logger_spec *spec)
+{
+   const char *s = strchr(*p, '%');
+   char conv;
+
+   if (!s)
+      return false;
+
+   memset(spec, 0, sizeof(*spec));
+   spec->start = s++;
+
+   while (*s && strchr("-+ #0'", *s))
+      s++;
+   if (*s == '*')
+   {
+      spec->star_width = true;
+      s++;
+   }
+   else
+      while (logger_is_digit(*s))
+         s++;
+   if (*s == '.')
+   {
+      spec->has_prec = true;
+      s++;
+      if (*s == '*')
+      {
+         spec->star_prec = true;
+         s++;
+      }
+      else
+         while (logger_is_digit(*s))
+            spec->prec = spec->prec * 10 + (*s++ - '0');
+   }
+
+   switch (*s)
+   {
+      case 'h':
+         spec->length = s[1] == 'h' ? LOGGER_LEN_HH : LOGGER_LEN_H;
+         s += s[1] == 'h' ? 2 : 1;
+         break;
+      case 'l':
+         spec->length = s[1] == 'l' ? LOGGER_LEN_LL : LOGGER_LEN_L;
+         s += s[1] == 'l' ? 2 : 1;
+         break;
+      case 'j': spec->length = LOGGER_LEN_J;  s++; break;
+      case 'z': spec->length = LOGGER_LEN_Z;  s++; break;
+      case 't': spec->length = LOGGER_LEN_T;  s++; break;
+      case 'L': spec->length = LOGGER_LEN_LD; s++; break;
+      default:
+         break;
+   }
+
+   conv = *s;
+   if (conv)
+      s++;
+   spec->end = s;
+   *p        = s;
+
+   /* 出力スレッドで '*' を数値に置き換えても収まる長さに限ります。 */
+   if (spec->end - spec->start > 32)
+   {
+      spec->arg = LOGGER_ARG_INVALID;
+      return true;
+   }
+
+   switch (conv)
+   {
+      case '%':
+         spec->arg = spec->end - spec->start == 2 ? LOGGER_ARG_NONE : LOGGER_ARG_INVALID;
+         break;
+      case 'd': case 'i':
+         spec->arg = spec->length == LOGGER_LEN_LD ? LOGGER_ARG_INVALID : LOGGER_ARG_INT;
+         break;
+      case 'u': case 'o': case 'x': case 'X':
+         spec->arg = spec->length == LOGGER_LEN_LD ? LOGGER_ARG_INVALID : LOGGER_ARG_UINT;
+         break;
+      case 'c':
+         spec->arg = spec->length == LOGGER_LEN_NONE ? LOGGER_ARG_INT : LOGGER_ARG_INVALID;
+         break;
+      case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+         spec->arg = spec->length == LOGGER_LEN_LD ? LOGGER_ARG_LDOUBLE
+                   : spec->length == LOGGER_LEN_NONE || spec->length == LOGGER_LEN_L
+                   ? LOGGER_ARG_DOUBLE : LOGGER_ARG_INVALID;
+         break;
+      case 's':
+         spec->arg = spec->length == LOGGER_LEN_NONE ? LOGGER_ARG_STRING : LOGGER_ARG_INVALID;
+         break;
+      case 'p':
+         spec->arg = spec->length == LOGGER_LEN_NONE ? LOGGER_ARG_POINTER : LOGGER_ARG_INVALID;
+         break;
+      default:
+         /* %n, %m, 位置指定 (%1$d) など。 */
+         spec->arg = LOGGER_ARG_INVALID;
+         break;
+   }
+   return true;
+}
+
+/* ---- 生産者側 ---- */
+
+static bool logger_put(uint8_t *buf, size_t *used, const void *src, size_t size)
+{
+   size_t aligned = LOGGER_ALIGN(size);
+
+   if (*used + aligned > LOGGER_RECORD_MAX)
+      return false;
+   memcpy(buf + *used, src, size);
+   memset(buf + *used + size, 0, aligned - size);
+   *used += aligned;
+   return true;
+}
+
+/* 長さ len の文字列を入れます。入りきらなければ切り詰め、truncate が false なら失敗します。 */
+static bool logger_put_string(uint8_t *buf, size_t *used, const char *s, size_t len, bool truncate)
+{
+   uint32_t n    = s ? (uint32_t)len : LOGGER_NULL_STRING;
+   size_t   room = LOGGER_RECORD_MAX - *used;
+   size_t   aligned;
+
+   if (room < sizeof(n) + 8)
+      return false;
+   if (!s)
+   {
+      memcpy(buf + *used, &n, sizeof(n));
+      memset(buf + *used + sizeof(n), 0, 8 - sizeof(n));
+      *used += 8;
+      return true;
+   }
+   if (sizeof(n) + len + 1 > room)
+   {
+      if (!truncate)
+         return false;
+      n = (uint32_t)(room - sizeof(n) - 1);
+   }
+
+   aligned = LOGGER_ALIGN(sizeof(n) + n + 1);
+   memcpy(buf + *used, &n, sizeof(n));
+   memcpy(buf + *used + sizeof(n), s, n);
+   memset(buf + *used + sizeof(n) + n, 0, aligned - sizeof(n) - n);
+   *used += aligned;
+   return true;
+}
+
+static int64_t logger_va_int(enum logger_length length, va_list *ap)
+{
+   switch (length)
+   {
+      case LOGGER_LEN_L:  return va_arg(*ap, long);
+      case LOGGER_LEN_LL: return va_arg(*ap, long long);
+      case LOGGER_LEN_J:  return va_arg(*ap, intmax_t);
+      case LOGGER_LEN_Z:  return va_arg(*ap, ssize_t);
+      case LOGGER_LEN_T:  return va_arg(*ap, ptrdiff_t);
+      default:            return va_arg(*ap, int);
+   }
+}
+
+static uint64_t logger_va_uint(enum logger_length length, va_list *ap)
+{
+   switch (length)
+   {
+      case LOGGER_LEN_L:  return va_arg(*ap, unsigned long);
+      case LOGGER_LEN_LL: return va_arg(*ap, unsigned long long);
+      case LOGGER_LEN_J:  return va_arg(*ap, uintmax_t);
+      case LOGGER_LEN_Z:  return va_arg(*ap, size_t);
+      case LOGGER_LEN_T:  return (uint64_t)va_arg(*ap, ptrdiff_t);
+      default:            return va_arg(*ap, unsigned);
+   }
+}
+
+/* 書式に従って ap の引数を buf に写します。後から整形できない変換があれば false を返します。 */
+static bool logger_encode(uint8_t *buf, size_t *used, const char *fmt, va_list *ap)
+{
+   struct logger_spec spec;
+
+   while (logger_next_spec(&fmt, &spec))
+   {
+      int64_t  i;
+      uint64_t u;
+      double   d;
+      long double ld;
+      const char *s;
+      int prec = spec.prec;
+
+      if (spec.arg == LOGGER_ARG_INVALID)
+         return false;
+      if (spec.star_width)
+      {
+         i = va_arg(*ap, int);
+         if (!logger_put(buf, used, &i, sizeof(i)))
+            return false;
+      }
+      if (spec.star_prec)
+      {
+         i    = va_arg(*ap, int);
+         prec = (int)i;
+         if (!logger_put(buf, used, &i, sizeof(i)))
+            return false;
+      }
+
+      switch (spec.arg)
+      {
+         case LOGGER_ARG_INT:
+            i = logger_va_int(spec.length, ap);
+            if (!logger_put(buf, used, &i, sizeof(i)))
+               return false;
+            break;
+         case LOGGER_ARG_UINT:
+            u = logger_va_uint(spec.length, ap);
+            if (!logger_put(buf, used, &u, sizeof(u)))
+               return false;
+            break;
+         case LOGGER_ARG_DOUBLE:
+            d = va_arg(*ap, double);
+            if (!logger_put(buf, used, &d, sizeof(d)))
+               return false;
+            break;
+         case LOGGER_ARG_LDOUBLE:
+            ld = va_arg(*ap, long double);
+            if (!logger_put(buf, used, &ld, sizeof(ld)))
+               return false;
+            break;
+         case LOGGER_ARG_POINTER:
+            u = (uint64_t)(uintptr_t)va_arg(*ap, void*);
+            if (!logger_put(buf, used, &u, sizeof(u)))
+               return false;
+            break;
+         case LOGGER_ARG_STRING:
+            /* 精度のある %.*s は NUL 終端していないバッファを指すことがあります。 */
+            s = va_arg(*ap, const char*);
+            if (!logger_put_string(buf, used, s,
+                     !s ? 0 : spec.has_prec && prec >= 0 ? strnlen(s, (size_t)prec) : strlen(s), true))
+               return false;
+            break;
+         default:
+            break;
+      }
+   }
+   return true;
+}
+
+/* 書式文字列が共有オブジェクトの書き込みできない PT_LOAD の中にあるかを調べます。
+ * そこにあるものは dlclose() まで変わらないので、ポインタだけを渡せます。 */
+static bool logger_in_rodata(const void *addr)
+{
+   const ElfW(Ehdr) *ehdr;
+   const ElfW(Phdr) *phdr;
+   struct link_map *map = NULL;
+   uintptr_t offset;
+   Dl_info info;
+   unsigned i;
+
+   if (!dladdr1(addr, &info, (void**)&map, RTLD_DL_LINKMAP) || !map || !info.dli_fbase)
+      return false;
+
+   ehdr   = (const ElfW(Ehdr)*)info.dli_fbase;
+   phdr   = (const ElfW(Phdr)*)((const char*)ehdr + ehdr->e_phoff);
+   offset = (uintptr_t)addr - (uintptr_t)map->l_addr;
+   for (i = 0; i < ehdr->e_phnum; i++)
+      if (phdr[i].p_type == PT_LOAD && offset - phdr[i].p_vaddr < phdr[i].p_memsz)
+         return !(phdr[i].p_flags & PF_W);
+   return false;
+}
+
+static bool logger_fmt_static(struct logger_ring *ring, const char *fmt)
+{
+   unsigned generation = atomic_load_explicit(&logger.generation, memory_order_relaxed);
+   unsigned slot       = (unsigned)((uintptr_t)fmt >> 3) % LOGGER_FMT_CACHE;
+
+   if (ring->fmt_generation != generation)
+   {
+      memset(ring->fmt_cache, 0, sizeof(ring->fmt_cache));
+      ring->fmt_generation = generation;
+   }
+   if (ring->fmt_cache[slot] == fmt)
+      return true;
+   if (!logger_in_rodata(fmt))
+      return false;
+   ring->fmt_cache[slot] = fmt;
+   return true;
+}
+
+/* スレッドの終了時に呼ばれます。残りは出力スレッドが書き出してから解放します。 */
+static void logger_ring_close(void *arg)
+{
+   struct logger_ring *ring = (struct logger_ring*)arg;
+
+   /* この後の別の TLS デストラクタがログを書いても、解放されるリングは使いません。 */
+   logger_self = NULL;
+   atomic_store_explicit(&ring->closed, true, memory_order_release);
+}
+
+static void logger_key_init(void)
+{
+   pthread_key_create(&logger.key, logger_ring_close);
+}
+
+/* 書き出し終えたリングのカウンタを残して解放します。rings_lock の中で呼びます。 */
+static void logger_ring_free(struct logger_ring *ring)
+{
+   unsigned l;
+
+   for (l = 0; l < LOGGER_LEVELS; l++)
+      logger.retired_messages[l] += atomic_load_explicit(&ring->messages[l], memory_order_relaxed);
+   logger.retired_overflowed   += atomic_load_explicit(&ring->overflowed, memory_order_relaxed);
+   logger.retired_preformatted += atomic_load_explicit(&ring->preformatted, memory_order_relaxed);
+   free(ring->data);
+   free(ring);
+}
+
+/* 今までに溢れて捨てた件数。 */
+static uint64_t logger_overflowed(void)
+{
+   struct logger_ring *ring;
+   uint64_t overflowed;
+
+   pthread_mutex_lock(&logger.rings_lock);
+   overflowed = logger.retired_overflowed;
+   for (ring = logger.rings; ring; ring = ring->next)
+      overflowed += atomic_load_explicit(&ring->overflowed, memory_order_relaxed);
+   pthread_mutex_unlock(&logger.rings_lock);
+   return overflowed;
+}
+
+static struct logger_ring *logger_ring_get(void)
+{
+   struct logger_ring *ring = logger_self;
+
+   if (ring)
+      return ring;
+
+   ring = (struct logger_ring*)calloc(1, sizeof(*ring));
+   if (!ring)
+      return NULL;
+   /* 詰め物のヘッダがリングの終わりをはみ出してもよいように余分に取ります。 */
+   ring->data = (uint8_t*)malloc(LOGGER_RING_SIZE + sizeof(struct logger_record));
+   if (!ring->data)
+   {
+      free(ring);
+      return NULL;
+   }
+   ring->fmt_generation = atomic_load(&logger.generation);
+
+   pthread_once(&logger.key_once, logger_key_init);
+   if (pthread_setspecific(logger.key, ring) != 0)
+   {
+      free(ring->data);
+      free(ring);
+      return NULL;
+   }
+
+   pthread_mutex_lock(&logger.rings_lock);
+   ring->next   = logger.rings;
+   logger.rings = ring;
+   pthread_mutex_unlock(&logger.rings_lock);
+   atomic_fetch_add(&logger.ring_count, 1);
+
+   logger_self = ring;
+   return ring;
+}
+
+static bool logger_push(struct logger_ring *ring, const void *record, size_t size)
+{
+   size_t head   = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   size_t tail   = atomic_load_explicit(&ring->tail, memory_order_acquire);
+   size_t offset = head & (LOGGER_RING_SIZE - 1);
+   size_t pad    = LOGGER_RING_SIZE - offset < size ? LOGGER_RING_SIZE - offset : 0;
+
+   if (LOGGER_RING_SIZE - (head - tail) < pad + size)
+      return false;
+
+   if (pad)
+   {
+      struct logger_record *p = (struct logger_record*)(ring->data + offset);
+      p->size  = (uint32_t)pad;
+      p->flags = LOGGER_PAD;
+      head    += pad;
+      offset   = 0;
+   }
+   memcpy(ring->data + offset, record, size);
+   atomic_store_explicit(&ring->head, head + size, memory_order_release);
+   return true;
+}
+
+static void logger_capture(struct logger_ring *ring, unsigned level, const char *fmt, va_list ap)
+{
+   uint8_t buf[LOGGER_RECORD_MAX] __attribute__((aligned(8)));
+   struct logger_record *record = (struct logger_record*)buf;
+   size_t  used = sizeof(*record);
+   bool    ok   = true;
+   va_list copy;
+
+   va_copy(copy, ap);
+   record->level    = (uint8_t)level;
+   record->flags    = 0;
+   record->reserved = 0;
+   record->fmt      = fmt;
+
+   if (!logger_fmt_static(ring, fmt))
+   {
+      record->flags |= LOGGER_FMT_COPY;
+      ok = logger_put_string(buf, &used, fmt, strlen(fmt), false);
+   }
+   if (ok)
+      ok = logger_encode(buf, &used, fmt, &copy);
+   va_end(copy);
+
+   if (!ok)
+   {
+      int n;
+
+      record->flags = LOGGER_TEXT;
+      used          = sizeof(*record);
+      n             = vsnprintf((char*)buf + used, LOGGER_RECORD_MAX - used, fmt, ap);
+      if (n < 0)
+         n = 0;
+      if ((size_t)n >= LOGGER_RECORD_MAX - used)
+         n = (int)(LOGGER_RECORD_MAX - used - 1);
+      used = LOGGER_ALIGN(used + (size_t)n + 1);
+      atomic_fetch_add_explicit(&ring->preformatted, 1, memory_order_relaxed);
+   }
+
+   record->size = (uint32_t)used;
+   if (logger_push(ring, buf, used))
+      atomic_fetch_add_explicit(&ring->messages[level], 1, memory_order_relaxed);
+   else
+      atomic_fetch_add_explicit(&ring->overflowed, 1, memory_order_relaxed);
+}
+
+/* レベルごとに 1 秒の窓で数え、rate を超えたものを捨てます。
+ * 窓の切り替えは最初に気づいたスレッドが CAS で行います。 */
+static bool logger_limited(unsigned level)
+{
+   uint64_t now;
+   uint64_t start;
+
+   if (!logger.rate)
+      return false;
+
+   now   = timer_ns();
+   start = atomic_load_explicit(&logger.window[level], memory_order_relaxed);
+   if (now - start >= 1000000000ull
+         && atomic_compare_exchange_strong(&logger.window[level], &start, now))
+      atomic_store_explicit(&logger.window_count[level], 0, memory_order_relaxed);
+
+   if (atomic_fetch_add_explicit(&logger.window_count[level], 1, memory_order_relaxed) < logger.rate)
+      return false;
+   atomic_fetch_add_explicit(&logger.limited[level], 1, memory_order_relaxed);
+   return true;
+}
+
+void RETRO_CALLCONV logger_printf(enum retro_log_level level, const char *fmt, ...)
+{
+   unsigned l = (unsigned)level < LOGGER_LEVELS ? (unsigned)level : RETRO_LOG_ERROR;
+   struct logger_ring *ring;
+   va_list ap;
+
+   if (level < logger.min_level || !fmt || logger_limited(l))
+      return;
+
+   va_start(ap, fmt);
+   if (atomic_load_explicit(&logger.active, memory_order_acquire) && (ring = logger_ring_get()))
+      logger_capture(ring, l, fmt, ap);
+   else
+   {
+      FILE *out = logger.out ? logger.out : stderr;
+      fprintf(out, "[%s] ", logger_names[l]);
+      vfprintf(out, fmt, ap);
+   }
+   va_end(ap);
+}
+
+/* ---- 出力スレッド側 ---- */
+
+static size_t logger_append(char *out, size_t size, size_t pos, const char *s, size_t len)
+{
+   if (pos + 1 >= size)
+      return pos;
+   if (len > size - 1 - pos)
+      len = size - 1 - pos;
+   memcpy(out + pos, s, len);
+   return pos + len;
+}
+
+/* snprintf() の戻り値で pos を進めます。切り詰められたら末尾で止めます。 */
+static size_t logger_advance(size_t size, size_t pos, int n)
+{
+   if (n < 0)
+      return pos;
+   return pos + (size_t)n < size ? pos + (size_t)n : size - 1;
+}
+
+/* 引数を取り出す位置。put と同じ 8 バイト単位で進みます。 */
+static const uint8_t *logger_get(const uint8_t *args, void *dst, size_t size)
+{
+   memcpy(dst, args, size);
+   return args + LOGGER_ALIGN(size);
+}
+
+static const uint8_t *logger_get_string(const uint8_t *args, const char **s)
+{
+   uint32_t n;
+
+   memcpy(&n, args, sizeof(n));
+   if (n == LOGGER_NULL_STRING)
+   {
+      *s = NULL;
+      return args + 8;
+   }
+   *s = (const char*)args + sizeof(n);
+   return args + LOGGER_ALIGN(sizeof(n) + n + 1);
+}
+
+/* 1 件を out に整形し、長さを返します。 */
+static size_t logger_format(char *out, size_t size, const char *fmt, const uint8_t *args)
+{
+   struct logger_spec spec;
+   const char *p = fmt;
+   size_t pos    = 0;
+
+   while (logger_next_spec(&p, &spec))
+   {
+      char     conv[64];
+      size_t   clen = 0;
+      const char *c;
+      int64_t  i;
+      uint64_t u;
+      double   d;
+      long double ld;
+      const char *s;
+
+      pos = logger_append(out, size, pos, fmt, (size_t)(spec.start - fmt));
+      fmt = spec.end;
+
+      if (spec.arg == LOGGER_ARG_NONE)
+      {
+         pos = logger_append(out, size, pos, "%", 1);
+         continue;
+      }
+
+      /* '*' を取り出した値に置き換えた変換指定を作ります。 */
+      for (c = spec.start; c < spec.end; c++)
+      {
+         if (*c != '*')
+         {
+            conv[clen++] = *c;
+            continue;
+         }
+         args  = logger_get(args, &i, sizeof(i));
+         clen += (size_t)snprintf(conv + clen, sizeof(conv) - clen, "%d", (int)i);
+      }
+      conv[clen] = '\0';
+
+      switch (spec.arg)
+      {
+         case LOGGER_ARG_INT:
+            args = logger_get(args, &i, sizeof(i));
+            switch (spec.length)
+            {
+               case LOGGER_LEN_L:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (long)i)); break;
+               case LOGGER_LEN_LL: pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (long long)i)); break;
+               case LOGGER_LEN_J:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (intmax_t)i)); break;
+               case LOGGER_LEN_Z:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (ssize_t)i)); break;
+               case LOGGER_LEN_T:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (ptrdiff_t)i)); break;
+               default:            pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (int)i)); break;
+            }
+            break;
+         case LOGGER_ARG_UINT:
+            args = logger_get(args, &u, sizeof(u));
+            switch (spec.length)
+            {
+               case LOGGER_LEN_L:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (unsigned long)u)); break;
+               case LOGGER_LEN_LL: pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (unsigned long long)u)); break;
+               case LOGGER_LEN_J:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (uintmax_t)u)); break;
+               case LOGGER_LEN_Z:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (size_t)u)); break;
+               case LOGGER_LEN_T:  pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (ptrdiff_t)u)); break;
+               default:            pos = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (unsigned)u)); break;
+            }
+            break;
+         case LOGGER_ARG_DOUBLE:
+            args = logger_get(args, &d, sizeof(d));
+            pos  = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, d));
+            break;
+         case LOGGER_ARG_LDOUBLE:
+            args = logger_get(args, &ld, sizeof(ld));
+            pos  = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, ld));
+            break;
+         case LOGGER_ARG_POINTER:
+            args = logger_get(args, &u, sizeof(u));
+            pos  = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, (void*)(uintptr_t)u));
+            break;
+         case LOGGER_ARG_STRING:
+            args = logger_get_string(args, &s);
+            pos  = logger_advance(size, pos, snprintf(out + pos, size - pos, conv, s ? s : "(null)"));
+            break;
+         default:
+            break;
+      }
+   }
+
+   pos = logger_append(out, size, pos, fmt, strlen(fmt));
+   out[pos] = '\0';
+   return pos;
+}
+
+static void logger_write(const char *s, size_t len)
+{
+   if (logger.batch_used + len > sizeof(logger.batch))
+   {
+      fwrite(logger.batch, 1, logger.batch_used, logger.out);
+      logger.batch_used = 0;
+   }
+   memcpy(logger.batch + logger.batch_used, s, len);
+   logger.batch_used += len;
+}
+
+/* 捨てたメッセージがあれば、前回からの数を 1 行ずつ書き出します。 */
+static void logger_note_dropped(void)
+{
+   uint64_t overflowed = logger_overflowed();
+   char line[128];
+   unsigned l;
+   int n;
+
+   for (l = 0; l < LOGGER_LEVELS; l++)
+   {
+      uint64_t limited = atomic_load_explicit(&logger.limited[l], memory_order_relaxed);
+      if (limited > logger.noted_limited[l])
+      {
+         n = snprintf(line, sizeof(line), "[log] %s を %llu 件間引きました\n",
+               logger_names[l], (unsigned long long)(limited - logger.noted_limited[l]));
+         logger_write(line, (size_t)n);
+      }
+      logger.noted_limited[l] = limited;
+   }
+
+   if (overflowed > logger.noted_overflowed)
+   {
+      n = snprintf(line, sizeof(line), "[log] リングが満杯で %llu 件を捨てました\n",
+            (unsigned long long)(overflowed - logger.noted_overflowed));
+      logger_write(line, (size_t)n);
+   }
+   logger.noted_overflowed = overflowed;
+}
+
+static unsigned logger_drain(void)
+{
+   struct logger_ring *ring, **link;
+   char line[LOGGER_LINE_MAX];
+   unsigned count = 0;
+   uint64_t start = timer_ns();
+   uint64_t now;
+
+   pthread_mutex_lock(&logger.rings_lock);
+   for (link = &logger.rings; (ring = *link); )
+   {
+      /* closed を先に読むので、立っていればこの head が最後です。 */
+      bool   closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+      size_t tail   = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+      size_t head   = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+      while (tail != head)
+      {
+         const struct logger_record *record =
+            (const struct logger_record*)(ring->data + (tail & (LOGGER_RING_SIZE - 1)));
+         const uint8_t *args = (const uint8_t*)(record + 1);
+         const char *fmt     = record->fmt;
+         size_t len;
+
+         tail += record->size;
+         if (record->flags & LOGGER_PAD)
+            continue;
+
+         len = (size_t)snprintf(line, sizeof(line), "[%s] ", logger_names[record->level]);
+         if (record->flags & LOGGER_TEXT)
+            len = logger_append(line, sizeof(line), len, (const char*)args, strlen((const char*)args));
+         else
+         {
+            if (record->flags & LOGGER_FMT_COPY)
+               args = logger_get_string(args, &fmt);
+            len += logger_format(line + len, sizeof(line) - len, fmt, args);
+         }
+         logger_write(line, len);
+         count++;
+      }
+      atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+      if (closed)
+      {
+         *link = ring->next;
+         logger_ring_free(ring);
+      }
+      else
+         link = &ring->next;
+   }
+   pthread_mutex_unlock(&logger.rings_lock);
+
+   now = timer_ns();
+   if (now - logger.noted_at >= LOGGER_NOTE_NS)
+   {
+      logger_note_dropped();
+      logger.noted_at = now;
+   }
+
+   if (logger.batch_used)
+   {
+      fwrite(logger.batch, 1, logger.batch_used, logger.out);
+      fflush(logger.out);
+      logger.batch_used = 0;
+   }
+   if (count)
+   {
+      atomic_fetch_add_explicit(&logger.written, count, memory_order_relaxed);
+      atomic_fetch_add_explicit(&logger.write_ns, timer_ns() - start, memory_order_relaxed);
+   }
+   atomic_fetch_add_explicit(&logger.passes, 1, memory_order_release);
+   return count;
+}
+
+static void *logger_thread(void *arg)
+{
+   struct timespec idle = { 0, LOGGER_IDLE_NS };
+   (void)arg;
+
+   while (!atomic_load(&logger.quit))
+      if (!logger_drain())
+         nanosleep(&idle, NULL);
+
+   logger_drain();
+   logger_note_dropped();
+   if (logger.batch_used)
+   {
+      fwrite(logger.batch, 1, logger.batch_used, logger.out);
+      fflush(logger.out);
+      logger.batch_used = 0;
+   }
+   return NULL;
+}
+
+/* ---- 公開関数 ---- */
+
+void logger_configure(FILE *out, enum retro_log_level min_level, unsigned rate)
+{
+   unsigned l;
+
+   logger.out       = out;
+   logger.min_level = min_level;
+   logger.rate      = rate;
+   for (l = 0; l < LOGGER_LEVELS; l++)
+   {
+      atomic_store(&logger.window[l], 0);
+      atomic_store(&logger.window_count[l], 0);
+   }
+}
+
+bool logger_start(void)
+{
+   unsigned l;
+
+   if (logger.running)
+      return true;
+   if (!logger.out)
+      logger.out = stderr;
+
+   /* 前回の停止までに数えた分は、もう書き出してあります。 */
+   for (l = 0; l < LOGGER_LEVELS; l++)
+      logger.noted_limited[l] = atomic_load(&logger.limited[l]);
+   logger.noted_overflowed = logger_overflowed();
+   logger.noted_at = timer_ns();
+
+   atomic_store(&logger.quit, false);
+   if (pthread_create(&logger.thread, NULL, logger_thread, NULL) != 0)
+      return false;
+   logger.running = true;
+   atomic_store_explicit(&logger.active, true, memory_order_release);
+   return true;
+}
+
+void logger_stop(void)
+{
+   if (!logger.running)
+      return;
+   atomic_store(&logger.active, false);
+   atomic_store(&logger.quit, true);
+   pthread_join(logger.thread, NULL);
+   logger.running = false;
+}
+
+void logger_flush(void)
+{
+   struct timespec wait = { 0, 100000 };
+   uint64_t passes;
+
+   /* 同じアドレスに別のコアが読み込まれても、古い判定を使わないようにします。 */
+   atomic_fetch_add(&logger.generation, 1);
+   if (!logger.running)
+      return;
+
+   /* 出力スレッドはリングを解放するために rings_lock を取るので、ここでは待ちません。
+    * 呼び出した後に始まった logger_drain() が 1 回終われば、それまでに積んだ分は書き出し済みです。 */
+   passes = atomic_load_explicit(&logger.passes, memory_order_acquire);
+   while (atomic_load_explicit(&logger.passes, memory_order_acquire) - passes < 2)
+      nanosleep(&wait, NULL);
+}
+
+static void logger_read_stats(struct logger_stats *stats)
+{
+   struct logger_ring *ring;
+   unsigned l;
+
+   memset(stats, 0, sizeof(*stats));
+   for (l = 0; l < LOGGER_LEVELS; l++)
+      stats->limited[l] = atomic_load_explicit(&logger.limited[l], memory_order_relaxed);
+   stats->written  = atomic_load_explicit(&logger.written, memory_order_relaxed);
+   stats->write_ns = atomic_load_explicit(&logger.write_ns, memory_order_relaxed);
+   stats->threads = atomic_load(&logger.ring_count);
+
+   pthread_mutex_lock(&logger.rings_lock);
+   for (l = 0; l < LOGGER_LEVELS; l++)
+      stats->messages[l] = logger.retired_messages[l];
+   stats->overflowed   = logger.retired_overflowed;
+   stats->preformatted = logger.retired_preformatted;
+   for (ring = logger.rings; ring; ring = ring->next)
+   {
+      for (l = 0; l < LOGGER_LEVELS; l++)
+         stats->messages[l] += atomic_load_explicit(&ring->messages[l], memory_order_relaxed);
+      stats->overflowed   += atomic_load_explicit(&ring->overflowed, memory_order_relaxed);
+      stats->preformatted += atomic_load_explicit(&ring->preformatted, memory_order_relaxed);
+   }
+   pthread_mutex_unlock(&logger.rings_lock);
+}
+
+void logger_get_stats(struct logger_stats *stats)
+{
+   unsigned l;
+
+   logger_read_stats(stats);
+   for (l = 0; l < LOGGER_LEVELS; l++)
+   {
+      stats->messages[l] -= logger_base.messages[l];
+      stats->limited[l]  -= logger_base.limited[l];
+   }
+   stats->overflowed   -= logger_base.overflowed;
+   stats->preformatted -= logger_base.preformatted;
+   stats->written      -= logger_base.written;
+   stats->write_ns     -= logger_base.write_ns;
+}
+
+void logger_reset_stats(void)
+{
+   logger_read_stats(&logger_base);
+}
+
+bool logger_parse_level(const char *name, enum retro_log_level *level)
+{
+   static const char *names[LOGGER_LEVELS] = { "debug", "info", "warn", "error" };
+   unsigned l;
+
+   for (l = 0; l < LOGGER_LEVELS; l++)
+   {
+      if (!strcmp(name, names[l]))
+      {
+         *level = (enum retro_log_level)l;
+         return true;
+      }
+   }
+   return false;
+}
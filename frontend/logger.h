@@ -0,0 +1,58 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_log_printf_t の非同期実装。
+ *
+ * コアのスレッドでは、書式文字列のポインタと引数をスレッドごとのロックフリーのリング (SPSC) に
+ * 写すだけにし、整形と書き出しは出力スレッドで行います。%s の文字列はその場でコピーします。
+ * 書式文字列は共有オブジェクトの読み取り専用の領域にあればポインタだけを渡し、
+ * スタックやヒープで組み立てたものは中身をコピーします。
+ * %n や %ls のように後から整形できない変換を含むメッセージは、呼び出したスレッドで整形してから渡します。
+ *
+ * レベルごとに 1 秒あたりのメッセージ数を制限でき、制限やリングの溢れで捨てた数を数えます。
+ * 捨てた数は出力スレッドが 1 秒に 1 回まとめて書き出します。
+ */
+
+#ifndef RETROBENCH_LOGGER_H__
+#define RETROBENCH_LOGGER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define LOGGER_LEVELS 4
+
+struct logger_stats
+{
+   uint64_t messages[LOGGER_LEVELS];   /* 表示するレベルで受け取った数 */
+   uint64_t limited[LOGGER_LEVELS];    /* 1 秒あたりの上限を超えて捨てた数 */
+   uint64_t overflowed;                /* リングが満杯で捨てた数 */
+   uint64_t preformatted;              /* 呼び出したスレッドで整形した数 */
+   uint64_t written;                   /* 出力スレッドが書き出した数 */
+   uint64_t write_ns;                  /* 出力スレッドが整形と書き出しにかけた時間 */
+   unsigned threads;                   /* リングを持つスレッドの数 */
+};
+
+/* 出力先と、表示する最低のレベル、レベルごとの 1 秒あたりの上限 (0 なら無制限) を設定します。
+ * 出力スレッドを開始するまでは、呼び出したスレッドで同期的に書き出します。 */
+void logger_configure(FILE *out, enum retro_log_level min_level, unsigned rate);
+
+/* 出力スレッドを開始 / 停止します。停止するときは受け取ったものをすべて書き出します。 */
+bool logger_start(void);
+void logger_stop(void);
+
+/* それまでに受け取ったメッセージを書き出し終えるまで待ちます。
+ * 書式文字列を持っているコアを dlclose() する前に呼びます。 */
+void logger_flush(void);
+
+/* RETRO_ENVIRONMENT_GET_LOG_INTERFACE で渡す retro_log_printf_t。 */
+void RETRO_CALLCONV logger_printf(enum retro_log_level level, const char *fmt, ...);
+
+void logger_get_stats(struct logger_stats *stats);
+void logger_reset_stats(void);
+
+/* "debug" / "info" / "warn" / "error" を解釈します。 */
+bool logger_parse_level(const char *name, enum retro_log_level *level);
+
+#endif
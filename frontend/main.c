@@ -0,0 +1,911 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - libretro.h を使ったヘッドレスのリファレンスフロントエンド。
+ *
+ * コアを dlopen() し、ペーシングなしで retro_run() を N 回呼び出して、
+ * フレームレート・フレームごとのレイテンシ分布・コールバックのオーバーヘッドを報告します。
+ * 映像・音声・入力のコールバックはすべてほぼゼロコストのシンクです。
+ * --audio を指定した場合だけ、コアの fps に合わせて実時間でペーシングし、
+ * 音声を出力スレッドへ流してアンダーランと遅延を計測します。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "libretro.h"
+#include "core.h"
+#include "callbacks.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "bench.h"
+#include "cpu_features.h"
+#include "pixconv.h"
+#include "dispatch.h"
+#include "video.h"
+#include "framehash.h"
+#include "tilediff.h"
+#include "fbpool.h"
+#include "audio.h"
+#include "movie.h"
+#include "input.h"
+#include "perf.h"
+#include "vfs.h"
+#include "content.h"
+#include "options.h"
+#include "logger.h"
+#include "autosave.h"
+#include "batch.h"
+#include "savestate.h"
+#include "timer.h"
+
+struct bench_config
+{
+   const char *core_path;
+   const char *content_path;
+   unsigned frames;
+   unsigned warmup;
+   size_t rewind_budget;   /* 0 なら巻き戻しを使いません */
+   unsigned runahead;      /* 0 なら先行実行を使いません */
+   unsigned autosave;      /* 0 でなければ、このフレーム数ごとに SRAM / RTC の変化を調べて保存します */
+   bool convert;           /* フレームを XRGB8888 に変換する映像パイプラインを通す */
+   bool fbpool;            /* GET_CURRENT_SOFTWARE_FRAMEBUFFER にプールのバッファで応える */
+   unsigned tiles;         /* 0 でなければ、この大きさのタイルで前のフレームと比べて変わった所だけを変換します */
+   unsigned audio_latency; /* 0 なら音声の出力スレッドを使いません (ms) */
+   unsigned stress_us;     /* 0 でなければフレームにランダムな負荷をかけます (最大 us) */
+   const char *record;     /* 計測中の入力を記録するムービー */
+   const char *play;       /* 計測中の入力を再生するムービー */
+   const char *trace;      /* perf カウンタの区間を書き出す Chrome trace の JSON */
+   const char *batch;      /* ワーカープロセスで並列に実行するコンテンツの一覧 */
+   unsigned jobs;          /* バッチのワーカー数。0 なら CPU の数 */
+   bool fork_server;       /* バッチの一覧をステートとし、起動済みのコアから fork() して実行する */
+   const char *load_state; /* 計測の前に読み込むステート */
+   const char *save_state; /* 計測の後に書き込むステート */
+};
+
+/* 音声パイプラインの既定値。出力側のクロックはわざと 0.3% 速くしてあり、
+ * dynamic rate control がなければいずれアンダーランします。 */
+#define AUDIO_OUT_RATE        48000
+#define AUDIO_PERIOD_FRAMES   256
+#define AUDIO_MAX_RATE_DELTA  0.005
+#define AUDIO_CLOCK_SKEW      0.003
+
+/* ログはレベルごとに 1 秒あたりこの件数までにします。 */
+#define LOG_RATE              200
+
+static void usage(const char *argv0)
+{
+   fprintf(stderr,
+         "使い方: %s [オプション] <core.so> [content]\n"
+         "        %s --bench NAME\n"
+         "  -n, --frames N     計測するフレーム数 (既定: 10000)\n"
+         "  -w, --warmup N     計測前に捨てるフレーム数 (既定: 100)\n"
+         "  -s, --system DIR   システムディレクトリ (既定: .)\n"
+         "  -S, --save DIR     セーブディレクトリ (既定: .)\n"
+         "  -r, --rewind MB    毎フレーム巻き戻し用のステートを積む (予算 MB)\n"
+         "  -a, --runahead N   2 つ目のインスタンスで N フレーム先行実行する\n"
+         "  -B, --autosave N   N フレームごとに SRAM / RTC の変化を調べ、変わっていればセーブディレクトリに保存する\n"
+         "  -c, --convert      フレームを XRGB8888 に変換する映像パイプラインを通す\n"
+         "  -f, --fbpool       GET_CURRENT_SOFTWARE_FRAMEBUFFER にプールのバッファで応える (-c を含む)\n"
+         "  -D, --dirty-tiles N N×N ピクセルのタイルで前のフレームと比べ、変わったタイルだけを変換する (-c を含む)\n"
+         "  -A, --audio MS     音声を遅延 MS の出力スレッドへ流し、実時間でペーシングする\n"
+         "  -t, --stress US    8 フレームに 1 回、最大 US マイクロ秒の CPU 負荷をかける\n"
+         "  -R, --record FILE  乱数のパッド入力で計測し、入力をムービーとして記録する\n"
+         "  -P, --play FILE    ムービーの開始ステートから入力を再生して計測する\n"
+         "  -T, --trace FILE   perf カウンタの区間を Chrome trace / Perfetto の JSON に書き出す\n"
+         "  -V, --vfs BACKEND  VFS の読み方: mmap (既定) / pread / uring / threads (先読み)\n"
+         "  -o, --option KEY=VALUE  コアオプションの値を指定する (複数回指定できます)\n"
+         "  -L, --log-level LEVEL  表示するログの最低レベル: debug / info / warn (既定) / error\n"
+         "  -l, --log-rate N   ログをレベルごとに 1 秒あたり N 件までにする (既定: 200, 0 で無制限)\n"
+         "  -C, --content-cache DIR  zip から展開したコンテンツを置く (既定: ~/.cache/retrobench/content)\n"
+         "  -X, --cpu-disable LIST  カンマ区切りの CPU 機能 (avx512f,avx2 など) を無いものとして扱う\n"
+         "  -Z, --load-state FILE  計測の前にステートを読み込む (コンテナか retro_serialize() のダンプ)\n"
+         "  -W, --save-state FILE  計測の後にステートをチャンクごとに並列に圧縮したコンテナで書き込む\n"
+         "  -J, --batch LIST   LIST の各行のコンテンツを -n フレームずつワーカープロセスで並列に実行する\n"
+         "  -j, --jobs N       バッチのワーカー数 (既定: CPU の数)\n"
+         "  -F, --fork-server  コアと content を 1 度だけ起動し、--batch の各行のステート (- なら無し) から\n"
+         "                     fork() した子でジョブを実行する\n"
+         "  -b, --bench NAME   コアを使わずに部品単体のベンチマークを実行する\n",
+         argv0, argv0);
+   bench_list();
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t*)a;
+   uint64_t y = *(const uint64_t*)b;
+   return x < y ? -1 : x > y;
+}
+
+/* ソート済み配列の p パーセンタイル(0-100)を返します。 */
+static uint64_t percentile(const uint64_t *sorted, size_t count, double p)
+{
+   size_t idx = (size_t)(p / 100.0 * (double)(count - 1) + 0.5);
+   return sorted[idx < count ? idx : count - 1];
+}
+
+static void report(const struct bench_config *config, const struct core *core,
+      uint64_t *frame_ns, uint64_t total_ns)
+{
+   struct callback_cost cost;
+   struct vfs_stats vfstats;
+   struct logger_stats lstats;
+   double frames   = (double)config->frames;
+   double per_frame_ns;
+   double overhead_ns;
+
+   qsort(frame_ns, config->frames, sizeof(*frame_ns), compare_u64);
+   callbacks_measure_cost(&cost);
+
+   per_frame_ns = (double)total_ns / frames;
+   overhead_ns  =
+        (double)callback_stats.video_refresh      * cost.video_refresh
+      + (double)callback_stats.audio_sample       * cost.audio_sample
+      + (double)callback_stats.audio_sample_batch * cost.audio_sample_batch
+      + (double)callback_stats.input_poll         * cost.input_poll
+      + (double)callback_stats.input_state        * cost.input_state
+      + (double)options_stats.gets                * cost.get_variable
+      + (double)options_stats.polls               * cost.get_variable_update;
+   overhead_ns /= frames;
+
+   printf("core:            %s %s (%s)\n",
+         core->system_info.library_name, core->system_info.library_version,
+         config->core_path);
+   if (config->content_path)
+   {
+      const struct content_stats *cs = &core->content.stats;
+
+      printf("content:         %.1f MB  %s%s  load %.2f ms\n", cs->size / 1048576.0,
+            !cs->archived ? "file" : cs->cache_hit ? "archive (cache hit)" : "archive (extracted)",
+            cs->mapped ? "  mmap" : "", cs->load_ns / 1e6);
+   }
+   printf("frames:          %u (warmup %u)\n", config->frames, config->warmup);
+   printf("total:           %.3f s\n", (double)total_ns / 1e9);
+   printf("fps:             %.1f (コアの想定: %.2f)\n",
+         1e9 / per_frame_ns, core->av_info.timing.fps);
+   printf("frame time (us): min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+         frame_ns[0] / 1e3,
+         percentile(frame_ns, config->frames, 50.0) / 1e3,
+         percentile(frame_ns, config->frames, 90.0) / 1e3,
+         percentile(frame_ns, config->frames, 99.0) / 1e3,
+         percentile(frame_ns, config->frames, 99.9) / 1e3,
+         frame_ns[config->frames - 1] / 1e3);
+   printf("callbacks/frame: video %.2f (dupe %.2f)  audio_sample %.1f (%.2f blocks)  "
+         "audio_batch %.2f (%.1f frames)  input_poll %.2f  input_state %.1f  env %.2f\n",
+         callback_stats.video_refresh      / frames,
+         callback_stats.video_dupe         / frames,
+         callback_stats.audio_sample       / frames,
+         callback_stats.audio_blocks       / frames,
+         callback_stats.audio_sample_batch / frames,
+         callback_stats.audio_frames       / frames,
+         callback_stats.input_poll         / frames,
+         callback_stats.input_state        / frames,
+         callback_stats.environment        / frames);
+   printf("input/frame:     joypad %.1f  analog %.1f  mouse %.1f  keyboard %.1f  "
+         "lightgun %.1f  pointer %.1f  other %.1f  max %llu\n",
+         input_stats.calls[RETRO_DEVICE_JOYPAD]   / frames,
+         input_stats.calls[RETRO_DEVICE_ANALOG]   / frames,
+         input_stats.calls[RETRO_DEVICE_MOUSE]    / frames,
+         input_stats.calls[RETRO_DEVICE_KEYBOARD] / frames,
+         input_stats.calls[RETRO_DEVICE_LIGHTGUN] / frames,
+         input_stats.calls[RETRO_DEVICE_POINTER]  / frames,
+         (input_stats.calls[RETRO_DEVICE_NONE] + input_stats.calls[7]) / frames,
+         (unsigned long long)input_stats.max_frame_calls);
+   if (options_count() || options_stats.gets || options_stats.polls)
+      printf("options/frame:   %u keys  get_variable %.2f (miss %.2f, %.1f ns)  "
+            "variable_update %.2f (true %llu, %.1f ns)\n",
+            options_count(), options_stats.gets / frames, options_stats.misses / frames,
+            cost.get_variable, options_stats.polls / frames,
+            (unsigned long long)options_stats.updates, cost.get_variable_update);
+   if (callback_stats.environment)
+      callbacks_report_environment(frames);
+   printf("callback cost:   video %.1f ns  audio_sample %.1f ns  audio_batch %.1f ns  "
+         "input_poll %.1f ns  input_state %.1f ns\n",
+         cost.video_refresh, cost.audio_sample, cost.audio_sample_batch,
+         cost.input_poll, cost.input_state);
+   printf("callback overhead: %.1f ns/frame (%.3f%%)\n",
+         overhead_ns, 100.0 * overhead_ns / per_frame_ns);
+
+   if (config->convert)
+   {
+      const struct video_stats *vs = &video_state.stats;
+      /* 重複フレームも含めた、表示側に渡したフレームあたりの値です。 */
+      double vframes = (double)(vs->frames + vs->dupes ? vs->frames + vs->dupes : 1);
+
+      if (config->tiles)
+         printf("video:           %s  %.1f us/frame (convert %.1f + diff %.1f %s)  "
+               "%.1f KB in + %.1f KB out per frame\n",
+               pixconv_kernel()->name,
+               (vs->convert_ns + vs->diff_ns) / 1e3 / vframes,
+               vs->convert_ns / 1e3 / vframes, vs->diff_ns / 1e3 / vframes,
+               tilediff_kernel()->name,
+               vs->bytes_in / 1024.0 / vframes, vs->bytes_out / 1024.0 / vframes);
+      else
+         printf("video:           %s  %.1f us/frame (convert %.1f + hash %.1f %s)  "
+               "%.1f KB in + %.1f KB out per frame\n",
+               pixconv_kernel()->name,
+               (vs->convert_ns + vs->hash_ns) / 1e3 / vframes,
+               vs->convert_ns / 1e3 / vframes, vs->hash_ns / 1e3 / vframes,
+               video_state.detect_dupes ? framehash_kernel()->name : "off",
+               vs->bytes_in / 1024.0 / vframes, vs->bytes_out / 1024.0 / vframes);
+      printf("                 dupe %.2f/frame (NULL %.2f  identical %.2f of %.2f hashed)  "
+            "memcpy %.2f/frame  zero-copy %.2f/frame",
+            (vs->dupes + vs->identical) / vframes, vs->dupes / vframes,
+            vs->identical / vframes, vs->hashed / vframes,
+            vs->copies / vframes, vs->zero_copy / vframes);
+      if (config->fbpool)
+         printf("  pool acquire %.2f/frame  submit %.2f/frame",
+               fbpool.acquires / frames, fbpool.submits / frames);
+      printf("\n");
+      if (config->tiles)
+         printf("                 tiles %upx  dirty %.1f of %.1f tiles/frame (%.1f rects)  "
+               "processed %.1f KB of %.1f KB per frame (%.1f%%)\n",
+               config->tiles, vs->dirty_tiles / vframes, vs->tiles / vframes, vs->rects / vframes,
+               vs->bytes_in / 1024.0 / vframes, vs->frame_bytes / 1024.0 / vframes,
+               vs->frame_bytes ? 100.0 * vs->bytes_in / vs->frame_bytes : 0.0);
+   }
+
+   vfs_get_stats(&vfstats);
+   if (vfstats.opens)
+   {
+      /* ロード中の読み込みも含めた、起動からの合計です。 */
+      printf("vfs:             %llu opens (%llu mapped)  %llu reads (%llu from map)  "
+            "%.1f MB read  %llu seeks  %.1f MB written\n",
+            (unsigned long long)vfstats.opens, (unsigned long long)vfstats.mapped,
+            (unsigned long long)vfstats.reads, (unsigned long long)vfstats.mapped_reads,
+            vfstats.read_bytes / 1048576.0, (unsigned long long)vfstats.seeks,
+            vfstats.write_bytes / 1048576.0);
+      if (vfstats.cached)
+         printf("                 readahead %s  hits %llu  waits %llu  misses %llu  "
+               "%llu blocks  stall %.1f us/frame\n",
+               vfstats.cached_uring ? "io_uring" : "thread pool",
+               (unsigned long long)vfstats.cache_hits, (unsigned long long)vfstats.cache_waits,
+               (unsigned long long)vfstats.cache_misses, (unsigned long long)vfstats.readaheads,
+               vfstats.stall_ns / 1e3 / frames);
+   }
+
+   logger_flush();
+   logger_get_stats(&lstats);
+   if (lstats.messages[RETRO_LOG_DEBUG] + lstats.messages[RETRO_LOG_INFO]
+         + lstats.messages[RETRO_LOG_WARN] + lstats.messages[RETRO_LOG_ERROR]
+         + lstats.limited[RETRO_LOG_DEBUG] + lstats.limited[RETRO_LOG_INFO]
+         + lstats.limited[RETRO_LOG_WARN] + lstats.limited[RETRO_LOG_ERROR] + lstats.overflowed)
+      printf("log:             debug %llu  info %llu  warn %llu  error %llu  (%u threads)  "
+            "rate-limited %llu  overflowed %llu  preformatted %llu\n",
+            (unsigned long long)lstats.messages[RETRO_LOG_DEBUG],
+            (unsigned long long)lstats.messages[RETRO_LOG_INFO],
+            (unsigned long long)lstats.messages[RETRO_LOG_WARN],
+            (unsigned long long)lstats.messages[RETRO_LOG_ERROR], lstats.threads,
+            (unsigned long long)(lstats.limited[RETRO_LOG_DEBUG] + lstats.limited[RETRO_LOG_INFO]
+               + lstats.limited[RETRO_LOG_WARN] + lstats.limited[RETRO_LOG_ERROR]),
+            (unsigned long long)lstats.overflowed, (unsigned long long)lstats.preformatted);
+
+   if (frontend_state.has_memmap)
+   {
+      unsigned j;
+      for (j = 0; j < frontend_state.memmap.num_spaces; j++)
+      {
+         const struct memmap_space *space = &frontend_state.memmap.spaces[j];
+         printf("memory map:      space \"%s\" max 0x%zX  page %u B  %zu pages (lookup %zu)\n",
+               space->name, space->max_addr, 1u << space->page_bits, space->pages,
+               space->lookup_pages);
+      }
+   }
+}
+
+static void report_audio(const struct audio_stats *as, const struct audio_config *cfg)
+{
+   double samples = (double)(as->fill_samples ? as->fill_samples : 1);
+
+   printf("audio:           %u Hz  latency %u ms  period %u  skew %+.2f%%\n",
+         cfg->out_rate, cfg->latency_ms, cfg->period_frames, cfg->clock_skew * 100.0);
+   printf("                 underruns %llu (%llu frames / %llu periods)  dropped %llu frames\n",
+         (unsigned long long)as->underruns, (unsigned long long)as->underrun_frames,
+         (unsigned long long)as->periods, (unsigned long long)as->dropped_frames);
+   printf("                 buffered avg %.1f ms  min %.1f ms  ratio %.5f - %.5f\n",
+         as->fill_sum / samples * 1e3 / cfg->out_rate,
+         as->fill_samples ? as->fill_min * 1e3 / cfg->out_rate : 0.0,
+         as->ratio_min, as->ratio_max);
+   printf("                 buffer status calls %llu (underrun likely %llu)\n",
+         (unsigned long long)as->status_calls, (unsigned long long)as->underrun_likely);
+}
+
+static void report_movie(const struct movie_stats *ms, bool record,
+      uint64_t total_ns, unsigned frames)
+{
+   double mframes = (double)(ms->frames ? ms->frames : 1);
+
+   printf("movie:           %s %llu frames  poll %.2f/frame  answers %.2f/frame "
+         "(queries %.2f)  %.1f B/frame + state %llu B\n",
+         record ? "record" : "playback", (unsigned long long)ms->frames,
+         ms->polls / mframes, ms->answers / mframes, ms->queries / mframes,
+         ms->bytes / mframes, (unsigned long long)ms->state_bytes);
+   printf("                 overhead %.1f ns/frame (%.3f%% of frame)  desyncs %llu\n",
+         ms->ns / mframes, 100.0 * ms->ns / (double)total_ns * frames / mframes,
+         (unsigned long long)ms->desyncs);
+}
+
+/* 合成 CPU 負荷。8 フレームに 1 回、最大 max_us マイクロ秒だけ空回りします。 */
+static void stress(unsigned max_us)
+{
+   uint64_t until;
+
+   if (rand() % 8)
+      return;
+   until = timer_ns() + (uint64_t)(rand() % (max_us + 1)) * 1000;
+   while (timer_ns() < until)
+      ;
+}
+
+/* 次のフレームの期限まで眠ります。大きく遅れたら期限を今に合わせ直します。 */
+static void pace(uint64_t *deadline, uint64_t frame_period)
+{
+   uint64_t now = timer_ns();
+   struct timespec ts;
+
+   *deadline += frame_period;
+   if (now > *deadline + frame_period)
+   {
+      *deadline = now;
+      return;
+   }
+   if (now >= *deadline)
+      return;
+
+   ts.tv_sec  = (time_t)(*deadline / 1000000000u);
+   ts.tv_nsec = (long)(*deadline % 1000000000u);
+   clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/* 自動保存の比較と書き込みの統計を表示します。 */
+static void report_autosave(unsigned frames)
+{
+   struct autosave_stats st;
+
+   autosave_get_stats(&st);
+   printf("autosave:        %s  check %.2f us (%.1f GB/s)  %llu checks  changed %llu  "
+         "written %llu (%.1f KB, coalesced %llu, failed %llu)  %.2f ms/write\n",
+         autosave_kernel()->name,
+         st.checks ? st.check_ns / 1e3 / st.checks : 0.0,
+         st.check_ns ? (double)st.check_bytes / st.check_ns : 0.0,
+         (unsigned long long)st.checks, (unsigned long long)st.changes,
+         (unsigned long long)st.writes, st.write_bytes / 1024.0,
+         (unsigned long long)st.coalesced, (unsigned long long)st.failures,
+         st.writes ? st.write_ns / 1e6 / st.writes : 0.0);
+   printf("                 %.1f bytes written per frame\n",
+         frames ? (double)st.write_bytes / frames : 0.0);
+}
+
+static void report_savestate(const char *what, const struct savestate_stats *st)
+{
+   printf("savestate:       %s %.2f ms  %.1f KB → %.1f KB (%.0f%%)",
+         what, st->ns / 1e6, st->size / 1024.0, st->file_bytes / 1024.0,
+         st->size ? 100.0 * st->file_bytes / st->size : 0.0);
+   if (st->chunks)
+      printf("  %u chunks on %u threads", st->chunks, st->threads);
+   printf("\n");
+}
+
+/* 積んだステートを最大 max_pops 回巻き戻し、所要時間と統計を表示します。 */
+static void report_rewind(struct rewind *rw, struct core *core,
+      uint64_t push_ns, unsigned max_pops)
+{
+   uint64_t start;
+   unsigned pops = 0;
+
+   start = timer_ns();
+   while (pops < max_pops && rw->entries_count > 0)
+   {
+      if (!rewind_pop_core(rw, core))
+      {
+         fprintf(stderr, "retro_unserialize() が失敗しました\n");
+         break;
+      }
+      pops++;
+   }
+
+   printf("rewind:          push %.1f us/frame  pop %.1f us/frame (%u pops)\n",
+         rw->pushes ? push_ns / 1e3 / rw->pushes : 0.0,
+         pops ? (timer_ns() - start) / 1e3 / pops : 0.0, pops);
+   printf("                 %zu frames held in %.2f MB  delta %.1f B/frame (%.2f%% of raw)  "
+         "evicted %llu  state %zu B%s\n",
+         rewind_frames(rw) + pops, rw->ring_size / 1048576.0,
+         rw->pushes ? (double)rw->compressed_bytes / rw->pushes : 0.0,
+         rw->raw_bytes ? 100.0 * rw->compressed_bytes / rw->raw_bytes : 0.0,
+         (unsigned long long)rw->evictions, rw->current_size,
+         (frontend_state.serialization_quirks
+          & RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE) ? " (variable)" : "");
+}
+
+/* 先行実行の内訳を表示します。base_ns は先行実行なしの 1 フレームの時間です。
+ * シリアライズと読み込みは入力が変わったフレームだけで行うので、フレームあたりに均した値です。 */
+static void report_runahead(const struct runahead *ra, double base_ns)
+{
+   double runs  = (double)(ra->runs ? ra->runs : 1);
+   double total = (double)(ra->primary_ns + ra->serialize_ns
+         + ra->unserialize_ns + ra->secondary_ns) / runs;
+
+   printf("runahead:        %u frames  primary %.1f us  serialize %.1f us  "
+         "unserialize %.1f us  secondary %.1f us\n",
+         ra->frames,
+         ra->primary_ns     / 1e3 / runs,
+         ra->serialize_ns   / 1e3 / runs,
+         ra->unserialize_ns / 1e3 / runs,
+         ra->secondary_ns   / 1e3 / runs);
+   printf("                 overhead %.1f us/frame  cost %.2fx base (%.1f us)  "
+         "resync %.1f%% of frames\n",
+         (total - base_ns) / 1e3, base_ns > 0.0 ? total / base_ns : 0.0,
+         base_ns / 1e3, 100.0 * ra->resyncs / runs);
+}
+
+int main(int argc, char **argv)
+{
+   static const struct option long_opts[] = {
+      { "frames", required_argument, NULL, 'n' },
+      { "warmup", required_argument, NULL, 'w' },
+      { "system", required_argument, NULL, 's' },
+      { "save",   required_argument, NULL, 'S' },
+      { "rewind", required_argument, NULL, 'r' },
+      { "runahead", required_argument, NULL, 'a' },
+      { "autosave", required_argument, NULL, 'B' },
+      { "convert", no_argument,      NULL, 'c' },
+      { "fbpool", no_argument,       NULL, 'f' },
+      { "dirty-tiles", required_argument, NULL, 'D' },
+      { "audio",  required_argument, NULL, 'A' },
+      { "stress", required_argument, NULL, 't' },
+      { "record", required_argument, NULL, 'R' },
+      { "play",   required_argument, NULL, 'P' },
+      { "trace",  required_argument, NULL, 'T' },
+      { "cpu-disable", required_argument, NULL, 'X' },
+      { "vfs",    required_argument, NULL, 'V' },
+      { "content-cache", required_argument, NULL, 'C' },
+      { "option", required_argument, NULL, 'o' },
+      { "log-level", required_argument, NULL, 'L' },
+      { "log-rate", required_argument, NULL, 'l' },
+      { "load-state", required_argument, NULL, 'Z' },
+      { "save-state", required_argument, NULL, 'W' },
+      { "batch",  required_argument, NULL, 'J' },
+      { "jobs",   required_argument, NULL, 'j' },
+      { "fork-server", no_argument,  NULL, 'F' },
+      { "bench",  required_argument, NULL, 'b' },
+      { "help",   no_argument,       NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+   };
+   struct bench_config config;
+   struct core core;
+   struct rewind rw;
+   struct runahead ra;
+   struct audio_config acfg;
+   struct audio_stats astats;
+   struct movie_stats mstats;
+   struct savestate_meta state_meta;
+   struct savestate_stats load_stats, save_stats;
+   /* コアのカウンタはこの区間の下に入れ子で集計されます。 */
+   static struct retro_perf_counter perf_frame = { "frame", 0, 0, 0, false };
+   bool movie_ok = true;
+   const char *bench = NULL;
+   uint64_t disabled;
+   enum vfs_backend vfs_backend;
+   enum retro_log_level log_level = RETRO_LOG_WARN;
+   unsigned log_rate  = LOG_RATE;
+   uint64_t *frame_ns = NULL;
+   uint64_t base_ns   = 0;
+   unsigned base_frames = 0;
+   uint64_t total_ns  = 0;
+   uint64_t rewind_ns = 0;
+   uint64_t deadline  = 0;
+   uint64_t frame_period = 0;
+   unsigned i;
+   int c;
+   int ret = EXIT_FAILURE;
+
+   memset(&config, 0, sizeof(config));
+   memset(&rw, 0, sizeof(rw));
+   memset(&ra, 0, sizeof(ra));
+   config.frames = 10000;
+   config.warmup = 100;
+
+   while ((c = getopt_long(argc, argv, "n:w:s:S:r:a:B:cfD:A:t:R:P:T:X:V:C:o:L:l:Z:W:J:j:Fb:h", long_opts, NULL)) != -1)
+   {
+      switch (c)
+      {
+         case 'n':
+            config.frames = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 'w':
+            config.warmup = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 's':
+            frontend_state.system_dir = optarg;
+            break;
+         case 'S':
+            frontend_state.save_dir = optarg;
+            break;
+         case 'r':
+            config.rewind_budget = (size_t)strtoul(optarg, NULL, 0) << 20;
+            break;
+         case 'a':
+            config.runahead = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 'B':
+            config.autosave = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 'c':
+            config.convert = true;
+            break;
+         case 'f':
+            config.fbpool  = true;
+            config.convert = true;
+            break;
+         case 'D':
+            config.tiles   = (unsigned)strtoul(optarg, NULL, 0);
+            config.convert = true;
+            break;
+         case 'A':
+            config.audio_latency = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 't':
+            config.stress_us = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 'R':
+            config.record = optarg;
+            input_set_synthetic(true);
+            break;
+         case 'P':
+            config.play = optarg;
+            break;
+         case 'T':
+            config.trace = optarg;
+            break;
+         case 'X':
+            if (!cpu_features_parse(optarg, &disabled))
+            {
+               fprintf(stderr, "知らない CPU 機能の名前です: %s\n", optarg);
+               return EXIT_FAILURE;
+            }
+            cpu_features_disable(disabled);
+            break;
+         case 'V':
+            if (!vfs_parse_backend(optarg, &vfs_backend))
+            {
+               fprintf(stderr, "知らない VFS の方式です: %s\n", optarg);
+               return EXIT_FAILURE;
+            }
+            vfs_set_backend(vfs_backend);
+            break;
+         case 'C':
+            content_set_cache_dir(optarg);
+            break;
+         case 'o':
+            if (!options_assign(optarg))
+            {
+               fprintf(stderr, "オプションは KEY=VALUE の形で指定してください: %s\n", optarg);
+               return EXIT_FAILURE;
+            }
+            break;
+         case 'L':
+            if (!logger_parse_level(optarg, &log_level))
+            {
+               fprintf(stderr, "知らないログのレベルです: %s\n", optarg);
+               return EXIT_FAILURE;
+            }
+            break;
+         case 'l':
+            log_rate = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 'Z':
+            config.load_state = optarg;
+            break;
+         case 'W':
+            config.save_state = optarg;
+            break;
+         case 'J':
+            config.batch = optarg;
+            break;
+         case 'j':
+            config.jobs = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+         case 'F':
+            config.fork_server = true;
+            break;
+         case 'b':
+            bench = optarg;
+            break;
+         default:
+            usage(argv[0]);
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+      }
+   }
+
+   /* 部品のカーネルは、コアが retro_init() で CPU の機能を問い合わせる前に 1 度だけ選びます。 */
+   pixconv_register();
+   framehash_register();
+   tilediff_register();
+   autosave_register();
+   dispatch_bind(cpu_features_ext());
+
+   if (bench)
+      return bench_run(bench) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+   if (optind >= argc || config.frames == 0)
+   {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if ((config.record || config.play) && (config.runahead || (config.record && config.play)))
+   {
+      fprintf(stderr, "--record/--play は先行実行や互いに併用できません\n");
+      return EXIT_FAILURE;
+   }
+
+   if (config.fork_server && !config.batch)
+   {
+      fprintf(stderr, "--fork-server には --batch でステートの一覧を指定してください\n");
+      return EXIT_FAILURE;
+   }
+
+   config.core_path = argv[optind];
+   if (optind + 1 < argc)
+      config.content_path = argv[optind + 1];
+
+   /* バッチはコンテンツごとにワーカーの中でコアを読み込むので、ここでは読み込みません。 */
+   if (config.batch)
+   {
+      struct batch_config bcfg;
+
+      bcfg.core_path    = config.core_path;
+      bcfg.list_path    = config.batch;
+      bcfg.workers      = config.jobs;
+      bcfg.frames       = config.frames;
+      bcfg.fork_server  = config.fork_server;
+      bcfg.content_path = config.content_path;
+      logger_configure(stderr, log_level, log_rate);
+      return batch_run(&bcfg) ? EXIT_SUCCESS : EXIT_FAILURE;
+   }
+
+   frame_ns = (uint64_t*)malloc(config.frames * sizeof(*frame_ns));
+   if (!frame_ns)
+      return EXIT_FAILURE;
+
+   perf_init(config.trace != NULL);
+
+   /* コアのログの整形と書き出しは出力スレッドに任せます。 */
+   logger_configure(stderr, log_level, log_rate);
+   if (!logger_start())
+      fprintf(stderr, "ログの出力スレッドを開始できないので、同期的に書き出します\n");
+
+   if (!core_load(&core, config.core_path, false))
+      goto end;
+
+   callbacks_set_environment(&core);
+   core.retro_init();
+   core.initialized = true;
+   callbacks_install(&core);
+
+   if (!core_load_game(&core, config.content_path))
+      goto end;
+
+   if (config.autosave && !autosave_init(&core, frontend_state.save_dir,
+            config.content_path ? core.content.name : core.system_info.library_name,
+            config.autosave))
+   {
+      fprintf(stderr, "自動保存を開始できません\n");
+      goto end;
+   }
+
+   if (config.convert && !video_init(
+            core.av_info.geometry.max_width, core.av_info.geometry.max_height))
+   {
+      fprintf(stderr, "映像の出力バッファを確保できません\n");
+      goto end;
+   }
+   if (config.tiles && !video_enable_tiles(config.tiles))
+   {
+      fprintf(stderr, "タイルの比較に使うバッファを確保できません\n");
+      goto end;
+   }
+   if (config.fbpool && !fbpool_init(core.av_info.geometry.max_width,
+            core.av_info.geometry.max_height, frontend_state.pixel_format))
+   {
+      fprintf(stderr, "フレームバッファプールを確保できません\n");
+      goto end;
+   }
+
+   if (config.rewind_budget &&
+         !rewind_init(&rw, config.rewind_budget, core.retro_serialize_size()))
+   {
+      fprintf(stderr, "巻き戻しバッファを確保できません\n");
+      goto end;
+   }
+
+   if (config.runahead &&
+         !runahead_init(&ra, &core, config.content_path, config.runahead))
+      goto end;
+
+   /* ステートにはコアとコンテンツを記録し、読み込むときに今のものと比べます。 */
+   if (config.load_state || config.save_state)
+   {
+      uint64_t hash = 0;
+
+      if (config.content_path && !content_hash(&core.content, &hash))
+         fprintf(stderr, "コンテンツのハッシュを求められません: %s\n", config.content_path);
+      savestate_describe(&state_meta, &core, frontend_state.serialization_quirks, hash);
+   }
+   if (config.load_state && !savestate_load(&core, config.load_state, &state_meta, &load_stats))
+   {
+      fprintf(stderr, "ステートを読み込めません: %s\n", config.load_state);
+      goto end;
+   }
+
+   /* ウォームアップ後半の平均を先行実行なしの基準フレーム時間とします。
+    * 先行実行の内訳と同じく retro_run() だけを測ります。 */
+   for (i = 0; i < config.warmup && !frontend_state.shutdown; i++)
+   {
+      uint64_t start = timer_ns();
+      callbacks_run(&core);
+      if (i >= config.warmup / 2)
+      {
+         base_ns += timer_ns() - start;
+         base_frames++;
+      }
+      callbacks_frame_end();
+   }
+
+   /* ウォームアップはペーシングしないので、音声はその後から流し始めます。 */
+   if (config.audio_latency)
+   {
+      acfg.out_rate       = AUDIO_OUT_RATE;
+      acfg.latency_ms     = config.audio_latency;
+      acfg.period_frames  = AUDIO_PERIOD_FRAMES;
+      acfg.max_rate_delta = AUDIO_MAX_RATE_DELTA;
+      acfg.clock_skew     = AUDIO_CLOCK_SKEW;
+      if (!audio_init(&acfg, core.av_info.timing.sample_rate))
+      {
+         fprintf(stderr, "音声の出力スレッドを開始できません\n");
+         goto end;
+      }
+      frame_period = (uint64_t)(1e9 / (core.av_info.timing.fps > 0.0
+               ? core.av_info.timing.fps : 60.0));
+   }
+   memset(&callback_stats, 0, sizeof(callback_stats));
+   memset(&input_stats, 0, sizeof(input_stats));
+   memset(&options_stats, 0, sizeof(options_stats));
+   logger_reset_stats();
+   autosave_reset_stats();
+   perf_reset();
+   memset(&video_state.stats, 0, sizeof(video_state.stats));
+   fbpool.acquires = 0;
+   fbpool.submits  = 0;
+   deadline        = timer_ns();
+
+   /* ムービーは計測の最初のフレームのステートを起点にします。 */
+   if (config.record && !movie_record(config.record, &core))
+      goto end;
+   if (config.play && !movie_play(config.play, &core))
+      goto end;
+
+   for (i = 0; i < config.frames && !frontend_state.shutdown; i++)
+   {
+      uint64_t start;
+
+      if (frame_period)
+         pace(&deadline, frame_period);
+      audio_report_buffer_status();
+
+      start = timer_ns();
+      perf_start(&perf_frame);
+      if (config.stress_us)
+         stress(config.stress_us);
+      if (config.runahead)
+      {
+         if (!runahead_run(&ra))
+         {
+            fprintf(stderr, "先行実行中にシリアライズが失敗しました\n");
+            break;
+         }
+      }
+      else
+         callbacks_run(&core);
+      perf_stop(&perf_frame);
+      /* 先行実行では、セカンダリを進める前に runahead_run() が呼んでいます。 */
+      if (!config.runahead)
+         callbacks_frame_end();
+      movie_ok       = movie_frame_end();
+      frame_ns[i]    = timer_ns() - start;
+      total_ns      += frame_ns[i];
+
+      if (config.rewind_budget)
+      {
+         bool pushed;
+
+         start      = timer_ns();
+         pushed     = rewind_push_core(&rw, &core);
+         rewind_ns += timer_ns() - start;
+         if (!pushed)
+         {
+            fprintf(stderr, "巻き戻し用のステートを積めません\n");
+            i++;
+            break;
+         }
+      }
+      autosave_frame();
+
+      /* 再生がムービーの終わりに達したか、ずれを検出したら止めます。 */
+      if (!movie_ok || (config.play && movie_mode() == MOVIE_NONE))
+      {
+         i++;
+         break;
+      }
+   }
+
+   /* RETRO_ENVIRONMENT_SHUTDOWN で途中終了した場合は実行できた分だけ報告します。 */
+   config.frames = i;
+   if (config.frames == 0)
+   {
+      fprintf(stderr, "計測前にコアが終了しました\n");
+      goto end;
+   }
+
+   /* callbacks_measure_cost() が音声・入力のコールバックを大量に呼ぶので、その前に止めておきます。 */
+   movie_close();
+   mstats = *movie_stats();
+
+   /* report_rewind() が巻き戻す前の、計測を終えた時点のステートを書き込みます。 */
+   if (config.save_state && !savestate_save(&core, config.save_state,
+            frontend_state.serialization_quirks, state_meta.content_hash, 0, &save_stats))
+   {
+      fprintf(stderr, "ステートを書き込めません: %s\n", config.save_state);
+      goto end;
+   }
+
+   if (config.audio_latency)
+   {
+      astats = *audio_stats();
+      acfg   = *audio_config();
+      audio_free();
+   }
+
+   report(&config, &core, frame_ns, total_ns);
+   if (config.runahead)
+      report_runahead(&ra, base_frames ? (double)base_ns / base_frames : 0.0);
+   if (config.audio_latency)
+      report_audio(&astats, &acfg);
+   if (config.record || config.play)
+      report_movie(&mstats, config.record != NULL, total_ns, config.frames);
+   if (config.rewind_budget)
+      report_rewind(&rw, &core, rewind_ns, 600);
+   if (config.autosave)
+      report_autosave(config.frames);
+   if (config.load_state)
+      report_savestate("load", &load_stats);
+   if (config.save_state)
+      report_savestate("save", &save_stats);
+   /* フロントエンドの "frame" だけなら、コアは perf インターフェースを使っていません。 */
+   if (perf_counter_count() > 1)
+      perf_report();
+   if (config.trace && !perf_export_trace(config.trace))
+      goto end;
+   if (mstats.desyncs)
+      fprintf(stderr, "movie: %llu フレーム目で記録とずれました\n",
+            (unsigned long long)mstats.frames + 1);
+   else
+      ret = EXIT_SUCCESS;
+
+end:
+   movie_close();
+   audio_free();
+   runahead_free(&ra);
+   autosave_free();
+   core_unload(&core);
+   logger_stop();
+   if (frontend_state.has_memmap)
+      memmap_free(&frontend_state.memmap);
+   video_free();
+   fbpool_free();
+   rewind_free(&rw);
+   free(frame_ns);
+   return ret;
+}
@@ -0,0 +1,115 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_memory_map をページテーブルにコンパイルしたアドレス変換。
+ *
+ * retro_memory_descriptor の start/select/disconnect/len/offset を
+ * アクセスのたびに辿る代わりに、SET_MEMORY_MAPS を受け取った時点で
+ * アドレス空間(addrspace)ごとに 2 段のページテーブルを作ります。
+ * ページサイズは、記述子の start/select/disconnect/len の最下位ビットより小さく取るので、
+ * ページ内の変換は線形になり、変換はテーブルを 2 回引くだけの O(1) で済みます。
+ * ただしページは MEMMAP_MIN_PAGE_BITS より小さくしません。それより細かい記述子が
+ * 該当しうるページだけは MEMMAP_PAGE_LOOKUP として、変換のたびに記述子を先頭から辿ります。
+ *
+ * ミラーは同じホストポインタを指すページとして、ptr == NULL の記述子や
+ * どの記述子にも該当しないアドレスは NULL ページ(穴)として表現されます。
+ *
+ * select == 0 や len == 0 の記述子は、コンパイルの前に RetroArch と同じ方法で
+ * 省略された値を補います。select == 0 なら len と disconnect から select を求めるので、
+ * disconnect のある記述子は [start, start + len) ではなく、disconnect のビットを飛ばした
+ * len バイト分のアドレスに該当します。len が 2 の累乗でない場合や、start が select の外に
+ * ビットを持つ場合は、RetroArch と同じくマップ全体を受け付けません。
+ */
+
+#ifndef RETROBENCH_MEMMAP_H__
+#define RETROBENCH_MEMMAP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define MEMMAP_MAX_SPACES   16
+#define MEMMAP_L2_BITS      10
+#define MEMMAP_MIN_PAGE_BITS 10     /* 24 ビット空間でも 16K ページ (256 KB) に収まります */
+
+/* ページより細かい記述子が該当しうるページの flags。base は NULL です。 */
+#define MEMMAP_PAGE_LOOKUP  (UINT64_C(1) << 63)
+
+struct memmap_page
+{
+   uint8_t *base;     /* ページ先頭に対応するホストポインタ。穴なら NULL */
+   uint64_t flags;    /* 該当する記述子の RETRO_MEMDESC_* */
+};
+
+struct memmap_space
+{
+   char name[16];                 /* addrspace。NULL は空文字列として扱います。 */
+   unsigned page_bits;
+   unsigned l2_bits;
+   size_t   max_addr;             /* この空間の最大アドレス */
+   struct memmap_page **l1;       /* 記述子に該当しない範囲は NULL */
+   size_t   l1_count;
+   size_t   pages;                /* 確保したページ数 */
+   size_t   lookup_pages;         /* そのうち MEMMAP_PAGE_LOOKUP のページ数 */
+   const struct retro_memory_descriptor **descs;   /* この空間の記述子。順序は元のまま */
+   unsigned num_descs;
+};
+
+struct memmap
+{
+   struct retro_memory_descriptor *descriptors;   /* 前処理済みのコピー */
+   unsigned num_descriptors;
+   struct memmap_space spaces[MEMMAP_MAX_SPACES];
+   unsigned num_spaces;
+};
+
+/* map をコンパイルします。map の内容はコピーするので、呼び出し後に解放してかまいません。 */
+bool memmap_compile(struct memmap *mm, const struct retro_memory_map *map);
+void memmap_free(struct memmap *mm);
+
+/* addrspace 名からアドレス空間を探します。name が NULL なら空の名前を探します。 */
+const struct memmap_space *memmap_find_space(const struct memmap *mm, const char *name);
+
+/* space の記述子を先頭から辿って変換します。MEMMAP_PAGE_LOOKUP のページで使います。 */
+uint8_t *memmap_translate_lookup(const struct memmap_space *space,
+      size_t addr, uint64_t *flags);
+
+/* エミュレートされたアドレスをホストポインタに変換します。穴なら NULL を返します。 */
+static inline uint8_t *memmap_translate(const struct memmap_space *space,
+      size_t addr, uint64_t *flags)
+{
+   const struct memmap_page *page;
+   size_t index;
+
+   if (addr > space->max_addr)
+      return NULL;
+
+   index = addr >> space->page_bits;
+   page  = space->l1[index >> space->l2_bits];
+   if (!page)
+      return NULL;
+
+   page += index & (((size_t)1 << space->l2_bits) - 1);
+   if (!page->base)
+      return (page->flags & MEMMAP_PAGE_LOOKUP)
+         ? memmap_translate_lookup(space, addr, flags) : NULL;
+
+   if (flags)
+      *flags = page->flags;
+   return page->base + (addr & (((size_t)1 << space->page_bits) - 1));
+}
+
+/* size (1/2/4/8) バイトを読み出します。RETRO_MEMDESC_BIGENDIAN の領域では
+ * ビッグエンディアンとして値を組み立てます。穴を含む場合は false を返します。 */
+bool memmap_read(const struct memmap_space *space, size_t addr,
+      unsigned size, uint64_t *value);
+
+/* 記述子を先頭から辿る、コンパイル前の変換。検証とベンチマーク用です。 */
+uint8_t *memmap_translate_descriptors(const struct memmap *mm,
+      const char *addrspace, size_t addr);
+
+/* len を超えたアドレスから、ヘッダーの規定どおり上位ビットを順に消します。 */
+size_t memmap_len_reduce(size_t addr, size_t len);
+
+#endif
@@ -0,0 +1,511 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 入力の記録と再生 (ムービー)。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "timer.h"
+
+#define MOVIE_MAGIC        "RBMV"
+#define MOVIE_VERSION      1
+#define MOVIE_TAG_FRAME    0
+#define MOVIE_TAG_POLL     1
+#define MOVIE_MAX_PORTS    16
+#define MOVIE_STDIO_BUFFER (64 * 1024)
+
+/* 問い合わせ 64 回に 1 回だけ時間を測り、64 倍して見積もります。
+ * 毎回 timer_ns() を呼ぶと、計測のコストが再生のコストを上回ってしまいます。 */
+#define MOVIE_SAMPLE_SHIFT 6
+
+struct movie_state
+{
+   enum movie_mode mode;
+   FILE *file;
+
+   /* 現在の区間 */
+   uint32_t hash;
+   uint64_t count;         /* この区間で記録・再生した応答の数 */
+   uint64_t expected;      /* 再生時: この区間の応答の数 */
+   int next_tag;           /* 再生時: この区間を閉じる境界 (-1 = ファイルの終わり) */
+   uint32_t mask_valid;    /* この区間でビットマスクを取得済みのポート */
+   int16_t  masks[MOVIE_MAX_PORTS];
+
+   /* 記録時: 区間の応答を溜めておくバッファ (n を先に書く必要があるため) */
+   uint8_t *pending;
+   size_t   pending_size;
+   size_t   pending_capacity;
+
+   uint64_t sample_ns;     /* 抜き取りで測った問い合わせの時間 */
+   uint64_t timer_cost;    /* timer_ns() 2 回分のコスト */
+   struct movie_stats stats;
+};
+
+static struct movie_state movie;
+
+/* ---- 可変長整数 ---- */
+
+static bool movie_pending_reserve(size_t bytes)
+{
+   if (movie.pending_size + bytes > movie.pending_capacity)
+   {
+      size_t   capacity = movie.pending_capacity ? movie.pending_capacity * 2 : 256;
+      uint8_t *pending;
+
+      while (capacity < movie.pending_size + bytes)
+         capacity *= 2;
+      pending = (uint8_t*)realloc(movie.pending, capacity);
+      if (!pending)
+         return false;
+      movie.pending          = pending;
+      movie.pending_capacity = capacity;
+   }
+   return true;
+}
+
+static size_t movie_varint_encode(uint8_t *out, uint64_t value)
+{
+   size_t len = 0;
+
+   while (value >= 0x80)
+   {
+      out[len++] = (uint8_t)(value | 0x80);
+      value >>= 7;
+   }
+   out[len++] = (uint8_t)value;
+   return len;
+}
+
+static void movie_write_varint(uint64_t value)
+{
+   uint8_t buf[10];
+   size_t  len = movie_varint_encode(buf, value);
+
+   fwrite(buf, 1, len, movie.file);
+   movie.stats.bytes += len;
+}
+
+static bool movie_read_varint(uint64_t *value)
+{
+   unsigned shift = 0;
+   int      c;
+
+   *value = 0;
+   do
+   {
+      if (shift > 63 || (c = getc_unlocked(movie.file)) == EOF)
+         return false;
+      *value |= (uint64_t)(c & 0x7F) << shift;
+      shift  += 7;
+      movie.stats.bytes++;
+   } while (c & 0x80);
+   return true;
+}
+
+static uint64_t movie_zigzag(int16_t value)
+{
+   return (uint64_t)(((uint32_t)(int32_t)value << 1) ^ (uint32_t)((int32_t)value >> 31));
+}
+
+static int16_t movie_unzigzag(uint64_t value)
+{
+   return (int16_t)((int32_t)(value >> 1) ^ -(int32_t)(value & 1));
+}
+
+/* FNV-1a で問い合わせを 1 つずつ混ぜます。 */
+static uint32_t movie_hash_query(uint32_t hash, unsigned port, unsigned device,
+      unsigned index, unsigned id)
+{
+   uint32_t key = (uint32_t)(port << 24) ^ (uint32_t)(device << 16)
+                ^ (uint32_t)(index << 12) ^ (uint32_t)id;
+   unsigned i;
+
+   for (i = 0; i < 4; i++)
+   {
+      hash ^= (key >> (i * 8)) & 0xFF;
+      hash *= 16777619u;
+   }
+   return hash;
+}
+
+static void movie_write_u32(uint32_t value)
+{
+   uint8_t buf[4];
+
+   buf[0] = (uint8_t)value;
+   buf[1] = (uint8_t)(value >> 8);
+   buf[2] = (uint8_t)(value >> 16);
+   buf[3] = (uint8_t)(value >> 24);
+   fwrite(buf, 1, 4, movie.file);
+}
+
+static bool movie_read_u32(uint32_t *value)
+{
+   uint8_t buf[4];
+
+   if (fread(buf, 1, 4, movie.file) != 4)
+      return false;
+   *value = (uint32_t)buf[0] | (uint32_t)buf[1] << 8
+          | (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+   return true;
+}
+
+static void movie_write_string(const char *s)
+{
+   size_t len = s ? strlen(s) : 0;
+
+   movie_write_varint(len);
+   fwrite(s, 1, len, movie.file);
+}
+
+/* 長さ付き文字列を読み、buf に収まる分だけ返します。 */
+static bool movie_read_string(char *buf, size_t size)
+{
+   uint64_t len, i;
+
+   if (!movie_read_varint(&len))
+      return false;
+   for (i = 0; i < len; i++)
+   {
+      int c = getc_unlocked(movie.file);
+      if (c == EOF)
+         return false;
+      if (i + 1 < size)
+         buf[i] = (char)c;
+   }
+   buf[len < size ? len : size - 1] = '\0';
+   return true;
+}
+
+/* ---- 区間 ---- */
+
+static void movie_interval_reset(void)
+{
+   movie.hash         = 2166136261u;
+   movie.count        = 0;
+   movie.mask_valid   = 0;
+   movie.pending_size = 0;
+}
+
+/* 記録時: tag で区間を閉じて書き出します。 */
+static void movie_record_boundary(int tag)
+{
+   putc_unlocked(tag, movie.file);
+   movie.stats.bytes++;
+   movie_write_varint(movie.count);
+   if (movie.count)
+   {
+      fwrite(movie.pending, 1, movie.pending_size, movie.file);
+      movie_write_u32(movie.hash);
+      movie.stats.bytes += movie.pending_size + 4;
+   }
+   movie_interval_reset();
+}
+
+/* 再生時: 次の区間の見出し (境界のタグと応答の数) を読みます。 */
+static void movie_read_header(void)
+{
+   int c = getc_unlocked(movie.file);
+
+   if (c == EOF || !movie_read_varint(&movie.expected))
+   {
+      movie.next_tag = -1;
+      movie.expected = 0;
+      return;
+   }
+   movie.stats.bytes++;
+   movie.next_tag = c;
+}
+
+/* 再生時: tag の境界に来たので、いまの区間が記録と一致するか確かめます。 */
+static bool movie_play_boundary(int tag)
+{
+   bool ok = movie.next_tag == tag && movie.count == movie.expected;
+
+   if (ok && movie.count)
+   {
+      uint32_t hash;
+      ok = movie_read_u32(&hash) && hash == movie.hash;
+      movie.stats.bytes += 4;
+   }
+
+   if (!ok)
+   {
+      movie.stats.desyncs++;
+      return false;
+   }
+
+   movie_interval_reset();
+   movie_read_header();
+   return true;
+}
+
+/* ---- 開始と終了 ---- */
+
+static uint64_t movie_elapsed(uint64_t start)
+{
+   uint64_t ns = timer_ns() - start;
+   return ns > movie.timer_cost ? ns - movie.timer_cost : 0;
+}
+
+static void movie_calibrate(void)
+{
+   uint64_t start = timer_ns();
+   unsigned i;
+
+   for (i = 0; i < 1000; i++)
+      timer_ns();
+   movie.timer_cost = (timer_ns() - start) * 2 / 1000;
+}
+
+bool movie_record(const char *path, struct core *core)
+{
+   size_t   size  = core->retro_serialize_size();
+   uint8_t *state = NULL;
+
+   movie_close();
+
+   if (size)
+   {
+      state = (uint8_t*)malloc(size);
+      if (!state || !core->retro_serialize(state, size))
+      {
+         fprintf(stderr, "movie: 開始ステートを retro_serialize() できません\n");
+         free(state);
+         return false;
+      }
+   }
+
+   movie.file = fopen(path, "wb");
+   if (!movie.file)
+   {
+      perror(path);
+      free(state);
+      return false;
+   }
+   setvbuf(movie.file, NULL, _IOFBF, MOVIE_STDIO_BUFFER);
+
+   fwrite(MOVIE_MAGIC, 1, 4, movie.file);
+   movie_write_u32(MOVIE_VERSION);
+   movie_write_varint(0);
+   movie_write_string(core->system_info.library_name);
+   movie_write_string(core->system_info.library_version);
+   movie_write_varint(size);
+   fwrite(state, 1, size, movie.file);
+   free(state);
+
+   memset(&movie.stats, 0, sizeof(movie.stats));
+   movie.stats.state_bytes = size;
+   movie.mode = MOVIE_RECORD;
+   movie_interval_reset();
+   movie_calibrate();
+   return true;
+}
+
+bool movie_play(const char *path, struct core *core)
+{
+   char     magic[4];
+   char     name[256];
+   char     version[256];
+   uint32_t file_version;
+   uint64_t flags, size;
+   uint8_t *state = NULL;
+
+   movie_close();
+
+   movie.file = fopen(path, "rb");
+   if (!movie.file)
+   {
+      perror(path);
+      return false;
+   }
+   setvbuf(movie.file, NULL, _IOFBF, MOVIE_STDIO_BUFFER);
+
+   if (fread(magic, 1, 4, movie.file) != 4 || memcmp(magic, MOVIE_MAGIC, 4) != 0
+         || !movie_read_u32(&file_version) || file_version != MOVIE_VERSION
+         || !movie_read_varint(&flags)
+         || !movie_read_string(name, sizeof(name))
+         || !movie_read_string(version, sizeof(version))
+         || !movie_read_varint(&size))
+   {
+      fprintf(stderr, "movie: %s はムービーファイルではありません\n", path);
+      goto error;
+   }
+
+   if (strcmp(name, core->system_info.library_name ? core->system_info.library_name : "")
+         || strcmp(version, core->system_info.library_version
+            ? core->system_info.library_version : ""))
+      fprintf(stderr, "movie: %s %s で記録されたムービーです (現在のコアは %s %s)\n",
+            name, version, core->system_info.library_name,
+            core->system_info.library_version);
+
+   if (size)
+   {
+      state = (uint8_t*)malloc(size);
+      if (!state || fread(state, 1, size, movie.file) != size)
+      {
+         fprintf(stderr, "movie: 開始ステートを読み込めません\n");
+         goto error;
+      }
+      if (!core->retro_unserialize(state, size))
+      {
+         fprintf(stderr, "movie: 開始ステートを retro_unserialize() できません\n");
+         goto error;
+      }
+      free(state);
+      state = NULL;
+   }
+
+   memset(&movie.stats, 0, sizeof(movie.stats));
+   movie.stats.state_bytes = size;
+   movie.mode = MOVIE_PLAYBACK;
+   movie_interval_reset();
+   movie_read_header();
+   movie_calibrate();
+   return true;
+
+error:
+   free(state);
+   fclose(movie.file);
+   movie.file = NULL;
+   return false;
+}
+
+void movie_close(void)
+{
+   if (movie.file)
+   {
+      /* 記録中に retro_run() の途中で閉じた場合も、最後の区間は残しておきます。 */
+      if (movie.mode == MOVIE_RECORD && movie.count)
+         movie_record_boundary(MOVIE_TAG_FRAME);
+      fclose(movie.file);
+   }
+   free(movie.pending);
+   movie.file             = NULL;
+   movie.pending          = NULL;
+   movie.pending_capacity = 0;
+   movie.mode             = MOVIE_NONE;
+   movie.stats.ns        += movie.sample_ns << MOVIE_SAMPLE_SHIFT;
+   movie.sample_ns        = 0;
+}
+
+enum movie_mode movie_mode(void)
+{
+   return movie.mode;
+}
+
+const struct movie_stats *movie_stats(void)
+{
+   return &movie.stats;
+}
+
+/* ---- コールバックから ---- */
+
+void movie_poll(void)
+{
+   uint64_t start;
+
+   if (movie.mode == MOVIE_NONE)
+      return;
+
+   start = timer_ns();
+   movie.stats.polls++;
+   if (movie.mode == MOVIE_RECORD)
+      movie_record_boundary(MOVIE_TAG_POLL);
+   else if (!movie_play_boundary(MOVIE_TAG_POLL))
+      movie.mode = MOVIE_NONE;
+   movie.stats.ns += movie_elapsed(start);
+}
+
+/* 区間の次の応答を記録または再生します。 */
+static int16_t movie_answer(int16_t live)
+{
+   movie.count++;
+   movie.stats.answers++;
+
+   if (movie.mode == MOVIE_RECORD)
+   {
+      if (movie_pending_reserve(10))
+         movie.pending_size += movie_varint_encode(
+               movie.pending + movie.pending_size, movie_zigzag(live));
+      return live;
+   }
+   else
+   {
+      uint64_t value;
+
+      if (movie.count > movie.expected || !movie_read_varint(&value))
+      {
+         /* 記録より多く問い合わせられました。境界で不一致として扱います。 */
+         movie.count = movie.expected + 1;
+         return 0;
+      }
+      return movie_unzigzag(value);
+   }
+}
+
+int16_t movie_input_state(unsigned port, unsigned device, unsigned index, unsigned id,
+      retro_input_state_t live)
+{
+   bool     sampled;
+   uint64_t start = 0;
+   int16_t  value;
+
+   if (movie.mode == MOVIE_NONE)
+      return live(port, device, index, id);
+
+   sampled = !(movie.stats.queries++ & ((1u << MOVIE_SAMPLE_SHIFT) - 1));
+   if (sampled)
+      start = timer_ns();
+
+   movie.hash = movie_hash_query(movie.hash, port, device, index, id);
+
+   if ((device & RETRO_DEVICE_MASK) == RETRO_DEVICE_JOYPAD && index == 0
+         && port < MOVIE_MAX_PORTS
+         && (id < 16 || id == RETRO_DEVICE_ID_JOYPAD_MASK))
+   {
+      /* ボタンは区間ごとにビットマスク 1 つで記録します。 */
+      if (!(movie.mask_valid & (1u << port)))
+      {
+         int16_t mask = movie.mode == MOVIE_RECORD
+            ? live(port, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_MASK) : 0;
+         movie.masks[port]  = movie_answer(mask);
+         movie.mask_valid  |= 1u << port;
+      }
+      value = id == RETRO_DEVICE_ID_JOYPAD_MASK
+         ? movie.masks[port] : (int16_t)((movie.masks[port] >> id) & 1);
+   }
+   else
+      value = movie_answer(movie.mode == MOVIE_RECORD ? live(port, device, index, id) : 0);
+
+   if (sampled)
+      movie.sample_ns += movie_elapsed(start);
+   return value;
+}
+
+bool movie_frame_end(void)
+{
+   uint64_t start;
+   bool     ok = true;
+
+   /* retro_input_poll_t の境界でずれを検出して再生を止めた場合も false を返します。 */
+   if (movie.mode == MOVIE_NONE)
+      return movie.stats.desyncs == 0;
+
+   start = timer_ns();
+   movie.stats.frames++;
+   if (movie.mode == MOVIE_RECORD)
+      movie_record_boundary(MOVIE_TAG_FRAME);
+   else
+   {
+      /* ファイルの終わりに達したら再生は完了です。 */
+      ok = movie_play_boundary(MOVIE_TAG_FRAME) && movie.next_tag >= 0;
+      if (!ok)
+         movie.mode = MOVIE_NONE;
+   }
+   movie.stats.ns += movie_elapsed(start);
+   return ok;
+}
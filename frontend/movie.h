@@ -0,0 +1,77 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 入力の記録と再生 (ムービー)。
+ *
+ * retro_input_state_t の応答と retro_input_poll_t・retro_run() の境界を
+ * 追記のみのストリームとして記録し、同じ順序で再生します。
+ * コアが決定的であれば、再生時の問い合わせの順序は記録時と同じになるので、
+ * 問い合わせの内容 (port, device, index, id) は保存せず、応答の値だけを並べます。
+ * 取り違えを検出できるよう、区間ごとに問い合わせ列のハッシュを添えます。
+ *
+ * RETRO_DEVICE_JOYPAD の問い合わせは、区間ごと・ポートごとに最初の 1 回だけ
+ * RETRO_DEVICE_ID_JOYPAD_MASK のビットマスクとして記録し、
+ * 同じ区間の残りのボタンはそのビットマスクから答えます。
+ * GET_INPUT_BITMASKS に対応したコアは最初からビットマスクで問い合わせます。
+ *
+ * ファイル形式 (数値は特に断りがなければ LEB128 の可変長):
+ *   "RBMV"  u32 version  flags
+ *   library_name の長さと文字列  library_version の長さと文字列
+ *   開始ステートのサイズと retro_serialize() の内容
+ *   区間レコードの列:
+ *     tag (1 byte: 0 = retro_run() の終わり, 1 = retro_input_poll_t)
+ *     応答の数 n, n 個の応答 (zigzag), n > 0 なら問い合わせ列のハッシュ (u32 LE)
+ * タグは区間の「終わり」の境界を表し、ファイルの終わりが記録の終わりです。
+ */
+
+#ifndef RETROBENCH_MOVIE_H__
+#define RETROBENCH_MOVIE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+#include "core.h"
+
+enum movie_mode
+{
+   MOVIE_NONE = 0,
+   MOVIE_RECORD,
+   MOVIE_PLAYBACK
+};
+
+struct movie_stats
+{
+   uint64_t frames;
+   uint64_t polls;
+   uint64_t answers;     /* 記録・再生した応答の数 */
+   uint64_t queries;     /* コアからの問い合わせの数 (ビットマスクから答えた分を含む) */
+   uint64_t bytes;       /* 区間レコードのバイト数 (ヘッダとステートを除く) */
+   uint64_t state_bytes;
+   uint64_t desyncs;
+   uint64_t ns;          /* ムービーの処理に費やした時間 (計測自体のコストを除く) */
+};
+
+/* 現在のコアのステートを起点に path へ記録を始めます。 */
+bool movie_record(const char *path, struct core *core);
+
+/* path の起点のステートを retro_unserialize() で復元し、再生を始めます。 */
+bool movie_play(const char *path, struct core *core);
+
+/* 記録中なら残りを書き出してファイルを閉じます。 */
+void movie_close(void);
+
+enum movie_mode movie_mode(void);
+const struct movie_stats *movie_stats(void);
+
+/* retro_input_poll_t から呼びます。 */
+void movie_poll(void);
+
+/* retro_input_state_t から呼びます。記録中は live の応答を記録して返し、
+ * 再生中は記録された応答を返します。 */
+int16_t movie_input_state(unsigned port, unsigned device, unsigned index, unsigned id,
+      retro_input_state_t live);
+
+/* retro_run() の後に呼びます。再生が終わったか、ずれを検出したら false を返します。 */
+bool movie_frame_end(void);
+
+#endif
@@ -0,0 +1,496 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアオプションの保管と RETRO_ENVIRONMENT_GET_VARIABLE。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "options.h"
+
+#define OPTIONS_MAX_ASSIGNMENTS  64
+#define OPTIONS_MAX_SEED         (1 << 16)
+#define OPTIONS_EMPTY            UINT32_MAX
+
+struct option
+{
+   const char  *key;
+   size_t       key_len;
+   const char **values;       /* 領域の中の num_values 個の値 */
+   unsigned     num_values;
+   unsigned     current;
+   bool         visible;
+};
+
+/* 登録された時点のキーと値。領域にコピーする前の、コアのメモリを指したままのものです。 */
+struct option_source
+{
+   const char *key;
+   const char *values[RETRO_NUM_CORE_OPTION_VALUES_MAX];
+   size_t      lengths[RETRO_NUM_CORE_OPTION_VALUES_MAX];
+   unsigned    num_values;
+   unsigned    def;
+};
+
+/* キーの 64 ビットハッシュの上位でバケットを選び、バケットごとの種 (負ならスロットそのもの) で
+ * 下位を混ぜてスロットを決めます。どのキーも別々のスロットに落ちるよう、登録時に種を探します。 */
+struct options_store
+{
+   struct option *options;
+   unsigned       count;
+   char          *arena;      /* キー・値の文字列と値のポインタ配列 */
+   int32_t       *displace;   /* バケットごと */
+   uint32_t      *slots;      /* スロットごとのオプションの番号 */
+   uint32_t       bucket_mask;
+   uint32_t       slot_mask;
+};
+
+struct options_stats options_stats;
+
+static struct options_store options_store;
+/* 値が変わるたびに options_generation を増やし、GET_VARIABLE_UPDATE で見た世代と比べます。
+ * 見た世代はコアインスタンスごとに持ち、options_swap_seen() で入れ替えます。 */
+static uint64_t options_generation;
+static uint64_t options_seen;
+static const char *options_assignments[OPTIONS_MAX_ASSIGNMENTS];
+static unsigned options_assignment_count;
+
+/* キーを 8 バイトずつ混ぜる 64 ビットハッシュ。長さも返します。 */
+static uint64_t options_hash(const char *key, size_t *len)
+{
+   size_t   n = strlen(key);
+   uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+   uint64_t w;
+   size_t   i;
+
+   for (i = 0; i + 8 <= n; i += 8)
+   {
+      memcpy(&w, key + i, 8);
+      h = (h ^ w) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+   }
+   if (i < n)
+   {
+      w = 0;
+      memcpy(&w, key + i, n - i);
+      h = (h ^ w) * 0xff51afd7ed558ccdull;
+   }
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ull;
+   h ^= h >> 33;
+
+   *len = n;
+   return h;
+}
+
+static uint32_t options_slot(uint64_t hash, uint32_t seed)
+{
+   uint64_t h = hash ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ull);
+
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdull;
+   h ^= h >> 33;
+   return (uint32_t)h;
+}
+
+static struct option *options_find(const struct options_store *store, const char *key)
+{
+   struct option *option;
+   uint64_t hash;
+   size_t   len;
+   int32_t  d;
+   uint32_t index;
+
+   if (!store->count)
+      return NULL;
+
+   hash  = options_hash(key, &len);
+   d     = store->displace[(uint32_t)(hash >> 32) & store->bucket_mask];
+   index = store->slots[(d < 0 ? (uint32_t)(-d - 1) : options_slot(hash, (uint32_t)d))
+         & store->slot_mask];
+
+   if (index == OPTIONS_EMPTY)
+      return NULL;
+   option = &store->options[index];
+   return option->key_len == len && memcmp(option->key, key, len) == 0 ? option : NULL;
+}
+
+/* 完全ハッシュの表を作ります。キーが多いバケットから順に、全員が空きスロットに入る種を探します。 */
+static bool options_build_index(struct options_store *store)
+{
+   unsigned  n       = store->count;
+   uint32_t  buckets = 1;
+   uint32_t  size    = 1;
+   uint64_t *hashes  = (uint64_t*)malloc((n ? n : 1) * sizeof(*hashes));
+   uint32_t *head    = NULL;
+   uint32_t *next    = (uint32_t*)malloc((n ? n : 1) * sizeof(*next));
+   uint32_t *count   = NULL;
+   uint32_t *order   = NULL;
+   uint32_t  free_slot, i, b;
+   bool      ok      = hashes && next;
+
+   while (buckets < n)
+      buckets <<= 1;
+   while (size < n)
+      size <<= 1;
+
+   head             = (uint32_t*)malloc(buckets * sizeof(*head));
+   count            = (uint32_t*)calloc(buckets, sizeof(*count));
+   order            = (uint32_t*)malloc(buckets * sizeof(*order));
+   store->displace  = (int32_t*)calloc(buckets, sizeof(*store->displace));
+   store->slots     = (uint32_t*)malloc(size * sizeof(*store->slots));
+   store->bucket_mask = buckets - 1;
+   store->slot_mask   = size - 1;
+   ok = ok && head && count && order && store->displace && store->slots;
+
+   for (i = 0; ok && i < buckets; i++)
+   {
+      head[i]  = OPTIONS_EMPTY;
+      order[i] = i;
+   }
+   for (i = 0; ok && i < size; i++)
+      store->slots[i] = OPTIONS_EMPTY;
+
+   for (i = 0; ok && i < n; i++)
+   {
+      size_t len;
+      hashes[i] = options_hash(store->options[i].key, &len);
+      b         = (uint32_t)(hashes[i] >> 32) & store->bucket_mask;
+      next[i]   = head[b];
+      head[b]   = i;
+      count[b]++;
+   }
+
+   /* バケットを大きい順に並べます。数は多くないので挿入ソートで足ります。 */
+   for (i = 1; ok && i < buckets; i++)
+   {
+      uint32_t v = order[i];
+      uint32_t j = i;
+      for (; j > 0 && count[order[j - 1]] < count[v]; j--)
+         order[j] = order[j - 1];
+      order[j] = v;
+   }
+
+   for (i = 0; ok && i < buckets && count[order[i]] > 1; i++)
+   {
+      uint32_t seed;
+
+      b = order[i];
+      for (seed = 0; seed < OPTIONS_MAX_SEED; seed++)
+      {
+         uint32_t k, placed = OPTIONS_EMPTY;
+
+         for (k = head[b]; k != OPTIONS_EMPTY; k = next[k])
+         {
+            uint32_t slot = options_slot(hashes[k], seed) & store->slot_mask;
+            if (store->slots[slot] != OPTIONS_EMPTY)
+               break;
+            store->slots[slot] = k;
+            placed = k;
+         }
+         if (k == OPTIONS_EMPTY)
+            break;
+
+         /* 入りきらなかったので、この種で置いた分を戻します。 */
+         for (k = head[b]; placed != OPTIONS_EMPTY; k = next[k])
+         {
+            store->slots[options_slot(hashes[k], seed) & store->slot_mask] = OPTIONS_EMPTY;
+            if (k == placed)
+               break;
+         }
+      }
+      if (seed == OPTIONS_MAX_SEED)
+      {
+         fprintf(stderr, "[options] キーの完全ハッシュを作れません\n");
+         ok = false;
+      }
+      store->displace[b] = (int32_t)seed;
+   }
+
+   /* キーが 1 つのバケットは、空いているスロットを直接指させます。 */
+   for (free_slot = 0; ok && i < buckets && count[order[i]] == 1; i++)
+   {
+      while (store->slots[free_slot] != OPTIONS_EMPTY)
+         free_slot++;
+      b = order[i];
+      store->slots[free_slot] = head[b];
+      store->displace[b]      = -(int32_t)free_slot - 1;
+   }
+
+   free(hashes);
+   free(head);
+   free(next);
+   free(count);
+   free(order);
+   return ok;
+}
+
+static void options_store_free(struct options_store *store)
+{
+   free(store->options);
+   free(store->arena);
+   free(store->displace);
+   free(store->slots);
+   memset(store, 0, sizeof(*store));
+}
+
+/* option に value を当てはめます。値の候補に無ければ false を返します。 */
+static bool options_apply(struct option *option, const char *value)
+{
+   unsigned i;
+
+   for (i = 0; i < option->num_values; i++)
+   {
+      if (strcmp(option->values[i], value) == 0)
+      {
+         if (option->current != i)
+         {
+            option->current = i;
+            options_generation++;
+         }
+         return true;
+      }
+   }
+   return false;
+}
+
+/* 1 つの "key=value" を今の表に当てはめます。キーがまだ無ければ true を返して後に回します。 */
+static bool options_apply_assignment(const char *assignment)
+{
+   const char    *eq = strchr(assignment, '=');
+   char           key[256];
+   struct option *option;
+
+   if (!eq || (size_t)(eq - assignment) >= sizeof(key))
+      return false;
+   memcpy(key, assignment, (size_t)(eq - assignment));
+   key[eq - assignment] = '\0';
+
+   option = options_find(&options_store, key);
+   if (!option)
+      return true;
+   if (!options_apply(option, eq + 1))
+   {
+      fprintf(stderr, "[options] %s には %s を指定できません\n", key, eq + 1);
+      return false;
+   }
+   return true;
+}
+
+/* 集めた定義を 1 つの領域にコピーして表を作り、今の表と差し替えます。
+ * 前の表にあったキーは、値が候補に残っていればそのまま引き継ぎます。 */
+static bool options_commit(const struct option_source *sources, unsigned n)
+{
+   struct options_store store;
+   size_t   bytes = 0;
+   char    *p;
+   const char **values;
+   unsigned i, j;
+
+   memset(&store, 0, sizeof(store));
+
+   for (i = 0; i < n; i++)
+   {
+      bytes += strlen(sources[i].key) + 1 + sources[i].num_values * sizeof(char*);
+      for (j = 0; j < sources[i].num_values; j++)
+         bytes += sources[i].lengths[j] + 1;
+   }
+
+   store.count   = n;
+   store.options = (struct option*)calloc(n ? n : 1, sizeof(*store.options));
+   store.arena   = (char*)malloc(bytes ? bytes : 1);
+   if (!store.options || !store.arena)
+   {
+      options_store_free(&store);
+      return false;
+   }
+
+   /* ポインタ配列を先頭に、文字列をその後ろに詰めます。 */
+   values = (const char**)store.arena;
+   for (i = 0; i < n; i++)
+      values += sources[i].num_values;
+   p      = (char*)values;
+   values = (const char**)store.arena;
+
+   for (i = 0; i < n; i++)
+   {
+      struct option *option = &store.options[i];
+      size_t len = strlen(sources[i].key);
+
+      memcpy(p, sources[i].key, len + 1);
+      option->key        = p;
+      option->key_len    = len;
+      p                 += len + 1;
+      option->values     = values;
+      option->num_values = sources[i].num_values;
+      option->current    = sources[i].def;
+      option->visible    = true;
+      for (j = 0; j < sources[i].num_values; j++)
+      {
+         memcpy(p, sources[i].values[j], sources[i].lengths[j]);
+         p[sources[i].lengths[j]] = '\0';
+         values[j] = p;
+         p        += sources[i].lengths[j] + 1;
+      }
+      values += sources[i].num_values;
+   }
+
+   if (!options_build_index(&store))
+   {
+      options_store_free(&store);
+      return false;
+   }
+
+   for (i = 0; i < n; i++)
+   {
+      const struct option *old = options_find(&options_store, store.options[i].key);
+      if (old)
+         options_apply(&store.options[i], old->values[old->current]);
+   }
+
+   options_store_free(&options_store);
+   options_store = store;
+
+   for (i = 0; i < options_assignment_count; i++)
+      options_apply_assignment(options_assignments[i]);
+   return true;
+}
+
+bool options_set_variables(const struct retro_variable *vars)
+{
+   struct option_source *sources;
+   unsigned n = 0, i;
+   bool ok;
+
+   while (vars[n].key)
+      n++;
+   sources = (struct option_source*)calloc(n ? n : 1, sizeof(*sources));
+   if (!sources)
+      return false;
+
+   for (i = 0; i < n; i++)
+   {
+      const char *v = vars[i].value ? strchr(vars[i].value, ';') : NULL;
+
+      sources[i].key = vars[i].key;
+      if (!v)
+         continue;
+      for (v++; *v == ' '; v++)
+         ;
+      while (*v && sources[i].num_values < RETRO_NUM_CORE_OPTION_VALUES_MAX)
+      {
+         size_t len = strcspn(v, "|");
+         sources[i].values[sources[i].num_values]  = v;
+         sources[i].lengths[sources[i].num_values] = len;
+         sources[i].num_values++;
+         v += len;
+         if (*v == '|')
+            v++;
+      }
+   }
+
+   ok = options_commit(sources, n);
+   free(sources);
+   return ok;
+}
+
+bool options_set_definitions(const struct retro_core_option_definition *defs)
+{
+   struct option_source *sources;
+   unsigned n = 0, i, j;
+   bool ok;
+
+   while (defs[n].key)
+      n++;
+   sources = (struct option_source*)calloc(n ? n : 1, sizeof(*sources));
+   if (!sources)
+      return false;
+
+   for (i = 0; i < n; i++)
+   {
+      sources[i].key = defs[i].key;
+      for (j = 0; j < RETRO_NUM_CORE_OPTION_VALUES_MAX && defs[i].values[j].value; j++)
+      {
+         sources[i].values[j]  = defs[i].values[j].value;
+         sources[i].lengths[j] = strlen(defs[i].values[j].value);
+         if (defs[i].default_value && strcmp(defs[i].default_value, defs[i].values[j].value) == 0)
+            sources[i].def = j;
+      }
+      sources[i].num_values = j;
+   }
+
+   ok = options_commit(sources, n);
+   free(sources);
+   return ok;
+}
+
+bool options_set_intl(const struct retro_core_options_intl *intl)
+{
+   return intl->us && options_set_definitions(intl->us);
+}
+
+bool options_set_display(const struct retro_core_option_display *display)
+{
+   struct option *option = display->key ? options_find(&options_store, display->key) : NULL;
+
+   if (!option)
+      return false;
+   option->visible = display->visible;
+   return true;
+}
+
+bool options_get(struct retro_variable *var)
+{
+   const struct option *option;
+
+   options_stats.gets++;
+   option = var->key ? options_find(&options_store, var->key) : NULL;
+   if (!option || !option->num_values)
+   {
+      options_stats.misses++;
+      var->value = NULL;
+      return false;
+   }
+   var->value = option->values[option->current];
+   return true;
+}
+
+bool options_poll_update(void)
+{
+   bool dirty = options_seen != options_generation;
+
+   options_stats.polls++;
+   if (dirty)
+   {
+      options_stats.updates++;
+      options_seen = options_generation;
+   }
+   return dirty;
+}
+
+void options_swap_seen(uint64_t *seen)
+{
+   uint64_t current = options_seen;
+
+   options_seen = *seen;
+   *seen        = current;
+}
+
+bool options_assign(const char *assignment)
+{
+   if (!strchr(assignment, '=') || options_assignment_count == OPTIONS_MAX_ASSIGNMENTS)
+      return false;
+   options_assignments[options_assignment_count++] = assignment;
+   return options_apply_assignment(assignment);
+}
+
+unsigned options_count(void)
+{
+   return options_store.count;
+}
+
+const char *options_first_key(void)
+{
+   return options_store.count ? options_store.options[0].key : NULL;
+}
@@ -0,0 +1,63 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - コアオプションの保管と RETRO_ENVIRONMENT_GET_VARIABLE。
+ *
+ * SET_VARIABLES / SET_CORE_OPTIONS / SET_CORE_OPTIONS_INTL で通知されたキーと値を
+ * 1 つの領域にコピーして保ち、キーから完全ハッシュ (hash and displace) の表を作ります。
+ * GET_VARIABLE は、キーのハッシュ 1 回と確認の memcmp() 1 回で答えます。
+ * retro_run() の中で毎フレーム全オプションを問い合わせるコアでも、オプションの数によらない
+ * コストで済みます。
+ *
+ * 値を変えると dirty ビットを立て、GET_VARIABLE_UPDATE はそれを読んで落とすだけです。
+ */
+
+#ifndef RETROBENCH_OPTIONS_H__
+#define RETROBENCH_OPTIONS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+struct options_stats
+{
+   uint64_t gets;
+   uint64_t misses;     /* 登録されていないキーの GET_VARIABLE */
+   uint64_t polls;      /* GET_VARIABLE_UPDATE */
+   uint64_t updates;    /* そのうち true を返した回数 */
+};
+
+extern struct options_stats options_stats;
+
+/* RETRO_ENVIRONMENT_SET_VARIABLES。"説明; 値1|値2|..." の先頭の値を既定値にします。 */
+bool options_set_variables(const struct retro_variable *vars);
+
+/* RETRO_ENVIRONMENT_SET_CORE_OPTIONS。 */
+bool options_set_definitions(const struct retro_core_option_definition *defs);
+
+/* RETRO_ENVIRONMENT_SET_CORE_OPTIONS_INTL。キーと値は us の定義を使います。 */
+bool options_set_intl(const struct retro_core_options_intl *intl);
+
+/* RETRO_ENVIRONMENT_SET_CORE_OPTIONS_DISPLAY。 */
+bool options_set_display(const struct retro_core_option_display *display);
+
+/* RETRO_ENVIRONMENT_GET_VARIABLE。 */
+bool options_get(struct retro_variable *var);
+
+/* RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE。前回から値が変わっていれば true を返します。 */
+bool options_poll_update(void);
+
+/* GET_VARIABLE_UPDATE が最後に見た値の世代を *seen と入れ替えます。
+ * 2 つ目のコアインスタンスが、プライマリの更新を横取りしないように使います。 */
+void options_swap_seen(uint64_t *seen);
+
+/* "key=value" の形で値を指定します。まだ登録されていないキーは、登録されたときに当てはめます。 */
+bool options_assign(const char *assignment);
+
+/* 登録されているオプションの数。 */
+unsigned options_count(void);
+
+/* 最初に登録されたキー。計測で使います。無ければ NULL を返します。 */
+const char *options_first_key(void);
+
+#endif
@@ -0,0 +1,571 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - struct retro_perf_callback の実装。
+ */
+
+/* dladdr() のために必要です。 */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "perf.h"
+#include "cpu_features.h"
+#include "timer.h"
+
+#define PERF_MAX_COUNTERS  128
+#define PERF_MAX_DEPTH     64
+#define PERF_MAX_NODES     1024
+#define PERF_BUCKETS       (64 * 4)
+#define PERF_TRACE_EVENTS  (1 << 18)
+#define PERF_NO_COUNTER    UINT32_MAX
+
+/* ident ごとの集計。スレッドごとに持ち、表示するときに足し合わせます。 */
+struct perf_slot
+{
+   uint64_t calls;
+   uint64_t ticks;
+   uint64_t min;
+   uint64_t max;
+   uint32_t histogram[PERF_BUCKETS];   /* 2 の累乗の区間をさらに 4 等分した対数ヒストグラム */
+};
+
+/* 呼び出し木の節。0 番は根で、カウンタを持ちません。 */
+struct perf_node
+{
+   uint32_t counter;
+   uint32_t parent;
+   uint32_t child;
+   uint32_t sibling;
+   uint64_t calls;
+   uint64_t ticks;
+};
+
+struct perf_frame
+{
+   uint32_t node;
+   uint32_t counter;
+   uint64_t start;
+};
+
+struct perf_event
+{
+   uint32_t counter;
+   uint32_t depth;
+   uint64_t start;
+   uint64_t end;
+};
+
+struct perf_thread
+{
+   struct perf_thread *next;
+   unsigned tid;
+
+   struct perf_slot  slots[PERF_MAX_COUNTERS];
+   struct perf_node  nodes[PERF_MAX_NODES];
+   unsigned          node_count;
+   struct perf_frame stack[PERF_MAX_DEPTH];
+   unsigned          depth;
+
+   struct perf_event *events;
+   size_t   event_count;
+   uint64_t events_dropped;
+   uint64_t mismatched;    /* start と対にならない stop */
+   uint64_t overflowed;    /* 入れ子が深すぎるか、木の節が足りなかった回数 */
+};
+
+static struct
+{
+   struct retro_perf_counter *_Atomic counters[PERF_MAX_COUNTERS];
+   /* カウンタの構造体はコアの中にあるので、表示に使う名前は写しを持ち、
+    * どの .so のものかを覚えておいて dlclose() の前に外せるようにします。 */
+   const char *idents[PERF_MAX_COUNTERS];
+   const void *modules[PERF_MAX_COUNTERS];
+   atomic_uint count;
+   struct perf_thread *_Atomic threads;
+   atomic_uint thread_count;
+
+   bool     trace;
+   bool     reported;
+   uint64_t base_tick;
+   double   ticks_per_us;
+} perf;
+
+static __thread struct perf_thread *perf_self;
+
+/* ---- 時刻 ---- */
+
+static retro_perf_tick_t RETRO_CALLCONV perf_get_counter(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   return timer_ns();
+#endif
+}
+
+static retro_time_t RETRO_CALLCONV perf_get_time_usec(void)
+{
+   return (retro_time_t)(timer_ns() / 1000);
+}
+
+void perf_init(bool trace)
+{
+   uint64_t t0   = timer_ns();
+   uint64_t c0   = perf_get_counter();
+   uint64_t t1;
+
+   /* TSC の刻みを 5 ms ほど空回りして較正します。 */
+   while ((t1 = timer_ns()) - t0 < 5000000)
+      ;
+   perf.ticks_per_us = (double)(perf_get_counter() - c0) * 1000.0 / (double)(t1 - t0);
+   perf.base_tick    = perf_get_counter();
+   perf.trace        = trace;
+}
+
+/* ---- スレッドごとの状態 ---- */
+
+static struct perf_thread *perf_thread_get(void)
+{
+   struct perf_thread *self = perf_self;
+
+   if (self)
+      return self;
+
+   self = (struct perf_thread*)calloc(1, sizeof(*self));
+   if (!self)
+      return NULL;
+   if (perf.trace)
+      self->events = (struct perf_event*)malloc(PERF_TRACE_EVENTS * sizeof(*self->events));
+
+   self->tid                 = atomic_fetch_add(&perf.thread_count, 1);
+   self->node_count          = 1;
+   self->nodes[0].counter    = PERF_NO_COUNTER;
+
+   /* 一覧への追加だけが複数スレッドから起こるので CAS で繋ぎます。 */
+   self->next = atomic_load(&perf.threads);
+   while (!atomic_compare_exchange_weak(&perf.threads, &self->next, self))
+      ;
+
+   perf_self = self;
+   return self;
+}
+
+/* parent の子のうち counter の節を探し、無ければ作ります。 */
+static uint32_t perf_child(struct perf_thread *self, uint32_t parent, uint32_t counter)
+{
+   uint32_t node = self->nodes[parent].child;
+   struct perf_node *n;
+
+   while (node)
+   {
+      if (self->nodes[node].counter == counter)
+         return node;
+      node = self->nodes[node].sibling;
+   }
+
+   if (self->node_count >= PERF_MAX_NODES)
+      return PERF_NO_COUNTER;
+
+   node       = self->node_count++;
+   n          = &self->nodes[node];
+   n->counter = counter;
+   n->parent  = parent;
+   n->child   = 0;
+   n->sibling = self->nodes[parent].child;
+   self->nodes[parent].child = node;
+   return node;
+}
+
+/* 2^e 以上 2^(e+1) 未満を 4 つに分け、バケット e * 4 + (上位 2 ビット) に入れます。
+ * 4 未満の値はそのままの番号のバケットに入れます。 */
+static unsigned perf_bucket(uint64_t ticks)
+{
+   unsigned e;
+
+   if (ticks < 4)
+      return (unsigned)ticks;
+   e = 63 - (unsigned)__builtin_clzll(ticks);
+   return e * 4 + (unsigned)((ticks >> (e - 2)) & 3);
+}
+
+/* バケットに入る値の上限 (含まない) を返します。 */
+static uint64_t perf_bucket_limit(unsigned b)
+{
+   unsigned e = b / 4;
+
+   if (b < 8)
+      return b + 1;
+   return ((uint64_t)(4 + b % 4) << (e - 2)) + ((uint64_t)1 << (e - 2));
+}
+
+static void perf_account(struct perf_thread *self, const struct perf_frame *frame,
+      unsigned depth, uint64_t end)
+{
+   uint64_t ticks         = end - frame->start;
+   struct perf_slot *slot = &self->slots[frame->counter];
+
+   if (!slot->calls || ticks < slot->min)
+      slot->min = ticks;
+   if (ticks > slot->max)
+      slot->max = ticks;
+   slot->calls++;
+   slot->ticks += ticks;
+   slot->histogram[perf_bucket(ticks)]++;
+
+   self->nodes[frame->node].calls++;
+   self->nodes[frame->node].ticks += ticks;
+
+   if (self->events)
+   {
+      if (self->event_count < PERF_TRACE_EVENTS)
+      {
+         struct perf_event *ev = &self->events[self->event_count++];
+         ev->counter = frame->counter;
+         ev->depth   = depth;
+         ev->start   = frame->start;
+         ev->end     = end;
+      }
+      else
+         self->events_dropped++;
+   }
+}
+
+/* ---- retro_perf_callback ---- */
+
+void RETRO_CALLCONV perf_register(struct retro_perf_counter *counter)
+{
+   unsigned id;
+
+   if (counter->registered)
+      return;
+
+   id = atomic_fetch_add(&perf.count, 1);
+   if (id < PERF_MAX_COUNTERS)
+   {
+      Dl_info info;
+
+      perf.idents[id]  = strdup(counter->ident ? counter->ident : "?");
+      perf.modules[id] = dladdr(counter, &info) ? info.dli_fbase : NULL;
+      atomic_store(&perf.counters[id], counter);
+   }
+   counter->start      = id;
+   counter->total      = 0;
+   counter->call_cnt   = 0;
+   counter->registered = true;
+}
+
+void RETRO_CALLCONV perf_start(struct retro_perf_counter *counter)
+{
+   struct perf_thread *self;
+   uint32_t parent, node;
+
+   if (!counter->registered)
+      perf_register(counter);
+   if (counter->start >= PERF_MAX_COUNTERS || !(self = perf_thread_get()))
+      return;
+
+   if (self->depth >= PERF_MAX_DEPTH)
+   {
+      self->overflowed++;
+      return;
+   }
+
+   parent = self->depth ? self->stack[self->depth - 1].node : 0;
+   node   = perf_child(self, parent, (uint32_t)counter->start);
+   if (node == PERF_NO_COUNTER)
+   {
+      self->overflowed++;
+      return;
+   }
+
+   self->stack[self->depth].node    = node;
+   self->stack[self->depth].counter = (uint32_t)counter->start;
+   self->depth++;
+   /* 時刻は最後に読み、フロントエンド側の処理を区間に含めないようにします。 */
+   self->stack[self->depth - 1].start = perf_get_counter();
+}
+
+void RETRO_CALLCONV perf_stop(struct retro_perf_counter *counter)
+{
+   uint64_t end = perf_get_counter();
+   struct perf_thread *self = perf_self;
+   unsigned i;
+
+   if (!self || counter->start >= PERF_MAX_COUNTERS)
+      return;
+
+   /* 閉じ忘れた内側の区間があれば、ここでまとめて閉じます。 */
+   for (i = self->depth; i > 0; i--)
+      if (self->stack[i - 1].counter == (uint32_t)counter->start)
+         break;
+   if (i == 0)
+   {
+      self->mismatched++;
+      return;
+   }
+   if (i != self->depth)
+      self->mismatched++;
+
+   while (self->depth >= i)
+   {
+      self->depth--;
+      perf_account(self, &self->stack[self->depth], self->depth, end);
+   }
+}
+
+/* ---- 集計 ---- */
+
+unsigned perf_counter_count(void)
+{
+   unsigned count = atomic_load(&perf.count);
+   return count < PERF_MAX_COUNTERS ? count : PERF_MAX_COUNTERS;
+}
+
+void perf_reset(void)
+{
+   struct perf_thread *t;
+
+   for (t = atomic_load(&perf.threads); t; t = t->next)
+   {
+      unsigned n;
+
+      /* 木の形は残し、実行中の区間が参照する節を壊さないようにします。 */
+      memset(t->slots, 0, sizeof(t->slots));
+      for (n = 0; n < t->node_count; n++)
+      {
+         t->nodes[n].calls = 0;
+         t->nodes[n].ticks = 0;
+      }
+      t->event_count    = 0;
+      t->events_dropped = 0;
+      t->mismatched     = 0;
+      t->overflowed     = 0;
+   }
+   perf.base_tick = perf_get_counter();
+}
+
+static const char *perf_ident(uint32_t id)
+{
+   return id < PERF_MAX_COUNTERS && perf.idents[id] ? perf.idents[id] : "?";
+}
+
+static void perf_report_node(const struct perf_thread *t, uint32_t node,
+      unsigned depth, uint64_t parent_ticks)
+{
+   const struct perf_node *n = &t->nodes[node];
+   uint32_t child;
+
+   if (node && n->calls)
+      printf("                 %*s%-*s calls %-8llu total %9.3f ms  avg %9.2f us  %5.1f%%\n",
+            (int)depth * 2, "", 28 - (int)depth * 2, perf_ident(n->counter),
+            (unsigned long long)n->calls,
+            n->ticks / perf.ticks_per_us / 1e3,
+            n->ticks / perf.ticks_per_us / (double)n->calls,
+            parent_ticks ? 100.0 * (double)n->ticks / (double)parent_ticks : 100.0);
+
+   for (child = n->child; child; child = t->nodes[child].sibling)
+      perf_report_node(t, child, node ? depth + 1 : depth, node ? n->ticks : 0);
+}
+
+/* ヒストグラムの累積が p を超えるバケットの上限を返します。誤差は 25% 以内です。 */
+static uint64_t perf_percentile(const struct perf_slot *slot, double p)
+{
+   uint64_t target = (uint64_t)(p * (double)slot->calls);
+   uint64_t seen   = 0;
+   unsigned b;
+
+   for (b = 0; b < PERF_BUCKETS; b++)
+   {
+      seen += slot->histogram[b];
+      if (seen > target)
+      {
+         uint64_t limit = perf_bucket_limit(b);
+         return limit < slot->max ? limit : slot->max;
+      }
+   }
+   return slot->max;
+}
+
+void perf_report(void)
+{
+   unsigned count = perf_counter_count();
+   unsigned id, j, b;
+   struct perf_thread *t;
+
+   perf.reported = true;
+
+   printf("perf:            %u counters  %u threads  %.2f ticks/us\n",
+         count, atomic_load(&perf.thread_count), perf.ticks_per_us);
+
+   for (t = atomic_load(&perf.threads); t; t = t->next)
+   {
+      printf("                 thread %u%s\n", t->tid,
+            t->mismatched || t->overflowed ? "  (対にならない stop や溢れがありました)" : "");
+      perf_report_node(t, 0, 0, 0);
+   }
+
+   /* ident が同じカウンタは 1 つにまとめます。 */
+   printf("                 %-28s %10s %10s %10s %10s %10s  (ticks)\n",
+         "ident", "calls", "min", "p50", "p99", "max");
+   for (id = 0; id < count; id++)
+   {
+      struct perf_slot sum;
+      const char *ident = perf_ident(id);
+      bool dup = false;
+
+      for (j = 0; j < id && !dup; j++)
+         dup = strcmp(perf_ident(j), ident) == 0;
+      if (dup)
+         continue;
+
+      memset(&sum, 0, sizeof(sum));
+      for (j = id; j < count; j++)
+      {
+         if (strcmp(perf_ident(j), ident))
+            continue;
+         for (t = atomic_load(&perf.threads); t; t = t->next)
+         {
+            const struct perf_slot *s = &t->slots[j];
+            if (!s->calls)
+               continue;
+            if (!sum.calls || s->min < sum.min)
+               sum.min = s->min;
+            if (s->max > sum.max)
+               sum.max = s->max;
+            sum.calls += s->calls;
+            sum.ticks += s->ticks;
+            for (b = 0; b < PERF_BUCKETS; b++)
+               sum.histogram[b] += s->histogram[b];
+         }
+      }
+      if (!sum.calls)
+         continue;
+
+      printf("                 %-28s %10llu %10llu %10llu %10llu %10llu\n", ident,
+            (unsigned long long)sum.calls, (unsigned long long)sum.min,
+            (unsigned long long)perf_percentile(&sum, 0.50),
+            (unsigned long long)perf_percentile(&sum, 0.99),
+            (unsigned long long)sum.max);
+   }
+}
+
+/* コアの perf_log()。カウンタに全スレッドの合計を書き戻し、まだなら表示します。 */
+static void RETRO_CALLCONV perf_log(void)
+{
+   unsigned count = perf_counter_count();
+   unsigned id;
+
+   for (id = 0; id < count; id++)
+   {
+      struct retro_perf_counter *counter = atomic_load(&perf.counters[id]);
+      struct perf_thread *t;
+
+      if (!counter)
+         continue;
+      counter->total    = 0;
+      counter->call_cnt = 0;
+      for (t = atomic_load(&perf.threads); t; t = t->next)
+      {
+         counter->total    += t->slots[id].ticks;
+         counter->call_cnt += t->slots[id].calls;
+      }
+   }
+
+   if (!perf.reported)
+      perf_report();
+}
+
+void perf_forget_module(const void *addr)
+{
+   unsigned count = perf_counter_count();
+   unsigned id;
+   Dl_info  info;
+
+   if (!dladdr(addr, &info))
+      return;
+
+   for (id = 0; id < count; id++)
+      if (perf.modules[id] == info.dli_fbase)
+         atomic_store(&perf.counters[id], NULL);
+}
+
+void perf_get_interface(struct retro_perf_callback *cb)
+{
+   cb->get_time_usec    = perf_get_time_usec;
+   cb->get_cpu_features = cpu_features_get;
+   cb->get_perf_counter = perf_get_counter;
+   cb->perf_register    = perf_register;
+   cb->perf_start       = perf_start;
+   cb->perf_stop        = perf_stop;
+   cb->perf_log         = perf_log;
+}
+
+/* ---- Chrome trace ---- */
+
+static void perf_write_json_string(FILE *f, const char *s)
+{
+   fputc('"', f);
+   for (; *s; s++)
+   {
+      unsigned char c = (unsigned char)*s;
+      if (c == '"' || c == '\\')
+         fprintf(f, "\\%c", c);
+      else if (c < 0x20)
+         fprintf(f, "\\u%04x", c);
+      else
+         fputc(c, f);
+   }
+   fputc('"', f);
+}
+
+bool perf_export_trace(const char *path)
+{
+   FILE *f = fopen(path, "w");
+   struct perf_thread *t;
+   bool first = true;
+   int  pid   = (int)getpid();
+
+   if (!f)
+   {
+      perror(path);
+      return false;
+   }
+
+   fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+   for (t = atomic_load(&perf.threads); t; t = t->next)
+   {
+      size_t i;
+
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,"
+            "\"args\":{\"name\":\"%s %u\"}}", first ? "" : ",\n", pid, t->tid,
+            t->tid ? "thread" : "main", t->tid);
+      first = false;
+
+      for (i = 0; i < t->event_count; i++)
+      {
+         const struct perf_event *ev = &t->events[i];
+         fprintf(f, ",\n{\"name\":");
+         perf_write_json_string(f, perf_ident(ev->counter));
+         fprintf(f, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+               "\"args\":{\"depth\":%u}}",
+               pid, t->tid,
+               (double)(int64_t)(ev->start - perf.base_tick) / perf.ticks_per_us,
+               (double)(ev->end - ev->start) / perf.ticks_per_us, ev->depth);
+      }
+      if (t->events_dropped)
+         fprintf(stderr, "perf: スレッド %u の区間 %llu 個を記録しきれませんでした\n",
+               t->tid, (unsigned long long)t->events_dropped);
+   }
+   fprintf(f, "\n]}\n");
+
+   return fclose(f) == 0;
+}
@@ -0,0 +1,51 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - struct retro_perf_callback の実装。
+ *
+ * カウンタの値はスレッドごとに持ち、perf_start()/perf_stop() はロックを取りません。
+ * 入れ子になった start/stop の組はスレッドごとの呼び出し木に積み、
+ * retro_perf_counter::ident ごとに所要サイクル数の log2 ヒストグラムを取ります。
+ * --trace を指定した場合は区間をすべて記録し、Chrome trace / Perfetto で
+ * 読める JSON に書き出します。
+ *
+ * perf_register() は登録順の番号をカウンタの start フィールドにしまっておき、
+ * スレッドごとの表の添字に使います。total と call_cnt は perf_log() のときに
+ * 全スレッドの合計を書き戻すので、コアはそこで値を覗けます。
+ */
+
+#ifndef RETROBENCH_PERF_H__
+#define RETROBENCH_PERF_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+/* 時刻の基準を較正します。コアに GET_PERF_INTERFACE を渡す前に呼びます。 */
+void perf_init(bool trace);
+
+/* GET_PERF_INTERFACE で渡す関数を埋めます。 */
+void perf_get_interface(struct retro_perf_callback *cb);
+
+/* 登録されたカウンタの数。フロントエンド自身のカウンタも含みます。 */
+unsigned perf_counter_count(void);
+
+/* 全スレッドの集計と記録した区間を捨てます。コアのスレッドが計測区間の外にいるときに呼びます。 */
+void perf_reset(void);
+
+/* addr を含む .so が登録したカウンタを外します。dlclose() の前に呼びます。
+ * 集計はそのまま残り、perf_log() がカウンタへ書き戻さなくなるだけです。 */
+void perf_forget_module(const void *addr);
+
+/* 呼び出し木とヒストグラムを表示します。 */
+void perf_report(void);
+
+/* 記録した区間を Chrome trace 形式の JSON で path に書き出します。 */
+bool perf_export_trace(const char *path);
+
+/* retro_perf_callback の各関数。フロントエンドからも直接使えます。 */
+void RETRO_CALLCONV perf_register(struct retro_perf_counter *counter);
+void RETRO_CALLCONV perf_start(struct retro_perf_counter *counter);
+void RETRO_CALLCONV perf_stop(struct retro_perf_counter *counter);
+
+#endif
@@ -0,0 +1,355 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 16 ビットのピクセルフォーマットを XRGB8888 に変換するカーネル。
+ *
+ * どのカーネルも 16 ビットのピクセル p を 32 ビットに広げてから、
+ * 次のシフトとマスクで各成分を最終位置に直接置きます（RGB565 の場合）。
+ *   R: ((p << 8) & 0xF80000) | ((p << 3) & 0x070000)
+ *   G: ((p << 5) & 0x00FC00) | ((p >> 1) & 0x000300)
+ *   B: ((p << 3) & 0x0000F8) | ((p >> 2) & 0x000007)
+ * 0RGB1555 では R と G のシフト量だけが異なります。
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXCONV_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PIXCONV_NEON
+#endif
+
+#include "pixconv.h"
+#include "cpu_features.h"
+#include "dispatch.h"
+
+static inline uint32_t pixconv_565(uint32_t p)
+{
+   return 0xFF000000u
+      | ((p << 8) & 0xF80000) | ((p << 3) & 0x070000)
+      | ((p << 5) & 0x00FC00) | ((p >> 1) & 0x000300)
+      | ((p << 3) & 0x0000F8) | ((p >> 2) & 0x000007);
+}
+
+static inline uint32_t pixconv_1555(uint32_t p)
+{
+   return 0xFF000000u
+      | ((p << 9) & 0xF80000) | ((p << 4) & 0x070000)
+      | ((p << 6) & 0x00F800) | ((p << 1) & 0x000700)
+      | ((p << 3) & 0x0000F8) | ((p >> 2) & 0x000007);
+}
+
+static void pixconv_rgb565_scalar(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   unsigned x;
+   for (x = 0; x < width; x++)
+      dst[x] = pixconv_565(src[x]);
+}
+
+static void pixconv_rgb1555_scalar(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   unsigned x;
+   for (x = 0; x < width; x++)
+      dst[x] = pixconv_1555(src[x]);
+}
+
+#if defined(PIXCONV_X86)
+#define PIXCONV_SSE2_BODY(p, s0, s1, s2, s3, m0, m1, m2, m3) \
+   _mm_or_si128(_mm_or_si128( \
+      _mm_or_si128(_mm_and_si128(_mm_slli_epi32(p, s0), m0), \
+                   _mm_and_si128(_mm_slli_epi32(p, s1), m1)), \
+      _mm_or_si128(_mm_and_si128(_mm_slli_epi32(p, s2), m2), \
+                   _mm_and_si128(s3, m3))), \
+      _mm_or_si128(_mm_and_si128(_mm_slli_epi32(p, 3), b_hi), \
+                   _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 2), b_lo), alpha)))
+
+__attribute__((target("sse2")))
+static void pixconv_rgb565_sse2(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   const __m128i zero  = _mm_setzero_si128();
+   const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+   const __m128i r_hi  = _mm_set1_epi32(0xF80000), r_lo = _mm_set1_epi32(0x070000);
+   const __m128i g_hi  = _mm_set1_epi32(0x00FC00), g_lo = _mm_set1_epi32(0x000300);
+   const __m128i b_hi  = _mm_set1_epi32(0x0000F8), b_lo = _mm_set1_epi32(0x000007);
+   unsigned x = 0;
+
+   for (; x + 8 <= width; x += 8)
+   {
+      __m128i in = _mm_loadu_si128((const __m128i*)(src + x));
+      __m128i lo = _mm_unpacklo_epi16(in, zero);
+      __m128i hi = _mm_unpackhi_epi16(in, zero);
+      _mm_storeu_si128((__m128i*)(dst + x),
+            PIXCONV_SSE2_BODY(lo, 8, 3, 5, _mm_srli_epi32(lo, 1), r_hi, r_lo, g_hi, g_lo));
+      _mm_storeu_si128((__m128i*)(dst + x + 4),
+            PIXCONV_SSE2_BODY(hi, 8, 3, 5, _mm_srli_epi32(hi, 1), r_hi, r_lo, g_hi, g_lo));
+   }
+
+   pixconv_rgb565_scalar(dst + x, src + x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void pixconv_rgb1555_sse2(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   const __m128i zero  = _mm_setzero_si128();
+   const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+   const __m128i r_hi  = _mm_set1_epi32(0xF80000), r_lo = _mm_set1_epi32(0x070000);
+   const __m128i g_hi  = _mm_set1_epi32(0x00F800), g_lo = _mm_set1_epi32(0x000700);
+   const __m128i b_hi  = _mm_set1_epi32(0x0000F8), b_lo = _mm_set1_epi32(0x000007);
+   unsigned x = 0;
+
+   for (; x + 8 <= width; x += 8)
+   {
+      __m128i in = _mm_loadu_si128((const __m128i*)(src + x));
+      __m128i lo = _mm_unpacklo_epi16(in, zero);
+      __m128i hi = _mm_unpackhi_epi16(in, zero);
+      _mm_storeu_si128((__m128i*)(dst + x),
+            PIXCONV_SSE2_BODY(lo, 9, 4, 6, _mm_slli_epi32(lo, 1), r_hi, r_lo, g_hi, g_lo));
+      _mm_storeu_si128((__m128i*)(dst + x + 4),
+            PIXCONV_SSE2_BODY(hi, 9, 4, 6, _mm_slli_epi32(hi, 1), r_hi, r_lo, g_hi, g_lo));
+   }
+
+   pixconv_rgb1555_scalar(dst + x, src + x, width - x);
+}
+
+#define PIXCONV_AVX2_BODY(p, s0, s1, s2, s3, m0, m1, m2, m3) \
+   _mm256_or_si256(_mm256_or_si256( \
+      _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(p, s0), m0), \
+                      _mm256_and_si256(_mm256_slli_epi32(p, s1), m1)), \
+      _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(p, s2), m2), \
+                      _mm256_and_si256(s3, m3))), \
+      _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(p, 3), b_hi), \
+                      _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(p, 2), b_lo), alpha)))
+
+__attribute__((target("avx2")))
+static void pixconv_rgb565_avx2(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+   const __m256i r_hi  = _mm256_set1_epi32(0xF80000), r_lo = _mm256_set1_epi32(0x070000);
+   const __m256i g_hi  = _mm256_set1_epi32(0x00FC00), g_lo = _mm256_set1_epi32(0x000300);
+   const __m256i b_hi  = _mm256_set1_epi32(0x0000F8), b_lo = _mm256_set1_epi32(0x000007);
+   unsigned x = 0;
+
+   for (; x + 16 <= width; x += 16)
+   {
+      __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + x)));
+      __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + x + 8)));
+      _mm256_storeu_si256((__m256i*)(dst + x),
+            PIXCONV_AVX2_BODY(lo, 8, 3, 5, _mm256_srli_epi32(lo, 1), r_hi, r_lo, g_hi, g_lo));
+      _mm256_storeu_si256((__m256i*)(dst + x + 8),
+            PIXCONV_AVX2_BODY(hi, 8, 3, 5, _mm256_srli_epi32(hi, 1), r_hi, r_lo, g_hi, g_lo));
+   }
+
+   pixconv_rgb565_sse2(dst + x, src + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void pixconv_rgb1555_avx2(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   const __m256i alpha = _mm256_set1_epi32((int)0xFF000000u);
+   const __m256i r_hi  = _mm256_set1_epi32(0xF80000), r_lo = _mm256_set1_epi32(0x070000);
+   const __m256i g_hi  = _mm256_set1_epi32(0x00F800), g_lo = _mm256_set1_epi32(0x000700);
+   const __m256i b_hi  = _mm256_set1_epi32(0x0000F8), b_lo = _mm256_set1_epi32(0x000007);
+   unsigned x = 0;
+
+   for (; x + 16 <= width; x += 16)
+   {
+      __m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + x)));
+      __m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + x + 8)));
+      _mm256_storeu_si256((__m256i*)(dst + x),
+            PIXCONV_AVX2_BODY(lo, 9, 4, 6, _mm256_slli_epi32(lo, 1), r_hi, r_lo, g_hi, g_lo));
+      _mm256_storeu_si256((__m256i*)(dst + x + 8),
+            PIXCONV_AVX2_BODY(hi, 9, 4, 6, _mm256_slli_epi32(hi, 1), r_hi, r_lo, g_hi, g_lo));
+   }
+
+   pixconv_rgb1555_sse2(dst + x, src + x, width - x);
+}
+#define PIXCONV_AVX512_BODY(p, s0, s1, s2, s3, m0, m1, m2, m3) \
+   _mm512_or_si512(_mm512_or_si512( \
+      _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(p, s0), m0), \
+                      _mm512_and_si512(_mm512_slli_epi32(p, s1), m1)), \
+      _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(p, s2), m2), \
+                      _mm512_and_si512(s3, m3))), \
+      _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(p, 3), b_hi), \
+                      _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi32(p, 2), b_lo), alpha)))
+
+__attribute__((target("avx512f")))
+static void pixconv_rgb565_avx512(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   const __m512i alpha = _mm512_set1_epi32((int)0xFF000000u);
+   const __m512i r_hi  = _mm512_set1_epi32(0xF80000), r_lo = _mm512_set1_epi32(0x070000);
+   const __m512i g_hi  = _mm512_set1_epi32(0x00FC00), g_lo = _mm512_set1_epi32(0x000300);
+   const __m512i b_hi  = _mm512_set1_epi32(0x0000F8), b_lo = _mm512_set1_epi32(0x000007);
+   unsigned x = 0;
+
+   for (; x + 32 <= width; x += 32)
+   {
+      __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + x)));
+      __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + x + 16)));
+      _mm512_storeu_si512((void*)(dst + x),
+            PIXCONV_AVX512_BODY(lo, 8, 3, 5, _mm512_srli_epi32(lo, 1), r_hi, r_lo, g_hi, g_lo));
+      _mm512_storeu_si512((void*)(dst + x + 16),
+            PIXCONV_AVX512_BODY(hi, 8, 3, 5, _mm512_srli_epi32(hi, 1), r_hi, r_lo, g_hi, g_lo));
+   }
+
+   pixconv_rgb565_avx2(dst + x, src + x, width - x);
+}
+
+__attribute__((target("avx512f")))
+static void pixconv_rgb1555_avx512(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   const __m512i alpha = _mm512_set1_epi32((int)0xFF000000u);
+   const __m512i r_hi  = _mm512_set1_epi32(0xF80000), r_lo = _mm512_set1_epi32(0x070000);
+   const __m512i g_hi  = _mm512_set1_epi32(0x00F800), g_lo = _mm512_set1_epi32(0x000700);
+   const __m512i b_hi  = _mm512_set1_epi32(0x0000F8), b_lo = _mm512_set1_epi32(0x000007);
+   unsigned x = 0;
+
+   for (; x + 32 <= width; x += 32)
+   {
+      __m512i lo = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + x)));
+      __m512i hi = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + x + 16)));
+      _mm512_storeu_si512((void*)(dst + x),
+            PIXCONV_AVX512_BODY(lo, 9, 4, 6, _mm512_slli_epi32(lo, 1), r_hi, r_lo, g_hi, g_lo));
+      _mm512_storeu_si512((void*)(dst + x + 16),
+            PIXCONV_AVX512_BODY(hi, 9, 4, 6, _mm512_slli_epi32(hi, 1), r_hi, r_lo, g_hi, g_lo));
+   }
+
+   pixconv_rgb1555_avx2(dst + x, src + x, width - x);
+}
+#endif
+
+#if defined(PIXCONV_NEON)
+/* 0RGB1555 では G の下位ビットが左シフトになるので、符号付きシフト量で表します。 */
+static inline uint32x4_t pixconv_neon_body(uint32x4_t p,
+      int s0, int s1, int s2, int s3,
+      uint32_t m0, uint32_t m1, uint32_t m2, uint32_t m3)
+{
+   uint32x4_t v;
+   v = vandq_u32(vshlq_u32(p, vdupq_n_s32(s0)), vdupq_n_u32(m0));
+   v = vorrq_u32(v, vandq_u32(vshlq_u32(p, vdupq_n_s32(s1)), vdupq_n_u32(m1)));
+   v = vorrq_u32(v, vandq_u32(vshlq_u32(p, vdupq_n_s32(s2)), vdupq_n_u32(m2)));
+   v = vorrq_u32(v, vandq_u32(vshlq_u32(p, vdupq_n_s32(s3)), vdupq_n_u32(m3)));
+   v = vorrq_u32(v, vandq_u32(vshlq_n_u32(p, 3), vdupq_n_u32(0xF8)));
+   v = vorrq_u32(v, vandq_u32(vshrq_n_u32(p, 2), vdupq_n_u32(0x07)));
+   return vorrq_u32(v, vdupq_n_u32(0xFF000000u));
+}
+
+static void pixconv_rgb565_neon(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   unsigned x = 0;
+
+   for (; x + 8 <= width; x += 8)
+   {
+      uint16x8_t in = vld1q_u16(src + x);
+      vst1q_u32(dst + x,     pixconv_neon_body(vmovl_u16(vget_low_u16(in)),
+               8, 3, 5, -1, 0xF80000, 0x070000, 0x00FC00, 0x000300));
+      vst1q_u32(dst + x + 4, pixconv_neon_body(vmovl_u16(vget_high_u16(in)),
+               8, 3, 5, -1, 0xF80000, 0x070000, 0x00FC00, 0x000300));
+   }
+
+   pixconv_rgb565_scalar(dst + x, src + x, width - x);
+}
+
+static void pixconv_rgb1555_neon(uint32_t *dst, const uint16_t *src, unsigned width)
+{
+   unsigned x = 0;
+
+   for (; x + 8 <= width; x += 8)
+   {
+      uint16x8_t in = vld1q_u16(src + x);
+      vst1q_u32(dst + x,     pixconv_neon_body(vmovl_u16(vget_low_u16(in)),
+               9, 4, 6, 1, 0xF80000, 0x070000, 0x00F800, 0x000700));
+      vst1q_u32(dst + x + 4, pixconv_neon_body(vmovl_u16(vget_high_u16(in)),
+               9, 4, 6, 1, 0xF80000, 0x070000, 0x00F800, 0x000700));
+   }
+
+   pixconv_rgb1555_scalar(dst + x, src + x, width - x);
+}
+#endif
+
+static const struct pixconv_kernel pixconv_kernel_list[] = {
+#if defined(PIXCONV_X86)
+   /* 行末の端数は AVX2 版で処理するので、両方を要求します。 */
+   { "avx512", RETRO_SIMD_AVX2 | CPU_FEATURE_AVX512F, pixconv_rgb565_avx512, pixconv_rgb1555_avx512 },
+   { "avx2",   RETRO_SIMD_AVX2, pixconv_rgb565_avx2,   pixconv_rgb1555_avx2 },
+   { "sse2",   RETRO_SIMD_SSE2, pixconv_rgb565_sse2,   pixconv_rgb1555_sse2 },
+#endif
+#if defined(PIXCONV_NEON)
+   { "neon",   RETRO_SIMD_NEON, pixconv_rgb565_neon,   pixconv_rgb1555_neon },
+#endif
+   { "scalar", 0,               pixconv_rgb565_scalar, pixconv_rgb1555_scalar },
+};
+
+#define PIXCONV_KERNELS (sizeof(pixconv_kernel_list) / sizeof(pixconv_kernel_list[0]))
+
+static struct dispatch_variant pixconv_variants[PIXCONV_KERNELS];
+
+/* dispatch_bind() までは、どの CPU でも動くスカラー版を使います。 */
+static const void *pixconv_current = &pixconv_kernel_list[PIXCONV_KERNELS - 1];
+
+const struct pixconv_kernel *pixconv_kernels(unsigned *count)
+{
+   *count = PIXCONV_KERNELS;
+   return pixconv_kernel_list;
+}
+
+void pixconv_register(void)
+{
+   unsigned i;
+
+   for (i = 0; i < PIXCONV_KERNELS; i++)
+   {
+      pixconv_variants[i].name     = pixconv_kernel_list[i].name;
+      pixconv_variants[i].features = pixconv_kernel_list[i].simd;
+      pixconv_variants[i].impl     = &pixconv_kernel_list[i];
+   }
+
+   dispatch_register("pixconv", pixconv_variants, PIXCONV_KERNELS, &pixconv_current);
+}
+
+const struct pixconv_kernel *pixconv_kernel(void)
+{
+   return (const struct pixconv_kernel*)pixconv_current;
+}
+
+void pixconv_frame_with(const struct pixconv_kernel *kernel,
+      enum retro_pixel_format format,
+      void *dst, size_t dst_pitch,
+      const void *src, size_t src_pitch,
+      unsigned width, unsigned height)
+{
+   pixconv_row_t row = NULL;
+   unsigned y;
+
+   switch (format)
+   {
+      case RETRO_PIXEL_FORMAT_RGB565:
+         row = kernel->rgb565;
+         break;
+      case RETRO_PIXEL_FORMAT_0RGB1555:
+         row = kernel->rgb1555;
+         break;
+      default:
+         break;
+   }
+
+   for (y = 0; y < height; y++)
+   {
+      uint32_t       *d = (uint32_t*)((uint8_t*)dst + y * dst_pitch);
+      const uint16_t *s = (const uint16_t*)((const uint8_t*)src + y * src_pitch);
+
+      if (row)
+         row(d, s, width);
+      else
+         memcpy(d, s, width * sizeof(uint32_t));
+   }
+}
+
+void pixconv_frame(enum retro_pixel_format format,
+      void *dst, size_t dst_pitch,
+      const void *src, size_t src_pitch,
+      unsigned width, unsigned height)
+{
+   pixconv_frame_with(pixconv_kernel(), format, dst, dst_pitch,
+         src, src_pitch, width, height);
+}
@@ -0,0 +1,55 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 16 ビットのピクセルフォーマットを XRGB8888 に変換するカーネル。
+ *
+ * RETRO_PIXEL_FORMAT_0RGB1555 / RETRO_PIXEL_FORMAT_RGB565 のフレームを、
+ * 任意の pitch を保ったまま XRGB8888 に変換します。
+ * カーネルは dispatch_bind() が CPU の機能から
+ * AVX-512 / AVX2 / SSE2 / NEON / スカラーの順に選びます。
+ * 5/6 ビットの成分は上位ビットを下位に複製して 8 ビットに広げ、X には 0xFF を入れます。
+ */
+
+#ifndef RETROBENCH_PIXCONV_H__
+#define RETROBENCH_PIXCONV_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libretro.h"
+
+/* 1 行分を変換する関数。 */
+typedef void (*pixconv_row_t)(uint32_t *dst, const uint16_t *src, unsigned width);
+
+struct pixconv_kernel
+{
+   const char   *name;
+   uint64_t      simd;        /* 必要な RETRO_SIMD_* / CPU_FEATURE_* ビット */
+   pixconv_row_t rgb565;
+   pixconv_row_t rgb1555;
+};
+
+/* 利用可能かどうかにかかわらず、すべてのカーネルを優先度順に返します。 */
+const struct pixconv_kernel *pixconv_kernels(unsigned *count);
+
+/* カーネルを dispatch_register() に "pixconv" として登録します。
+ * dispatch_bind() で選ばれたカーネルを以降の pixconv_frame() で使います。 */
+void pixconv_register(void);
+
+/* 選ばれているカーネルを返します。 */
+const struct pixconv_kernel *pixconv_kernel(void);
+
+/* フレーム全体を XRGB8888 に変換します。
+ * format が XRGB8888 の場合は行ごとにコピーします。 */
+void pixconv_frame(enum retro_pixel_format format,
+      void *dst, size_t dst_pitch,
+      const void *src, size_t src_pitch,
+      unsigned width, unsigned height);
+
+/* 指定したカーネルでフレームを変換します。ベンチマーク用です。 */
+void pixconv_frame_with(const struct pixconv_kernel *kernel,
+      enum retro_pixel_format format,
+      void *dst, size_t dst_pitch,
+      const void *src, size_t src_pitch,
+      unsigned width, unsigned height);
+
+#endif
@@ -0,0 +1,414 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_serialize() を使った巻き戻しエンジン。
+ *
+ * 差分のフォーマット（32 ビットワード単位）:
+ *   [一致ワード数 varint][不一致ワード数 varint][XOR したワード × 不一致ワード数] ...
+ * 末尾の一致ワードは省略します。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include "rewind.h"
+
+/* ステートバッファは 16 バイト（4 ワード）単位で比較するため、この単位に切り上げます。 */
+#define REWIND_ALIGN(x) (((x) + 15) & ~(size_t)15)
+
+/* 16 バイトのブロックが一致するかを返します。a, b は 16 バイト境界にあるとは限りません。 */
+static inline bool rewind_block_equal(const uint32_t *a, const uint32_t *b)
+{
+#if defined(__SSE2__)
+   __m128i va = _mm_loadu_si128((const __m128i*)a);
+   __m128i vb = _mm_loadu_si128((const __m128i*)b);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xFFFF;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+   return vminvq_u32(vceqq_u32(vld1q_u32(a), vld1q_u32(b))) == 0xFFFFFFFFu;
+#else
+   return memcmp(a, b, 16) == 0;
+#endif
+}
+
+static inline uint8_t *rewind_put_varint(uint8_t *out, size_t v)
+{
+   while (v >= 0x80)
+   {
+      *out++ = (uint8_t)(v | 0x80);
+      v    >>= 7;
+   }
+   *out++ = (uint8_t)v;
+   return out;
+}
+
+static inline const uint8_t *rewind_get_varint(const uint8_t *in, size_t *v)
+{
+   size_t   r     = 0;
+   unsigned shift = 0;
+
+   for (;;)
+   {
+      uint8_t b = *in++;
+      r |= (size_t)(b & 0x7F) << shift;
+      if (!(b & 0x80))
+         break;
+      shift += 7;
+   }
+
+   *v = r;
+   return in;
+}
+
+/* a と b の差分を out に書き出し、そのバイト数を返します。 */
+static size_t rewind_encode(const uint32_t *a, const uint32_t *b,
+      size_t words, uint8_t *out)
+{
+   uint8_t *start = out;
+   size_t   i     = 0;
+
+   while (i < words)
+   {
+      size_t same = i;
+      size_t diff;
+
+      /* 差分の後は 4 ワード境界にあるとは限らないので、ブロックがはみ出さない間だけ
+       * 16 バイト単位で読み飛ばし、残りはワードごとに比べます。 */
+      while (same + 4 <= words && rewind_block_equal(a + same, b + same))
+         same += 4;
+      while (same < words && a[same] == b[same])
+         same++;
+      if (same == words)
+         break;
+
+      diff = same;
+      while (diff < words && a[diff] != b[diff])
+         diff++;
+
+      out = rewind_put_varint(out, same - i);
+      out = rewind_put_varint(out, diff - same);
+      for (i = same; i < diff; i++)
+      {
+         uint32_t x = a[i] ^ b[i];
+         memcpy(out, &x, sizeof(x));
+         out += sizeof(x);
+      }
+   }
+
+   return (size_t)(out - start);
+}
+
+/* 差分を state に XOR で適用します。 */
+static void rewind_decode(const uint8_t *in, size_t len, uint32_t *state)
+{
+   const uint8_t *end = in + len;
+   size_t         pos = 0;
+
+   while (in < end)
+   {
+      size_t same, diff;
+
+      in   = rewind_get_varint(in, &same);
+      in   = rewind_get_varint(in, &diff);
+      pos += same;
+
+      while (diff--)
+      {
+         uint32_t x;
+         memcpy(&x, in, sizeof(x));
+         state[pos++] ^= x;
+         in          += sizeof(x);
+      }
+   }
+}
+
+static void *rewind_alloc(size_t size)
+{
+   void *ptr = NULL;
+   if (posix_memalign(&ptr, 64, size) != 0)
+      return NULL;
+   return ptr;
+}
+
+/* 作業用バッファを size バイトのステートが入る大きさにします。 */
+static bool rewind_ensure_capacity(struct rewind *rw, size_t size)
+{
+   uint8_t *current, *next, *scratch;
+   size_t   capacity = REWIND_ALIGN(size);
+
+   if (capacity <= rw->capacity)
+      return true;
+
+   current = (uint8_t*)rewind_alloc(capacity);
+   next    = (uint8_t*)rewind_alloc(capacity);
+   /* 最悪ケースは「不一致 1 ワード + 一致 1 ワード」の繰り返しで、8 バイトあたり 6 バイト。 */
+   scratch = (uint8_t*)rewind_alloc(capacity * 2 + 64);
+
+   if (!current || !next || !scratch)
+   {
+      free(current);
+      free(next);
+      free(scratch);
+      return false;
+   }
+
+   memset(current, 0, capacity);
+   memset(next,    0, capacity);
+   if (rw->current)
+      memcpy(current, rw->current, rw->capacity);
+   if (rw->next)
+      memcpy(next, rw->next, rw->capacity);
+
+   free(rw->current);
+   free(rw->next);
+   free(rw->scratch);
+
+   rw->current  = current;
+   rw->next     = next;
+   rw->scratch  = scratch;
+   rw->capacity = capacity;
+   return true;
+}
+
+bool rewind_init(struct rewind *rw, size_t budget, size_t state_size)
+{
+   memset(rw, 0, sizeof(*rw));
+
+   rw->ring_size   = budget;
+   rw->ring        = (uint8_t*)malloc(budget);
+   rw->entries_cap = 64;
+   rw->entries     = (struct rewind_entry*)malloc(
+         rw->entries_cap * sizeof(*rw->entries));
+
+   if (!rw->ring || !rw->entries || !rewind_ensure_capacity(rw, state_size))
+   {
+      rewind_free(rw);
+      return false;
+   }
+
+   return true;
+}
+
+void rewind_free(struct rewind *rw)
+{
+   free(rw->ring);
+   free(rw->entries);
+   free(rw->current);
+   free(rw->next);
+   free(rw->scratch);
+   memset(rw, 0, sizeof(*rw));
+}
+
+static inline struct rewind_entry *rewind_entry_at(struct rewind *rw, size_t i)
+{
+   return &rw->entries[(rw->entries_first + i) & (rw->entries_cap - 1)];
+}
+
+static void rewind_ring_clear(struct rewind *rw)
+{
+   rw->entries_count = 0;
+   rw->ring_head     = 0;
+   rw->ring_tail     = 0;
+   rw->ring_wrap_end = 0;
+   rw->ring_wrapped  = false;
+}
+
+static void rewind_drop_oldest(struct rewind *rw)
+{
+   const struct rewind_entry *oldest = rewind_entry_at(rw, 0);
+
+   /* 長さ 0 の差分はリングを使っていないので tail を動かしません。 */
+   if (oldest->length)
+      rw->ring_tail = oldest->offset + oldest->length;
+   if (rw->ring_wrapped && rw->ring_tail == rw->ring_wrap_end)
+   {
+      rw->ring_tail    = 0;
+      rw->ring_wrapped = false;
+   }
+
+   rw->entries_first = (rw->entries_first + 1) & (rw->entries_cap - 1);
+   rw->entries_count--;
+   rw->evictions++;
+   if (!rw->entries_count)
+      rewind_ring_clear(rw);
+}
+
+/* len バイトの差分を置ける位置をリング内に確保します。
+ * 差分は折り返さずに配置し、空きが足りなければ古い差分から捨てます。 */
+static bool rewind_reserve(struct rewind *rw, size_t len, size_t *offset)
+{
+   if (len > rw->ring_size)
+      return false;
+
+   for (;;)
+   {
+      if (rw->entries_count == 0)
+      {
+         *offset = 0;
+         break;
+      }
+
+      if (!rw->ring_wrapped)
+      {
+         /* 折り返していない: 末尾の空き、次に先頭の空きを試します。 */
+         if (rw->ring_size - rw->ring_head >= len)
+         {
+            *offset = rw->ring_head;
+            break;
+         }
+         if (rw->ring_tail >= len)
+         {
+            rw->ring_wrap_end = rw->ring_head;
+            rw->ring_wrapped  = true;
+            *offset           = 0;
+            break;
+         }
+      }
+      else if (rw->ring_tail - rw->ring_head >= len)
+      {
+         *offset = rw->ring_head;
+         break;
+      }
+
+      rewind_drop_oldest(rw);
+   }
+
+   rw->ring_head = *offset + len;
+   return true;
+}
+
+static bool rewind_append_entry(struct rewind *rw, const struct rewind_entry *entry)
+{
+   if (rw->entries_count == rw->entries_cap)
+   {
+      size_t i;
+      size_t cap = rw->entries_cap * 2;
+      struct rewind_entry *entries = (struct rewind_entry*)malloc(cap * sizeof(*entries));
+
+      if (!entries)
+         return false;
+
+      for (i = 0; i < rw->entries_count; i++)
+         entries[i] = *rewind_entry_at(rw, i);
+
+      free(rw->entries);
+      rw->entries       = entries;
+      rw->entries_cap   = cap;
+      rw->entries_first = 0;
+   }
+
+   *rewind_entry_at(rw, rw->entries_count++) = *entry;
+   return true;
+}
+
+/* rw->next に置かれた size バイトのステートを積みます。 */
+static bool rewind_commit(struct rewind *rw, size_t size)
+{
+   struct rewind_entry entry;
+   uint8_t *tmp;
+   size_t   bytes = REWIND_ALIGN(size > rw->current_size ? size : rw->current_size);
+   size_t   dirty = bytes > rw->next_size ? bytes : rw->next_size;
+
+   /* ステートの後ろを 0 にして、サイズの異なるステート同士でも XOR が成り立つようにします。
+    * 以前 next に入っていたより大きなステートの残りもここで消します。 */
+   memset(rw->next + size, 0, dirty - size);
+
+   if (rw->has_current)
+   {
+      entry.length    = rewind_encode((const uint32_t*)rw->current,
+            (const uint32_t*)rw->next, bytes / sizeof(uint32_t), rw->scratch);
+      entry.prev_size = rw->current_size;
+
+      rw->raw_bytes        += bytes;
+      rw->compressed_bytes += entry.length;
+
+      if (rewind_reserve(rw, entry.length, &entry.offset))
+      {
+         memcpy(rw->ring + entry.offset, rw->scratch, entry.length);
+         if (!rewind_append_entry(rw, &entry))
+            return false;
+      }
+      else
+      {
+         /* 予算より大きな差分は積めないので、履歴のつながりが切れます。 */
+         rw->evictions += rw->entries_count;
+         rewind_ring_clear(rw);
+      }
+   }
+
+   tmp               = rw->current;
+   rw->current       = rw->next;
+   rw->next          = tmp;
+   rw->next_size     = rw->current_size;
+   rw->current_size  = size;
+   rw->has_current   = true;
+   rw->pushes++;
+   return true;
+}
+
+bool rewind_push(struct rewind *rw, const void *state, size_t size)
+{
+   if (!rewind_ensure_capacity(rw, size))
+      return false;
+
+   memcpy(rw->next, state, size);
+   return rewind_commit(rw, size);
+}
+
+bool rewind_push_core(struct rewind *rw, struct core *core)
+{
+   size_t size = core->retro_serialize_size();
+
+   if (!size || !rewind_ensure_capacity(rw, size))
+      return false;
+
+   if (!core->retro_serialize(rw->next, size))
+      return false;
+
+   return rewind_commit(rw, size);
+}
+
+const void *rewind_pop(struct rewind *rw, size_t *size)
+{
+   if (!rw->has_current)
+      return NULL;
+
+   if (rw->entries_count > 0)
+   {
+      const struct rewind_entry *entry =
+         rewind_entry_at(rw, rw->entries_count - 1);
+
+      rewind_decode(rw->ring + entry->offset, entry->length,
+            (uint32_t*)rw->current);
+      rw->current_size = entry->prev_size;
+      rw->ring_head    = entry->offset;
+      /* 折り返した後の差分がすべて無くなったら、折り返す前の末尾に戻ります。 */
+      if (rw->ring_wrapped && rw->ring_head == 0)
+      {
+         rw->ring_head    = rw->ring_wrap_end;
+         rw->ring_wrapped = false;
+      }
+      rw->entries_count--;
+      if (!rw->entries_count)
+         rewind_ring_clear(rw);
+      rw->pops++;
+   }
+
+   *size = rw->current_size;
+   return rw->current;
+}
+
+bool rewind_pop_core(struct rewind *rw, struct core *core)
+{
+   size_t      size;
+   const void *state = rewind_pop(rw, &size);
+
+   if (!state)
+      return false;
+
+   return core->retro_unserialize(state, size);
+}
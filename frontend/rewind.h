@@ -0,0 +1,94 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - retro_serialize() を使った巻き戻しエンジン。
+ *
+ * 最新のステートだけを完全な形で保持し、それより古いステートは
+ * 「1 つ新しいステートとの XOR 差分」をゼロワードのランレングスで圧縮して
+ * 固定サイズのリングバッファに積みます。
+ * push は新しい差分を積み、pop は最新の差分を現在のステートに XOR して
+ * 1 つ前のステートを復元するので、どちらも履歴の長さに依存しない O(1) です。
+ * 予算を超えたときは最も古い差分から捨てます。
+ *
+ * RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE のコアのために、
+ * 差分ごとに 1 つ前のステートのサイズを記録しておき、
+ * サイズがセッション中に変わっても正しく復元できるようにしています。
+ */
+
+#ifndef RETROBENCH_REWIND_H__
+#define RETROBENCH_REWIND_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "core.h"
+
+struct rewind_entry
+{
+   size_t offset;      /* リング内の差分の位置 */
+   size_t length;      /* 圧縮後の差分のバイト数 */
+   size_t prev_size;   /* この差分を適用した後のステートのサイズ */
+};
+
+struct rewind
+{
+   uint8_t *ring;               /* 圧縮済み差分を置くリング。折り返さずに配置します。 */
+   size_t   ring_size;
+   /* 使用中の範囲。折り返していなければ [tail, head)、折り返していれば
+    * [tail, wrap_end) と [0, head) です。差分の長さは 0 のこともあるので、
+    * 差分の位置からは導かずにここで管理します。 */
+   size_t   ring_head;
+   size_t   ring_tail;
+   size_t   ring_wrap_end;
+   bool     ring_wrapped;
+
+   struct rewind_entry *entries;   /* entries[first .. first+count) が古い順に並びます。 */
+   size_t entries_cap;             /* 常に 2 の累乗 */
+   size_t entries_first;
+   size_t entries_count;
+
+   /* current: 最新のステート。capacity を超える部分は常に 0 に保ちます。
+    * next:    retro_serialize() の出力先。
+    * scratch: 圧縮した差分の一時置き場。 */
+   uint8_t *current;
+   uint8_t *next;
+   uint8_t *scratch;
+   size_t   current_size;
+   size_t   next_size;          /* next のうち 0 でない可能性がある範囲 */
+   size_t   capacity;
+   bool     has_current;
+
+   /* 統計 */
+   uint64_t pushes;
+   uint64_t pops;
+   uint64_t evictions;
+   uint64_t raw_bytes;          /* 圧縮前の差分サイズの合計 */
+   uint64_t compressed_bytes;   /* 圧縮後の差分サイズの合計 */
+};
+
+/* budget バイトの差分リングを持つ巻き戻しエンジンを初期化します。
+ * 作業用バッファとしてこれとは別にステートサイズの 4 倍 (+64 バイト) のメモリを使います。 */
+bool rewind_init(struct rewind *rw, size_t budget, size_t state_size);
+void rewind_free(struct rewind *rw);
+
+/* 新しいステートを積みます。size は呼ぶたびに変わってもかまいません。 */
+bool rewind_push(struct rewind *rw, const void *state, size_t size);
+
+/* 最新のステートを 1 つ捨て、その 1 つ前のステートを返します。
+ * 履歴が尽きた場合は最も古いステートを返し続けます。
+ * 返したポインタは次の push/pop まで有効です。 */
+const void *rewind_pop(struct rewind *rw, size_t *size);
+
+/* コアの現在のステートをシリアライズして積みます。 */
+bool rewind_push_core(struct rewind *rw, struct core *core);
+
+/* 1 つ前のステートをコアに書き戻します。 */
+bool rewind_pop_core(struct rewind *rw, struct core *core);
+
+/* 保持しているフレーム数（現在のステートを含む）を返します。 */
+static inline size_t rewind_frames(const struct rewind *rw)
+{
+   return rw->has_current ? rw->entries_count + 1 : 0;
+}
+
+#endif
@@ -0,0 +1,159 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 2 つ目のコアインスタンスを使った先行実行(run-ahead)。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "runahead.h"
+#include "callbacks.h"
+#include "timer.h"
+
+bool runahead_init(struct runahead *ra, struct core *primary,
+      const char *content_path, unsigned frames)
+{
+   bool loaded;
+
+   memset(ra, 0, sizeof(*ra));
+   ra->primary = primary;
+   ra->frames  = frames ? frames : 1;
+   callbacks_context_init(&ra->context);
+   ra->context.state.predict_input = true;
+
+   /* 同じ .so を dlopen() するとグローバル状態を共有してしまうので、コピーを読み込みます。 */
+   if (!core_load(&ra->secondary, primary->path, true))
+      return false;
+
+   /* 読み込み中の environment 呼び出しも、セカンダリ自身の状態で受けます。 */
+   callbacks_swap_context(&ra->context);
+   callbacks_set_environment(&ra->secondary);
+   ra->secondary.retro_init();
+   ra->secondary.initialized = true;
+   callbacks_install(&ra->secondary);
+   loaded = core_load_game(&ra->secondary, content_path);
+   callbacks_swap_context(&ra->context);
+   if (!loaded)
+      goto error;
+
+   ra->state_size = primary->retro_serialize_size();
+   ra->state      = (uint8_t*)malloc(ra->state_size ? ra->state_size : 1);
+   if (!ra->state_size || !ra->state)
+   {
+      fprintf(stderr, "[runahead] コアがシリアライズに対応していません\n");
+      goto error;
+   }
+
+   return true;
+
+error:
+   runahead_free(ra);
+   return false;
+}
+
+void runahead_free(struct runahead *ra)
+{
+   if (ra->primary)
+   {
+      callbacks_swap_context(&ra->context);
+      core_unload(&ra->secondary);
+      callbacks_swap_context(&ra->context);
+      callbacks_context_free(&ra->context);
+   }
+   free(ra->state);
+   ra->primary    = NULL;
+   ra->state      = NULL;
+   ra->state_size = 0;
+}
+
+/* プライマリのステートを ra->state にシリアライズし、サイズを返します。失敗したら 0 です。 */
+static size_t runahead_serialize(struct runahead *ra)
+{
+   /* RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE のコアではサイズが増えることがあります。 */
+   size_t size = ra->primary->retro_serialize_size();
+
+   if (size > ra->state_size)
+   {
+      uint8_t *state = (uint8_t*)realloc(ra->state, size);
+      if (!state)
+         return 0;
+      ra->state      = state;
+      ra->state_size = size;
+   }
+
+   frontend_state.av_enable = FRONTEND_AV_ENABLE_FAST_SAVESTATES;
+   return ra->primary->retro_serialize(ra->state, size) ? size : 0;
+}
+
+bool runahead_run(struct runahead *ra)
+{
+   int      saved  = frontend_state.av_enable;
+   size_t   size   = 0;
+   unsigned runs   = 1;
+   unsigned i;
+   bool     resync;
+   bool     ok     = true;
+   uint64_t t0, t1, t2, t3, t4, t5;
+
+   t0 = timer_ns();
+
+   /* プライマリ: 音声のみ。表示される映像はセカンダリが出します。 */
+   frontend_state.av_enable = FRONTEND_AV_ENABLE_AUDIO;
+   callbacks_run(ra->primary);
+   t1 = timer_ns();
+
+   /* 1 フレームずつ渡されたサンプルは、音声が有効なうちに流します。基準のフレーム時間と
+    * 同じく retro_run() だけを比べられるように、この分は内訳に含めません。 */
+   callbacks_frame_end();
+
+   /* セカンダリは前のフレームの入力が続くものとして先に進んでいます。
+    * プライマリが読んだ入力がそれと違うときだけ、ステートから進め直します。 */
+   resync = !ra->synced
+         || memcmp(&ra->predicted, &input_snapshot, sizeof(input_snapshot)) != 0;
+   t2 = timer_ns();
+
+   if (resync)
+   {
+      ra->synced = false;
+      size       = runahead_serialize(ra);
+      if (!size)
+         goto end;
+      memcpy(&ra->predicted, &input_snapshot, sizeof(input_snapshot));
+      runs = ra->frames;
+      ra->resyncs++;
+   }
+   t3 = timer_ns();
+
+   callbacks_swap_context(&ra->context);
+   if (resync)
+   {
+      frontend_state.av_enable = FRONTEND_AV_ENABLE_FAST_SAVESTATES
+                               | FRONTEND_AV_ENABLE_HARD_DISABLE_AUDIO;
+      ok = ra->secondary.retro_unserialize(ra->state, size);
+   }
+   t4 = timer_ns();
+
+   /* 途中のフレームは映像も生成させず、最後の 1 フレームだけ映像を有効にします。 */
+   for (i = 0; ok && i < runs; i++)
+   {
+      frontend_state.av_enable = FRONTEND_AV_ENABLE_HARD_DISABLE_AUDIO
+                               | (i + 1 == runs ? FRONTEND_AV_ENABLE_VIDEO : 0);
+      callbacks_run(&ra->secondary);
+   }
+   callbacks_swap_context(&ra->context);
+   t5 = timer_ns();
+   if (!ok)
+      goto end;
+
+   ra->primary_ns     += t1 - t0;
+   ra->serialize_ns   += t3 - t2;
+   ra->unserialize_ns += t4 - t3;
+   ra->secondary_ns   += t5 - t4;
+   ra->runs++;
+   ra->synced = true;
+
+end:
+   frontend_state.av_enable = saved;
+   return ra->synced;
+}
@@ -0,0 +1,62 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 2 つ目のコアインスタンスを使った先行実行(run-ahead)。
+ *
+ * セカンダリはプライマリより N フレーム先を保ったまま、フレームをまたいで進めます。
+ * 1 フレームごとに次の手順を踏みます。
+ *   1. プライマリは映像を無効にして 1 フレーム進め、音声だけを出力します。
+ *   2. プライマリが読んだ入力が、セカンダリの予測 (前のフレームの入力が続く) どおりなら、
+ *      セカンダリを映像ありで 1 フレーム進めるだけです。
+ *   3. 入力が変わっていれば、プライマリのステートをメモリ上でシリアライズしてセカンダリに読み込ませ、
+ *      今の入力が続くものとして N フレーム先まで進め直します。映像は最後のフレームだけ出力します。
+ * シリアライズの間は RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE の bit 2
+ * (高速セーブステート) を立て、セカンダリには常に bit 3 (音声のハード無効) を立てます。
+ *
+ * 入力が変わらないフレームでは retro_run() は 2 回で済み、入力が変わったフレームだけ
+ * シリアライズと 1 + N 回の retro_run() がかかります。
+ * セカンダリは retro_input_poll_t で入力層を読まず、プライマリが最後に読んだスナップショットを使います。
+ * frontend_state・GET_GAME_INFO_EXT のコンテンツ・GET_VARIABLE_UPDATE の世代は
+ * セカンダリ用の struct frontend_context に持ち、セカンダリを呼ぶ間だけ入れ替えます。
+ */
+
+#ifndef RETROBENCH_RUNAHEAD_H__
+#define RETROBENCH_RUNAHEAD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "core.h"
+#include "callbacks.h"
+#include "input.h"
+
+struct runahead
+{
+   struct core *primary;
+   struct core  secondary;
+   uint8_t     *state;
+   size_t       state_size;
+   unsigned     frames;         /* 先行するフレーム数 */
+
+   struct frontend_context context;    /* セカンダリを呼ぶ間だけ入れ替える状態 */
+   struct input_snapshot   predicted;  /* セカンダリが先のフレームに使った入力 */
+   bool                    synced;     /* セカンダリが predicted のまま N フレーム先にいる */
+
+   /* 累計時間 (ns) */
+   uint64_t primary_ns;
+   uint64_t serialize_ns;
+   uint64_t unserialize_ns;
+   uint64_t secondary_ns;
+   uint64_t runs;
+   uint64_t resyncs;            /* 入力が予測と違い、ステートから進め直した回数 */
+};
+
+/* primary と同じコア・コンテンツで 2 つ目のインスタンスを起動します。
+ * primary はすでに retro_load_game() 済みである必要があります。 */
+bool runahead_init(struct runahead *ra, struct core *primary,
+      const char *content_path, unsigned frames);
+void runahead_free(struct runahead *ra);
+
+/* 1 フレーム分進めます。失敗した場合は false を返します。 */
+bool runahead_run(struct runahead *ra);
+
+#endif
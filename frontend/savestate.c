@@ -0,0 +1,467 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - メタデータ付きの圧縮ステートファイル。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "savestate.h"
+#include "timer.h"
+
+#define SAVESTATE_MAGIC    "RBSS"
+#define SAVESTATE_VERSION  1
+#define SAVESTATE_HEADER   (4 + 4 + 4 + 8 + 8 + 8 + 2 + 2)
+
+/* 読み込みで 1 回に fread() する圧縮データの量。 */
+#define SAVESTATE_READ_BUFFER (64 * 1024)
+
+/* 速さを優先します。ステートの大部分はゼロや繰り返しなので、これでも十分に縮みます。 */
+#define SAVESTATE_LEVEL    1
+
+static void savestate_put(uint8_t *p, uint64_t value, unsigned bytes)
+{
+   unsigned i;
+
+   for (i = 0; i < bytes; i++)
+      p[i] = (uint8_t)(value >> (8 * i));
+}
+
+static uint64_t savestate_get(const uint8_t *p, unsigned bytes)
+{
+   uint64_t value = 0;
+   unsigned i;
+
+   for (i = 0; i < bytes; i++)
+      value |= (uint64_t)p[i] << (8 * i);
+   return value;
+}
+
+void savestate_describe(struct savestate_meta *meta, const struct core *core,
+      uint64_t quirks, uint64_t content_hash)
+{
+   memset(meta, 0, sizeof(*meta));
+   snprintf(meta->library_name, sizeof(meta->library_name), "%s",
+         core->system_info.library_name ? core->system_info.library_name : "");
+   snprintf(meta->library_version, sizeof(meta->library_version), "%s",
+         core->system_info.library_version ? core->system_info.library_version : "");
+   meta->quirks       = quirks;
+   meta->content_hash = content_hash;
+}
+
+/* ---- 書き込み ---- */
+
+struct savestate_chunk
+{
+   uint8_t    *packed;         /* 圧縮した内容。そのまま置く場合は使いません */
+   uint32_t    size;
+   uint32_t    packed_size;
+   uint32_t    crc;
+   atomic_bool done;
+};
+
+struct savestate_encoder
+{
+   const uint8_t          *state;
+   struct savestate_chunk *chunks;
+   unsigned                count;
+   atomic_uint             next;       /* 次に圧縮するチャンク */
+   bool                    failed;
+   pthread_mutex_t         lock;
+   pthread_cond_t          cond;       /* チャンクが終わるたびに知らせます */
+};
+
+static void savestate_encode_chunk(z_stream *z, const uint8_t *src, struct savestate_chunk *chunk)
+{
+   chunk->crc         = (uint32_t)crc32_z(0, src, chunk->size);
+   chunk->packed_size = chunk->size;
+
+   z->next_in   = (Bytef*)src;
+   z->avail_in  = chunk->size;
+   z->next_out  = chunk->packed;
+   z->avail_out = chunk->size;
+   /* 縮まなかったチャンクは、圧縮せずにそのまま置きます。 */
+   if (deflate(z, Z_FINISH) == Z_STREAM_END && z->total_out < chunk->size)
+      chunk->packed_size = (uint32_t)z->total_out;
+   deflateReset(z);
+}
+
+static void *savestate_encode_thread(void *arg)
+{
+   struct savestate_encoder *enc = (struct savestate_encoder*)arg;
+   bool     ok;
+   unsigned i;
+   z_stream z;
+
+   memset(&z, 0, sizeof(z));
+   ok = deflateInit2(&z, SAVESTATE_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+   while ((i = atomic_fetch_add(&enc->next, 1)) < enc->count)
+   {
+      struct savestate_chunk *chunk = &enc->chunks[i];
+
+      if (ok)
+         savestate_encode_chunk(&z, enc->state + (size_t)i * SAVESTATE_CHUNK, chunk);
+
+      pthread_mutex_lock(&enc->lock);
+      if (!ok)
+         enc->failed = true;
+      atomic_store(&chunk->done, true);
+      pthread_cond_broadcast(&enc->cond);
+      pthread_mutex_unlock(&enc->lock);
+   }
+
+   if (ok)
+      deflateEnd(&z);
+   return NULL;
+}
+
+static bool savestate_write_header(FILE *fp, const struct savestate_meta *meta, uint64_t size)
+{
+   uint8_t header[SAVESTATE_HEADER];
+   size_t  name    = strlen(meta->library_name);
+   size_t  version = strlen(meta->library_version);
+
+   memcpy(header, SAVESTATE_MAGIC, 4);
+   savestate_put(header + 4,  SAVESTATE_VERSION, 4);
+   savestate_put(header + 8,  SAVESTATE_CHUNK, 4);
+   savestate_put(header + 12, size, 8);
+   savestate_put(header + 20, meta->quirks, 8);
+   savestate_put(header + 28, meta->content_hash, 8);
+   savestate_put(header + 36, name, 2);
+   savestate_put(header + 38, version, 2);
+
+   return fwrite(header, 1, sizeof(header), fp) == sizeof(header)
+      && fwrite(meta->library_name, 1, name, fp) == name
+      && fwrite(meta->library_version, 1, version, fp) == version;
+}
+
+/* チャンクを終わった順に待ちながら、ファイルの順に書き出します。 */
+static bool savestate_write_chunks(FILE *fp, struct savestate_encoder *enc)
+{
+   unsigned i;
+
+   for (i = 0; i < enc->count; i++)
+   {
+      struct savestate_chunk *chunk = &enc->chunks[i];
+      const uint8_t *data;
+      uint8_t head[8];
+
+      if (!atomic_load(&chunk->done))
+      {
+         pthread_mutex_lock(&enc->lock);
+         while (!atomic_load(&chunk->done))
+            pthread_cond_wait(&enc->cond, &enc->lock);
+         pthread_mutex_unlock(&enc->lock);
+      }
+      if (enc->failed)
+         return false;
+
+      data = chunk->packed_size < chunk->size ? chunk->packed
+         : enc->state + (size_t)i * SAVESTATE_CHUNK;
+      savestate_put(head,     chunk->packed_size, 4);
+      savestate_put(head + 4, chunk->crc, 4);
+      if (fwrite(head, 1, sizeof(head), fp) != sizeof(head)
+            || fwrite(data, 1, chunk->packed_size, fp) != chunk->packed_size)
+         return false;
+   }
+   return true;
+}
+
+bool savestate_write(const char *path, const struct savestate_meta *meta,
+      const void *state, size_t size, unsigned threads, struct savestate_stats *stats)
+{
+   struct savestate_encoder enc;
+   pthread_t tids[SAVESTATE_MAX_THREADS];
+   char      tmp[4096 + 8];
+   uint64_t  start = timer_ns();
+   uint8_t  *packed = NULL;
+   unsigned  i, started = 0;
+   FILE     *fp = NULL;
+   bool      ok = false;
+   int       fd;
+
+   memset(&enc, 0, sizeof(enc));
+   enc.state = (const uint8_t*)state;
+   enc.count = (unsigned)((size + SAVESTATE_CHUNK - 1) / SAVESTATE_CHUNK);
+   pthread_mutex_init(&enc.lock, NULL);
+   pthread_cond_init(&enc.cond, NULL);
+
+   if (!threads)
+   {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? (unsigned)cpus : 1;
+   }
+   if (threads > SAVESTATE_MAX_THREADS)
+      threads = SAVESTATE_MAX_THREADS;
+   if (threads > enc.count)
+      threads = enc.count;
+
+   /* 元より小さくなった場合だけ使うので、圧縮先はチャンクと同じ大きさで足ります。 */
+   enc.chunks = (struct savestate_chunk*)calloc(enc.count ? enc.count : 1, sizeof(*enc.chunks));
+   packed     = (uint8_t*)malloc((size_t)SAVESTATE_CHUNK * (enc.count ? enc.count : 1));
+   if (!enc.chunks || !packed)
+      goto end;
+   for (i = 0; i < enc.count; i++)
+   {
+      enc.chunks[i].packed = packed + (size_t)SAVESTATE_CHUNK * i;
+      enc.chunks[i].size   = (uint32_t)(i + 1 < enc.count ? SAVESTATE_CHUNK
+            : size - (size_t)i * SAVESTATE_CHUNK);
+      atomic_init(&enc.chunks[i].done, false);
+   }
+   atomic_init(&enc.next, 0);
+
+   snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+   fd = mkstemp(tmp);
+   if (fd < 0)
+      goto end;
+   fp = fdopen(fd, "wb");
+   if (!fp)
+   {
+      close(fd);
+      unlink(tmp);
+      goto end;
+   }
+
+   for (i = 0; i < threads; i++)
+      if (pthread_create(&tids[started], NULL, savestate_encode_thread, &enc) == 0)
+         started++;
+   /* スレッドを起動できなければ、このスレッドで圧縮してから書きます。 */
+   if (!started)
+      savestate_encode_thread(&enc);
+
+   ok = savestate_write_header(fp, meta, size) && savestate_write_chunks(fp, &enc);
+
+   /* 書き込みが失敗しても、圧縮中のスレッドが enc を使い終えるまで待ちます。 */
+   atomic_store(&enc.next, enc.count);
+   for (i = 0; i < started; i++)
+      pthread_join(tids[i], NULL);
+
+   if (fflush(fp) != 0 || fsync(fileno(fp)) != 0 || fchmod(fileno(fp), 0644) != 0)
+      ok = false;
+   if (stats)
+   {
+      stats->size       = size;
+      stats->file_bytes = (uint64_t)ftell(fp);
+      stats->chunks     = enc.count;
+      stats->threads    = started ? started : 1;
+   }
+   if (fclose(fp) != 0)
+      ok = false;
+   if (ok && rename(tmp, path) != 0)
+      ok = false;
+   if (!ok)
+      unlink(tmp);
+
+end:
+   free(packed);
+   free(enc.chunks);
+   pthread_mutex_destroy(&enc.lock);
+   pthread_cond_destroy(&enc.cond);
+   if (stats)
+      stats->ns = timer_ns() - start;
+   return ok;
+}
+
+/* ---- 読み込み ---- */
+
+bool savestate_open(struct savestate_reader *reader, const char *path)
+{
+   uint8_t header[SAVESTATE_HEADER];
+   size_t  name, version;
+   long    end;
+
+   memset(reader, 0, sizeof(*reader));
+   reader->fp = fopen(path, "rb");
+   if (!reader->fp)
+      return false;
+
+   if (fread(header, 1, sizeof(header), reader->fp) != sizeof(header)
+         || memcmp(header, SAVESTATE_MAGIC, 4) != 0)
+   {
+      /* ヘッダーが無ければ retro_serialize() の内容をそのまま書いたものです。 */
+      if (fseek(reader->fp, 0, SEEK_END) != 0 || (end = ftell(reader->fp)) < 0
+            || fseek(reader->fp, 0, SEEK_SET) != 0)
+         goto error;
+      reader->raw       = true;
+      reader->meta.size = (uint64_t)end;
+      return true;
+   }
+
+   if (savestate_get(header + 4, 4) != SAVESTATE_VERSION)
+   {
+      fprintf(stderr, "[savestate] 知らない版のステートです: %s\n", path);
+      goto error;
+   }
+
+   reader->chunk_size        = (uint32_t)savestate_get(header + 8, 4);
+   reader->meta.size         = savestate_get(header + 12, 8);
+   reader->meta.quirks       = savestate_get(header + 20, 8);
+   reader->meta.content_hash = savestate_get(header + 28, 8);
+   name                      = (size_t)savestate_get(header + 36, 2);
+   version                   = (size_t)savestate_get(header + 38, 2);
+   reader->in                = (uint8_t*)malloc(SAVESTATE_READ_BUFFER);
+
+   if (!reader->in || !reader->chunk_size
+         || name >= sizeof(reader->meta.library_name)
+         || version >= sizeof(reader->meta.library_version)
+         || fread(reader->meta.library_name, 1, name, reader->fp) != name
+         || fread(reader->meta.library_version, 1, version, reader->fp) != version)
+   {
+      fprintf(stderr, "[savestate] ヘッダーが壊れています: %s\n", path);
+      goto error;
+   }
+   return true;
+
+error:
+   savestate_close(reader);
+   return false;
+}
+
+/* packed バイトの raw deflate を読みながら dst に size バイト展開します。 */
+static bool savestate_inflate(struct savestate_reader *reader, z_stream *z,
+      uint8_t *dst, uint32_t size, uint32_t packed)
+{
+   int  ret = Z_OK;
+   bool ok;
+
+   z->next_out  = dst;
+   z->avail_out = size;
+   while (packed && ret == Z_OK)
+   {
+      size_t n = packed < SAVESTATE_READ_BUFFER ? packed : SAVESTATE_READ_BUFFER;
+
+      if (fread(reader->in, 1, n, reader->fp) != n)
+         return false;
+      packed     -= (uint32_t)n;
+      z->next_in  = reader->in;
+      z->avail_in = (uInt)n;
+      ret = inflate(z, packed ? Z_NO_FLUSH : Z_FINISH);
+      if (ret == Z_BUF_ERROR && z->avail_in == 0 && packed)
+         ret = Z_OK;
+   }
+   ok = ret == Z_STREAM_END && z->avail_out == 0 && !packed;
+   inflateReset(z);
+   return ok;
+}
+
+bool savestate_read(struct savestate_reader *reader, void *dst)
+{
+   uint8_t *out  = (uint8_t*)dst;
+   uint64_t left = reader->meta.size;
+   z_stream z;
+   bool     ok = true;
+
+   if (reader->raw)
+      return fread(dst, 1, (size_t)left, reader->fp) == left;
+
+   memset(&z, 0, sizeof(z));
+   if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+      return false;
+
+   while (ok && left)
+   {
+      uint32_t size = left < reader->chunk_size ? (uint32_t)left : reader->chunk_size;
+      uint32_t packed, crc;
+      uint8_t  head[8];
+
+      if (!(ok = fread(head, 1, sizeof(head), reader->fp) == sizeof(head)))
+         break;
+      packed = (uint32_t)savestate_get(head, 4);
+      crc    = (uint32_t)savestate_get(head + 4, 4);
+
+      if (packed == size)
+         ok = fread(out, 1, size, reader->fp) == size;
+      else
+         ok = packed < size && savestate_inflate(reader, &z, out, size, packed);
+      ok = ok && (uint32_t)crc32_z(0, out, size) == crc;
+      if (!ok)
+         break;
+
+      out  += size;
+      left -= size;
+   }
+
+   inflateEnd(&z);
+   if (!ok)
+      fprintf(stderr, "[savestate] ステートの %llu バイト目のチャンクが壊れています\n",
+            (unsigned long long)(reader->meta.size - left));
+   return ok;
+}
+
+void savestate_close(struct savestate_reader *reader)
+{
+   if (reader->fp)
+      fclose(reader->fp);
+   free(reader->in);
+   reader->fp = NULL;
+   reader->in = NULL;
+}
+
+/* ---- コアとのやりとり ---- */
+
+bool savestate_save(struct core *core, const char *path, uint64_t quirks, uint64_t content_hash,
+      unsigned threads, struct savestate_stats *stats)
+{
+   struct savestate_meta meta;
+   size_t size = core->retro_serialize_size();
+   void  *state = size ? malloc(size) : NULL;
+   bool   ok;
+
+   savestate_describe(&meta, core, quirks, content_hash);
+   ok = state && core->retro_serialize(state, size)
+      && savestate_write(path, &meta, state, size, threads, stats);
+   free(state);
+   return ok;
+}
+
+bool savestate_load(struct core *core, const char *path, const struct savestate_meta *expect,
+      struct savestate_stats *stats)
+{
+   struct savestate_reader reader;
+   uint64_t start = timer_ns();
+   void    *state;
+   bool     ok;
+
+   if (!savestate_open(&reader, path))
+   {
+      fprintf(stderr, "[savestate] ステートを開けません: %s\n", path);
+      return false;
+   }
+
+   if (expect && !reader.raw)
+   {
+      if (strcmp(reader.meta.library_name, expect->library_name) != 0)
+      {
+         fprintf(stderr, "[savestate] %s のステートは %s では読み込めません: %s\n",
+               reader.meta.library_name, expect->library_name, path);
+         savestate_close(&reader);
+         return false;
+      }
+      if (strcmp(reader.meta.library_version, expect->library_version) != 0)
+         fprintf(stderr, "[savestate] %s %s で作られたステートです (今のコアは %s)\n",
+               reader.meta.library_name, reader.meta.library_version, expect->library_version);
+      if (reader.meta.content_hash != expect->content_hash)
+         fprintf(stderr, "[savestate] 別のコンテンツで作られたステートです: %s\n", path);
+   }
+
+   state = reader.meta.size ? malloc((size_t)reader.meta.size) : NULL;
+   ok    = state && savestate_read(&reader, state)
+      && core->retro_unserialize(state, (size_t)reader.meta.size);
+   if (stats)
+   {
+      memset(stats, 0, sizeof(*stats));
+      stats->size       = reader.meta.size;
+      stats->file_bytes = (uint64_t)ftell(reader.fp);
+      stats->ns         = timer_ns() - start;
+   }
+
+   free(state);
+   savestate_close(&reader);
+   return ok;
+}
@@ -0,0 +1,89 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - メタデータ付きの圧縮ステートファイル。
+ *
+ * retro_serialize() の内容を固定長のチャンクに分け、チャンクごとに deflate で圧縮して並べます。
+ * チャンクは互いに独立しているので、書き込みでは複数のスレッドが並列に圧縮し、
+ * 呼び出したスレッドは終わったものから順にファイルへ書き出します。
+ * 読み込みはチャンクを小さなバッファで少しずつ展開するので、圧縮後の全体をメモリに置きません。
+ * ヘッダーにはステートを作ったコアの名前とバージョン、コンテンツのハッシュ、
+ * RETRO_SERIALIZATION_QUIRK_* を残し、読み込むときに今のコアと食い違えば知らせます。
+ * ヘッダーの無いファイルは、これまでどおり retro_serialize() をそのまま書いたものとして読みます。
+ *
+ * ファイル形式 (数値はすべてリトルエンディアン):
+ *   "RBSS"  u32 version  u32 chunk_size  u64 size  u64 quirks  u64 content_hash
+ *   u16 library_name の長さ  u16 library_version の長さ  それぞれの文字列
+ *   チャンクの列 (size を chunk_size ごとに区切った数だけ):
+ *     u32 packed_size  u32 crc32 (展開後の内容)  packed_size バイトの raw deflate
+ *     packed_size がチャンクの大きさと同じなら、圧縮せずにそのまま置いたものです。
+ * 書き込みは一時ファイルに書いて fsync() してから rename() します。
+ */
+
+#ifndef RETROBENCH_SAVESTATE_H__
+#define RETROBENCH_SAVESTATE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "core.h"
+
+#define SAVESTATE_CHUNK        (256 * 1024)
+#define SAVESTATE_MAX_THREADS  16
+#define SAVESTATE_NAME_MAX     256
+
+struct savestate_meta
+{
+   char     library_name[SAVESTATE_NAME_MAX];
+   char     library_version[SAVESTATE_NAME_MAX];
+   uint64_t content_hash;      /* content_hash() の値。コンテンツなしなら 0 */
+   uint64_t quirks;            /* RETRO_SERIALIZATION_QUIRK_* */
+   uint64_t size;              /* retro_serialize() の大きさ */
+};
+
+struct savestate_stats
+{
+   uint64_t size;              /* ステートの大きさ */
+   uint64_t file_bytes;        /* ヘッダーを含むファイルの大きさ */
+   unsigned chunks;
+   unsigned threads;           /* 圧縮に使ったスレッド */
+   uint64_t ns;                /* 書き込み / 読み込みの所要時間 */
+};
+
+/* 圧縮されたステートを少しずつ展開する読み手です。 */
+struct savestate_reader
+{
+   FILE    *fp;
+   bool     raw;               /* ヘッダーの無い retro_serialize() の内容そのもの */
+   uint32_t chunk_size;
+   struct savestate_meta meta;
+   uint8_t *in;                /* ファイルから読んだ圧縮データのバッファ */
+};
+
+/* core のコア名とバージョン、quirks と content_hash を meta に入れます。size は 0 のままです。 */
+void savestate_describe(struct savestate_meta *meta, const struct core *core,
+      uint64_t quirks, uint64_t content_hash);
+
+/* state を path に書き込みます。threads が 0 ならオンラインの CPU の数 (最大 SAVESTATE_MAX_THREADS) です。 */
+bool savestate_write(const char *path, const struct savestate_meta *meta,
+      const void *state, size_t size, unsigned threads, struct savestate_stats *stats);
+
+/* path を開いてヘッダーを読みます。ヘッダーが無ければ raw として全体を 1 つのステートとみなします。 */
+bool savestate_open(struct savestate_reader *reader, const char *path);
+
+/* 残りを dst (reader->meta.size バイト) に展開し、チャンクごとに CRC を確かめます。 */
+bool savestate_read(struct savestate_reader *reader, void *dst);
+
+void savestate_close(struct savestate_reader *reader);
+
+/* core のステートを path に書き込みます。 */
+bool savestate_save(struct core *core, const char *path, uint64_t quirks, uint64_t content_hash,
+      unsigned threads, struct savestate_stats *stats);
+
+/* path のステートを core に retro_unserialize() します。expect が NULL でなければ、
+ * 別のコアのステートは読み込まず、バージョンやコンテンツの食い違いは警告します。 */
+bool savestate_load(struct core *core, const char *path, const struct savestate_meta *expect,
+      struct savestate_stats *stats);
+
+#endif
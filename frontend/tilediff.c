@@ -0,0 +1,208 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - フレームのタイルを前のフレームと比べるカーネル。
+ *
+ * タイルの 1 行は 16 ピクセルの RGB565 で 32 バイト、XRGB8888 で 64 バイトと短く、
+ * タイルごとに比べると呼び出しと分岐のコストが比較そのものを上回ります。
+ * そこで各カーネルは行を 64 バイトのチャンクに区切って途切れずに比べ、
+ * 違うチャンクが見つかったときだけ、どのタイルが違うのかをスカラーで調べます。
+ */
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TILEDIFF_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define TILEDIFF_NEON
+#endif
+
+#include "tilediff.h"
+#include "cpu_features.h"
+#include "dispatch.h"
+
+/* タイル t から始まる、違っていた [x, x + n) を含むタイルのうち、実際に違うものに印を付け、
+ * 新しく印を付けた数を返します。違うチャンクは少ないので、ここはスカラーで済ませます。 */
+static unsigned tilediff_mark(const uint8_t *ref, const uint8_t *src, size_t x, size_t n,
+      size_t tile_bytes, size_t t, uint8_t *dirty)
+{
+   unsigned marked = 0;
+
+   for (; t * tile_bytes < x + n; t++)
+   {
+      size_t lo = t * tile_bytes > x ? t * tile_bytes : x;
+      size_t hi = (t + 1) * tile_bytes < x + n ? (t + 1) * tile_bytes : x + n;
+
+      if (!dirty[t] && memcmp(ref + lo, src + lo, hi - lo))
+      {
+         dirty[t] = 1;
+         marked++;
+      }
+   }
+   return marked;
+}
+
+/* 行を TILEDIFF_CHUNK バイトずつ differs で比べ、違うチャンクだけ tilediff_mark() に渡す本体です。
+ * t はチャンクの先頭を含むタイルで、end はその終わりです。
+ * チャンクが 1 つのタイルに収まり、そのタイルにもう印が付いていれば比べません。 */
+#define TILEDIFF_CHUNK 64
+#define TILEDIFF_ROW(differs) \
+   size_t   x, t = 0, end = tile_bytes; \
+   unsigned marked = 0; \
+   for (x = 0; x + TILEDIFF_CHUNK <= row_bytes; x += TILEDIFF_CHUNK) \
+   { \
+      while (x >= end) \
+      { \
+         t++; \
+         end += tile_bytes; \
+      } \
+      if (x + TILEDIFF_CHUNK <= end && dirty[t]) \
+         continue; \
+      if (differs(ref + x, src + x)) \
+         marked += tilediff_mark(ref, src, x, TILEDIFF_CHUNK, tile_bytes, t, dirty); \
+   } \
+   if (x < row_bytes && memcmp(ref + x, src + x, row_bytes - x)) \
+      marked += tilediff_mark(ref, src, x, row_bytes - x, tile_bytes, x / tile_bytes, dirty); \
+   return marked
+
+static inline bool tilediff_differs_scalar(const uint8_t *a, const uint8_t *b)
+{
+   uint64_t diff = 0;
+   unsigned x;
+
+   for (x = 0; x < TILEDIFF_CHUNK; x += 8)
+   {
+      uint64_t va, vb;
+      memcpy(&va, a + x, 8);
+      memcpy(&vb, b + x, 8);
+      diff |= va ^ vb;
+   }
+   return diff != 0;
+}
+
+static unsigned tilediff_row_scalar(const uint8_t *ref, const uint8_t *src,
+      size_t row_bytes, size_t tile_bytes, uint8_t *dirty)
+{
+   TILEDIFF_ROW(tilediff_differs_scalar);
+}
+
+#if defined(TILEDIFF_X86)
+__attribute__((target("sse2")))
+static inline bool tilediff_differs_sse2(const uint8_t *a, const uint8_t *b)
+{
+   __m128i eq = _mm_and_si128(
+         _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)a),
+                           _mm_loadu_si128((const __m128i*)b)),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 16)),
+                           _mm_loadu_si128((const __m128i*)(b + 16)))),
+         _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 32)),
+                           _mm_loadu_si128((const __m128i*)(b + 32))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + 48)),
+                           _mm_loadu_si128((const __m128i*)(b + 48)))));
+   return _mm_movemask_epi8(eq) != 0xFFFF;
+}
+
+__attribute__((target("sse2")))
+static unsigned tilediff_row_sse2(const uint8_t *ref, const uint8_t *src,
+      size_t row_bytes, size_t tile_bytes, uint8_t *dirty)
+{
+   TILEDIFF_ROW(tilediff_differs_sse2);
+}
+
+__attribute__((target("avx2")))
+static inline bool tilediff_differs_avx2(const uint8_t *a, const uint8_t *b)
+{
+   __m256i diff = _mm256_or_si256(
+         _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)a),
+                          _mm256_loadu_si256((const __m256i*)b)),
+         _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + 32)),
+                          _mm256_loadu_si256((const __m256i*)(b + 32))));
+   return !_mm256_testz_si256(diff, diff);
+}
+
+__attribute__((target("avx2")))
+static unsigned tilediff_row_avx2(const uint8_t *ref, const uint8_t *src,
+      size_t row_bytes, size_t tile_bytes, uint8_t *dirty)
+{
+   TILEDIFF_ROW(tilediff_differs_avx2);
+}
+
+__attribute__((target("avx512f")))
+static inline bool tilediff_differs_avx512(const uint8_t *a, const uint8_t *b)
+{
+   return _mm512_cmpneq_epi64_mask(_mm512_loadu_si512((const void*)a),
+         _mm512_loadu_si512((const void*)b)) != 0;
+}
+
+__attribute__((target("avx512f")))
+static unsigned tilediff_row_avx512(const uint8_t *ref, const uint8_t *src,
+      size_t row_bytes, size_t tile_bytes, uint8_t *dirty)
+{
+   TILEDIFF_ROW(tilediff_differs_avx512);
+}
+#endif
+
+#if defined(TILEDIFF_NEON)
+static inline bool tilediff_differs_neon(const uint8_t *a, const uint8_t *b)
+{
+   uint64x2_t d = vreinterpretq_u64_u8(vorrq_u8(
+         vorrq_u8(veorq_u8(vld1q_u8(a),      vld1q_u8(b)),
+                  veorq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16))),
+         vorrq_u8(veorq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32)),
+                  veorq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48)))));
+   return (vgetq_lane_u64(d, 0) | vgetq_lane_u64(d, 1)) != 0;
+}
+
+static unsigned tilediff_row_neon(const uint8_t *ref, const uint8_t *src,
+      size_t row_bytes, size_t tile_bytes, uint8_t *dirty)
+{
+   TILEDIFF_ROW(tilediff_differs_neon);
+}
+#endif
+
+static const struct tilediff_kernel tilediff_kernel_list[] = {
+#if defined(TILEDIFF_X86)
+   { "avx512", CPU_FEATURE_AVX512F, tilediff_row_avx512 },
+   { "avx2",   RETRO_SIMD_AVX2, tilediff_row_avx2 },
+   { "sse2",   RETRO_SIMD_SSE2, tilediff_row_sse2 },
+#endif
+#if defined(TILEDIFF_NEON)
+   { "neon",   RETRO_SIMD_NEON, tilediff_row_neon },
+#endif
+   { "scalar", 0,               tilediff_row_scalar },
+};
+
+#define TILEDIFF_KERNELS (sizeof(tilediff_kernel_list) / sizeof(tilediff_kernel_list[0]))
+
+static struct dispatch_variant tilediff_variants[TILEDIFF_KERNELS];
+
+/* dispatch_bind() までは、どの CPU でも動くスカラー版を使います。 */
+static const void *tilediff_current = &tilediff_kernel_list[TILEDIFF_KERNELS - 1];
+
+const struct tilediff_kernel *tilediff_kernels(unsigned *count)
+{
+   *count = TILEDIFF_KERNELS;
+   return tilediff_kernel_list;
+}
+
+void tilediff_register(void)
+{
+   unsigned i;
+
+   for (i = 0; i < TILEDIFF_KERNELS; i++)
+   {
+      tilediff_variants[i].name     = tilediff_kernel_list[i].name;
+      tilediff_variants[i].features = tilediff_kernel_list[i].simd;
+      tilediff_variants[i].impl     = &tilediff_kernel_list[i];
+   }
+
+   dispatch_register("tilediff", tilediff_variants, TILEDIFF_KERNELS, &tilediff_current);
+}
+
+const struct tilediff_kernel *tilediff_kernel(void)
+{
+   return (const struct tilediff_kernel*)tilediff_current;
+}
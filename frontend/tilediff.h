@@ -0,0 +1,39 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - フレームのタイルを前のフレームと比べるカーネル。
+ *
+ * 映像パイプラインはフレームをタイルに分け、前のフレームの写しとタイルごとに比べて
+ * 変わったタイルだけを変換します。プリフェッチが効くように、カーネルはタイルごとではなく
+ * 1 行ずつ左から右へ比べ、行を tile_bytes ごとに区切った各タイルの dirty に印を付けます。
+ * カーネルは dispatch_bind() が CPU の機能から AVX-512 / AVX2 / SSE2 / NEON / スカラーの順に選びます。
+ */
+
+#ifndef RETROBENCH_TILEDIFF_H__
+#define RETROBENCH_TILEDIFF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* row_bytes バイトの 1 行を比べ、違う部分を含むタイル t の dirty[t] を 1 にします。
+ * 新しく印を付けたタイルの数を返します。 */
+typedef unsigned (*tilediff_row_t)(const uint8_t *ref, const uint8_t *src,
+      size_t row_bytes, size_t tile_bytes, uint8_t *dirty);
+
+struct tilediff_kernel
+{
+   const char      *name;
+   uint64_t         simd;      /* 必要な RETRO_SIMD_* / CPU_FEATURE_* ビット */
+   tilediff_row_t   row;
+};
+
+/* 利用可能かどうかにかかわらず、すべてのカーネルを優先度順に返します。 */
+const struct tilediff_kernel *tilediff_kernels(unsigned *count);
+
+/* カーネルを dispatch_register() に "tilediff" として登録します。 */
+void tilediff_register(void);
+
+/* 選ばれているカーネルを返します。 */
+const struct tilediff_kernel *tilediff_kernel(void);
+
+#endif
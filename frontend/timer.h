@@ -0,0 +1,28 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 計測用の時刻取得ヘルパー。
+ */
+
+#ifndef RETROBENCH_TIMER_H__
+#define RETROBENCH_TIMER_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* 単調増加するナノ秒カウンタを返します。 */
+static inline uint64_t timer_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* このプロセスの全スレッドが使った CPU 時間をナノ秒で返します。 */
+static inline uint64_t timer_cpu_ns(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#endif
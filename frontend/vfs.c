@@ -0,0 +1,518 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - RETRO_ENVIRONMENT_GET_VFS_INTERFACE で渡す VFS (API v3)。
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vfs.h"
+#include "vfs_cache.h"
+
+struct retro_vfs_file_handle
+{
+   int            fd;
+   char          *path;
+   unsigned       mode;
+   const uint8_t *map;        /* 読み取り専用で mmap() できた場合のみ */
+   struct vfs_cache *cache;   /* 先読みキャッシュを付けた場合のみ */
+   int64_t        size;       /* map か cache がある場合のファイルサイズ */
+   int64_t        pos;
+   struct vfs_stats stats;    /* このハンドルの分。閉じるときに合計へ足します */
+   struct retro_vfs_file_handle *prev, *next;
+};
+
+struct retro_vfs_dir_handle
+{
+   DIR           *dir;
+   struct dirent *entry;
+   bool           include_hidden;
+};
+
+/* 開いているハンドルの一覧。統計を集めるためだけに使い、読み書きの経路では触りません。 */
+static pthread_mutex_t vfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct retro_vfs_file_handle *vfs_handles;
+static struct vfs_stats vfs_closed;
+static enum vfs_backend vfs_backend = VFS_BACKEND_MMAP;
+
+static void vfs_stats_add(struct vfs_stats *dst, const struct vfs_stats *src)
+{
+   dst->opens        += src->opens;
+   dst->mapped       += src->mapped;
+   dst->reads        += src->reads;
+   dst->mapped_reads += src->mapped_reads;
+   dst->read_bytes   += src->read_bytes;
+   dst->writes       += src->writes;
+   dst->write_bytes  += src->write_bytes;
+   dst->seeks        += src->seeks;
+   dst->cached       += src->cached;
+   dst->cached_uring += src->cached_uring;
+   dst->cache_hits   += src->cache_hits;
+   dst->cache_waits  += src->cache_waits;
+   dst->cache_misses += src->cache_misses;
+   dst->readaheads   += src->readaheads;
+   dst->stall_ns     += src->stall_ns;
+}
+
+/* 通常ファイルで中身があれば、そのサイズを返します。 */
+static int64_t vfs_regular_size(int fd)
+{
+   struct stat st;
+
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+      return 0;
+   return st.st_size;
+}
+
+static void vfs_attach_cache(struct retro_vfs_file_handle *stream)
+{
+   int64_t size = vfs_regular_size(stream->fd);
+
+   if (!size)
+      return;
+
+   stream->cache = vfs_cache_new(stream->fd, size,
+         vfs_backend == VFS_BACKEND_URING ? VFS_CACHE_URING : VFS_CACHE_THREADS);
+   if (!stream->cache)
+      return;
+
+   stream->size = size;
+   stream->stats.cached++;
+   if (vfs_cache_engine(stream->cache) == VFS_CACHE_URING)
+      stream->stats.cached_uring++;
+}
+
+static void vfs_map(struct retro_vfs_file_handle *stream, unsigned hints)
+{
+   int64_t size = vfs_regular_size(stream->fd);
+   void *map;
+
+   if (!size || (uint64_t)size > SIZE_MAX)
+      return;
+
+   map = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, stream->fd, 0);
+   if (map == MAP_FAILED)
+      return;
+
+   if (hints & RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS)
+   {
+      madvise(map, (size_t)size, MADV_RANDOM);
+      madvise(map, (size_t)size, MADV_WILLNEED);
+   }
+   else
+      madvise(map, (size_t)size, MADV_SEQUENTIAL);
+
+   stream->map  = (const uint8_t*)map;
+   stream->size = size;
+   stream->stats.mapped++;
+}
+
+struct retro_vfs_file_handle *RETRO_CALLCONV vfs_open(const char *path,
+      unsigned mode, unsigned hints)
+{
+   struct retro_vfs_file_handle *stream;
+   int flags;
+
+   if (!path)
+      return NULL;
+
+   switch (mode & RETRO_VFS_FILE_ACCESS_READ_WRITE)
+   {
+      case RETRO_VFS_FILE_ACCESS_READ:
+         flags = O_RDONLY;
+         break;
+      case RETRO_VFS_FILE_ACCESS_WRITE:
+         flags = O_WRONLY | O_CREAT;
+         break;
+      case RETRO_VFS_FILE_ACCESS_READ_WRITE:
+         flags = O_RDWR | O_CREAT;
+         break;
+      default:
+         return NULL;
+   }
+   if ((mode & RETRO_VFS_FILE_ACCESS_WRITE) && !(mode & RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING))
+      flags |= O_TRUNC;
+
+   stream = (struct retro_vfs_file_handle*)calloc(1, sizeof(*stream));
+   if (!stream)
+      return NULL;
+
+   stream->fd   = open(path, flags | O_CLOEXEC, 0644);
+   stream->path = strdup(path);
+   stream->mode = mode;
+   if (stream->fd < 0 || !stream->path)
+   {
+      if (stream->fd >= 0)
+         close(stream->fd);
+      free(stream->path);
+      free(stream);
+      return NULL;
+   }
+
+   if (flags == O_RDONLY && vfs_backend == VFS_BACKEND_MMAP)
+      vfs_map(stream, hints);
+   else if (flags == O_RDONLY && vfs_backend != VFS_BACKEND_PREAD)
+      vfs_attach_cache(stream);
+   if (!stream->map)
+      posix_fadvise(stream->fd, 0, 0,
+            (hints & RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS)
+            ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+   stream->stats.opens = 1;
+
+   pthread_mutex_lock(&vfs_lock);
+   stream->next = vfs_handles;
+   if (vfs_handles)
+      vfs_handles->prev = stream;
+   vfs_handles = stream;
+   pthread_mutex_unlock(&vfs_lock);
+
+   return stream;
+}
+
+int RETRO_CALLCONV vfs_close(struct retro_vfs_file_handle *stream)
+{
+   int ret;
+
+   if (!stream)
+      return -1;
+
+   pthread_mutex_lock(&vfs_lock);
+   if (stream->prev)
+      stream->prev->next = stream->next;
+   else
+      vfs_handles = stream->next;
+   if (stream->next)
+      stream->next->prev = stream->prev;
+   vfs_stats_add(&vfs_closed, &stream->stats);
+   pthread_mutex_unlock(&vfs_lock);
+
+   if (stream->map)
+      munmap((void*)stream->map, (size_t)stream->size);
+   vfs_cache_free(stream->cache);
+   ret = close(stream->fd);
+   free(stream->path);
+   free(stream);
+   return ret == 0 ? 0 : -1;
+}
+
+static const char *RETRO_CALLCONV vfs_get_path(struct retro_vfs_file_handle *stream)
+{
+   return stream ? stream->path : NULL;
+}
+
+int64_t RETRO_CALLCONV vfs_size(struct retro_vfs_file_handle *stream)
+{
+   struct stat st;
+
+   if (!stream)
+      return -1;
+   if (stream->map || stream->cache)
+      return stream->size;
+   if (fstat(stream->fd, &st) != 0)
+      return -1;
+   return st.st_size;
+}
+
+static int64_t RETRO_CALLCONV vfs_truncate(struct retro_vfs_file_handle *stream, int64_t length)
+{
+   if (!stream || stream->map || stream->cache || length < 0)
+      return -1;
+   return ftruncate(stream->fd, (off_t)length) == 0 ? 0 : -1;
+}
+
+int64_t RETRO_CALLCONV vfs_tell(struct retro_vfs_file_handle *stream)
+{
+   return stream ? stream->pos : -1;
+}
+
+int64_t RETRO_CALLCONV vfs_seek(struct retro_vfs_file_handle *stream,
+      int64_t offset, int seek_position)
+{
+   int64_t base;
+
+   if (!stream)
+      return -1;
+
+   switch (seek_position)
+   {
+      case RETRO_VFS_SEEK_POSITION_START:
+         base = 0;
+         break;
+      case RETRO_VFS_SEEK_POSITION_CURRENT:
+         base = stream->pos;
+         break;
+      case RETRO_VFS_SEEK_POSITION_END:
+         base = vfs_size(stream);
+         if (base < 0)
+            return -1;
+         break;
+      default:
+         return -1;
+   }
+
+   /* fseek() と同じく、終端より後ろへの移動は許します。 */
+   if (base + offset < 0)
+      return -1;
+   stream->stats.seeks++;
+   stream->pos = base + offset;
+   return stream->pos;
+}
+
+int64_t RETRO_CALLCONV vfs_read(struct retro_vfs_file_handle *stream, void *s, uint64_t len)
+{
+   uint64_t done = 0;
+
+   if (!stream || !(stream->mode & RETRO_VFS_FILE_ACCESS_READ))
+      return -1;
+
+   stream->stats.reads++;
+
+   if (stream->map)
+   {
+      if (stream->pos < stream->size)
+      {
+         done = (uint64_t)(stream->size - stream->pos);
+         if (done > len)
+            done = len;
+         memcpy(s, stream->map + stream->pos, (size_t)done);
+      }
+      stream->stats.mapped_reads++;
+   }
+   else if (stream->cache)
+   {
+      int64_t n = vfs_cache_read(stream->cache, s, stream->pos, len, &stream->stats);
+      if (n < 0)
+         return -1;
+      done = (uint64_t)n;
+   }
+   else
+   {
+      while (done < len)
+      {
+         ssize_t n = pread(stream->fd, (uint8_t*)s + done, (size_t)(len - done),
+               (off_t)(stream->pos + (int64_t)done));
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n < 0)
+            return -1;
+         if (n == 0)
+            break;
+         done += (uint64_t)n;
+      }
+   }
+
+   stream->pos              += (int64_t)done;
+   stream->stats.read_bytes += done;
+   return (int64_t)done;
+}
+
+static int64_t RETRO_CALLCONV vfs_write(struct retro_vfs_file_handle *stream,
+      const void *s, uint64_t len)
+{
+   uint64_t done = 0;
+
+   if (!stream || !(stream->mode & RETRO_VFS_FILE_ACCESS_WRITE))
+      return -1;
+
+   while (done < len)
+   {
+      ssize_t n = pwrite(stream->fd, (const uint8_t*)s + done, (size_t)(len - done),
+            (off_t)(stream->pos + (int64_t)done));
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         return done ? (int64_t)done : -1;
+      done += (uint64_t)n;
+   }
+
+   stream->pos               += (int64_t)done;
+   stream->stats.writes++;
+   stream->stats.write_bytes += done;
+   return (int64_t)done;
+}
+
+static int RETRO_CALLCONV vfs_flush(struct retro_vfs_file_handle *stream)
+{
+   /* 書き込みは pwrite() で直接行い、ユーザー空間にバッファを持ちません。 */
+   return stream ? 0 : -1;
+}
+
+static int RETRO_CALLCONV vfs_remove(const char *path)
+{
+   return path && remove(path) == 0 ? 0 : -1;
+}
+
+static int RETRO_CALLCONV vfs_rename(const char *old_path, const char *new_path)
+{
+   return old_path && new_path && rename(old_path, new_path) == 0 ? 0 : -1;
+}
+
+static int RETRO_CALLCONV vfs_stat(const char *path, int32_t *size)
+{
+   struct stat st;
+   int flags = RETRO_VFS_STAT_IS_VALID;
+
+   if (!path || stat(path, &st) != 0)
+      return 0;
+
+   if (S_ISDIR(st.st_mode))
+      flags |= RETRO_VFS_STAT_IS_DIRECTORY;
+   if (S_ISCHR(st.st_mode))
+      flags |= RETRO_VFS_STAT_IS_CHARACTER_SPECIAL;
+   if (size)
+      *size = st.st_size > INT32_MAX ? INT32_MAX : (int32_t)st.st_size;
+   return flags;
+}
+
+static int RETRO_CALLCONV vfs_mkdir(const char *dir)
+{
+   if (!dir)
+      return -1;
+   if (mkdir(dir, 0755) == 0)
+      return 0;
+   return errno == EEXIST ? -2 : -1;
+}
+
+static struct retro_vfs_dir_handle *RETRO_CALLCONV vfs_opendir(const char *dir,
+      bool include_hidden)
+{
+   struct retro_vfs_dir_handle *stream;
+
+   if (!dir)
+      return NULL;
+
+   stream = (struct retro_vfs_dir_handle*)calloc(1, sizeof(*stream));
+   if (!stream)
+      return NULL;
+
+   stream->dir            = opendir(dir);
+   stream->include_hidden = include_hidden;
+   if (!stream->dir)
+   {
+      free(stream);
+      return NULL;
+   }
+
+   return stream;
+}
+
+static bool RETRO_CALLCONV vfs_readdir(struct retro_vfs_dir_handle *dirstream)
+{
+   if (!dirstream)
+      return false;
+
+   while ((dirstream->entry = readdir(dirstream->dir)) != NULL)
+   {
+      const char *name = dirstream->entry->d_name;
+
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+         continue;
+      if (name[0] == '.' && !dirstream->include_hidden)
+         continue;
+      return true;
+   }
+
+   return false;
+}
+
+static const char *RETRO_CALLCONV vfs_dirent_get_name(struct retro_vfs_dir_handle *dirstream)
+{
+   return dirstream && dirstream->entry ? dirstream->entry->d_name : NULL;
+}
+
+static bool RETRO_CALLCONV vfs_dirent_is_dir(struct retro_vfs_dir_handle *dirstream)
+{
+   struct stat st;
+
+   if (!dirstream || !dirstream->entry)
+      return false;
+   if (dirstream->entry->d_type != DT_UNKNOWN && dirstream->entry->d_type != DT_LNK)
+      return dirstream->entry->d_type == DT_DIR;
+
+   /* d_type を返さないファイルシステムやシンボリックリンクは stat() で確かめます。 */
+   return fstatat(dirfd(dirstream->dir), dirstream->entry->d_name, &st, 0) == 0
+      && S_ISDIR(st.st_mode);
+}
+
+static int RETRO_CALLCONV vfs_closedir(struct retro_vfs_dir_handle *dirstream)
+{
+   int ret;
+
+   if (!dirstream)
+      return -1;
+
+   ret = closedir(dirstream->dir);
+   free(dirstream);
+   return ret == 0 ? 0 : -1;
+}
+
+static struct retro_vfs_interface vfs_interface = {
+   vfs_get_path,
+   vfs_open,
+   vfs_close,
+   vfs_size,
+   vfs_tell,
+   vfs_seek,
+   vfs_read,
+   vfs_write,
+   vfs_flush,
+   vfs_remove,
+   vfs_rename,
+   vfs_truncate,
+   vfs_stat,
+   vfs_mkdir,
+   vfs_opendir,
+   vfs_readdir,
+   vfs_dirent_get_name,
+   vfs_dirent_is_dir,
+   vfs_closedir,
+};
+
+bool vfs_get_interface(struct retro_vfs_interface_info *info)
+{
+   if (info->required_interface_version > VFS_INTERFACE_VERSION)
+      return false;
+
+   info->required_interface_version = VFS_INTERFACE_VERSION;
+   info->iface                      = &vfs_interface;
+   return true;
+}
+
+void vfs_set_backend(enum vfs_backend backend)
+{
+   vfs_backend = backend;
+}
+
+bool vfs_parse_backend(const char *name, enum vfs_backend *backend)
+{
+   static const char *names[] = { "mmap", "pread", "uring", "threads" };
+   unsigned i;
+
+   for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+      if (strcmp(names[i], name) == 0)
+      {
+         *backend = (enum vfs_backend)i;
+         return true;
+      }
+
+   return false;
+}
+
+void vfs_get_stats(struct vfs_stats *stats)
+{
+   const struct retro_vfs_file_handle *stream;
+
+   pthread_mutex_lock(&vfs_lock);
+   *stats = vfs_closed;
+   for (stream = vfs_handles; stream; stream = stream->next)
+      vfs_stats_add(stats, &stream->stats);
+   pthread_mutex_unlock(&vfs_lock);
+}
@@ -0,0 +1,78 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - RETRO_ENVIRONMENT_GET_VFS_INTERFACE で渡す VFS (API v3)。
+ *
+ * 読み取り専用で開いた通常ファイルは全体を mmap() し、read/seek/tell/size を
+ * システムコールなしでマッピングから答えます。ページキャッシュからコアのバッファへの
+ * コピーが 1 回だけになり、read() のたびのカーネル遷移がなくなります。
+ * RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS のファイルは何度も読み直されると見て
+ * MADV_WILLNEED | MADV_RANDOM を、それ以外はストリームとして MADV_SEQUENTIAL を与えます。
+ *
+ * 書き込みを伴うファイルや mmap() できないファイル (空のファイル、パイプなど) は、
+ * 位置を自前で持って pread()/pwrite() で読み書きします。
+ *
+ * VFS_BACKEND_URING / VFS_BACKEND_THREADS では mmap() の代わりに vfs_cache.h の
+ * 先読みキャッシュを付け、順次に読まれるファイルを非同期に先読みします。
+ */
+
+#ifndef RETROBENCH_VFS_H__
+#define RETROBENCH_VFS_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define VFS_INTERFACE_VERSION 3
+
+/* 読み取り専用のファイルの読み方。 */
+enum vfs_backend
+{
+   VFS_BACKEND_MMAP = 0,
+   VFS_BACKEND_PREAD,
+   VFS_BACKEND_URING,         /* io_uring で先読み。使えなければ VFS_BACKEND_THREADS */
+   VFS_BACKEND_THREADS        /* スレッドプールで先読み */
+};
+
+/* 閉じたハンドルと開いているハンドルの合計。 */
+struct vfs_stats
+{
+   uint64_t opens;
+   uint64_t mapped;           /* mmap() で開いた数 */
+   uint64_t reads;
+   uint64_t mapped_reads;     /* マッピングから答えた read の数 */
+   uint64_t read_bytes;
+   uint64_t writes;
+   uint64_t write_bytes;
+   uint64_t seeks;
+   uint64_t cached;           /* 先読みキャッシュを付けた数 */
+   uint64_t cached_uring;     /* そのうち io_uring を使えた数 */
+   uint64_t cache_hits;       /* 待たずにキャッシュから答えた read */
+   uint64_t cache_waits;      /* 先読みの完了を待った read */
+   uint64_t cache_misses;     /* 同期で読んだ read */
+   uint64_t readaheads;       /* 発行した先読みのブロック数 */
+   uint64_t stall_ns;         /* 待ちと同期読み込みにかかった時間 */
+};
+
+/* RETRO_ENVIRONMENT_GET_VFS_INTERFACE に応えます。 */
+bool vfs_get_interface(struct retro_vfs_interface_info *info);
+
+/* 以降に開く読み取り専用ファイルの読み方を選びます。既定は VFS_BACKEND_MMAP です。 */
+void vfs_set_backend(enum vfs_backend backend);
+
+/* "mmap" / "pread" / "uring" / "threads" を enum vfs_backend にします。 */
+bool vfs_parse_backend(const char *name, enum vfs_backend *backend);
+
+void vfs_get_stats(struct vfs_stats *stats);
+
+/* retro_vfs_interface の各関数。ベンチマークなどフロントエンドからも直接使えます。 */
+struct retro_vfs_file_handle *RETRO_CALLCONV vfs_open(const char *path,
+      unsigned mode, unsigned hints);
+int     RETRO_CALLCONV vfs_close(struct retro_vfs_file_handle *stream);
+int64_t RETRO_CALLCONV vfs_size(struct retro_vfs_file_handle *stream);
+int64_t RETRO_CALLCONV vfs_tell(struct retro_vfs_file_handle *stream);
+int64_t RETRO_CALLCONV vfs_seek(struct retro_vfs_file_handle *stream,
+      int64_t offset, int seek_position);
+int64_t RETRO_CALLCONV vfs_read(struct retro_vfs_file_handle *stream, void *s, uint64_t len);
+
+#endif
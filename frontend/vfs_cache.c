@@ -0,0 +1,592 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - VFS のハンドルごとの先読みキャッシュ。
+ *
+ * liburing には頼らず、io_uring_setup / io_uring_enter を直接呼びます。
+ * 1 つのハンドルを複数のスレッドから同時に使うことはない (FILE* と同じ) 前提で、
+ * io_uring の提出と刈り取りは read を呼んだスレッドだけが行います。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define VFS_CACHE_HAVE_URING
+#endif
+
+#include "vfs_cache.h"
+#include "perf.h"
+#include "timer.h"
+
+enum
+{
+   VFS_SLOT_EMPTY = 0,
+   VFS_SLOT_PENDING,
+   VFS_SLOT_READY,
+   VFS_SLOT_ERROR,
+   VFS_SLOT_ABANDONED         /* 待つのを諦めたが、完了はまだ届いていない。バッファは使えません */
+};
+
+struct vfs_cache_slot
+{
+   int64_t      block;        /* 載っているブロック。-1 なら空 */
+   atomic_int   state;
+   int32_t      len;          /* 読めたバイト数 */
+   uint8_t     *buf;
+   struct iovec iov;          /* IORING_OP_READV に渡す */
+};
+
+#ifdef VFS_CACHE_HAVE_URING
+struct vfs_uring
+{
+   int       fd;
+   unsigned *sq_tail, *sq_mask, *sq_array;
+   unsigned *cq_head, *cq_tail, *cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   void     *sq_ptr, *cq_ptr;
+   size_t    sq_size, cq_size, sqes_size;
+   unsigned  queued;          /* 書いたが io_uring_enter() していない SQE の数 */
+};
+#endif
+
+struct vfs_cache
+{
+   int      fd;
+   int64_t  size;
+   int64_t  blocks;
+   enum vfs_cache_engine engine;
+   int64_t  next_pos;         /* 直前の read の終わり。ここから読まれたら順次アクセス */
+   int64_t  ra_next;          /* 次に先読みするブロック */
+   uint8_t *buffers;
+#ifdef VFS_CACHE_HAVE_URING
+   struct vfs_uring ring;
+#endif
+   struct vfs_cache_slot slots[VFS_CACHE_SLOTS];
+};
+
+static struct retro_perf_counter vfs_cache_perf_stall = { "vfs_stall", 0, 0, 0, false };
+
+/* 途中で短く終わっても、want バイトか終端まで読みます。 */
+static int64_t vfs_cache_pread(int fd, uint8_t *dst, size_t want, int64_t offset)
+{
+   size_t done = 0;
+
+   while (done < want)
+   {
+      ssize_t n = pread(fd, dst + done, want - done, (off_t)(offset + (int64_t)done));
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n < 0)
+         return done ? (int64_t)done : -1;
+      if (n == 0)
+         break;
+      done += (size_t)n;
+   }
+
+   return (int64_t)done;
+}
+
+static size_t vfs_cache_block_len(const struct vfs_cache *cache, int64_t block)
+{
+   int64_t left = cache->size - block * VFS_CACHE_BLOCK;
+   return left < VFS_CACHE_BLOCK ? (size_t)left : VFS_CACHE_BLOCK;
+}
+
+/* ---- スレッドプール ----
+ * io_uring がない場合の代わり。全ハンドルで共有し、最初の先読みで起動します。 */
+
+#define VFS_POOL_THREADS 2
+#define VFS_POOL_JOBS    64
+
+struct vfs_pool_job
+{
+   int      fd;
+   int64_t  offset;
+   size_t   want;
+   struct vfs_cache_slot *slot;
+};
+
+static pthread_mutex_t vfs_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  vfs_pool_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  vfs_pool_done = PTHREAD_COND_INITIALIZER;
+static struct vfs_pool_job vfs_pool_jobs[VFS_POOL_JOBS];
+static unsigned vfs_pool_head, vfs_pool_tail;
+static unsigned vfs_pool_threads;
+
+static void *vfs_pool_worker(void *arg)
+{
+   (void)arg;
+
+   for (;;)
+   {
+      struct vfs_pool_job job;
+      int64_t n;
+
+      pthread_mutex_lock(&vfs_pool_lock);
+      while (vfs_pool_head == vfs_pool_tail)
+         pthread_cond_wait(&vfs_pool_work, &vfs_pool_lock);
+      job = vfs_pool_jobs[vfs_pool_head++ % VFS_POOL_JOBS];
+      pthread_mutex_unlock(&vfs_pool_lock);
+
+      n = vfs_cache_pread(job.fd, job.slot->buf, job.want, job.offset);
+
+      pthread_mutex_lock(&vfs_pool_lock);
+      job.slot->len = (int32_t)(n < 0 ? 0 : n);
+      atomic_store_explicit(&job.slot->state, n < 0 ? VFS_SLOT_ERROR : VFS_SLOT_READY,
+            memory_order_release);
+      pthread_cond_broadcast(&vfs_pool_done);
+      pthread_mutex_unlock(&vfs_pool_lock);
+   }
+
+   return NULL;
+}
+
+static bool vfs_pool_submit(struct vfs_cache *cache, struct vfs_cache_slot *slot, int64_t block)
+{
+   bool ok = false;
+
+   pthread_mutex_lock(&vfs_pool_lock);
+   while (vfs_pool_threads < VFS_POOL_THREADS)
+   {
+      pthread_t thread;
+      if (pthread_create(&thread, NULL, vfs_pool_worker, NULL) != 0)
+         break;
+      pthread_detach(thread);
+      vfs_pool_threads++;
+   }
+
+   if (vfs_pool_threads && vfs_pool_tail - vfs_pool_head < VFS_POOL_JOBS)
+   {
+      struct vfs_pool_job *job = &vfs_pool_jobs[vfs_pool_tail++ % VFS_POOL_JOBS];
+      job->fd     = cache->fd;
+      job->offset = block * VFS_CACHE_BLOCK;
+      job->want   = vfs_cache_block_len(cache, block);
+      job->slot   = slot;
+      pthread_cond_signal(&vfs_pool_work);
+      ok = true;
+   }
+   pthread_mutex_unlock(&vfs_pool_lock);
+
+   return ok;
+}
+
+static void vfs_pool_wait(struct vfs_cache_slot *slot)
+{
+   pthread_mutex_lock(&vfs_pool_lock);
+   while (atomic_load_explicit(&slot->state, memory_order_acquire) == VFS_SLOT_PENDING)
+      pthread_cond_wait(&vfs_pool_done, &vfs_pool_lock);
+   pthread_mutex_unlock(&vfs_pool_lock);
+}
+
+/* ---- io_uring ---- */
+
+#ifdef VFS_CACHE_HAVE_URING
+static bool vfs_uring_init(struct vfs_uring *ring)
+{
+   struct io_uring_params p;
+   uint8_t *sq, *cq;
+
+   memset(&p, 0, sizeof(p));
+   ring->fd = (int)syscall(__NR_io_uring_setup, VFS_CACHE_SLOTS, &p);
+   if (ring->fd < 0)
+      return false;
+
+   ring->sq_size   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   ring->cq_size   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+   if (p.features & IORING_FEAT_SINGLE_MMAP)
+   {
+      if (ring->cq_size > ring->sq_size)
+         ring->sq_size = ring->cq_size;
+      ring->cq_size = ring->sq_size;
+   }
+
+   ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+   ring->cq_ptr = ring->sq_ptr;
+   if (ring->sq_ptr != MAP_FAILED && !(p.features & IORING_FEAT_SINGLE_MMAP))
+      ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+   ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+   if (ring->sq_ptr == MAP_FAILED || ring->cq_ptr == MAP_FAILED || ring->sqes == MAP_FAILED)
+   {
+      if (ring->sqes != MAP_FAILED)
+         munmap(ring->sqes, ring->sqes_size);
+      if (ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+         munmap(ring->cq_ptr, ring->cq_size);
+      if (ring->sq_ptr != MAP_FAILED)
+         munmap(ring->sq_ptr, ring->sq_size);
+      close(ring->fd);
+      return false;
+   }
+
+   sq = (uint8_t*)ring->sq_ptr;
+   cq = (uint8_t*)ring->cq_ptr;
+   ring->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+   ring->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+   ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+   ring->cq_head  = (unsigned*)(cq + p.cq_off.head);
+   ring->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+   ring->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+   ring->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+   ring->queued   = 0;
+   return true;
+}
+
+static void vfs_uring_deinit(struct vfs_uring *ring)
+{
+   munmap(ring->sqes, ring->sqes_size);
+   if (ring->cq_ptr != ring->sq_ptr)
+      munmap(ring->cq_ptr, ring->cq_size);
+   munmap(ring->sq_ptr, ring->sq_size);
+   close(ring->fd);
+}
+
+/* SQE を書くだけで、カーネルへの通知は vfs_uring_enter() でまとめて行います。
+ * スロットの数だけ SQ を用意してあるので、溢れることはありません。 */
+static void vfs_uring_queue(struct vfs_cache *cache, struct vfs_cache_slot *slot, int64_t block)
+{
+   struct vfs_uring *ring = &cache->ring;
+   unsigned tail  = *ring->sq_tail;
+   unsigned index = tail & *ring->sq_mask;
+   struct io_uring_sqe *sqe = &ring->sqes[index];
+
+   slot->iov.iov_base = slot->buf;
+   slot->iov.iov_len  = vfs_cache_block_len(cache, block);
+
+   memset(sqe, 0, sizeof(*sqe));
+   sqe->opcode    = IORING_OP_READV;
+   sqe->fd        = cache->fd;
+   sqe->addr      = (uint64_t)(uintptr_t)&slot->iov;
+   sqe->len       = 1;
+   sqe->off       = (uint64_t)(block * VFS_CACHE_BLOCK);
+   sqe->user_data = (uint64_t)(slot - cache->slots);
+
+   ring->sq_array[index] = index;
+   __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   ring->queued++;
+}
+
+static int vfs_uring_enter(struct vfs_uring *ring, unsigned min_complete)
+{
+   int ret;
+
+   do
+   {
+      ret = (int)syscall(__NR_io_uring_enter, ring->fd, ring->queued, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+   } while (ret < 0 && errno == EINTR);
+
+   if (ret > 0)
+      ring->queued -= (unsigned)ret < ring->queued ? (unsigned)ret : ring->queued;
+   return ret;
+}
+
+static void vfs_uring_reap(struct vfs_cache *cache)
+{
+   struct vfs_uring *ring = &cache->ring;
+   unsigned head = *ring->cq_head;
+
+   while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+   {
+      const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      struct vfs_cache_slot *slot    = &cache->slots[cqe->user_data % VFS_CACHE_SLOTS];
+
+      slot->len = cqe->res < 0 ? 0 : cqe->res;
+      atomic_store_explicit(&slot->state, cqe->res < 0 ? VFS_SLOT_ERROR : VFS_SLOT_READY,
+            memory_order_release);
+      head++;
+   }
+
+   __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static bool vfs_uring_busy(const struct vfs_cache_slot *slot)
+{
+   int state = atomic_load_explicit(&slot->state, memory_order_acquire);
+   return state == VFS_SLOT_PENDING || state == VFS_SLOT_ABANDONED;
+}
+
+static void vfs_uring_wait(struct vfs_cache *cache, struct vfs_cache_slot *slot)
+{
+   vfs_uring_reap(cache);
+   while (vfs_uring_busy(slot))
+   {
+      if (vfs_uring_enter(&cache->ring, 1) < 0)
+      {
+         /* 待てないなら読み込みを諦め、呼び出し側に同期で読ませます。カーネルはまだ
+          * バッファに書き込むかもしれないので、完了が届くまでスロットは再利用しません。 */
+         atomic_store_explicit(&slot->state, VFS_SLOT_ABANDONED, memory_order_release);
+         break;
+      }
+      vfs_uring_reap(cache);
+   }
+}
+#endif
+
+/* ---- キャッシュ ---- */
+
+static void vfs_cache_wait(struct vfs_cache *cache, struct vfs_cache_slot *slot)
+{
+#ifdef VFS_CACHE_HAVE_URING
+   if (cache->engine == VFS_CACHE_URING)
+   {
+      vfs_uring_wait(cache, slot);
+      return;
+   }
+#endif
+   vfs_pool_wait(slot);
+}
+
+/* 読んでいるブロック current の先 VFS_CACHE_WINDOW 個を先読みします。 */
+static void vfs_cache_readahead(struct vfs_cache *cache, int64_t current, struct vfs_stats *stats)
+{
+   int64_t last = current + VFS_CACHE_WINDOW;
+
+   if (last >= cache->blocks)
+      last = cache->blocks - 1;
+   if (cache->ra_next <= current)
+      cache->ra_next = current + 1;
+
+   for (; cache->ra_next <= last; cache->ra_next++)
+   {
+      struct vfs_cache_slot *slot = &cache->slots[cache->ra_next % VFS_CACHE_SLOTS];
+      int state = atomic_load_explicit(&slot->state, memory_order_acquire);
+
+      if (slot->block == cache->ra_next && (state == VFS_SLOT_PENDING || state == VFS_SLOT_READY))
+         continue;
+      /* スロットがまだ古いブロックを読み込み中なら、次の read で続きから発行します。 */
+      if (state == VFS_SLOT_PENDING || state == VFS_SLOT_ABANDONED)
+         break;
+
+      slot->block = cache->ra_next;
+      atomic_store_explicit(&slot->state, VFS_SLOT_PENDING, memory_order_relaxed);
+#ifdef VFS_CACHE_HAVE_URING
+      if (cache->engine == VFS_CACHE_URING)
+         vfs_uring_queue(cache, slot, cache->ra_next);
+      else
+#endif
+      if (!vfs_pool_submit(cache, slot, cache->ra_next))
+      {
+         slot->block = -1;
+         atomic_store_explicit(&slot->state, VFS_SLOT_EMPTY, memory_order_relaxed);
+         break;
+      }
+      stats->readaheads++;
+   }
+
+#ifdef VFS_CACHE_HAVE_URING
+   if (cache->engine == VFS_CACHE_URING && cache->ring.queued)
+      vfs_uring_enter(&cache->ring, 0);
+#endif
+}
+
+struct vfs_cache *vfs_cache_new(int fd, int64_t size, enum vfs_cache_engine engine)
+{
+   struct vfs_cache *cache;
+   unsigned i;
+
+   if (size <= 0)
+      return NULL;
+
+   cache = (struct vfs_cache*)calloc(1, sizeof(*cache));
+   if (!cache)
+      return NULL;
+
+   if (posix_memalign((void**)&cache->buffers, 4096,
+            (size_t)VFS_CACHE_BLOCK * VFS_CACHE_SLOTS) != 0)
+   {
+      free(cache);
+      return NULL;
+   }
+
+   cache->fd      = fd;
+   cache->size    = size;
+   cache->blocks  = (size + VFS_CACHE_BLOCK - 1) / VFS_CACHE_BLOCK;
+   cache->ra_next = -1;
+   cache->engine  = VFS_CACHE_THREADS;
+#ifdef VFS_CACHE_HAVE_URING
+   if (engine == VFS_CACHE_URING && vfs_uring_init(&cache->ring))
+      cache->engine = VFS_CACHE_URING;
+#else
+   (void)engine;
+#endif
+
+   for (i = 0; i < VFS_CACHE_SLOTS; i++)
+   {
+      cache->slots[i].block = -1;
+      cache->slots[i].buf   = cache->buffers + (size_t)i * VFS_CACHE_BLOCK;
+      atomic_init(&cache->slots[i].state, VFS_SLOT_EMPTY);
+   }
+
+   return cache;
+}
+
+void vfs_cache_free(struct vfs_cache *cache)
+{
+   unsigned i;
+
+   if (!cache)
+      return;
+
+   /* カーネルやワーカーがバッファに書き込んでいる間は解放できません。 */
+   for (i = 0; i < VFS_CACHE_SLOTS; i++)
+   {
+      int state = atomic_load_explicit(&cache->slots[i].state, memory_order_acquire);
+      if (state == VFS_SLOT_PENDING || state == VFS_SLOT_ABANDONED)
+         vfs_cache_wait(cache, &cache->slots[i]);
+   }
+
+#ifdef VFS_CACHE_HAVE_URING
+   if (cache->engine == VFS_CACHE_URING)
+   {
+      bool busy = false;
+
+      for (i = 0; i < VFS_CACHE_SLOTS; i++)
+         busy |= vfs_uring_busy(&cache->slots[i]);
+      vfs_uring_deinit(&cache->ring);
+      /* それでも完了が届かなければ、バッファと iovec はカーネルに残したまま手放します。 */
+      if (busy)
+         return;
+   }
+#endif
+   free(cache->buffers);
+   free(cache);
+}
+
+enum vfs_cache_engine vfs_cache_engine(const struct vfs_cache *cache)
+{
+   return cache->engine;
+}
+
+int64_t vfs_cache_read(struct vfs_cache *cache, void *dst, int64_t pos, uint64_t len,
+      struct vfs_stats *stats)
+{
+   uint8_t *out       = (uint8_t*)dst;
+   uint64_t done      = 0;
+   bool     sequential = pos == cache->next_pos;
+   bool     missed    = false;
+   bool     waited    = false;
+   uint64_t stall_start = 0;
+
+   if (pos >= cache->size)
+      return 0;
+   if (len > (uint64_t)(cache->size - pos))
+      len = (uint64_t)(cache->size - pos);
+   if (!sequential)
+      cache->ra_next = -1;
+
+#ifdef VFS_CACHE_HAVE_URING
+   /* 完了は vfs_uring_wait() でしか刈り取らないので、ここで先に集めます。
+    * そうしないと、読み終わっているブロックまで待ちとして数えてしまいます。 */
+   if (cache->engine == VFS_CACHE_URING)
+      vfs_uring_reap(cache);
+#endif
+
+   while (done < len)
+   {
+      int64_t  p     = pos + (int64_t)done;
+      int64_t  block = p / VFS_CACHE_BLOCK;
+      size_t   off   = (size_t)(p % VFS_CACHE_BLOCK);
+      size_t   n     = VFS_CACHE_BLOCK - off;
+      struct vfs_cache_slot *slot = &cache->slots[block % VFS_CACHE_SLOTS];
+      int      state = atomic_load_explicit(&slot->state, memory_order_acquire);
+      int64_t  got;
+
+      if (n > len - done)
+         n = (size_t)(len - done);
+
+      if (slot->block == block && state == VFS_SLOT_PENDING)
+      {
+         if (!stall_start)
+         {
+            perf_start(&vfs_cache_perf_stall);
+            stall_start = timer_ns();
+         }
+         vfs_cache_wait(cache, slot);
+         state  = atomic_load_explicit(&slot->state, memory_order_acquire);
+         waited = true;
+      }
+
+      if (slot->block == block && state == VFS_SLOT_READY && off + n <= (size_t)slot->len)
+      {
+         memcpy(out + done, slot->buf + off, n);
+         done += n;
+         continue;
+      }
+
+      /* キャッシュにないので同期で読みます。ここからは待ち時間として数えます。 */
+      if (!stall_start)
+      {
+         perf_start(&vfs_cache_perf_stall);
+         stall_start = timer_ns();
+      }
+      missed = true;
+
+      if (sequential && state == VFS_SLOT_PENDING)
+      {
+         vfs_cache_wait(cache, slot);
+         state = atomic_load_explicit(&slot->state, memory_order_acquire);
+      }
+
+      /* 順次でなければブロックを丸ごと読まず、要求された範囲だけを読みます。
+       * 完了が届いていないスロットのバッファにも書き込めないので、同じく直接読みます。 */
+      if (!sequential || state == VFS_SLOT_ABANDONED)
+      {
+         got = vfs_cache_pread(cache->fd, out + done, (size_t)(len - done), p);
+         if (got > 0)
+            done += (uint64_t)got;
+         break;
+      }
+
+      slot->block = block;
+      got = vfs_cache_pread(cache->fd, slot->buf, vfs_cache_block_len(cache, block),
+            block * VFS_CACHE_BLOCK);
+      slot->len = (int32_t)(got < 0 ? 0 : got);
+      atomic_store_explicit(&slot->state, got < 0 ? VFS_SLOT_ERROR : VFS_SLOT_READY,
+            memory_order_relaxed);
+      if (got < 0 || off + n > (size_t)slot->len)
+      {
+         /* 読めなかったブロックは次の read で読み直します。 */
+         slot->block = -1;
+         atomic_store_explicit(&slot->state, VFS_SLOT_EMPTY, memory_order_relaxed);
+         if (got >= 0 && off < (size_t)got)
+         {
+            memcpy(out + done, slot->buf + off, (size_t)got - off);
+            done += (size_t)got - off;
+         }
+         break;
+      }
+   }
+
+   if (stall_start)
+   {
+      stats->stall_ns += timer_ns() - stall_start;
+      perf_stop(&vfs_cache_perf_stall);
+   }
+   if (missed)
+      stats->cache_misses++;
+   else if (waited)
+      stats->cache_waits++;
+   else
+      stats->cache_hits++;
+
+   cache->next_pos = pos + (int64_t)done;
+   if (sequential && done)
+      vfs_cache_readahead(cache, (cache->next_pos - 1) / VFS_CACHE_BLOCK, stats);
+
+   if (!done && len)
+      return -1;
+   return (int64_t)done;
+}
@@ -0,0 +1,54 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - VFS のハンドルごとの先読みキャッシュ。
+ *
+ * ファイルを VFS_CACHE_BLOCK バイトのブロックに区切り、VFS_CACHE_SLOTS 個の
+ * スロットに直接マップで置きます (ブロック b はスロット b % VFS_CACHE_SLOTS)。
+ * 直前の read の終わりから続けて読まれたハンドルを順次アクセスとみなし、
+ * 読んでいるブロックの先 VFS_CACHE_WINDOW 個を非同期に読み込みます。
+ * キャッシュに載ったブロックへの read はメモリからのコピーだけで終わります。
+ *
+ * 非同期の読み込みはハンドルごとの io_uring で発行し、io_uring を使えないカーネルでは
+ * 全ハンドルで共有するスレッドプールの pread() に切り替えます。
+ * 順次でない read はキャッシュを通さず、要求された範囲だけを pread() します。
+ *
+ * 読み込みの完了を待った時間 (ストール) は "vfs_stall" の perf カウンタで計り、
+ * 計測中のフレームの下に入れ子で集計されます。
+ */
+
+#ifndef RETROBENCH_VFS_CACHE_H__
+#define RETROBENCH_VFS_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vfs.h"
+
+#define VFS_CACHE_BLOCK   (256 * 1024)
+#define VFS_CACHE_SLOTS   32
+#define VFS_CACHE_WINDOW  24     /* VFS_CACHE_SLOTS より小さくします */
+
+enum vfs_cache_engine
+{
+   VFS_CACHE_URING = 0,
+   VFS_CACHE_THREADS
+};
+
+struct vfs_cache;
+
+/* 読み取り専用の fd (サイズ size) にキャッシュを付けます。
+ * VFS_CACHE_URING で io_uring を用意できなければスレッドプールを使います。 */
+struct vfs_cache *vfs_cache_new(int fd, int64_t size, enum vfs_cache_engine engine);
+
+/* 発行済みの読み込みの完了を待ってから解放します。fd は閉じません。 */
+void vfs_cache_free(struct vfs_cache *cache);
+
+/* 実際に使っている方式を返します。 */
+enum vfs_cache_engine vfs_cache_engine(const struct vfs_cache *cache);
+
+/* pos から len バイトを dst に読みます。読んだバイト数を返し、エラーの場合は -1 を返します。
+ * キャッシュの当たり外れと待ち時間を stats に足します。 */
+int64_t vfs_cache_read(struct vfs_cache *cache, void *dst, int64_t pos, uint64_t len,
+      struct vfs_stats *stats);
+
+#endif
@@ -0,0 +1,312 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 映像パイプライン。
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "video.h"
+#include "pixconv.h"
+#include "fbpool.h"
+#include "framehash.h"
+#include "tilediff.h"
+#include "timer.h"
+
+struct video_state video_state;
+
+bool video_init(unsigned max_width, unsigned max_height)
+{
+   void *output = NULL;
+
+   video_free();
+
+   video_state.output_pitch = (size_t)max_width * sizeof(uint32_t);
+   if (posix_memalign(&output, 64, video_state.output_pitch * max_height) != 0)
+      return false;
+
+   video_state.output     = (uint32_t*)output;
+   video_state.max_width  = max_width;
+   video_state.max_height = max_height;
+   video_state.detect_dupes = true;
+   return true;
+}
+
+void video_free(void)
+{
+   free(video_state.output);
+   free(video_state.reference);
+   free(video_state.tile_dirty);
+   free(video_state.dirty);
+   memset(&video_state, 0, sizeof(video_state));
+}
+
+bool video_enable_tiles(unsigned tile)
+{
+   void    *reference = NULL;
+   unsigned tiles_x, tiles_y;
+
+   if (!video_state.output || !tile)
+      return false;
+
+   /* 16 ビットのフレームも XRGB8888 と同じ大きさで確保しておけば、途中で形式が変わっても足ります。 */
+   tiles_x = (video_state.max_width  + tile - 1) / tile;
+   tiles_y = (video_state.max_height + tile - 1) / tile;
+   if (posix_memalign(&reference, 64, video_state.output_pitch * video_state.max_height) != 0)
+      return false;
+
+   free(video_state.reference);
+   free(video_state.tile_dirty);
+   free(video_state.dirty);
+   video_state.reference       = (uint8_t*)reference;
+   video_state.reference_pitch = video_state.output_pitch;
+   video_state.tile_dirty      = (uint8_t*)malloc(tiles_x);
+   video_state.dirty           = (struct video_rect*)malloc(
+         (size_t)tiles_x * tiles_y * sizeof(*video_state.dirty));
+   video_state.dirty_count     = 0;
+   video_state.tiled           = false;
+   video_state.tile            = video_state.dirty && video_state.tile_dirty ? tile : 0;
+   return video_state.tile != 0;
+}
+
+/* フレームをタイルに分けて写しと比べ、変わったタイルを写しに取り込んで dirty に積みます。
+ * 変わったタイルが無ければ false を返します。 */
+static bool video_diff_tiles(const uint8_t *data, size_t pitch, unsigned width, unsigned height,
+      unsigned bpp, uint8_t *ref, size_t ref_pitch, bool full)
+{
+   tilediff_row_t row  = tilediff_kernel()->row;
+   unsigned tile       = video_state.tile;
+   unsigned tiles_x    = (width + tile - 1) / tile;
+   uint8_t *tile_dirty = video_state.tile_dirty;
+   unsigned y, r, t, first = 0;
+
+   video_state.dirty_count = 0;
+
+   for (y = 0; y < height; y += tile)
+   {
+      unsigned h = height - y < tile ? height - y : tile;
+      struct video_rect *span = NULL;
+
+      memset(tile_dirty, full, tiles_x);
+      if (!full)
+      {
+         unsigned clean = tiles_x;
+
+         /* 横一列のタイルがすべて変わっていれば、残りの行は比べるまでもありません。 */
+         for (r = 0; r < h && clean; r++)
+            clean -= row(ref + (y + r) * ref_pitch, data + (y + r) * pitch,
+                  (size_t)width * bpp, (size_t)tile * bpp, tile_dirty);
+      }
+      video_state.stats.tiles += tiles_x;
+
+      for (t = 0; t < tiles_x; t++)
+      {
+         unsigned x = t * tile;
+         unsigned w = width - x < tile ? width - x : tile;
+
+         if (!tile_dirty[t])
+         {
+            span = NULL;
+            continue;
+         }
+         video_state.stats.dirty_tiles++;
+
+         /* 左隣のタイルも変わっていれば、同じ矩形を右に伸ばします。 */
+         if (span)
+            span->width += w;
+         else
+         {
+            span = &video_state.dirty[video_state.dirty_count++];
+            span->x      = x;
+            span->y      = y;
+            span->width  = w;
+            span->height = h;
+         }
+      }
+
+      /* 写しへの取り込みは、つないだ矩形ごとに行単位でまとめて写します。 */
+      for (; first < video_state.dirty_count; first++)
+      {
+         const struct video_rect *rect = &video_state.dirty[first];
+         const uint8_t *s = data + y * pitch + (size_t)rect->x * bpp;
+         uint8_t       *d = ref + y * ref_pitch + (size_t)rect->x * bpp;
+
+         for (r = 0; r < h; r++)
+            memcpy(d + r * ref_pitch, s + r * pitch, (size_t)rect->width * bpp);
+      }
+   }
+
+   video_state.stats.rects += video_state.dirty_count;
+   return video_state.dirty_count != 0;
+}
+
+/* video_enable_tiles() を呼んだ場合の video_frame()。 */
+static void video_frame_tiles(const uint8_t *data, unsigned width, unsigned height,
+      size_t pitch, enum retro_pixel_format format, unsigned bpp, bool pool)
+{
+   /* プールのバッファでない XRGB8888 は、写しに取り込むことがそのまま出力になります。 */
+   bool     direct    = !pool && format == RETRO_PIXEL_FORMAT_XRGB8888;
+   uint8_t *ref       = direct ? (uint8_t*)video_state.output : video_state.reference;
+   size_t   ref_pitch = direct ? video_state.output_pitch : video_state.reference_pitch;
+   bool     full      = !video_state.tiled
+      || width  != video_state.tiled_width  || height != video_state.tiled_height
+      || format != video_state.tiled_format || direct != video_state.tiled_output;
+   uint64_t start     = timer_ns();
+   bool     changed   = video_diff_tiles(data, pitch, width, height, bpp, ref, ref_pitch, full);
+   unsigned i;
+
+   video_state.stats.diff_ns     += timer_ns() - start;
+   video_state.stats.frame_bytes += (uint64_t)width * height * bpp;
+   video_state.tiled         = true;
+   video_state.tiled_width   = width;
+   video_state.tiled_height  = height;
+   video_state.tiled_format  = format;
+   video_state.tiled_output  = direct;
+   video_state.width         = width;
+   video_state.height        = height;
+   video_state.dupe          = !changed;
+   if (!changed)
+      video_state.stats.identical++;
+
+   if (pool)
+   {
+      video_state.frame       = (const uint32_t*)data;
+      video_state.frame_pitch = pitch;
+      video_state.stats.zero_copy++;
+      return;
+   }
+
+   start = timer_ns();
+   for (i = 0; i < video_state.dirty_count; i++)
+   {
+      const struct video_rect *rect = &video_state.dirty[i];
+      uint64_t pixels = (uint64_t)rect->width * rect->height;
+
+      if (!direct)
+         pixconv_frame(format,
+               (uint8_t*)video_state.output + rect->y * video_state.output_pitch + rect->x * 4,
+               video_state.output_pitch,
+               data + rect->y * pitch + (size_t)rect->x * bpp, pitch,
+               rect->width, rect->height);
+      video_state.stats.bytes_in  += pixels * bpp;
+      video_state.stats.bytes_out += pixels * sizeof(uint32_t);
+   }
+   video_state.stats.convert_ns += timer_ns() - start;
+
+   video_state.frame       = video_state.output;
+   video_state.frame_pitch = video_state.output_pitch;
+   if (direct && changed)
+      video_state.stats.copies++;
+}
+
+void video_frame(const void *data, unsigned width, unsigned height,
+      size_t pitch, enum retro_pixel_format format)
+{
+   uint64_t start, hash = 0;
+   unsigned bpp = format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+   int      pool_index;
+   bool     pool;
+
+   /* 表示中のバッファも出力バッファもそのまま使えるので、印を付けるだけです。
+    * コアが自分で重複を知らせるなら、ハッシュで比べる必要はありません。 */
+   if (!data)
+   {
+      if (video_state.output && video_state.frame)
+      {
+         video_state.dupe          = true;
+         video_state.detect_dupes  = false;
+         video_state.dirty_count   = 0;
+         video_state.stats.dupes++;
+      }
+      return;
+   }
+
+   pool_index = fbpool_find(data);
+   fbpool_submit(pool_index);
+
+   if (!video_state.output)
+      return;
+
+   /* SET_GEOMETRY などで最大サイズを超えた場合は収まる範囲だけ扱います。 */
+   if (width > video_state.max_width)
+      width = video_state.max_width;
+   if (height > video_state.max_height)
+      height = video_state.max_height;
+
+   pool = pool_index >= 0 && format == RETRO_PIXEL_FORMAT_XRGB8888;
+   video_state.stats.frames++;
+
+   if (video_state.tile)
+   {
+      video_frame_tiles((const uint8_t*)data, width, height, pitch, format, bpp, pool);
+      return;
+   }
+
+   if (video_state.detect_dupes && video_state.hash_skip)
+   {
+      /* 次にハッシュを求めるフレームと比べるものはありません。 */
+      video_state.hash_skip--;
+      video_state.hashed = false;
+   }
+   else if (video_state.detect_dupes)
+   {
+      start = timer_ns();
+      hash  = framehash_frame(data, pitch, (size_t)width * bpp, height);
+      video_state.stats.hash_ns += timer_ns() - start;
+      video_state.stats.hashed++;
+
+      /* 前のフレームと同じ経路 (変換 / プール) を通ったときだけ、前の結果を使い回せます。 */
+      if (video_state.hashed && hash == video_state.hash
+            && width == video_state.width && height == video_state.height
+            && format == video_state.hash_format && pool == video_state.hash_pool)
+      {
+         /* 前に表示していたプールのバッファは fbpool_submit() で返却したので、今回のものに替えます。 */
+         if (pool)
+         {
+            video_state.frame       = (const uint32_t*)data;
+            video_state.frame_pitch = pitch;
+         }
+         video_state.dupe        = true;
+         video_state.hash_misses = 0;
+         video_state.stats.identical++;
+         return;
+      }
+
+      /* 比べて外れるたびに、ハッシュを求めない間隔を倍にします。 */
+      if (video_state.hashed)
+      {
+         unsigned misses = ++video_state.hash_misses;
+
+         video_state.hash_skip = misses <= 6 ? 1u << (misses - 1) : VIDEO_HASH_MAX_SKIP;
+      }
+
+      video_state.hashed      = true;
+      video_state.hash        = hash;
+      video_state.hash_format = format;
+      video_state.hash_pool   = pool;
+   }
+
+   video_state.width  = width;
+   video_state.height = height;
+   video_state.dupe   = false;
+
+   if (pool)
+   {
+      video_state.frame       = (const uint32_t*)data;
+      video_state.frame_pitch = pitch;
+      video_state.stats.zero_copy++;
+      return;
+   }
+
+   start = timer_ns();
+   pixconv_frame(format, video_state.output, video_state.output_pitch,
+         data, pitch, width, height);
+   video_state.stats.convert_ns += timer_ns() - start;
+
+   video_state.frame            = video_state.output;
+   video_state.frame_pitch      = video_state.output_pitch;
+   video_state.stats.bytes_in  += (uint64_t)width * height * bpp;
+   video_state.stats.bytes_out += (uint64_t)width * height * sizeof(uint32_t);
+   if (format == RETRO_PIXEL_FORMAT_XRGB8888)
+      video_state.stats.copies++;
+}
@@ -0,0 +1,105 @@
+/* Copyright (C) 2010-2020 The RetroArch team
+ *
+ * retrobench - 映像パイプライン。
+ *
+ * retro_video_refresh_t で受け取ったフレームを、表示やエンコーダーが
+ * 期待する XRGB8888 に変換して出力バッファに置きます。
+ * コアが GET_CURRENT_SOFTWARE_FRAMEBUFFER のバッファに XRGB8888 で描いた場合は
+ * コピーせず、そのバッファをそのまま表示側に渡します。
+ *
+ * 前のフレームと同じ内容のフレームには dupe の印を付け、変換を省きます。
+ * GET_CAN_DUPE に応じたコアが NULL を渡したフレームはそのまま重複として扱い、
+ * NULL を渡さないコアのフレームは framehash で前のフレームと比べます。
+ * 一致しないフレームが続くとハッシュを求める間隔を最大 VIDEO_HASH_MAX_SKIP フレームまで広げ、
+ * 動き続ける場面ではハッシュのコストをほとんど払わないようにします。
+ * 表示やエンコーダーは dupe を見て、直近のフレームを繰り返せば済みます。
+ *
+ * video_enable_tiles() でタイルの大きさを指定すると、ハッシュの代わりにフレームを
+ * タイルに分けて前のフレームの写しと比べ、変わったタイルだけを写しに取り込んで変換します。
+ * 変わったタイルは行ごとに横につないだ矩形の一覧 (dirty) として残すので、
+ * テクスチャーの転送やエンコーダーもその範囲だけを扱えます。
+ * XRGB8888 のフレームは出力バッファそのものを写しとして使います。
+ */
+
+#ifndef RETROBENCH_VIDEO_H__
+#define RETROBENCH_VIDEO_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "libretro.h"
+
+#define VIDEO_HASH_MAX_SKIP 32
+
+struct video_rect
+{
+   unsigned x, y, width, height;
+};
+
+struct video_stats
+{
+   uint64_t frames;            /* NULL 以外で受け取ったフレーム数 */
+   uint64_t dupes;             /* コアが NULL を渡した重複フレーム */
+   uint64_t identical;         /* ハッシュかタイルの比較で前のフレームと一致し、変換を省いたフレーム */
+   uint64_t hashed;            /* ハッシュを求めたフレーム */
+   uint64_t bytes_in;          /* 読み出したコアのピクセルデータ */
+   uint64_t bytes_out;         /* 書き込んだ XRGB8888 データ */
+   uint64_t copies;            /* XRGB8888 のフレームを出力バッファに memcpy した回数 */
+   uint64_t zero_copy;         /* プールのバッファをそのまま表示側に渡した回数 */
+   uint64_t convert_ns;
+   uint64_t hash_ns;
+   uint64_t tiles;             /* 比べたタイル */
+   uint64_t dirty_tiles;       /* 変わっていたタイル */
+   uint64_t rects;             /* dirty に残した矩形 */
+   uint64_t frame_bytes;       /* フレーム全体を処理した場合に読み出すピクセルデータ */
+   uint64_t diff_ns;           /* タイルの比較と写しへの取り込み */
+};
+
+struct video_state
+{
+   uint32_t *output;           /* XRGB8888 の出力バッファ */
+   unsigned  max_width;
+   unsigned  max_height;
+   size_t    output_pitch;
+   const uint32_t *frame;      /* 表示側が読む直近のフレーム (output またはプールのバッファ) */
+   size_t    frame_pitch;
+   unsigned  width;            /* 直近のフレームの大きさ */
+   unsigned  height;
+   bool      dupe;             /* 直近のフレームが前のフレームと同じ内容 */
+   bool      detect_dupes;     /* NULL 以外のフレームもハッシュで比べる (コアが NULL を渡すまで) */
+   bool      hashed;           /* 以下が直近のフレームの値を持っている */
+   uint64_t  hash;
+   enum retro_pixel_format hash_format;
+   bool      hash_pool;        /* 直近のフレームがプールのバッファをそのまま渡したもの */
+   unsigned  hash_misses;      /* 続けて一致しなかった回数 */
+   unsigned  hash_skip;        /* ハッシュを求めずに通すフレームの残り */
+
+   unsigned  tile;             /* タイルの一辺のピクセル数。0 ならタイルで比べない */
+   uint8_t  *reference;        /* 前のフレームの写し (コアのピクセル形式) */
+   size_t    reference_pitch;
+   bool      tiled;            /* 写しが以下のフレームの内容を持っている */
+   unsigned  tiled_width;
+   unsigned  tiled_height;
+   enum retro_pixel_format tiled_format;
+   bool      tiled_output;     /* 写しとして出力バッファを使った */
+   uint8_t  *tile_dirty;       /* 比べている横一列のタイルごとの印 */
+   struct video_rect *dirty;   /* 直近のフレームで変わった矩形 */
+   unsigned  dirty_count;
+   struct video_stats stats;
+};
+
+extern struct video_state video_state;
+
+/* max_width × max_height までのフレームを受け取れるように出力バッファを確保します。 */
+bool video_init(unsigned max_width, unsigned max_height);
+void video_free(void);
+
+/* tile × tile ピクセルのタイルで前のフレームと比べるようにします。video_init() の後に呼びます。 */
+bool video_enable_tiles(unsigned tile);
+
+/* コアのフレームを出力バッファに変換します。data が NULL なら直近のフレームの重複です。 */
+void video_frame(const void *data, unsigned width, unsigned height,
+      size_t pitch, enum retro_pixel_format format);
+
+#endif